@@ -1,8 +1,27 @@
 #!/usr/bin/env bash
 # Seeing error like this? ./build-wasm.sh: line 23: emcc: command not found
 # Remember to cd ~/dev/emsdk && source ./emsdk_env.sh
+#
+# Build profile, overridable from the environment:
+#   FLLAMA_WASM_THREADS=8       most ggml threads per request. The module
+#                               starts this many pthread workers, plus two
+#                               for the inference queue, so threads never
+#                               have to be started while inference blocks.
+#   FLLAMA_WASM_RELAXED_SIMD=1  also allow relaxed SIMD instructions (fused
+#                               multiply-add). Chrome 114+ and Firefox 120+
+#                               only; Safari can't load the module.
+#
+# The output runs in browsers and in Node; example/web/fllama_wasm_bench.mjs
+# measures tokens/second headlessly.
 set -e
 
+FLLAMA_WASM_THREADS=${FLLAMA_WASM_THREADS:-8}
+FLLAMA_WASM_RELAXED_SIMD=${FLLAMA_WASM_RELAXED_SIMD:-0}
+FLLAMA_WASM_SIMD_FLAGS="-msimd128"
+if [ "$FLLAMA_WASM_RELAXED_SIMD" = "1" ]; then
+    FLLAMA_WASM_SIMD_FLAGS="$FLLAMA_WASM_SIMD_FLAGS -mrelaxed-simd"
+fi
+
 LLAMA_CPP_WASM_BUILD_DIR=wasm_build
 LLAMA_CPP_WASM_DIST_DIR=dist
 LLAMA_CPP_WASM_DIST_LLAMA_DIR=$LLAMA_CPP_WASM_DIST_DIR/llama-mt
@@ -53,9 +72,13 @@ mkdir -p $LLAMA_CPP_BUILD_DIR
 cd $LLAMA_CPP_BUILD_DIR
 echo "now in directory: $(pwd)"
 emcc --clear-cache
-emcmake cmake $FLLAMA_SOURCE_DIR
+emcmake cmake $FLLAMA_SOURCE_DIR -DCMAKE_BUILD_TYPE=Release -DGGML_OPENMP=OFF \
+    -DFLLAMA_WASM_THREADS=$FLLAMA_WASM_THREADS \
+    "-DCMAKE_C_FLAGS=$FLLAMA_WASM_SIMD_FLAGS" "-DCMAKE_CXX_FLAGS=$FLLAMA_WASM_SIMD_FLAGS"
 # export EMCC_CFLAGS="-O3 -pthread -DNDEBUG -flto -s SHARED_MEMORY=1 -s EXPORT_ALL=1 -s EXPORT_ES6=1 -s MODULARIZE=1 -s INITIAL_MEMORY=2GB -s MAXIMUM_MEMORY=4GB -s ALLOW_MEMORY_GROWTH -s FORCE_FILESYSTEM=1 -s EXPORTED_FUNCTIONS=_main -s EXPORTED_RUNTIME_METHODS=callMain -s NO_EXIT_RUNTIME=1"
-export EMCC_CFLAGS="-O3 -msimd128 -pthread -fno-rtti -s USE_PTHREADS=1 -s ASYNCIFY=1 -s PTHREAD_POOL_SIZE=4 -DNDEBUG -flto=full -s ALLOW_TABLE_GROWTH  -s SHARED_MEMORY=1 -s EXPORT_ALL=1 -s EXPORT_ES6=1 -s MODULARIZE=1 -s INITIAL_MEMORY=800MB -s MAXIMUM_MEMORY=4GB -s ALLOW_MEMORY_GROWTH -s FORCE_FILESYSTEM=1 -s EXPORTED_RUNTIME_METHODS=['addFunction'] -s EXPORTED_FUNCTIONS=['_fllama_get_bos_token_export, _fllama_get_eos_token_export, _fllama_cancel_inference_export, _fllama_tokenize_export, _fllama_get_chat_template_export, _fllama_inference_export, _malloc'] -s NO_EXIT_RUNTIME=1"
+# PTHREAD_POOL_SIZE and the WORKERFS/NODEFS file systems, which models are
+# read from in place, come from the fllama_wasm target in src/CMakeLists.txt.
+export EMCC_CFLAGS="-O3 $FLLAMA_WASM_SIMD_FLAGS -pthread -fno-rtti -s USE_PTHREADS=1 -s ASYNCIFY=1 -DNDEBUG -flto=full -s ALLOW_TABLE_GROWTH  -s SHARED_MEMORY=1 -s EXPORT_ALL=1 -s EXPORT_ES6=1 -s MODULARIZE=1 -s INITIAL_MEMORY=800MB -s MAXIMUM_MEMORY=4GB -s ALLOW_MEMORY_GROWTH -s FORCE_FILESYSTEM=1 -s ENVIRONMENT=web,worker,node -s EXPORTED_RUNTIME_METHODS=['addFunction','FS','UTF8ToString'] -s EXPORTED_FUNCTIONS=['_fllama_get_bos_token_export, _fllama_get_eos_token_export, _fllama_cancel_inference_export, _fllama_tokenize_export, _fllama_get_chat_template_export, _fllama_inference_export, _malloc, _free'] -s NO_EXIT_RUNTIME=1"
 emmake make fllama_wasm -j
 
 #
@@ -0,0 +1,140 @@
+// Headless tokens/second benchmark of the web build, run with Node 18+:
+//
+//   node fllama_wasm_bench.mjs MODEL.gguf [--threads N] [--tokens N]
+//        [--runs N] [--context N] [--prompt TEXT]
+//
+// Loads fllama_wasm.js from this directory, as built by build-wasm.sh. The
+// model is read from disk through NODEFS as it loads, like WORKERFS does in
+// browsers. The first run loads the model and isn't counted.
+import path from "node:path";
+import { fileURLToPath } from "node:url";
+import Module from "./fllama_wasm.js";
+
+function parseArgs(argv) {
+    const args = {
+        model: null,
+        threads: 0,
+        tokens: 64,
+        runs: 3,
+        context: 2048,
+        prompt: "Write a short story about a fox who learns to read.",
+    };
+    for (let i = 0; i < argv.length; i++) {
+        const arg = argv[i];
+        const next = () => argv[++i];
+        switch (arg) {
+            case "--threads": args.threads = parseInt(next(), 10); break;
+            case "--tokens": args.tokens = parseInt(next(), 10); break;
+            case "--runs": args.runs = parseInt(next(), 10); break;
+            case "--context": args.context = parseInt(next(), 10); break;
+            case "--prompt": args.prompt = next(); break;
+            default:
+                if (arg.startsWith("--") || args.model !== null) {
+                    throw new Error(`unexpected argument ${arg}`);
+                }
+                args.model = arg;
+        }
+    }
+    if (args.model === null) {
+        throw new Error("usage: node fllama_wasm_bench.mjs MODEL.gguf [--threads N] [--tokens N] [--runs N] [--context N] [--prompt TEXT]");
+    }
+    return args;
+}
+
+function allocString(module, s) {
+    const bytes = new TextEncoder().encode(s);
+    const ptr = module._malloc(bytes.length + 1);
+    module.HEAPU8.set(bytes, ptr);
+    module.HEAPU8[ptr + bytes.length] = 0;
+    return ptr;
+}
+
+// Resolves with the time of the first and last token and the final
+// response's usage once inference is done.
+function infer(module, args, modelPathPtr, requestId) {
+    return new Promise((resolve) => {
+        const inputPtr = allocString(module, args.prompt);
+        const start = performance.now();
+        let firstToken = null;
+        let callbackPtr = 0;
+        const logPtr = module.addFunction(() => {}, "vi");
+        callbackPtr = module.addFunction((response, json, done) => {
+            const now = performance.now();
+            if (firstToken === null) {
+                firstToken = now;
+            }
+            if (!done) {
+                return;
+            }
+            let usage = null;
+            try {
+                usage = JSON.parse(module.UTF8ToString(json)).usage || null;
+            } catch (e) {
+                // Errors come without a response JSON.
+            }
+            module._free(inputPtr);
+            module.removeFunction?.(callbackPtr);
+            module.removeFunction?.(logPtr);
+            resolve({
+                start,
+                firstToken,
+                end: now,
+                usage,
+                text: module.UTF8ToString(response),
+            });
+        }, "viii");
+        module._fllama_inference_export(
+            requestId, args.context, inputPtr, args.tokens, modelPathPtr,
+            /* model_mmproj_path */ 0, /* num_gpu_layers */ 0, args.threads,
+            /* temperature */ 0, /* top_p */ 1, /* penalty_freq */ 0,
+            /* penalty_repeat */ 1, /* grammar */ 0, /* eos_token */ 0,
+            callbackPtr, logPtr);
+    });
+}
+
+async function main() {
+    const args = parseArgs(process.argv.slice(2));
+    const modelFile = path.resolve(args.model);
+    const moduleDir = path.dirname(fileURLToPath(import.meta.url));
+    const module = await Module({
+        locateFile: (file) => path.join(moduleDir, file),
+        print: () => {},
+        printErr: () => {},
+    });
+    if (!module.FS.filesystems.NODEFS) {
+        throw new Error("fllama_wasm.js was built without NODEFS, rebuild with build-wasm.sh");
+    }
+    module.FS.mkdir("/models");
+    module.FS.mount(module.FS.filesystems.NODEFS, { root: path.dirname(modelFile) }, "/models");
+    const modelPathPtr = allocString(module, `/models/${path.basename(modelFile)}`);
+
+    const loadStart = performance.now();
+    const warmup = await infer(module, { ...args, tokens: 1 }, modelPathPtr, 0);
+    console.log(`load + first token: ${(warmup.end - loadStart).toFixed(0)} ms`);
+
+    for (let run = 1; run <= args.runs; run++) {
+        const result = await infer(module, args, modelPathPtr, run);
+        if (result.usage === null) {
+            throw new Error(`inference failed: ${result.text}`);
+        }
+        const promptTokens = result.usage.prompt_tokens;
+        const completionTokens = result.usage.completion_tokens;
+        const prefillMs = result.firstToken - result.start;
+        const decodeMs = result.end - result.firstToken;
+        // The first token comes out of prefill.
+        const decodeTokPerSec = completionTokens > 1
+            ? ((completionTokens - 1) * 1000) / decodeMs
+            : 0;
+        console.log(
+            `run ${run}: prompt ${promptTokens} tok in ${prefillMs.toFixed(0)} ms ` +
+            `(${((promptTokens * 1000) / prefillMs).toFixed(1)} tok/s), ` +
+            `generated ${completionTokens} tok, ${decodeTokPerSec.toFixed(1)} tok/s`);
+    }
+    module._free(modelPathPtr);
+    process.exit(0);
+}
+
+main().catch((e) => {
+    console.error(e.message);
+    process.exit(1);
+});
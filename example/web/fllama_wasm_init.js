@@ -44,11 +44,12 @@ async function inferenceWithWorker(worker, request, callback) {
         if (request.modelPath.startsWith('blob:')) {
             // Handle the blob URL
             // console.log('[fllama_wasm_init.js.fllamaInferenceJs] Detected blob URL, processing it.', request.modelPath);
+            // Checks the blob URL is still valid. The worker loads the model
+            // itself: a copy here would be posted along with the request.
             await fetch(request.modelPath)
-                .then(response => response.arrayBuffer())
-                .then(arrayBuffer => {
-                    console.log("[fllama_wasm_init.js.fllamaInferenceJs] loaded blob arrayBuffer", arrayBuffer.byteLength, arrayBuffer.slice(0, 10));
-                    request = Object.assign({}, request, { modelArrayBuffer: arrayBuffer });
+                .then(response => response.blob())
+                .then(blob => {
+                    console.log("[fllama_wasm_init.js.fllamaInferenceJs] found blob", blob.size);
                 })
                 .catch(error => {
                     console.error('[fllamaInferenceJs] Error fetching blob:', error);
@@ -227,9 +228,10 @@ function initializeWorker(modelPath) {
         let modelSize = -1;
         if (modelPath.startsWith('blob:')) {
             fetch(modelPath)
-                .then(response => response.arrayBuffer())
-                .then(arrayBuffer => {
-                    modelSize = arrayBuffer.byteLength;
+                // Only the size is needed; a Blob's contents aren't read.
+                .then(response => response.blob())
+                .then(blob => {
+                    modelSize = blob.size;
                     sendMessage(worker, { event: action.LOAD, url: modelPath, modelSize: modelSize });
                 })
                 .catch(error => {
@@ -72,11 +72,19 @@ const initWorker = async (modelPath, modelSize) => {
     module = await Module(emscriptenModuleOptions);
     // console.log("[fllama_wasm_main_worker.js.initWorker] Module loaded", module);
     // console.log("[fllama_wasm_main_worker.js.initWorker] initializing worker at model path ", modelPath);
-    const initCallback = (bytes) => {
-        // create vfs folder for storing model bins
-        module['FS_createPath']("/", "models", true, true);
-        // load model
-        module['FS_createDataFile']('/models', 'model.bin', bytes, true, true, true);
+    const initCallback = async (blob) => {
+        const workerFs = module.FS && module.FS.filesystems && module.FS.filesystems.WORKERFS;
+        if (workerFs) {
+            // WORKERFS reads the Blob in slices as llama.cpp reads tensors, so
+            // the weights are only copied once, into wasm memory.
+            module.FS.mkdir('/models');
+            module.FS.mount(workerFs, { blobs: [{ name: 'model.bin', data: blob }] }, '/models');
+        } else {
+            // Builds without WORKERFS: the file lives in MEMFS, a second copy.
+            module['FS_createPath']("/", "models", true, true);
+            const bytes = new Uint8Array(await blob.arrayBuffer());
+            module['FS_createDataFile']('/models', 'model.bin', bytes, true, true, true);
+        }
         // update callback action to worker main thread
         wroteModel = true;
         postMessage({
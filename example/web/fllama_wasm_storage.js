@@ -14,14 +14,13 @@ async function loadBinaryResource(url, modelSize, callback) {
             const cachedResponse = await cache.match(cacheKey);
             
             if (cachedResponse) {
-                const data = await cachedResponse.arrayBuffer();
+                const blob = await cachedResponse.blob();
                 // Check for model size mismatch if the cached model is a blob URL
-                if (cacheKey === 'cached_blob_model' && data.byteLength !== modelSize) {
-                    // console.error("[fllama_wasm_storage.js] Cached model size mismatch. Expected:", modelSize, "Got:", data.byteLength);
+                if (cacheKey === 'cached_blob_model' && blob.size !== modelSize) {
+                    // console.error("[fllama_wasm_storage.js] Cached model size mismatch. Expected:", modelSize, "Got:", blob.size);
                 } else {
-                    const byteArray = new Uint8Array(data);
                     // console.debug("[fllama_wasm_storage.js] Loaded resource from cache:", cacheKey);
-                    callback(byteArray);
+                    callback(blob);
                     return;
                 }
             }
@@ -35,16 +34,17 @@ async function loadBinaryResource(url, modelSize, callback) {
     // Fallback to fetching the resource and update cache if necessary
     console.log("[fllama_wasm_storage.js] Fetching resource:", url);
     fetch(url).then(async response => {
-        const arrayBuffer = await response.arrayBuffer();
-        const byteArray = new Uint8Array(arrayBuffer);
-        console.debug("[fllama_wasm_storage.js] Loaded binary resource from URL:", url, "Resource size:", byteArray.length);
+        // A Blob, unlike an ArrayBuffer, can stay on disk: the model is read
+        // from it in slices as it is loaded, see fllama_wasm_main_worker.js.
+        const blob = await response.blob();
+        console.debug("[fllama_wasm_storage.js] Loaded binary resource from URL:", url, "Resource size:", blob.size);
 
         if (cache) {
-            await cache.put(cacheKey, new Response(arrayBuffer));
+            await cache.put(cacheKey, new Response(blob));
             console.debug(`[fllama_wasm_storage.js] Cached the data for ${cacheKey === 'cached_blob_model' ? 'blob URL' : 'URL'}:`, cacheKey);
         }
 
-        callback(byteArray);
+        callback(blob);
     }).catch(error => {
         console.error("[fllama_wasm_storage.js] Error fetching or caching resource:", url, error);
     });
@@ -1,10 +1,24 @@
 // Relative import to be able to reuse the C sources.
 // See the comment in ../{projectName}}.podspec for more information.
 #include "../../src/fllama.cpp"
+#include "../../src/fllama_backend.cpp"
 #include "../../src/fllama_chat_template.cpp"
+#include "../../src/fllama_continue.cpp"
 #include "../../src/fllama_eos.cpp"
+#include "../../src/fllama_history.cpp"
+#include "../../src/fllama_host.cpp"
 #include "../../src/fllama_inference_queue.cpp"
+#include "../../src/fllama_kv_tier.cpp"
 #include "../../src/fllama_llava.cpp"
+#include "../../src/fllama_lookahead.cpp"
+#include "../../src/fllama_memory.cpp"
+#include "../../src/fllama_op_profile.cpp"
+#include "../../src/fllama_parallel.cpp"
+#include "../../src/fllama_penalties.cpp"
+#include "../../src/fllama_perf.cpp"
+#include "../../src/fllama_reasoning.cpp"
+#include "../../src/fllama_rpc.cpp"
 #include "../../src/fllama_tokenize.cpp"
+#include "../../src/fllama_weight_stream.cpp"
 #include "../../src/clip.cpp"
 #include "../../src/llava.cpp"
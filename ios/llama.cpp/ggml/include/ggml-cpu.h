@@ -133,6 +133,15 @@ extern "C" {
 
     GGML_BACKEND_API ggml_backend_reg_t ggml_backend_cpu_reg(void);
 
+    // Per-node profiling of graph computes: called by every compute thread
+    // after it finishes its part of a node, with the ggml_time_us() span it
+    // spent on it (barrier waits excluded). Calls from different threads
+    // (ith) are concurrent. NULL disables it, at the cost of a branch per
+    // node. Also available as "ggml_cpu_set_op_profile_callback" from the
+    // CPU backend's ggml_backend_reg_get_proc_address.
+    typedef void (*ggml_cpu_op_profile_callback)(const struct ggml_tensor * node, int ith, int64_t t_start_us, int64_t t_end_us, void * user_data);
+    GGML_BACKEND_API void ggml_cpu_set_op_profile_callback(ggml_cpu_op_profile_callback callback, void * user_data);
+
     GGML_BACKEND_API void ggml_cpu_fp32_to_fp16(const float *, ggml_fp16_t *, int64_t);
     GGML_BACKEND_API void ggml_cpu_fp16_to_fp32(const ggml_fp16_t *, float *, int64_t);
     GGML_BACKEND_API void ggml_cpu_fp32_to_bf16(const float *, ggml_bf16_t *, int64_t);
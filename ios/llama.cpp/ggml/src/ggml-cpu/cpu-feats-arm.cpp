@@ -0,0 +1,48 @@
+#include "ggml-backend-impl.h"
+
+#if defined(__aarch64__) && (defined(__linux__) || defined(__ANDROID__))
+
+#include <sys/auxv.h>
+
+// values from the kernel's arch/arm64/include/uapi/asm/hwcap.h, older NDKs lack some of them
+#ifndef HWCAP_FPHP
+#define HWCAP_FPHP    (1 << 9)
+#endif
+#ifndef HWCAP_ASIMDHP
+#define HWCAP_ASIMDHP (1 << 10)
+#endif
+#ifndef HWCAP_ASIMDDP
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+#ifndef HWCAP2_I8MM
+#define HWCAP2_I8MM   (1 << 13)
+#endif
+
+static int ggml_backend_cpu_aarch64_score() {
+    int score = 1;
+
+    const unsigned long hwcap  = getauxval(AT_HWCAP);
+    const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+
+    (void) hwcap;
+    (void) hwcap2;
+
+#ifdef GGML_DOTPROD
+    if (!(hwcap & HWCAP_ASIMDDP)) { return 0; }
+    score += 1<<1;
+#endif
+#ifdef GGML_FP16_VECTOR_ARITHMETIC
+    if (!(hwcap & HWCAP_FPHP) || !(hwcap & HWCAP_ASIMDHP)) { return 0; }
+    score += 1<<2;
+#endif
+#ifdef GGML_MATMUL_INT8
+    if (!(hwcap2 & HWCAP2_I8MM)) { return 0; }
+    score += 1<<3;
+#endif
+
+    return score;
+}
+
+GGML_BACKEND_DL_SCORE_IMPL(ggml_backend_cpu_aarch64_score)
+
+#endif // defined(__aarch64__) && (defined(__linux__) || defined(__ANDROID__))
@@ -2786,6 +2786,14 @@ struct ggml_cplan ggml_graph_plan(
                         const int64_t ne20 = node->src[2]->ne[0]; // DV
 
                         cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
+
+                        const int n_chunks = ggml_flash_attn_ext_n_kv_chunks(node, n_tasks);
+                        if (n_chunks > 1) {
+                            const int64_t nr = ggml_nrows(node->src[0]);
+
+                            cur += CACHE_LINE_SIZE*n_tasks;              // per-thread padding
+                            cur += sizeof(float)*(ne20 + 2)*nr*n_chunks; // M, S and accumulator per (row, chunk)
+                        }
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
@@ -2832,6 +2840,14 @@ struct ggml_cplan ggml_graph_plan(
     return cplan;
 }
 
+static ggml_cpu_op_profile_callback g_op_profile_callback  = NULL;
+static void *                       g_op_profile_user_data = NULL;
+
+void ggml_cpu_set_op_profile_callback(ggml_cpu_op_profile_callback callback, void * user_data) {
+    g_op_profile_user_data = user_data;
+    g_op_profile_callback  = callback;
+}
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
@@ -2839,6 +2855,10 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     const struct ggml_cgraph * cgraph = tp->cgraph;
     const struct ggml_cplan  * cplan  = tp->cplan;
 
+    // read once, so a graph is either fully profiled or not at all
+    const ggml_cpu_op_profile_callback op_profile_callback  = g_op_profile_callback;
+    void * const                       op_profile_user_data = g_op_profile_user_data;
+
     set_numa_thread_affinity(state->ith);
 
     struct ggml_compute_params params = {
@@ -2852,7 +2872,13 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+        if (op_profile_callback) {
+            const int64_t t_start_us = ggml_time_us();
+            ggml_compute_forward(&params, node);
+            op_profile_callback(node, state->ith, t_start_us, ggml_time_us(), op_profile_user_data);
+        } else {
+            ggml_compute_forward(&params, node);
+        }
 
         if (state->ith == 0 && cplan->abort_callback &&
                 cplan->abort_callback(cplan->abort_callback_data)) {
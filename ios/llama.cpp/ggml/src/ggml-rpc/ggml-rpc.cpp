@@ -3,6 +3,7 @@
 #include "ggml-backend-impl.h"
 #include "ggml-cpp.h"
 
+#include <atomic>
 #include <cinttypes>
 #include <string>
 #include <vector>
@@ -39,9 +40,19 @@ using ssize_t = __int64;
 typedef int sockfd_t;
 #endif
 
+// client-side traffic counters, one per endpoint
+struct rpc_endpoint_stats {
+    std::atomic<uint64_t> n_cmds             {0};
+    std::atomic<uint64_t> bytes_sent         {0};
+    std::atomic<uint64_t> bytes_recv         {0};
+    std::atomic<uint64_t> n_graph_compute    {0};
+    std::atomic<int64_t>  t_graph_compute_us {0};
+};
+
 // cross-platform socket
 struct socket_t {
     sockfd_t fd;
+    rpc_endpoint_stats * stats = nullptr; // client sockets only
     socket_t(sockfd_t fd) : fd(fd) {}
     ~socket_t() {
         GGML_PRINT_DEBUG("[%s] closing socket %d\n", __func__, this->fd);
@@ -390,6 +401,10 @@ static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cm
     if (!send_data(sock->fd, input, input_size)) {
         return false;
     }
+    if (sock->stats) {
+        sock->stats->n_cmds++;
+        sock->stats->bytes_sent += sizeof(cmd_byte) + sizeof(input_size) + input_size;
+    }
     return true;
 }
 
@@ -411,11 +426,28 @@ static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cm
     if (!recv_data(sock->fd, output, output_size)) {
         return false;
     }
+    if (sock->stats) {
+        sock->stats->bytes_recv += sizeof(out_size) + output_size;
+    }
     return true;
 }
 
 // RPC client-side implementation
 
+static rpc_endpoint_stats * get_endpoint_stats(const std::string & endpoint) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    // NOTE: stats outlive the sockets so they can be read after a disconnect; never freed
+    static std::unordered_map<std::string, rpc_endpoint_stats *> stats_map;
+    auto it = stats_map.find(endpoint);
+    if (it != stats_map.end()) {
+        return it->second;
+    }
+    rpc_endpoint_stats * stats = new rpc_endpoint_stats;
+    stats_map[endpoint] = stats;
+    return stats;
+}
+
 static bool check_server_version(const std::shared_ptr<socket_t> & sock) {
     rpc_msg_hello_rsp response;
     bool status = send_rpc_cmd(sock, RPC_CMD_HELLO, nullptr, 0, &response, sizeof(response));
@@ -467,6 +499,7 @@ static std::shared_ptr<socket_t> get_socket(const std::string & endpoint) {
         return nullptr;
     }
     GGML_PRINT_DEBUG("[%s] connected to %s, sockfd=%d\n", __func__, endpoint.c_str(), sock->fd);
+    sock->stats = get_endpoint_stats(endpoint);
     sockets[endpoint] = sock;
     return sock;
 }
@@ -752,8 +785,12 @@ static enum ggml_status ggml_backend_rpc_graph_compute(ggml_backend_t backend, g
     serialize_graph(cgraph, input);
     rpc_msg_graph_compute_rsp response;
     auto sock = get_socket(rpc_ctx->endpoint);
+    // the command returns when the server has finished, so this is the compute time plus the transfer
+    const int64_t t_start_us = ggml_time_us();
     bool status = send_rpc_cmd(sock, RPC_CMD_GRAPH_COMPUTE, input.data(), input.size(), &response, sizeof(response));
     GGML_ASSERT(status);
+    sock->stats->n_graph_compute++;
+    sock->stats->t_graph_compute_us += ggml_time_us() - t_start_us;
     return (enum ggml_status)response.result;
 }
 
@@ -842,6 +879,24 @@ void ggml_backend_rpc_get_device_memory(const char * endpoint, size_t * free, si
     get_device_memory(sock, free, total);
 }
 
+void ggml_backend_rpc_get_stats(const char * endpoint, struct ggml_backend_rpc_stats * stats) {
+    const rpc_endpoint_stats * s = get_endpoint_stats(endpoint);
+    stats->n_cmds             = s->n_cmds;
+    stats->bytes_sent         = s->bytes_sent;
+    stats->bytes_recv         = s->bytes_recv;
+    stats->n_graph_compute    = s->n_graph_compute;
+    stats->t_graph_compute_us = s->t_graph_compute_us;
+}
+
+void ggml_backend_rpc_reset_stats(const char * endpoint) {
+    rpc_endpoint_stats * s = get_endpoint_stats(endpoint);
+    s->n_cmds             = 0;
+    s->bytes_sent         = 0;
+    s->bytes_recv         = 0;
+    s->n_graph_compute    = 0;
+    s->t_graph_compute_us = 0;
+}
+
 // RPC server-side implementation
 
 class rpc_server {
@@ -1748,6 +1803,18 @@ static void * ggml_backend_rpc_get_proc_address(ggml_backend_reg_t reg, const ch
     if (std::strcmp(name, "ggml_backend_rpc_add_device") == 0) {
         return (void *)ggml_backend_rpc_add_device;
     }
+    if (std::strcmp(name, "ggml_backend_rpc_get_device_memory") == 0) {
+        return (void *)ggml_backend_rpc_get_device_memory;
+    }
+    if (std::strcmp(name, "ggml_backend_rpc_get_stats") == 0) {
+        return (void *)ggml_backend_rpc_get_stats;
+    }
+    if (std::strcmp(name, "ggml_backend_rpc_reset_stats") == 0) {
+        return (void *)ggml_backend_rpc_reset_stats;
+    }
+    if (std::strcmp(name, "ggml_backend_rpc_start_server") == 0) {
+        return (void *)ggml_backend_rpc_start_server;
+    }
     return NULL;
 
     GGML_UNUSED(reg);
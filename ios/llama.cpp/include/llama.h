@@ -60,6 +60,7 @@ extern "C" {
     struct llama_model;
     struct llama_context;
     struct llama_sampler;
+    struct llama_compute_arena;
     struct llama_kv_cache;
 
     typedef int32_t llama_pos;
@@ -319,6 +320,9 @@ extern "C" {
         bool use_mmap;      // use mmap if possible
         bool use_mlock;     // force system to keep model in RAM
         bool check_tensors; // validate model tensor data
+        bool use_hugepages; // back CPU weights (copied when !use_mmap), KV cache and compute buffers with huge pages where supported
+        bool use_prefetch;  // populate the whole mmap at load time; disable when streaming weights layer by layer
+        bool use_extra_bufts; // allow CPU repack buffer types, which copy the weights out of the mmap
     };
 
     // NOTE: changing the default values of parameters marked as [EXPERIMENTAL] may cause crashes or incorrect results in certain configurations
@@ -364,6 +368,10 @@ extern "C" {
         // currently works only with CPU execution
         ggml_abort_callback abort_callback;
         void *              abort_callback_data;
+
+        // Optional: borrow compute buffers from this arena for each decode instead of owning them, see
+        // llama_compute_arena_init
+        struct llama_compute_arena * compute_arena;
     };
 
     // model quantization parameters
@@ -462,6 +470,21 @@ extern "C" {
     // Frees all allocated memory
     LLAMA_API void llama_free(struct llama_context * ctx);
 
+    // Compute buffers shared by the contexts created with it, sized for the largest of their worst-case graphs.
+    // Each llama_decode, llama_encode and llama_kv_self_update holds the arena until its results are ready, so
+    // contexts using it run one at a time, and an arena is best shared by contexts that are used one at a time anyway,
+    // ex. the models one worker thread serves.
+    LLAMA_API struct llama_compute_arena * llama_compute_arena_init(void);
+
+    // Free after the contexts using it
+    LLAMA_API void llama_compute_arena_free(struct llama_compute_arena * arena);
+
+    // Size of the arena's buffers in bytes
+    LLAMA_API size_t llama_compute_arena_size(struct llama_compute_arena * arena);
+
+    // Frees the arena's buffers, the next context to use it allocates them again
+    LLAMA_API void llama_compute_arena_trim(struct llama_compute_arena * arena);
+
     LLAMA_API int64_t llama_time_us(void);
 
     LLAMA_API size_t llama_max_devices(void);
@@ -534,6 +557,11 @@ extern "C" {
     // Returns the total number of parameters in the model
     LLAMA_API uint64_t llama_model_n_params(const struct llama_model * model);
 
+    // The model's weight tensors, ex. to find the memory a layer's weights live in;
+    // ggml_get_name gives their GGUF names. NULL if i is out of range
+    LLAMA_API int32_t llama_model_n_tensors(const struct llama_model * model);
+    LLAMA_API const struct ggml_tensor * llama_model_get_tensor_by_index(const struct llama_model * model, int32_t i);
+
     // Returns true if the model contains an encoder that requires llama_encode() call
     LLAMA_API bool llama_model_has_encoder(const struct llama_model * model);
 
@@ -672,6 +700,11 @@ extern "C" {
     LLAMA_API void llama_kv_self_clear(
             struct llama_context * ctx);
 
+    // Clear the KV cache like llama_kv_self_clear, but give the memory of its CPU buffers back to the OS
+    // instead of zeroing it; the buffers stay allocated and fill again on next use
+    LLAMA_API void llama_kv_self_release(
+            struct llama_context * ctx);
+
     // Removes all tokens that belong to the specified sequence and have positions in [p0, p1)
     // Returns false if a partial sequence cannot be removed. Removing a whole sequence never fails
     // seq_id < 0 : match any sequence
@@ -1438,33 +1438,47 @@ ggml_tensor * llm_graph_context::build_attn(
     {
         GGML_ASSERT(!kv_self->recurrent);
 
-        const auto kv_head = kv_self->head;
-
         GGML_ASSERT(kv_self->size == n_ctx);
 
-        ggml_tensor * k_cache_view = ggml_view_1d(ctx0, kv_self->k_l[il], n_tokens*n_embd_k_gqa, ggml_row_size(kv_self->k_l[il]->type, n_embd_k_gqa)*kv_head);
-        //cb(k_cache_view, "k_cache_view", il);
+        v_cur = ggml_reshape_2d(ctx0, v_cur, n_embd_v_gqa, n_tokens);
 
-        // note: storing RoPE-ed version of K in the KV cache
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, k_cur, k_cache_view));
+        // one copy per run of cells the ubatch is stored in, usually a single one
+        int64_t i0 = 0;
+        for (const auto & range : kv_self->slot_ranges(n_tokens)) {
+            const auto    kv_head  = range.c0;
+            const int64_t n_cells  = range.c1 - range.c0;
+
+            ggml_tensor * k_src = k_cur;
+            ggml_tensor * v_src = v_cur;
+            if (n_cells != n_tokens) {
+                k_src = ggml_view_3d(ctx0, k_cur, k_cur->ne[0], k_cur->ne[1], n_cells, k_cur->nb[1], k_cur->nb[2], i0*k_cur->nb[2]);
+                v_src = ggml_view_2d(ctx0, v_cur, n_embd_v_gqa, n_cells, v_cur->nb[1], i0*v_cur->nb[1]);
+            }
+            i0 += n_cells;
 
-        v_cur = ggml_reshape_2d(ctx0, v_cur, n_embd_v_gqa, n_tokens);
+            ggml_tensor * k_cache_view = ggml_view_1d(ctx0, kv_self->k_l[il], n_cells*n_embd_k_gqa, ggml_row_size(kv_self->k_l[il]->type, n_embd_k_gqa)*kv_head);
+            //cb(k_cache_view, "k_cache_view", il);
 
-        ggml_tensor * v_cache_view = nullptr;
+            // note: storing RoPE-ed version of K in the KV cache
+            ggml_build_forward_expand(gf, ggml_cpy(ctx0, k_src, k_cache_view));
 
-        if (!v_trans) {
-            v_cache_view = ggml_view_1d(ctx0, kv_self->v_l[il], n_tokens*n_embd_v_gqa, ggml_row_size(kv_self->v_l[il]->type, n_embd_v_gqa)*kv_head);
-        } else {
-            // note: the V cache is transposed when not using flash attention
-            v_cache_view = ggml_view_2d(ctx0, kv_self->v_l[il], n_tokens, n_embd_v_gqa,
-                    (  n_ctx)*ggml_element_size(kv_self->v_l[il]),
-                    (kv_head)*ggml_element_size(kv_self->v_l[il]));
+            ggml_tensor * v_cache_view = nullptr;
 
-            v_cur = ggml_transpose(ctx0, v_cur);
-        }
-        //cb(v_cache_view, "v_cache_view", il);
+            if (!v_trans) {
+                v_cache_view = ggml_view_1d(ctx0, kv_self->v_l[il], n_cells*n_embd_v_gqa, ggml_row_size(kv_self->v_l[il]->type, n_embd_v_gqa)*kv_head);
+            } else {
+                // note: the V cache is transposed when not using flash attention
+                v_cache_view = ggml_view_2d(ctx0, kv_self->v_l[il], n_cells, n_embd_v_gqa,
+                        (  n_ctx)*ggml_element_size(kv_self->v_l[il]),
+                        (kv_head)*ggml_element_size(kv_self->v_l[il]));
 
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, v_cur, v_cache_view));
+                v_src = ggml_transpose(ctx0, v_src);
+            }
+            //cb(v_cache_view, "v_cache_view", il);
+
+            ggml_build_forward_expand(gf, ggml_cpy(ctx0, v_src, v_cache_view));
+        }
+        GGML_ASSERT(i0 == n_tokens);
     }
 
     const bool is_swa = hparams.is_swa(il);
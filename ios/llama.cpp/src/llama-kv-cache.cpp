@@ -7,10 +7,20 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <limits>
 #include <map>
 #include <stdexcept>
 
+#ifdef __has_include
+    #if __has_include(<unistd.h>)
+        #include <unistd.h>
+        #if defined(_POSIX_MAPPED_FILES)
+            #include <sys/mman.h>
+        #endif
+    #endif
+#endif
+
 llama_kv_cache_unified::llama_kv_cache_unified(const llama_hparams & hparams, callbacks cbs) : hparams(hparams), cbs(std::move(cbs)) {
 }
 
@@ -168,6 +178,63 @@ void llama_kv_cache_unified::clear() {
     }
 }
 
+// gives the pages of a CPU buffer back to the OS, they read as zeros (or as before, on Apple) on next use
+// returns false if the buffer is left as it was
+static bool llama_kv_cache_release_pages(ggml_backend_buffer_t buf) {
+#if defined(_POSIX_MAPPED_FILES)
+    // the CPU buffer type has no device, host buffers of GPU devices (ex. Metal) are left alone
+    ggml_backend_dev_t dev = ggml_backend_buft_get_device(ggml_backend_buffer_get_type(buf));
+    if (!ggml_backend_buffer_is_host(buf) || (dev != nullptr && ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_CPU)) {
+        return false;
+    }
+
+    const uintptr_t page  = (uintptr_t) sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = (uintptr_t) ggml_backend_buffer_get_base(buf);
+    const uintptr_t end   = begin + ggml_backend_buffer_get_size(buf);
+
+    // whole pages only, the partial ones at either end are zeroed
+    const uintptr_t first = (begin + page - 1) & ~(page - 1);
+    const uintptr_t last  = end & ~(page - 1);
+    if (first >= last) {
+        return false;
+    }
+
+#if defined(__APPLE__) && defined(MADV_FREE_REUSABLE)
+    const int advice = MADV_FREE_REUSABLE; // taken out of the footprint right away
+#else
+    const int advice = MADV_DONTNEED;
+#endif
+    if (madvise((void *) first, last - first, advice) != 0) {
+        return false;
+    }
+
+    memset((void *) begin, 0, first - begin);
+    memset((void *) last,  0, end - last);
+
+    return true;
+#else
+    GGML_UNUSED(buf);
+    return false;
+#endif
+}
+
+void llama_kv_cache_unified::release() {
+    for (int32_t i = 0; i < (int32_t) size; ++i) {
+        cells[i].pos = -1;
+        cells[i].seq_id.clear();
+        cells[i].src = -1;
+        cells[i].tail = -1;
+    }
+    head = 0;
+    used = 0;
+
+    for (auto & buf : bufs) {
+        if (!llama_kv_cache_release_pages(buf.get())) {
+            ggml_backend_buffer_clear(buf.get(), 0);
+        }
+    }
+}
+
 bool llama_kv_cache_unified::seq_rm(llama_seq_id seq_id, llama_pos p0, llama_pos p1) {
     uint32_t new_head = size;
 
@@ -500,7 +567,8 @@ bool llama_kv_cache_unified::get_can_shift() const {
 }
 
 bool llama_kv_cache_unified::find_slot(
-       const llama_ubatch & ubatch) {
+       const llama_ubatch & ubatch,
+       bool contiguous) {
     const uint32_t n_tokens = ubatch.n_tokens;
     const uint32_t n_seqs   = ubatch.n_seqs;
     const uint32_t n_seq_tokens = ubatch.n_seq_tokens;
@@ -682,6 +750,7 @@ bool llama_kv_cache_unified::find_slot(
     }
 
     uint32_t n_tested = 0;
+    bool     found    = false;
 
     while (true) {
         if (head + n_tokens > size) {
@@ -690,7 +759,7 @@ bool llama_kv_cache_unified::find_slot(
             continue;
         }
 
-        bool found = true;
+        found = true;
         for (uint32_t i = 0; i < n_tokens; i++) {
             if (cells[head + i].pos >= 0) {
                 found = false;
@@ -700,34 +769,96 @@ bool llama_kv_cache_unified::find_slot(
             }
         }
 
-        if (found) {
+        if (found || n_tested >= size) {
             break;
         }
+    }
 
-        if (n_tested >= size) {
+    slot.clear();
+
+    if (found) {
+        slot.push_back({head, head + n_tokens});
+    } else {
+        // no contiguous room: store the ubatch in the largest runs of free cells instead,
+        // so that a fragmented cache still takes it without a defrag pass
+        if (contiguous || used + n_tokens > size) {
             //LLAMA_LOG_ERROR("%s: failed to find a slot for %d tokens\n", __func__, n_tokens);
             return false;
         }
+
+        std::vector<slot_range> runs;
+        for (uint32_t i = 0; i < size; ) {
+            if (cells[i].pos >= 0) {
+                i++;
+                continue;
+            }
+            uint32_t j = i;
+            while (j < size && cells[j].pos < 0) {
+                j++;
+            }
+            runs.push_back({i, j});
+            i = j;
+        }
+
+        std::stable_sort(runs.begin(), runs.end(), [](const slot_range & a, const slot_range & b) {
+            return a.c1 - a.c0 > b.c1 - b.c0;
+        });
+
+        uint32_t n_left = n_tokens;
+        for (const auto & run : runs) {
+            if (n_left == 0 || slot.size() == LLAMA_KV_MAX_SLOT_RUNS) {
+                break;
+            }
+            const uint32_t n_take = std::min(run.c1 - run.c0, n_left);
+            slot.push_back({run.c0, run.c0 + n_take});
+            n_left -= n_take;
+        }
+
+        if (n_left > 0) {
+            slot.clear();
+            return false;
+        }
+
+        std::sort(slot.begin(), slot.end(), [](const slot_range & a, const slot_range & b) {
+            return a.c0 < b.c0;
+        });
+
+        head = slot[0].c0;
     }
 
-    for (uint32_t s = 0; s < n_seqs; s++) {
-        for (uint32_t i = 0; i < n_seq_tokens; ++i) {
-            uint32_t k = s*n_seq_tokens + i;
-            cells[head + k].pos = ubatch.pos[k];
+    uint32_t k = 0;
+    for (const auto & range : slot) {
+        for (uint32_t c = range.c0; c < range.c1; ++c, ++k) {
+            const uint32_t s = k / n_seq_tokens;
+
+            cells[c].pos = ubatch.pos[k];
 
             for (int32_t j = 0; j < ubatch.n_seq_id[s]; j++) {
-                cells[head + k].seq_id.insert(ubatch.seq_id[s][j]);
+                cells[c].seq_id.insert(ubatch.seq_id[s][j]);
             }
         }
     }
 
     used += n_tokens;
 
-    pending.ranges.push_back({head, head + n_tokens});
+    pending.ranges.insert(pending.ranges.end(), slot.begin(), slot.end());
 
     return true;
 }
 
+std::vector<llama_kv_cache_unified::slot_range> llama_kv_cache_unified::slot_ranges(uint32_t n_tokens) const {
+    uint32_t n_slot = 0;
+    for (const auto & range : slot) {
+        n_slot += range.c1 - range.c0;
+    }
+
+    if (n_slot != n_tokens) {
+        return { { head, head + n_tokens } };
+    }
+
+    return slot;
+}
+
 uint32_t llama_kv_cache_unified::get_padding(const llama_cparams & cparams) const {
     // the FA kernels require padding to avoid extra runtime boundary checks
     return cparams.flash_attn ? 256u : 32u;
@@ -1086,7 +1217,7 @@ bool llama_kv_cache_unified::state_read_meta(llama_io_read_i & io, uint32_t cell
         }
         batch.n_seq_id[0] = 1;
         batch.seq_id[0] = &dest_seq_id;
-        if (!find_slot(batch)) {
+        if (!find_slot(batch, /* contiguous */ true)) {
             LLAMA_LOG_ERROR("%s: failed to find available cells in kv cache\n", __func__);
             return false;
         }
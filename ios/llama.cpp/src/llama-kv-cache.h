@@ -25,6 +25,9 @@ struct llama_kv_cache : public llama_memory_i {
 
     virtual bool get_can_shift() const = 0;
 
+    // clear(), but the memory of the buffers goes back to the OS where it can, instead of being zeroed
+    virtual void release() = 0;
+
     bool get_can_edit() const override { return get_can_shift(); }
 };
 
@@ -43,6 +46,9 @@ private:
     llama_kv_cache * kv;
 };
 
+// max number of separate runs of cells a ubatch can be stored in, each costs a copy per layer
+#define LLAMA_KV_MAX_SLOT_RUNS 64
+
 struct llama_kv_cell {
     llama_pos pos   = -1;
     llama_pos delta =  0;
@@ -100,6 +106,8 @@ public:
     void clear() override;
     void defrag() override;
 
+    void release() override;
+
     virtual void restore() override;
     virtual void commit() override;
 
@@ -114,10 +122,12 @@ public:
     bool get_can_shift() const override;
 
     // find an empty slot of size "n_tokens" in the cache
-    // updates the cache head
+    // updates the cache head and slot
     // Note: On success, it's important that cache.head points
     // to the first cell of the slot.
-    bool find_slot(const llama_ubatch & batch);
+    // if there is no contiguous room, the slot is spread over up to LLAMA_KV_MAX_SLOT_RUNS
+    // runs of free cells instead, unless contiguous is set
+    bool find_slot(const llama_ubatch & batch, bool contiguous = false);
 
     // TODO: maybe not needed
     uint32_t get_padding(const llama_cparams & cparams) const;
@@ -149,6 +159,14 @@ public:
         std::vector<slot_range> ranges;
     } pending;
 
+    // cells of the last slot found, in ubatch token order - a single range unless
+    // the cache was too fragmented for a contiguous slot
+    std::vector<slot_range> slot;
+
+    // the runs of cells a ubatch of n_tokens is stored in: slot, or when no slot was
+    // found for it (e.g. when reserving worst-case graphs), n_tokens cells from head
+    std::vector<slot_range> slot_ranges(uint32_t n_tokens) const;
+
     // state write/load
 
     void state_write(llama_io_write_i & io, llama_seq_id seq_id = -1) const;
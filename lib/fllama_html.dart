@@ -188,6 +188,36 @@ Future<int> fllamaTokenize(FllamaTokenizeRequest request) async {
   }
 }
 
+/// Scores how likely each of [request.candidates] is to follow
+/// [request.prompt], in the order given.
+///
+/// Useful for classification and reranking without generating text.
+///
+/// Not supported on web.
+Future<List<FllamaCandidateScore>> fllamaScore(
+    FllamaScoreRequest request) async {
+  throw UnsupportedError('fllamaScore is not supported on web.');
+}
+
+/// Summarizes [request.document], which may be much longer than the model's
+/// context, streaming progress and then the summary to [callback].
+///
+/// Not supported on web: [callback] is called with `done` and an error.
+Future<int> fllamaSummarize(
+    FllamaSummarizeRequest request, FllamaInferenceCallback callback) async {
+  callback('Error: Summarizing is not supported on web.', '', true);
+  return -1;
+}
+
+/// Runs a JSONL file of chat requests, see [FllamaBatchRequest].
+///
+/// Not supported on web: [callback] is called with `done` and an error.
+Future<int> fllamaBatch(
+    FllamaBatchRequest request, FllamaInferenceCallback callback) async {
+  callback('Error: Batch inference is not supported on web.', '', true);
+  return -1;
+}
+
 // Chat template
 @JS('fllamaChatTemplateGetJs')
 external JSPromise<JSString> fllamaChatTemplateGetJs(String modelPath);
@@ -283,3 +313,46 @@ external void fllamaCancelInferenceJs(int requestId);
 void fllamaCancelInference(int requestId) {
   fllamaCancelInferenceJs(requestId);
 }
+
+/// Resumes the inference with the given [requestId] after it stopped on
+/// `maxTokens` or was cancelled, generating up to [extraMaxTokens] more.
+///
+/// [callback] is called like it is for [fllamaInference], with the whole
+/// response, including the text generated before.
+///
+/// Not supported on web: [callback] is called with `done` and an error.
+Future<void> fllamaContinueInference(int requestId, int extraMaxTokens,
+    FllamaInferenceCallback callback) async {
+  callback('Error: Continuing inference is not supported on web.', '', true);
+}
+
+/// Releases memory in response to an OS memory warning, and returns how many
+/// bytes were released.
+///
+/// Not supported on web, where the browser manages memory: returns 0.
+int fllamaTrimMemory(FllamaMemoryPressure level) {
+  return 0;
+}
+
+/// Keeps the KV cache of conversations a loaded model has moved on from, so
+/// going back to one doesn't process its history again.
+///
+/// Not supported on web: does nothing.
+void fllamaConfigureKvTier({
+  String? cacheDir,
+  required int ramBudgetBytes,
+  int diskBudgetBytes = 0,
+  Duration idleAfter = Duration.zero,
+}) {}
+
+/// Prefills the KV cache with the chat in [request] while the user is still
+/// typing its last message, so that sending it only has to process the last
+/// few tokens.
+///
+/// Call it whenever the draft changes, e.g. debounced on text input, with
+/// [sessionId] identifying the chat: a newer hint replaces one that hasn't run
+/// yet. Hints run only while no inference is queued, and only for a model that
+/// is already loaded; they are dropped otherwise.
+///
+/// Not supported on web, where this does nothing.
+void fllamaChatPrefillHint(OpenAiRequest request, {int sessionId = 0}) {}
@@ -1,4 +1,5 @@
 export 'io/fllama_io_inference.dart';
+export 'io/fllama_io_score.dart';
 export 'io/fllama_io_tokenize.dart';
 
 import 'dart:ffi';
@@ -111,3 +112,64 @@ Future<bool> fllamaMlcIsWebModelDownloaded(String modelId) async {
       'WARNING: called fllamaMlcIsWebModelDownloaded on native platform. Returning false.');
   return false;
 }
+
+/// Releases memory in response to an OS memory warning, ex. from
+/// `WidgetsBindingObserver.didHaveMemoryPressure`, and returns how many bytes
+/// the process footprint shrank by. The model that is generating is never
+/// touched.
+///
+/// After [FllamaMemoryPressure.critical], queued requests wait until this is
+/// called with [FllamaMemoryPressure.none].
+int fllamaTrimMemory(FllamaMemoryPressure level) {
+  return fllamaBindings.fllama_trim_memory(level.index);
+}
+
+/// Keeps the KV cache of conversations a loaded model has moved on from, so
+/// going back to one, e.g. switching chat threads, doesn't process its
+/// history again.
+///
+/// Up to [ramBudgetBytes] stay in memory. The least recently used, and any
+/// unused for [idleAfter] if it's not zero, are written to files in
+/// [cacheDir] in the background, up to [diskBudgetBytes], and read back when
+/// their conversation continues. Use a directory of the app's own, e.g. from
+/// `getApplicationCacheDirectory()`: files there from earlier runs are
+/// deleted. Without [cacheDir], snapshots stay in memory. A [ramBudgetBytes]
+/// of 0, the default, turns this off.
+void fllamaConfigureKvTier({
+  String? cacheDir,
+  required int ramBudgetBytes,
+  int diskBudgetBytes = 0,
+  Duration idleAfter = Duration.zero,
+}) {
+  final Pointer<Char> cacheDirPointer =
+      cacheDir == null ? nullptr : stringToPointerChar(cacheDir);
+  fllamaBindings.fllama_kv_tier_configure(cacheDirPointer, ramBudgetBytes,
+      diskBudgetBytes, idleAfter.inSeconds);
+  if (cacheDirPointer != nullptr) {
+    calloc.free(cacheDirPointer);
+  }
+}
+
+/// Prefills the KV cache with the chat in [request] while the user is still
+/// typing its last message, so that sending it only has to process the last
+/// few tokens.
+///
+/// Call it whenever the draft changes, e.g. debounced on text input, with
+/// [sessionId] identifying the chat: a newer hint replaces one that hasn't run
+/// yet. Hints run only while no inference is queued, and only for a model that
+/// is already loaded; they are dropped otherwise.
+void fllamaChatPrefillHint(OpenAiRequest request, {int sessionId = 0}) {
+  final Pointer<fllama_inference_request> requestPointer =
+      calloc<fllama_inference_request>();
+  final Pointer<Char> modelPath = stringToPointerChar(request.modelPath);
+  final Pointer<Char> openAiRequestJsonString =
+      stringToPointerChar(request.toJsonString());
+  requestPointer.ref.request_id = sessionId;
+  requestPointer.ref.model_path = modelPath;
+  requestPointer.ref.openai_request_json_string = openAiRequestJsonString;
+  // The native side copies what it needs before returning.
+  fllamaBindings.fllama_prefill_hint(requestPointer.ref);
+  calloc.free(modelPath);
+  calloc.free(openAiRequestJsonString);
+  calloc.free(requestPointer);
+}
@@ -90,9 +90,70 @@ void fllamaCancelInference(int requestId) {
   throw UnimplementedError();
 }
 
+/// Resumes the inference with the given [requestId] after it stopped on
+/// `maxTokens` or was cancelled, generating up to [extraMaxTokens] more.
+///
+/// [callback] is called like it is for [fllamaInference], with the whole
+/// response, including the text generated before.
+Future<void> fllamaContinueInference(int requestId, int extraMaxTokens,
+    FllamaInferenceCallback callback) async {
+  throw UnimplementedError();
+}
+
+/// Scores how likely each of [request.candidates] is to follow
+/// [request.prompt], in the order given.
+///
+/// Useful for classification and reranking without generating text.
+Future<List<FllamaCandidateScore>> fllamaScore(
+    FllamaScoreRequest request) async {
+  throw UnimplementedError();
+}
+
+/// Summarizes [request.document], which may be much longer than the model's
+/// context, streaming progress and then the summary to [callback].
+Future<int> fllamaSummarize(
+    FllamaSummarizeRequest request, FllamaInferenceCallback callback) async {
+  throw UnimplementedError();
+}
+
+/// Runs a JSONL file of chat requests, see [FllamaBatchRequest].
+Future<int> fllamaBatch(
+    FllamaBatchRequest request, FllamaInferenceCallback callback) async {
+  throw UnimplementedError();
+}
+
 /// Returns the number of tokens in [request.input].
 ///
 /// Useful for identifying what messages will be in context when the LLM is run.
 Future<int> fllamaTokenize(FllamaTokenizeRequest request) async {
   throw UnimplementedError();
 }
+
+/// Releases memory in response to an OS memory warning, and returns how many
+/// bytes were released.
+int fllamaTrimMemory(FllamaMemoryPressure level) {
+  throw UnimplementedError();
+}
+
+/// Keeps the KV cache of conversations a loaded model has moved on from, so
+/// going back to one doesn't process its history again.
+void fllamaConfigureKvTier({
+  String? cacheDir,
+  required int ramBudgetBytes,
+  int diskBudgetBytes = 0,
+  Duration idleAfter = Duration.zero,
+}) {
+  throw UnimplementedError();
+}
+
+/// Prefills the KV cache with the chat in [request] while the user is still
+/// typing its last message, so that sending it only has to process the last
+/// few tokens.
+///
+/// Call it whenever the draft changes, e.g. debounced on text input, with
+/// [sessionId] identifying the chat: a newer hint replaces one that hasn't run
+/// yet. Hints run only while no inference is queued, and only for a model that
+/// is already loaded; they are dropped otherwise.
+void fllamaChatPrefillHint(OpenAiRequest request, {int sessionId = 0}) {
+  throw UnimplementedError();
+}
@@ -107,6 +107,142 @@ class FllamaTokenizeRequest {
   FllamaTokenizeRequest({required this.input, required this.modelPath});
 }
 
+/// How hard the OS is pressing for memory, see [fllamaTrimMemory]. Each level
+/// releases what the ones before it do.
+enum FllamaMemoryPressure {
+  /// Pressure is over: queued requests paused by [critical] run again.
+  none,
+
+  /// Frees tokenizer caches and idle models' KV caches. They are recreated on
+  /// next use, which costs a prefill rather than a model load.
+  moderate,
+
+  /// Also frees models that aren't generating, and shrinks compute buffers.
+  severe,
+
+  /// Also pauses queued requests until [none].
+  critical,
+}
+
+/// Represents a request to summarize a document longer than the model's
+/// context. Use with [fllamaSummarize].
+class FllamaSummarizeRequest {
+  final String modelPath;
+  final String document;
+
+  /// What the summary should focus on, ex. 'decisions and action items'.
+  final String? instructions;
+
+  /// Length of each summary: the parts' and the final one.
+  final int maxTokens;
+
+  /// Parts of the document summarized at once.
+  final int parallel;
+  final double temperature;
+
+  /// Used if the model isn't loaded yet.
+  final int contextSize;
+
+  /// Used if the model isn't loaded yet.
+  final int numGpuLayers;
+
+  FllamaSummarizeRequest({
+    required this.modelPath,
+    required this.document,
+    this.instructions,
+    this.maxTokens = 256,
+    this.parallel = 4,
+    this.temperature = 0,
+    this.contextSize = 2048,
+    this.numGpuLayers = 0,
+  });
+}
+
+/// Represents an offline batch of chat requests, read from [inputPath] and
+/// answered in [outputPath]. Use with [fllamaBatch].
+///
+/// Each input line is an OpenAI chat completion request body, optionally
+/// with a "custom_id". Each output line has the request's "id", "content",
+/// "finish_reason" and "usage", or an "error".
+class FllamaBatchRequest {
+  final String modelPath;
+  final String inputPath;
+
+  /// Appended to; requests already in it are skipped, so running an
+  /// interrupted batch again resumes it.
+  final String outputPath;
+
+  /// For requests without max_tokens.
+  final int maxTokens;
+
+  /// Sequences decoded together.
+  final int parallel;
+
+  /// For all requests.
+  final double temperature;
+
+  /// Used if the model isn't loaded yet.
+  final int contextSize;
+
+  /// Used if the model isn't loaded yet.
+  final int numGpuLayers;
+
+  FllamaBatchRequest({
+    required this.modelPath,
+    required this.inputPath,
+    required this.outputPath,
+    this.maxTokens = 512,
+    this.parallel = 8,
+    this.temperature = 0,
+    this.contextSize = 4096,
+    this.numGpuLayers = 0,
+  });
+}
+
+/// Represents a request to score how likely each of [candidates] is to follow
+/// [prompt], without generating. Use with [fllamaScore].
+///
+/// Useful for classification and reranking: scoring all the labels costs
+/// about one forward pass. Candidates are tokenized on their own, so give
+/// them the leading space they would have after the prompt, ex. ' positive'.
+class FllamaScoreRequest {
+  final String modelPath;
+  final String prompt;
+  final List<String> candidates;
+
+  /// Used if the model isn't loaded yet.
+  final int contextSize;
+
+  /// Used if the model isn't loaded yet.
+  final int numGpuLayers;
+
+  FllamaScoreRequest({
+    required this.modelPath,
+    required this.prompt,
+    required this.candidates,
+    this.contextSize = 2048,
+    this.numGpuLayers = 0,
+  });
+}
+
+/// How likely a candidate from a [FllamaScoreRequest] is to follow its prompt.
+class FllamaCandidateScore {
+  final String candidate;
+
+  /// Sum of the log-probabilities of the candidate's tokens.
+  final double logProb;
+  final int tokenCount;
+
+  /// [logProb] per token, fairer when candidates differ in length.
+  double get meanLogProb => tokenCount == 0 ? 0 : logProb / tokenCount;
+
+  const FllamaCandidateScore({
+    required this.candidate,
+    required this.logProb,
+    required this.tokenCount,
+  });
+}
+
 /// Run the LLM using the standard LLM chat interface. This is the most common
 /// way to use FLLAMA.
 ///
@@ -75,6 +75,129 @@ class FllamaBindings {
   late final _fllama_inference_cancel =
       _fllama_inference_cancelPtr.asFunction<void Function(int)>();
 
+  void fllama_batch(
+    fllama_batch_request request,
+    fllama_inference_callback callback,
+  ) {
+    return _fllama_batch(
+      request,
+      callback,
+    );
+  }
+
+  late final _fllama_batchPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Void Function(
+              fllama_batch_request, fllama_inference_callback)>>('fllama_batch');
+  late final _fllama_batch = _fllama_batchPtr.asFunction<
+      void Function(fllama_batch_request, fllama_inference_callback)>();
+
+  void fllama_summarize(
+    fllama_summarize_request request,
+    fllama_inference_callback callback,
+  ) {
+    return _fllama_summarize(
+      request,
+      callback,
+    );
+  }
+
+  late final _fllama_summarizePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Void Function(fllama_summarize_request,
+              fllama_inference_callback)>>('fllama_summarize');
+  late final _fllama_summarize = _fllama_summarizePtr.asFunction<
+      void Function(fllama_summarize_request, fllama_inference_callback)>();
+
+  int fllama_score(
+    fllama_score_request request,
+    ffi.Pointer<ffi.Float> log_probs,
+    ffi.Pointer<ffi.Int> n_tokens,
+  ) {
+    return _fllama_score(
+      request,
+      log_probs,
+      n_tokens,
+    );
+  }
+
+  late final _fllama_scorePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int Function(fllama_score_request, ffi.Pointer<ffi.Float>,
+              ffi.Pointer<ffi.Int>)>>('fllama_score');
+  late final _fllama_score = _fllama_scorePtr.asFunction<
+      int Function(fllama_score_request, ffi.Pointer<ffi.Float>,
+          ffi.Pointer<ffi.Int>)>();
+
+  void fllama_inference_continue(
+    int request_id,
+    int extra_max_tokens,
+    fllama_inference_callback callback,
+  ) {
+    return _fllama_inference_continue(
+      request_id,
+      extra_max_tokens,
+      callback,
+    );
+  }
+
+  late final _fllama_inference_continuePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Void Function(ffi.Int, ffi.Int,
+              fllama_inference_callback)>>('fllama_inference_continue');
+  late final _fllama_inference_continue = _fllama_inference_continuePtr
+      .asFunction<void Function(int, int, fllama_inference_callback)>();
+
+  void fllama_prefill_hint(
+    fllama_inference_request request,
+  ) {
+    return _fllama_prefill_hint(
+      request,
+    );
+  }
+
+  late final _fllama_prefill_hintPtr = _lookup<
+          ffi.NativeFunction<ffi.Void Function(fllama_inference_request)>>(
+      'fllama_prefill_hint');
+  late final _fllama_prefill_hint = _fllama_prefill_hintPtr
+      .asFunction<void Function(fllama_inference_request)>();
+
+  int fllama_trim_memory(
+    int level,
+  ) {
+    return _fllama_trim_memory(
+      level,
+    );
+  }
+
+  late final _fllama_trim_memoryPtr =
+      _lookup<ffi.NativeFunction<ffi.Int64 Function(ffi.Int)>>(
+          'fllama_trim_memory');
+  late final _fllama_trim_memory =
+      _fllama_trim_memoryPtr.asFunction<int Function(int)>();
+
+  void fllama_kv_tier_configure(
+    ffi.Pointer<ffi.Char> cache_dir,
+    int ram_budget_bytes,
+    int disk_budget_bytes,
+    int idle_seconds,
+  ) {
+    return _fllama_kv_tier_configure(
+      cache_dir,
+      ram_budget_bytes,
+      disk_budget_bytes,
+      idle_seconds,
+    );
+  }
+
+  late final _fllama_kv_tier_configurePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Void Function(ffi.Pointer<ffi.Char>, ffi.Int64, ffi.Int64,
+              ffi.Int)>>('fllama_kv_tier_configure');
+  late final _fllama_kv_tier_configure =
+      _fllama_kv_tier_configurePtr.asFunction<
+          void Function(ffi.Pointer<ffi.Char>, int, int, int)>();
+
   ffi.Pointer<ffi.Char> fllama_get_chat_template(
     ffi.Pointer<ffi.Char> fname,
   ) {
@@ -191,8 +314,11 @@ final class fllama_inference_request extends ffi.Struct {
   @ffi.Float()
   external double penalty_freq;
 
-  /// Optional: 0 <= penalty_repeat <= 1. Defaults to 1.0,
+  /// Optional: penalty_repeat >= 1. Defaults to 1.0,
   /// which means disabled. (llama.cpp behavior)
+  /// Both apply to the last 64 generated tokens, or
+  /// "repeat_last_n" in the OpenAI JSON, along with its
+  /// "presence_penalty".
   @ffi.Float()
   external double penalty_repeat;
 
@@ -223,6 +349,103 @@ typedef fllama_inference_callback = ffi.Pointer<
             ffi.Pointer<ffi.Char> openai_response_json_string,
             ffi.Uint8 done)>>;
 
+final class fllama_score_request extends ffi.Struct {
+  /// Used for cancellation, like inference requests.
+  @ffi.Int()
+  external int request_id;
+
+  /// Used if the model isn't cached yet.
+  @ffi.Int()
+  external int context_size;
+
+  /// Shares the cached model with inference.
+  external ffi.Pointer<ffi.Char> model_path;
+
+  /// Used if the model isn't cached yet.
+  @ffi.Int()
+  external int num_gpu_layers;
+
+  /// Decoded once, shared by all candidates.
+  external ffi.Pointer<ffi.Char> prompt;
+
+  /// Continuations of prompt to score, ex. " positive".
+  external ffi.Pointer<ffi.Pointer<ffi.Char>> candidates;
+
+  @ffi.Int()
+  external int n_candidates;
+}
+
+final class fllama_summarize_request extends ffi.Struct {
+  /// Used for cancellation, like inference requests.
+  @ffi.Int()
+  external int request_id;
+
+  /// Used if the model isn't cached yet.
+  @ffi.Int()
+  external int context_size;
+
+  /// Shares the cached model with inference.
+  external ffi.Pointer<ffi.Char> model_path;
+
+  /// Used if the model isn't cached yet.
+  @ffi.Int()
+  external int num_gpu_layers;
+
+  /// Text to summarize, any length.
+  external ffi.Pointer<ffi.Char> document;
+
+  /// Optional: what to focus on, ex. "decisions and action
+  /// items". NULL for a general summary.
+  external ffi.Pointer<ffi.Char> instructions;
+
+  /// Length of each summary: the parts' and the final one.
+  @ffi.Int()
+  external int max_tokens;
+
+  /// Optional: parts summarized at once. 0 for 4.
+  @ffi.Int()
+  external int n_parallel;
+
+  /// 0 samples greedily.
+  @ffi.Float()
+  external double temperature;
+}
+
+final class fllama_batch_request extends ffi.Struct {
+  /// Used for cancellation, like inference requests.
+  @ffi.Int()
+  external int request_id;
+
+  /// Used if the model isn't cached yet.
+  @ffi.Int()
+  external int context_size;
+
+  /// Shares the cached model with inference.
+  external ffi.Pointer<ffi.Char> model_path;
+
+  /// Used if the model isn't cached yet.
+  @ffi.Int()
+  external int num_gpu_layers;
+
+  /// JSONL, one OpenAI-style chat request per line.
+  external ffi.Pointer<ffi.Char> input_path;
+
+  /// JSONL results, appended to.
+  external ffi.Pointer<ffi.Char> output_path;
+
+  /// For requests without max_tokens.
+  @ffi.Int()
+  external int max_tokens;
+
+  /// Optional: sequences decoded together. 0 for 8.
+  @ffi.Int()
+  external int n_parallel;
+
+  /// For all requests. 0 samples greedily.
+  @ffi.Float()
+  external double temperature;
+}
+
 final class fllama_tokenize_request extends ffi.Struct {
   /// Required: input text
   external ffi.Pointer<ffi.Char> input;
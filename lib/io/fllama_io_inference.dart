@@ -52,6 +52,27 @@ class _IsolateInferenceCancel {
   const _IsolateInferenceCancel(this.id);
 }
 
+class _IsolateInferenceContinue {
+  final int id;
+  final int extraMaxTokens;
+
+  const _IsolateInferenceContinue(this.id, this.extraMaxTokens);
+}
+
+class _IsolateSummarizeRequest {
+  final int id;
+  final FllamaSummarizeRequest request;
+
+  const _IsolateSummarizeRequest(this.id, this.request);
+}
+
+class _IsolateBatchRequest {
+  final int id;
+  final FllamaBatchRequest request;
+
+  const _IsolateBatchRequest(this.id, this.request);
+}
+
 class _IsolateInferenceResponse {
   final int id;
   final String response;
@@ -187,6 +208,81 @@ void fllamaCancelInference(int requestId) async {
   helperIsolateSendPort.send(isolateCancel);
 }
 
+/// Resumes the inference with the given [requestId] after it stopped on
+/// `maxTokens` or was cancelled, generating up to [extraMaxTokens] more.
+///
+/// [callback] is called like it is for [fllamaInference], with the whole
+/// response, including the text generated before. Resuming soon after the
+/// inference stopped, before other requests run, doesn't process the prompt
+/// again. If the inference can't be continued, ex. it finished normally or
+/// stopped more than a few minutes ago, [callback] is called with `done` and
+/// an error message.
+Future<void> fllamaContinueInference(int requestId, int extraMaxTokens,
+    FllamaInferenceCallback callback) async {
+  final SendPort helperIsolateSendPort = await _helperIsolateSendPort;
+  _isolateInferenceCallbacks[requestId] = callback;
+  helperIsolateSendPort
+      .send(_IsolateInferenceContinue(requestId, extraMaxTokens));
+}
+
+/// Summarizes [request.document], which may be much longer than the model's
+/// context. The future returns immediately with an ID for
+/// [fllamaCancelInference].
+///
+/// The document is split into parts that fit, several parts are summarized
+/// at once, then their summaries are combined. While parts are summarized,
+/// [callback] gets an empty response and progress JSON, ex.
+/// `{"stage":"map","level":0,"parts":12,"parts_done":3}`. The final summary
+/// then streams like an inference response.
+Future<int> fllamaSummarize(
+    FllamaSummarizeRequest request, FllamaInferenceCallback callback) async {
+  final SendPort helperIsolateSendPort = await _helperIsolateSendPort;
+  final int requestId = _nextInferenceRequestId++;
+  _isolateInferenceCallbacks[requestId] = callback;
+  helperIsolateSendPort.send(_IsolateSummarizeRequest(requestId, request));
+  return requestId;
+}
+
+/// Runs every chat request in [request.inputPath] and appends the results to
+/// [request.outputPath]. The future returns immediately with an ID for
+/// [fllamaCancelInference]; finished results stay in the output, and running
+/// the same batch again resumes after them.
+///
+/// Requests are sorted by prompt length and decoded several at a time.
+/// After each one, [callback] gets an empty response and progress JSON, ex.
+/// `{"done":3,"total":40,"tokens_per_second":210.5}`. When done, it gets the
+/// totals, or an error response.
+Future<int> fllamaBatch(
+    FllamaBatchRequest request, FllamaInferenceCallback callback) async {
+  final SendPort helperIsolateSendPort = await _helperIsolateSendPort;
+  final int requestId = _nextInferenceRequestId++;
+  _isolateInferenceCallbacks[requestId] = callback;
+  helperIsolateSendPort.send(_IsolateBatchRequest(requestId, request));
+  return requestId;
+}
+
+/// Decodes [pointer], dropping trailing bytes that aren't valid UTF-8 yet,
+/// ex. the first bytes of a multi-byte character.
+String _decodeValidUtf8Prefix(Pointer<Char> pointer) {
+  final codeUnits = pointer.cast<Uint8>();
+
+  var length = 0;
+  while (codeUnits[length] != 0) {
+    length++;
+  }
+
+  while (length > 0) {
+    try {
+      return utf8.decode(codeUnits.asTypedList(length), allowMalformed: false);
+    } catch (e) {
+      // If an exception is caught, try with one less byte
+      length--;
+    }
+  }
+  // Decoding failed at every attempt.
+  return '';
+}
+
 void _fllamaInferenceIsolate(SendPort sendPort) async {
   final ReceivePort helperReceivePort = ReceivePort();
   helperReceivePort.listen((dynamic data) {
@@ -196,6 +292,107 @@ void _fllamaInferenceIsolate(SendPort sendPort) async {
         return;
       }
 
+      if (data is _IsolateSummarizeRequest) {
+        late final NativeCallable<NativeInferenceCallback> callback;
+        void onResponse(Pointer<Char> responsePointer,
+            Pointer<Char> openaiReponseJsonStringPointer, int done) {
+          sendPort.send(_IsolateInferenceResponse(
+            id: data.id,
+            response: _decodeValidUtf8Prefix(responsePointer),
+            openaiResponseJsonString:
+                _decodeValidUtf8Prefix(openaiReponseJsonStringPointer),
+            done: done == 1,
+          ));
+        }
+
+        callback = NativeCallable<NativeInferenceCallback>.listener(onResponse);
+        final request = data.request;
+        final nativeRequest = calloc<fllama_summarize_request>();
+        nativeRequest.ref.request_id = data.id;
+        nativeRequest.ref.context_size = request.contextSize;
+        nativeRequest.ref.model_path =
+            request.modelPath.toNativeUtf8().cast<Char>();
+        nativeRequest.ref.num_gpu_layers = request.numGpuLayers;
+        nativeRequest.ref.document =
+            request.document.toNativeUtf8().cast<Char>();
+        if (request.instructions != null) {
+          nativeRequest.ref.instructions =
+              request.instructions!.toNativeUtf8().cast<Char>();
+        }
+        nativeRequest.ref.max_tokens = request.maxTokens;
+        nativeRequest.ref.n_parallel = request.parallel;
+        nativeRequest.ref.temperature = request.temperature;
+        // Copied by the native side before it returns.
+        fllamaBindings.fllama_summarize(
+            nativeRequest.ref, callback.nativeFunction);
+        calloc.free(nativeRequest.ref.model_path);
+        calloc.free(nativeRequest.ref.document);
+        if (nativeRequest.ref.instructions != nullptr) {
+          calloc.free(nativeRequest.ref.instructions);
+        }
+        calloc.free(nativeRequest);
+        return;
+      }
+
+      if (data is _IsolateBatchRequest) {
+        late final NativeCallable<NativeInferenceCallback> callback;
+        void onResponse(Pointer<Char> responsePointer,
+            Pointer<Char> openaiReponseJsonStringPointer, int done) {
+          sendPort.send(_IsolateInferenceResponse(
+            id: data.id,
+            response: _decodeValidUtf8Prefix(responsePointer),
+            openaiResponseJsonString:
+                _decodeValidUtf8Prefix(openaiReponseJsonStringPointer),
+            done: done == 1,
+          ));
+        }
+
+        callback = NativeCallable<NativeInferenceCallback>.listener(onResponse);
+        final request = data.request;
+        final nativeRequest = calloc<fllama_batch_request>();
+        nativeRequest.ref.request_id = data.id;
+        nativeRequest.ref.context_size = request.contextSize;
+        nativeRequest.ref.model_path =
+            request.modelPath.toNativeUtf8().cast<Char>();
+        nativeRequest.ref.num_gpu_layers = request.numGpuLayers;
+        nativeRequest.ref.input_path =
+            request.inputPath.toNativeUtf8().cast<Char>();
+        nativeRequest.ref.output_path =
+            request.outputPath.toNativeUtf8().cast<Char>();
+        nativeRequest.ref.max_tokens = request.maxTokens;
+        nativeRequest.ref.n_parallel = request.parallel;
+        nativeRequest.ref.temperature = request.temperature;
+        // Copied by the native side before it returns.
+        fllamaBindings.fllama_batch(nativeRequest.ref, callback.nativeFunction);
+        calloc.free(nativeRequest.ref.model_path);
+        calloc.free(nativeRequest.ref.input_path);
+        calloc.free(nativeRequest.ref.output_path);
+        calloc.free(nativeRequest);
+        return;
+      }
+
+      if (data is _IsolateInferenceContinue) {
+        late final NativeCallable<NativeInferenceCallback> callback;
+        void onResponse(Pointer<Char> responsePointer,
+            Pointer<Char> openaiReponseJsonStringPointer, int done) {
+          sendPort.send(_IsolateInferenceResponse(
+            id: data.id,
+            response: _decodeValidUtf8Prefix(responsePointer),
+            openaiResponseJsonString:
+                _decodeValidUtf8Prefix(openaiReponseJsonStringPointer),
+            done: done == 1,
+          ));
+        }
+
+        callback = NativeCallable<NativeInferenceCallback>.listener(onResponse);
+        fllamaBindings.fllama_inference_continue(
+          data.id,
+          data.extraMaxTokens,
+          callback.nativeFunction,
+        );
+        return;
+      }
+
       // On the helper isolate listen to requests and respond to them.
       if (data is! _IsolateInferenceRequest) {
         throw UnsupportedError('Unsupported message type: ${data.runtimeType}');
@@ -206,63 +403,10 @@ void _fllamaInferenceIsolate(SendPort sendPort) async {
       late final NativeCallable<NativeInferenceCallback> callback;
       void onResponse(Pointer<Char> responsePointer,
           Pointer<Char> openaiReponseJsonStringPointer, int done) {
-        // This is responsePointer.cast<Utf8>().toDartString(), inlined, in
-        // order to allow only valid UTF-8.
-        var decodedString = '';
-
-        {
-          final codeUnits = responsePointer.cast<Uint8>();
-
-          var length = 0;
-          while (codeUnits[length] != 0) {
-            length++;
-          }
-
-          while (length > 0) {
-            try {
-              decodedString = utf8.decode(codeUnits.asTypedList(length),
-                  allowMalformed: false);
-              // if the decode succeeds, exit the loop
-              break;
-            } catch (e) {
-              // If an exception is caught, try with one less byte
-              length--;
-            }
-          }
-
-          // If length becomes zero, it means decoding failed at every attempt - use an empty string
-          if (length == 0) {
-            decodedString = '';
-          }
-        }
-
-        var decodedOpenaiResponseJsonString = '';
-
-        {
-          final codeUnits = openaiReponseJsonStringPointer.cast<Uint8>();
-
-          var length = 0;
-          while (codeUnits[length] != 0) {
-            length++;
-          }
-
-          while (length > 0) {
-            try {
-              decodedOpenaiResponseJsonString = utf8
-                  .decode(codeUnits.asTypedList(length), allowMalformed: false);
-              // if the decode succeeds, exit the loop
-              break;
-            } catch (e) {
-              // If an exception is caught, try with one less byte
-              length--;
-            }
-          }
-
-          // If length becomes zero, it means decoding failed at every attempt - use an empty string
-          if (length == 0) {
-            decodedOpenaiResponseJsonString = '';
-          }
-        }
+        // Only valid UTF-8, so partial characters don't reach the caller.
+        final decodedString = _decodeValidUtf8Prefix(responsePointer);
+        final decodedOpenaiResponseJsonString =
+            _decodeValidUtf8Prefix(openaiReponseJsonStringPointer);
 
         final _IsolateInferenceResponse response = _IsolateInferenceResponse(
           id: data.id,
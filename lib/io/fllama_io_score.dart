@@ -0,0 +1,131 @@
+import 'dart:async';
+import 'dart:ffi';
+import 'dart:isolate';
+
+import 'package:ffi/ffi.dart';
+import 'package:fllama/fllama_io.dart';
+import 'package:fllama/fllama_universal.dart';
+import 'package:fllama/io/fllama_bindings_generated.dart';
+
+class _IsolateScoreRequest {
+  final int id;
+  final FllamaScoreRequest request;
+
+  _IsolateScoreRequest(this.id, this.request);
+}
+
+class _IsolateScoreResponse {
+  final int id;
+  final List<FllamaCandidateScore>? scores;
+
+  _IsolateScoreResponse(this.id, this.scores);
+}
+
+int _nextScoreRequestId = 0;
+final Map<int, Completer<List<FllamaCandidateScore>>> _isolateScoreRequests =
+    <int, Completer<List<FllamaCandidateScore>>>{};
+
+// fllama_score blocks until the inference queue gets to it, so it runs on its
+// own isolate.
+Future<SendPort> _helperScoreIsolateSendPort = (() async {
+  final completer = Completer<SendPort>();
+  final receivePort = ReceivePort();
+
+  await Isolate.spawn(_fllamaScoreIsolate, receivePort.sendPort);
+
+  receivePort.listen((dynamic data) {
+    if (data is SendPort) {
+      completer.complete(data);
+    } else if (data is _IsolateScoreResponse) {
+      final requestCompleter = _isolateScoreRequests.remove(data.id);
+      if (requestCompleter == null) {
+        // ignore: avoid_print
+        print(
+            '[fllama] fllama_io_score ERROR: No completer found for request ID: ${data.id}');
+        return;
+      }
+      final scores = data.scores;
+      if (scores == null) {
+        requestCompleter.completeError(
+            StateError('fllama_score failed, see the log for details.'));
+      } else {
+        requestCompleter.complete(scores);
+      }
+    } else {
+      // ignore: avoid_print
+      print(
+          '[fllama] fllama_io_score ERROR: Unexpected data from isolate: $data');
+    }
+  });
+
+  return completer.future;
+}());
+
+/// Scores how likely each of [request.candidates] is to follow
+/// [request.prompt], in the order given.
+///
+/// Useful for classification and reranking without generating text: the
+/// prompt is processed once, and all the candidates together cost about one
+/// forward pass. Runs on the inference queue, after requests queued before it.
+/// Throws if the model can't be loaded or the candidates don't fit in its
+/// context.
+Future<List<FllamaCandidateScore>> fllamaScore(
+    FllamaScoreRequest request) async {
+  final SendPort helperIsolateSendPort = await _helperScoreIsolateSendPort;
+  final requestId = _nextScoreRequestId++;
+  final completer = Completer<List<FllamaCandidateScore>>();
+  _isolateScoreRequests[requestId] = completer;
+  helperIsolateSendPort.send(_IsolateScoreRequest(requestId, request));
+  return completer.future;
+}
+
+void _fllamaScoreIsolate(SendPort mainIsolateSendPort) {
+  final helperReceivePort = ReceivePort();
+  mainIsolateSendPort.send(helperReceivePort.sendPort);
+
+  helperReceivePort.listen((dynamic data) {
+    if (data is! _IsolateScoreRequest) {
+      return;
+    }
+    final request = data.request;
+    final int n = request.candidates.length;
+    final nativeRequest = calloc<fllama_score_request>();
+    final candidates = calloc<Pointer<Char>>(n == 0 ? 1 : n);
+    final logProbs = calloc<Float>(n == 0 ? 1 : n);
+    final nTokens = calloc<Int>(n == 0 ? 1 : n);
+    // Inference request ids count up from 0; stay clear of them.
+    nativeRequest.ref.request_id = -1 - data.id;
+    nativeRequest.ref.context_size = request.contextSize;
+    nativeRequest.ref.model_path = request.modelPath.toNativeUtf8().cast<Char>();
+    nativeRequest.ref.num_gpu_layers = request.numGpuLayers;
+    nativeRequest.ref.prompt = request.prompt.toNativeUtf8().cast<Char>();
+    for (var i = 0; i < n; i++) {
+      candidates[i] = request.candidates[i].toNativeUtf8().cast<Char>();
+    }
+    nativeRequest.ref.candidates = candidates;
+    nativeRequest.ref.n_candidates = n;
+
+    final result =
+        fllamaBindings.fllama_score(nativeRequest.ref, logProbs, nTokens);
+    final List<FllamaCandidateScore>? scores = result != 0
+        ? null
+        : List<FllamaCandidateScore>.generate(
+            n,
+            (i) => FllamaCandidateScore(
+              candidate: request.candidates[i],
+              logProb: logProbs[i],
+              tokenCount: nTokens[i],
+            ));
+    mainIsolateSendPort.send(_IsolateScoreResponse(data.id, scores));
+
+    for (var i = 0; i < n; i++) {
+      calloc.free(candidates[i]);
+    }
+    calloc.free(candidates);
+    calloc.free(nativeRequest.ref.model_path);
+    calloc.free(nativeRequest.ref.prompt);
+    calloc.free(nativeRequest);
+    calloc.free(logProbs);
+    calloc.free(nTokens);
+  });
+}
@@ -63,6 +63,7 @@ class OpenAiRequest {
   final double topP;
   final double frequencyPenalty;
   final double presencePenalty;
+  final double additivePresencePenalty;
   // Not in OpenAI, but used by llama.
   final String modelPath;
   final String? mmprojPath;
@@ -71,6 +72,9 @@ class OpenAiRequest {
   final String? jinjaTemplate;
   final Function(String)? logger;
   final ToolChoice? toolChoice;
+  final int? reasoningBudget;
+  final bool lookahead;
+  final bool trimHistory;
 
   String toJsonString() {
     final Map<String, dynamic> json = {
@@ -101,9 +105,16 @@ class OpenAiRequest {
       'max_tokens': maxTokens,
       'top_p': topP,
       'frequency_penalty': frequencyPenalty,
-      'presence_penalty': presencePenalty,
+      // presencePenalty is llama.cpp's multiplicative repeat penalty, sent
+      // natively as penalty_repeat; this is informational.
+      'repeat_penalty': presencePenalty,
+      if (additivePresencePenalty != 0.0)
+        'presence_penalty': additivePresencePenalty,
       if (toolChoice != null) 'tool_choice': toolChoice?.jsonName,
       if (jinjaTemplate != null) 'jinja_template': jinjaTemplate,
+      if (reasoningBudget != null) 'reasoning_budget': reasoningBudget,
+      if (lookahead) 'lookahead': true,
+      if (trimHistory) 'trim_history': true,
     };
     return jsonEncode(json);
   }
@@ -122,8 +133,12 @@ class OpenAiRequest {
     // 0.05 means only the top 5% of tokens are considered.
     this.topP = 1.0,
     this.frequencyPenalty = 0.0,
-    // Match default penalty_repeat of 1.1 in llama.cpp.
+    // Despite the name, llama.cpp's repeat penalty: logits of recent tokens
+    // are divided by it. Match default penalty_repeat of 1.1 in llama.cpp.
     this.presencePenalty = 1.1,
+    // OpenAI's presence_penalty: subtracted once from the logits of every
+    // token that appeared recently. 0.0 means disabled.
+    this.additivePresencePenalty = 0.0,
     //
     // Following arguments aren't actually in OpenAI, but are used by Fllama.
     //
@@ -142,5 +157,16 @@ class OpenAiRequest {
     // Optional logger.
     this.logger,
     this.jinjaTemplate,
+    // Max tokens a reasoning model spends inside <think> before it is made to
+    // answer. null means no limit, 0 skips reasoning when the template allows.
+    this.reasoningBudget,
+    // Lookahead decoding: guesses several tokens per decode and keeps the
+    // ones the model agrees with. Same output, fewer decodes; worth it when
+    // decoding is bound by memory bandwidth rather than compute.
+    this.lookahead = false,
+    // When the messages don't fit in [contextSize] with room for [maxTokens],
+    // drop the oldest turns natively instead of failing. System messages and
+    // the last user message are kept.
+    this.trimHistory = false,
   });
 }
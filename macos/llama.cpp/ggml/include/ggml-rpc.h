@@ -28,6 +28,18 @@ GGML_BACKEND_API ggml_backend_reg_t ggml_backend_rpc_reg(void);
 
 GGML_BACKEND_API ggml_backend_dev_t ggml_backend_rpc_add_device(const char * endpoint);
 
+// client-side counters for an endpoint, accumulated over all connections since the last reset
+struct ggml_backend_rpc_stats {
+    uint64_t n_cmds;             // commands sent
+    uint64_t bytes_sent;
+    uint64_t bytes_recv;
+    uint64_t n_graph_compute;    // graph splits computed on the server
+    int64_t  t_graph_compute_us; // round-trip time of those computes, including transfer
+};
+
+GGML_BACKEND_API void ggml_backend_rpc_get_stats(const char * endpoint, struct ggml_backend_rpc_stats * stats);
+GGML_BACKEND_API void ggml_backend_rpc_reset_stats(const char * endpoint);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -361,12 +361,82 @@ struct node_alloc {
     struct tensor_alloc src[GGML_MAX_SRC];
 };
 
+#define GGML_GALLOCR_ARENA_MAX_BUFTS 16
+
+struct ggml_gallocr_arena {
+    ggml_backend_buffer_type_t bufts[GGML_GALLOCR_ARENA_MAX_BUFTS];
+    ggml_backend_buffer_t buffers[GGML_GALLOCR_ARENA_MAX_BUFTS];
+    int n_bufts;
+};
+
+ggml_gallocr_arena_t ggml_gallocr_arena_new(void) {
+    ggml_gallocr_arena_t arena = (ggml_gallocr_arena_t)calloc(1, sizeof(struct ggml_gallocr_arena));
+    GGML_ASSERT(arena != NULL);
+    return arena;
+}
+
+void ggml_gallocr_arena_reset(ggml_gallocr_arena_t arena) {
+    for (int i = 0; i < arena->n_bufts; i++) {
+        ggml_backend_buffer_free(arena->buffers[i]);
+        arena->buffers[i] = NULL;
+    }
+}
+
+void ggml_gallocr_arena_free(ggml_gallocr_arena_t arena) {
+    if (arena == NULL) {
+        return;
+    }
+    ggml_gallocr_arena_reset(arena);
+    free(arena);
+}
+
+size_t ggml_gallocr_arena_get_size(ggml_gallocr_arena_t arena) {
+    size_t size = 0;
+    for (int i = 0; i < arena->n_bufts; i++) {
+        if (arena->buffers[i] != NULL) {
+            size += ggml_backend_buffer_get_size(arena->buffers[i]);
+        }
+    }
+    return size;
+}
+
+// the arena's buffer of the given type, grown to at least size bytes
+static ggml_backend_buffer_t ggml_gallocr_arena_get(ggml_gallocr_arena_t arena, ggml_backend_buffer_type_t buft, size_t size) {
+    int id = 0;
+    while (id < arena->n_bufts && arena->bufts[id] != buft) {
+        id++;
+    }
+    if (id == arena->n_bufts) {
+        GGML_ASSERT(arena->n_bufts < GGML_GALLOCR_ARENA_MAX_BUFTS);
+        arena->bufts[id] = buft;
+        arena->buffers[id] = NULL;
+        arena->n_bufts++;
+    }
+
+    size_t cur_size = arena->buffers[id] ? ggml_backend_buffer_get_size(arena->buffers[id]) : 0;
+    if (size > cur_size || arena->buffers[id] == NULL) {
+#ifndef NDEBUG
+        GGML_LOG_DEBUG("%s: reallocating shared %s buffer from size %.02f MiB to %.02f MiB\n", __func__, ggml_backend_buft_name(buft), cur_size / 1024.0 / 1024.0, size / 1024.0 / 1024.0);
+#endif
+        ggml_backend_buffer_free(arena->buffers[id]);
+        arena->buffers[id] = ggml_backend_buft_alloc_buffer(buft, size);
+        if (arena->buffers[id] == NULL) {
+            GGML_LOG_ERROR("%s: failed to allocate shared %s buffer of size %zu\n", __func__, ggml_backend_buft_name(buft), size);
+            return NULL;
+        }
+        ggml_backend_buffer_set_usage(arena->buffers[id], GGML_BACKEND_BUFFER_USAGE_COMPUTE);
+    }
+    return arena->buffers[id];
+}
+
 struct ggml_gallocr {
     ggml_backend_buffer_type_t * bufts; // [n_buffers]
-    ggml_backend_buffer_t * buffers; // [n_buffers]
+    ggml_backend_buffer_t * buffers; // [n_buffers], borrowed from the arena if there is one
     struct ggml_dyn_tallocr ** buf_tallocs; // [n_buffers]
     int n_buffers;
 
+    ggml_gallocr_arena_t arena;
+
     struct ggml_hash_set hash_set;
     struct hash_node * hash_values; // [hash_set.size]
 
@@ -422,7 +492,7 @@ void ggml_gallocr_free(ggml_gallocr_t galloc) {
     }
 
     for (int i = 0; i < galloc->n_buffers; i++) {
-        if (galloc->buffers != NULL) {
+        if (galloc->buffers != NULL && galloc->arena == NULL) {
             // skip if already freed
             bool freed = false;
             for (int j = 0; j < i; j++) {
@@ -670,6 +740,39 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
     }
 }
 
+void ggml_gallocr_set_arena(ggml_gallocr_t galloc, ggml_gallocr_arena_t arena) {
+    GGML_ASSERT(galloc->arena == NULL);
+    for (int i = 0; i < galloc->n_buffers; i++) {
+        bool freed = false;
+        for (int j = 0; j < i; j++) {
+            if (galloc->buffers[j] == galloc->buffers[i]) {
+                freed = true;
+                break;
+            }
+        }
+        if (!freed) {
+            ggml_backend_buffer_free(galloc->buffers[i]);
+        }
+    }
+    for (int i = 0; i < galloc->n_buffers; i++) {
+        galloc->buffers[i] = NULL;
+    }
+    galloc->arena = arena;
+}
+
+// points the buffers at the arena's, which another allocator may have replaced or the arena's owner freed since they
+// were last used, growing them to this allocator's needs
+static bool ggml_gallocr_borrow_arena(ggml_gallocr_t galloc) {
+    for (int i = 0; i < galloc->n_buffers; i++) {
+        size_t size = ggml_dyn_tallocr_max_size(galloc->buf_tallocs[i]);
+        galloc->buffers[i] = ggml_gallocr_arena_get(galloc->arena, galloc->bufts[i], size);
+        if (galloc->buffers[i] == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, const int * node_buffer_ids, const int * leaf_buffer_ids) {
     size_t min_hash_size = graph->n_nodes + graph->n_leafs;
     // add 25% margin to avoid hash collisions
@@ -748,6 +851,10 @@ bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, c
         }
     }
 
+    if (galloc->arena != NULL) {
+        return ggml_gallocr_borrow_arena(galloc);
+    }
+
     // reallocate buffers if needed
     for (int i = 0; i < galloc->n_buffers; i++) {
         // if the buffer type is used multiple times, we reuse the same buffer
@@ -882,6 +989,10 @@ bool ggml_gallocr_alloc_graph(ggml_gallocr_t galloc, struct ggml_cgraph * graph)
         }
     }
 
+    if (galloc->arena != NULL && !ggml_gallocr_borrow_arena(galloc)) {
+        return false;
+    }
+
     // reset buffers
     for (int i = 0; i < galloc->n_buffers; i++) {
         if (galloc->buffers[i] != NULL) {
@@ -916,6 +1027,16 @@ bool ggml_gallocr_alloc_graph(ggml_gallocr_t galloc, struct ggml_cgraph * graph)
 size_t ggml_gallocr_get_buffer_size(ggml_gallocr_t galloc, int buffer_id) {
     GGML_ASSERT(buffer_id >= 0 && buffer_id < galloc->n_buffers);
 
+    if (galloc->arena != NULL) {
+        // what this allocator needs of the shared buffer
+        for (int i = 0; i < buffer_id; i++) {
+            if (galloc->buf_tallocs[i] == galloc->buf_tallocs[buffer_id]) {
+                return 0;
+            }
+        }
+        return ggml_dyn_tallocr_max_size(galloc->buf_tallocs[buffer_id]);
+    }
+
     if (galloc->buffers[buffer_id] == NULL) {
         return 0;
     }
@@ -83,6 +83,8 @@ void ggml_compute_forward_flash_attn_ext(
     const struct ggml_tensor * v,
     const struct ggml_tensor * mask,
     struct ggml_tensor * dst);
+// number of chunks ggml_compute_forward_flash_attn_ext splits the KV sequence of each row into
+int ggml_flash_attn_ext_n_kv_chunks(const struct ggml_tensor * dst, int nth);
 void ggml_compute_forward_flash_attn_back(
         const struct ggml_compute_params * params,
         const bool masked,
@@ -280,6 +280,11 @@ llama_context::llama_context(
 
         sched.reset(ggml_backend_sched_new(backend_ptrs.data(), backend_buft.data(), backend_ptrs.size(), max_nodes, pipeline_parallel));
 
+        if (params.compute_arena) {
+            compute_arena = params.compute_arena;
+            ggml_backend_sched_set_arena(sched.get(), compute_arena->arena);
+        }
+
         if (pipeline_parallel) {
             LLAMA_LOG_INFO("%s: pipeline parallelism enabled (n_copies=%d)\n", __func__, ggml_backend_sched_get_n_copies(sched.get()));
         }
@@ -287,6 +292,9 @@ llama_context::llama_context(
 
     // reserve worst-case graph
     if (!hparams.vocab_only) {
+        // reserving can replace the arena's buffers under another context's graph
+        auto arena_lock = lock_compute_arena();
+
         const uint32_t n_seqs = 1; // TODO: worst-case number of sequences
         const uint32_t n_tokens = std::min(cparams.n_ctx, cparams.n_ubatch);
 
@@ -371,9 +379,10 @@ llama_context::llama_context(
             ggml_backend_buffer_type_t buft    = backend_buft[i];
             size_t size = ggml_backend_sched_get_buffer_size(sched.get(), backend);
             if (size > 1) {
-                LLAMA_LOG_INFO("%s: %10s compute buffer size = %8.2f MiB\n", __func__,
+                LLAMA_LOG_INFO("%s: %10s compute buffer size = %8.2f MiB%s\n", __func__,
                         ggml_backend_buft_name(buft),
-                        size / 1024.0 / 1024.0);
+                        size / 1024.0 / 1024.0,
+                        compute_arena ? " (shared)" : "");
             }
         }
 
@@ -393,6 +402,13 @@ llama_context::llama_context(
 
 llama_context::~llama_context() = default;
 
+std::unique_lock<std::mutex> llama_context::lock_compute_arena() {
+    if (!compute_arena) {
+        return {};
+    }
+    return std::unique_lock<std::mutex>(compute_arena->mutex);
+}
+
 void llama_context::synchronize() {
     ggml_backend_sched_synchronize(sched.get());
 
@@ -730,6 +746,9 @@ llm_graph_result_ptr llama_context::build_kv_self_defrag(
 void llama_context::kv_self_update() {
     auto & kv = kv_self;
 
+    // reserving below may reallocate the compute buffers
+    llama_hugepages_scope hugepages(model.params.use_hugepages);
+
     bool need_reserve = false;
 
     if (kv->has_shift) {
@@ -1011,6 +1030,9 @@ bool llama_context::apply_adapter_cvec(
 }
 
 int llama_context::encode(llama_batch & inp_batch) {
+    // the graph may outgrow the reserved compute buffers
+    llama_hugepages_scope hugepages(model.params.use_hugepages);
+
     if (inp_batch.n_tokens == 0) {
         LLAMA_LOG_ERROR("%s: n_tokens == 0\n", __func__);
         return -1;
@@ -1176,6 +1198,9 @@ int llama_context::encode(llama_batch & inp_batch) {
 }
 
 int llama_context::decode(llama_batch & inp_batch) {
+    // the graph may outgrow the reserved compute buffers
+    llama_hugepages_scope hugepages(model.params.use_hugepages);
+
     if (inp_batch.n_tokens == 0) {
         LLAMA_LOG_ERROR("%s: n_tokens == 0\n", __func__);
         return -1;
@@ -2237,6 +2262,7 @@ llama_context_params llama_context_default_params() {
         /*.no_perf                     =*/ true,
         /*.abort_callback              =*/ nullptr,
         /*.abort_callback_data         =*/ nullptr,
+        /*.compute_arena               =*/ nullptr,
     };
 
     return result;
@@ -2271,6 +2297,9 @@ llama_context * llama_init_from_model(
     }
 
     try {
+        // the KV cache and compute buffers follow the model
+        llama_hugepages_scope hugepages(model->params.use_hugepages);
+
         auto * ctx = new llama_context(*model, params);
         return ctx;
     } catch (const std::exception & err) {
@@ -2291,6 +2320,30 @@ void llama_free(llama_context * ctx) {
     delete ctx;
 }
 
+llama_compute_arena * llama_compute_arena_init(void) {
+    auto * arena = new llama_compute_arena;
+    arena->arena = ggml_gallocr_arena_new();
+    return arena;
+}
+
+void llama_compute_arena_free(llama_compute_arena * arena) {
+    if (arena == nullptr) {
+        return;
+    }
+    ggml_gallocr_arena_free(arena->arena);
+    delete arena;
+}
+
+size_t llama_compute_arena_size(llama_compute_arena * arena) {
+    std::lock_guard<std::mutex> lock(arena->mutex);
+    return ggml_gallocr_arena_get_size(arena->arena);
+}
+
+void llama_compute_arena_trim(llama_compute_arena * arena) {
+    std::lock_guard<std::mutex> lock(arena->mutex);
+    ggml_gallocr_arena_reset(arena->arena);
+}
+
 uint32_t llama_n_ctx(const llama_context * ctx) {
     return ctx->n_ctx();
 }
@@ -2316,7 +2369,11 @@ llama_kv_cache * llama_get_kv_self(llama_context * ctx) {
 }
 
 void llama_kv_self_update(llama_context * ctx) {
+    auto arena_lock = ctx->lock_compute_arena();
     ctx->kv_self_update();
+    if (arena_lock) {
+        ctx->synchronize();
+    }
 }
 
 enum llama_pooling_type llama_pooling_type(const llama_context * ctx) {
@@ -2501,6 +2558,15 @@ void llama_kv_self_clear(llama_context * ctx) {
     kv->clear();
 }
 
+void llama_kv_self_release(llama_context * ctx) {
+    auto * kv = ctx->get_kv_self();
+    if (!kv) {
+        return;
+    }
+
+    kv->release();
+}
+
 // deprecated
 bool llama_kv_cache_seq_rm(
         llama_context * ctx,
@@ -2769,7 +2835,11 @@ size_t llama_state_seq_load_file(llama_context * ctx, const char * filepath, lla
 int32_t llama_encode(
         llama_context * ctx,
           llama_batch   batch) {
+    auto arena_lock = ctx->lock_compute_arena();
     const int ret = ctx->encode(batch);
+    if (arena_lock) {
+        ctx->synchronize();
+    }
     if (ret != 0) {
         LLAMA_LOG_ERROR("%s: failed to encode, ret = %d\n", __func__, ret);
     }
@@ -2780,7 +2850,11 @@ int32_t llama_encode(
 int32_t llama_decode(
         llama_context * ctx,
           llama_batch   batch) {
+    auto arena_lock = ctx->lock_compute_arena();
     const int ret = ctx->decode(batch);
+    if (arena_lock) {
+        ctx->synchronize();
+    }
     if (ret != 0) {
         LLAMA_LOG_ERROR("%s: failed to decode, ret = %d\n", __func__, ret);
     }
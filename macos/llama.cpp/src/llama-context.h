@@ -9,6 +9,7 @@
 #include "ggml-cpp.h"
 
 #include <map>
+#include <mutex>
 #include <vector>
 
 struct llama_model;
@@ -17,6 +18,13 @@ struct llama_kv_cache;
 class llama_io_read_i;
 class llama_io_write_i;
 
+struct llama_compute_arena {
+    ggml_gallocr_arena_t arena;
+
+    // held while a context's graphs use the arena's buffers
+    std::mutex mutex;
+};
+
 struct llama_context {
     // init scheduler and compute buffers, reserve worst-case graphs
     llama_context(
@@ -27,6 +35,10 @@ struct llama_context {
 
     void synchronize();
 
+    // locks the compute arena, if the context has one, until the returned lock is released
+    // synchronize before releasing it: results are read from the arena's buffers
+    std::unique_lock<std::mutex> lock_compute_arena();
+
     const llama_model & get_model() const;
 
     uint32_t n_ctx()         const;
@@ -225,6 +237,8 @@ private:
 
     ggml_backend_sched_ptr sched;
 
+    llama_compute_arena * compute_arena = nullptr;
+
     ggml_backend_t backend_cpu = nullptr;
     std::vector<ggml_backend_ptr> backends;
 
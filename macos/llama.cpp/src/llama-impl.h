@@ -2,6 +2,7 @@
 
 #include "ggml.h" // for ggml_log_level
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -49,6 +50,14 @@ struct time_meas {
     int64_t & t_acc;
 };
 
+// sets ggml_backend_cpu_buffer_set_hugepages for the calling thread and restores the previous value when it goes out of scope
+struct llama_hugepages_scope {
+    explicit llama_hugepages_scope(bool enable);
+    ~llama_hugepages_scope();
+
+    const bool prev;
+};
+
 void replace_all(std::string & s, const std::string & search, const std::string & replace);
 
 // TODO: rename to llama_format ?
@@ -58,4 +67,5 @@ std::string format(const char * fmt, ...);
 std::string llama_format_tensor_shape(const std::vector<int64_t> & ne);
 std::string llama_format_tensor_shape(const struct ggml_tensor * t);
 
-std::string gguf_kv_to_str(const struct gguf_context * ctx_gguf, int i);
+// arrays stop after the element that takes them past max_len characters
+std::string gguf_kv_to_str(const struct gguf_context * ctx_gguf, int i, size_t max_len = SIZE_MAX);
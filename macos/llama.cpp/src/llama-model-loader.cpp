@@ -6,6 +6,7 @@
 #include <cinttypes>
 #include <cstring>
 #include <future>
+#include <thread>
 
 static const size_t kiB = 1024;
 static const size_t MiB = 1024*kiB;
@@ -661,8 +662,8 @@ llama_model_loader::llama_model_loader(
                 ? format("%s[%s,%zu]", gguf_type_name(type), gguf_type_name(gguf_get_arr_type(meta.get(), i)), gguf_get_arr_n(meta.get(), i))
                 : gguf_type_name(type);
 
-            std::string value          = gguf_kv_to_str(meta.get(), i);
             const size_t MAX_VALUE_LEN = 40;
+            std::string value          = gguf_kv_to_str(meta.get(), i, MAX_VALUE_LEN);
             if (value.size() > MAX_VALUE_LEN) {
                 value = format("%s...", value.substr(0, MAX_VALUE_LEN - 3).c_str());
             }
@@ -817,14 +818,14 @@ void llama_model_loader::done_getting_tensors() const {
     }
 }
 
-void llama_model_loader::init_mappings(bool prefetch, llama_mlocks * mlock_mmaps) {
+void llama_model_loader::init_mappings(bool prefetch, llama_mlocks * mlock_mmaps, bool hugepages) {
     if (use_mmap) {
         mappings.reserve(files.size());
         mmaps_used.reserve(files.size());
         for (const auto & file : files) {
             auto * reg = ggml_backend_dev_backend_reg(ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU));
             auto * is_numa_fn = (decltype(ggml_is_numa) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_is_numa");
-            std::unique_ptr<llama_mmap> mapping = std::make_unique<llama_mmap>(file.get(), prefetch ? -1 : 0, is_numa_fn());
+            std::unique_ptr<llama_mmap> mapping = std::make_unique<llama_mmap>(file.get(), prefetch ? -1 : 0, is_numa_fn(), hugepages);
             mmaps_used.emplace_back(mapping->size(), 0);
             if (mlock_mmaps) {
                 std::unique_ptr<llama_mlock> mlock_mmap(new llama_mlock());
@@ -981,7 +982,14 @@ bool llama_model_loader::load_all_data(
             ggml_backend_name(upload_backend));
     }
 
-    for (struct ggml_tensor * cur = ggml_get_first_tensor(ctx); cur != NULL; cur = ggml_get_next_tensor(ctx, cur)) {
+    const bool use_parallel_reads = !use_mmap && !upload_backend && llama_file_reader::SUPPORTED;
+    if (use_parallel_reads) {
+        if (!load_all_data_parallel(ctx, validation_result, progress_callback, progress_callback_user_data)) {
+            return false;
+        }
+    }
+
+    for (struct ggml_tensor * cur = ggml_get_first_tensor(ctx); cur != NULL && !use_parallel_reads; cur = ggml_get_next_tensor(ctx, cur)) {
         const auto * weight = get_weight(ggml_get_name(cur));
         if (weight == nullptr) {
             // this can happen with split experts models
@@ -1114,6 +1122,111 @@ bool llama_model_loader::load_all_data(
     return true;
 }
 
+bool llama_model_loader::load_all_data_parallel(
+        struct ggml_context * ctx,
+        std::vector<std::future<std::pair<ggml_tensor *, bool>>> & validation_result,
+        llama_progress_callback progress_callback,
+        void * progress_callback_user_data) {
+    // tensors in non-host buffers (e.g. CPU repack) are read into a staging buffer first
+    // cap the staging memory so that large models do not need a second copy of the weights in RAM
+    constexpr size_t max_staged_size = 256u * 1024 * 1024;
+
+    struct pending_read {
+        ggml_tensor * cur;
+        std::vector<no_init<uint8_t>> staging; // empty when reading directly into a host buffer
+    };
+
+    // declared before the reader so that the buffers outlive any read still in flight on early return
+    std::vector<pending_read> reads;
+    std::vector<size_t> done;
+    size_t size_staged = 0;
+    size_t size_read   = 0;
+
+    const size_t n_threads = std::min<size_t>(8, std::max<size_t>(1, std::thread::hardware_concurrency()));
+    llama_file_reader reader(n_threads);
+
+    const int64_t t_start_us = ggml_time_us();
+
+    auto complete = [&](size_t idx) {
+        auto & r = reads[idx];
+        const size_t n_size = ggml_nbytes(r.cur);
+        if (r.staging.empty()) {
+            if (check_tensors) {
+                ggml_tensor * cur = r.cur;
+                validation_result.emplace_back(std::async(std::launch::async, [cur, n_size] {
+                    return std::make_pair(cur, ggml_validate_row_data(cur->type, cur->data, n_size));
+                }));
+            }
+        } else {
+            ggml_backend_tensor_set(r.cur, r.staging.data(), 0, n_size);
+            if (check_tensors && !ggml_validate_row_data(r.cur->type, r.staging.data(), n_size)) {
+                throw std::runtime_error(format("tensor '%s' has invalid data", ggml_get_name(r.cur)));
+            }
+            size_staged -= n_size;
+            std::vector<no_init<uint8_t>>().swap(r.staging);
+        }
+        size_done += n_size;
+        size_read += n_size;
+    };
+
+    auto wait_some = [&]() {
+        done.clear();
+        if (!reader.wait(done)) {
+            return false;
+        }
+        for (size_t idx : done) {
+            complete(idx);
+        }
+        return true;
+    };
+
+    for (struct ggml_tensor * cur = ggml_get_first_tensor(ctx); cur != NULL; cur = ggml_get_next_tensor(ctx, cur)) {
+        const auto * weight = get_weight(ggml_get_name(cur));
+        if (weight == nullptr) {
+            // this can happen with split experts models
+            continue;
+        }
+
+        if (progress_callback) {
+            if (!progress_callback((float) size_done / size_data, progress_callback_user_data)) {
+                return false;
+            }
+        }
+
+        const size_t n_size = ggml_nbytes(cur);
+        const auto & file = files.at(weight->idx);
+
+        if (ggml_backend_buffer_is_host(cur->buffer)) {
+            reader.submit(file.get(), weight->offs, cur->data, n_size, reads.size());
+            reads.push_back({ cur, {} });
+        } else {
+            while (size_staged > 0 && size_staged + n_size > max_staged_size && wait_some()) {
+            }
+            pending_read r = { cur, {} };
+            r.staging.resize(n_size);
+            size_staged += n_size;
+            // the staging vector is moved, not copied, so its data pointer stays valid
+            reader.submit(file.get(), weight->offs, r.staging.data(), n_size, reads.size());
+            reads.push_back(std::move(r));
+        }
+    }
+
+    while (wait_some()) {
+        if (progress_callback) {
+            if (!progress_callback((float) size_done / size_data, progress_callback_user_data)) {
+                return false;
+            }
+        }
+    }
+
+    const double t_load_s = (ggml_time_us() - t_start_us) / 1e6;
+    LLAMA_LOG_INFO("%s: read %.2f MiB in %.2f s (%.2f GiB/s, %s, %zu threads)\n", __func__,
+        size_read / 1024.0 / 1024.0, t_load_s, t_load_s > 0 ? size_read / 1024.0 / 1024.0 / 1024.0 / t_load_s : 0.0,
+        reader.name(), n_threads);
+
+    return true;
+}
+
 std::string llama_model_loader::ftype_name() const {
     return llama_model_ftype_name(ftype);
 }
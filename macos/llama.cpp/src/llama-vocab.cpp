@@ -6,6 +6,7 @@
 #include "unicode.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cfloat>
 #include <climits>
@@ -13,8 +14,10 @@
 #include <cstring>
 #include <forward_list>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
+#include <string_view>
 #include <unordered_map>
 #include <cctype>
 
@@ -65,6 +68,140 @@ struct naive_trie {
     llama_token value;
 };
 
+// Token text -> id, by open addressing over the texts of the tokens it maps:
+// it holds no text of its own, so the whole table is one allocation instead
+// of a node and a copy of the text per token.
+struct llama_token_text_map {
+    struct slot {
+        uint32_t    hash = 0;
+        llama_token id   = LLAMA_TOKEN_NULL;
+    };
+
+    // Room for n tokens of texts.
+    void init(const std::vector<llama_vocab::token_data> & texts, size_t n) {
+        tokens = &texts;
+        size_t capacity = 16;
+        while (capacity < 2*n) {
+            capacity *= 2;
+        }
+        slots.assign(capacity, slot());
+        n_used = 0;
+    }
+
+    // Maps the text of token id to it, replacing a token with the same text.
+    void insert(llama_token id) {
+        GGML_ASSERT(2*(n_used + 1) <= slots.size());
+        const std::string & text = (*tokens)[id].text;
+        const uint64_t hash = hash_text(text);
+        slot & s = slots[probe(text, hash)];
+        if (s.id == LLAMA_TOKEN_NULL) {
+            n_used++;
+        }
+        s.hash = (uint32_t) (hash >> 32);
+        s.id   = id;
+    }
+
+    // LLAMA_TOKEN_NULL if text isn't a token.
+    llama_token find(std::string_view text) const {
+        if (slots.empty()) {
+            return LLAMA_TOKEN_NULL;
+        }
+        return slots[probe(text, hash_text(text))].id;
+    }
+
+    llama_token at(std::string_view text) const {
+        const llama_token id = find(text);
+        if (id == LLAMA_TOKEN_NULL) {
+            throw std::out_of_range("no token for text: " + std::string(text));
+        }
+        return id;
+    }
+
+    size_t size() const {
+        return n_used;
+    }
+
+private:
+    static uint64_t hash_text(std::string_view text) {
+        return std::hash<std::string_view>{}(text);
+    }
+
+    // The slot holding text, or the empty one it would go in.
+    size_t probe(std::string_view text, uint64_t hash) const {
+        const size_t mask = slots.size() - 1;
+        const uint32_t tag = (uint32_t) (hash >> 32);
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            const slot & s = slots[i];
+            if (s.id == LLAMA_TOKEN_NULL || (s.hash == tag && (*tokens)[s.id].text == text)) {
+                return i;
+            }
+        }
+    }
+
+    const std::vector<llama_vocab::token_data> * tokens = nullptr;
+    std::vector<slot> slots;
+    size_t n_used = 0;
+};
+
+// BPE merge ranks by the ids of the two tokens merged, packed in 64 bits, by
+// open addressing.
+struct llama_bpe_rank_map {
+    static uint64_t key(llama_token left, llama_token right) {
+        return ((uint64_t) (uint32_t) left << 32) | (uint32_t) right;
+    }
+
+    void reserve(size_t n) {
+        size_t capacity = 16;
+        while (capacity < 2*n) {
+            capacity *= 2;
+        }
+        slots.assign(capacity, { empty, -1 });
+        shift = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) {
+            shift--;
+        }
+        n_used = 0;
+    }
+
+    // Keeps the rank already there, like std::unordered_map::emplace.
+    void emplace(uint64_t k, int rank) {
+        GGML_ASSERT(2*(n_used + 1) <= slots.size());
+        auto & s = slots[probe(k)];
+        if (s.first == empty) {
+            s = { k, rank };
+            n_used++;
+        }
+    }
+
+    // -1 if there's no such merge.
+    int find(uint64_t k) const {
+        if (slots.empty()) {
+            return -1;
+        }
+        return slots[probe(k)].second;
+    }
+
+    size_t size() const {
+        return n_used;
+    }
+
+private:
+    static constexpr uint64_t empty = UINT64_MAX; // ids are never negative
+
+    size_t probe(uint64_t k) const {
+        const size_t mask = slots.size() - 1;
+        for (size_t i = (k * 0x9E3779B97F4A7C15ull) >> shift; ; i = (i + 1) & mask) {
+            if (slots[i].first == empty || slots[i].first == k) {
+                return i;
+            }
+        }
+    }
+
+    std::vector<std::pair<uint64_t, int32_t>> slots;
+    int shift = 64;
+    size_t n_used = 0;
+};
+
 //
 // tokenizers
 //
@@ -1263,18 +1400,23 @@ struct llama_vocab::impl {
     bool escape_whitespaces         = true;
     bool treat_whitespace_as_suffix = false;
 
-    std::unordered_map<std::string, llama_token> token_to_id;
-    std::vector<token_data>                      id_to_token;
+    llama_token_text_map    token_to_id;
+    std::vector<token_data> id_to_token;
 
     std::vector<llama_token> cache_special_tokens;
-    std::vector<std::string> cache_token_to_piece; // llama_token_to_piece(special = true);
+    // llama_token_to_piece(special = true), filled as tokens are first used
+    mutable std::vector<std::string>             cache_token_to_piece;
+    mutable std::unique_ptr<std::atomic<bool>[]> cache_token_to_piece_set;
+    mutable std::mutex                           cache_token_to_piece_mutex;
     struct pair_hash {
         size_t operator()(const std::pair<std::string, std::string> & p) const {
             return std::hash<std::string>{}(p.first) ^  //create some hash for pair
                    (std::hash<std::string>{}(p.second) << 1);
         }
     };
-    std::unordered_map<std::pair<std::string, std::string>, int, pair_hash> bpe_ranks;
+    llama_bpe_rank_map bpe_ranks;
+    // merges of texts that aren't both tokens, which tokenizers don't produce
+    std::unordered_map<std::pair<std::string, std::string>, int, pair_hash> bpe_ranks_text;
 
     // set of all tokens that cause "end of generation"
     std::set<llama_token> special_eog_ids;
@@ -1314,6 +1456,9 @@ struct llama_vocab::impl {
                   llama_token   token,
                          bool   special) const;
 
+    // the token's entry in cache_token_to_piece, filled if it isn't yet
+    const std::string & cached_piece(llama_token token) const;
+
 
     std::vector<llama_token> tokenize(
             const std::string & raw_text,
@@ -1334,7 +1479,8 @@ struct llama_vocab::impl {
                          char * buf,
                       int32_t   length,
                       int32_t   lstrip,
-                         bool   special) const;
+                         bool   special,
+                         bool   use_cache = true) const;
 
     // use cached data
     const std::string & token_to_piece(llama_token token) const;
@@ -1360,6 +1506,8 @@ private:
 void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
     struct gguf_context * ctx = ml.meta.get();
 
+    int bpe_merges_keyidx = -1;
+
     // determine vocab type
     {
         std::string tokenizer_model;
@@ -1421,23 +1569,8 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
                 throw std::runtime_error("cannot find tokenizer merges in model file\n");
             }
 
-            const int n_merges = gguf_get_arr_n(ctx, merges_keyidx);
-            for (int i = 0; i < n_merges; i++) {
-                const std::string word = gguf_get_arr_str(ctx, merges_keyidx, i);
-                //GGML_ASSERT(unicode_cpts_from_utf8(word).size() > 0);
-
-                std::string first;
-                std::string second;
-
-                const size_t pos = word.find(' ', 1);
-
-                if (pos != std::string::npos) {
-                    first  = word.substr(0, pos);
-                    second = word.substr(pos + 1);
-                }
-
-                bpe_ranks.emplace(std::make_pair(first, second), i);
-            }
+            // ranks are by token id, read once the tokens are
+            bpe_merges_keyidx = merges_keyidx;
 
             // default special tokens
             special_bos_id  = 11;
@@ -1686,6 +1819,7 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
 
     uint32_t n_tokens = gguf_get_arr_n(ctx, token_idx);
     id_to_token.resize(n_tokens);
+    token_to_id.init(id_to_token, n_tokens);
 
     for (uint32_t i = 0; i < n_tokens; i++) {
         std::string word = gguf_get_arr_str(ctx, token_idx, i);
@@ -1694,11 +1828,11 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
             word = "[EMPTY_" + std::to_string(i) + "]";
         }
 
-        token_to_id[word] = i;
         max_token_len = std::max(max_token_len, (int) word.size());
 
         auto & token_data = id_to_token[i];
         token_data.text  = std::move(word);
+        token_to_id.insert(i);
         token_data.score = scores ? scores[i] : 0.0f;
         token_data.attr  = LLAMA_TOKEN_ATTR_NORMAL;
 
@@ -1717,6 +1851,33 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
     }
     GGML_ASSERT(id_to_token.size() == token_to_id.size());
 
+    if (bpe_merges_keyidx != -1) {
+        const int n_merges = gguf_get_arr_n(ctx, bpe_merges_keyidx);
+        bpe_ranks.reserve(n_merges);
+        for (int i = 0; i < n_merges; i++) {
+            const std::string_view word = gguf_get_arr_str(ctx, bpe_merges_keyidx, i);
+            //GGML_ASSERT(unicode_cpts_from_utf8(word).size() > 0);
+
+            std::string_view first;
+            std::string_view second;
+
+            const size_t pos = word.find(' ', 1);
+
+            if (pos != std::string_view::npos) {
+                first  = word.substr(0, pos);
+                second = word.substr(pos + 1);
+            }
+
+            const llama_token id_first  = token_to_id.find(first);
+            const llama_token id_second = token_to_id.find(second);
+            if (id_first != LLAMA_TOKEN_NULL && id_second != LLAMA_TOKEN_NULL) {
+                bpe_ranks.emplace(llama_bpe_rank_map::key(id_first, id_second), i);
+            } else {
+                bpe_ranks_text.emplace(std::make_pair(std::string(first), std::string(second)), i);
+            }
+        }
+    }
+
     init_tokenizer(type);
 
     // determine the newline token: LLaMA "<0x0A>" == 10 == '\n', Falcon 193 == '\n'
@@ -1801,148 +1962,97 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
         // TODO: convert scripts should provide these tokens through the KV metadata LLM_KV_TOKENIZER_...
         //       for now, we apply this workaround to find the tokens based on their text
 
-        for (const auto & t : token_to_id) {
-            // find EOT token: "<|eot_id|>", "<|im_end|>", "<end_of_turn>", etc.
-            if (special_eot_id == LLAMA_TOKEN_NULL) {
-                if (false
-                        || t.first == "<|eot_id|>"
-                        || t.first == "<|im_end|>"
-                        || t.first == "<|end|>"
-                        || t.first == "<end_of_turn>"
-                        || t.first == "<|endoftext|>"
-                        || t.first == "<EOT>"
-                        || t.first == "_<EOT>"
-                        || t.first == "<｜end▁of▁sentence｜>" // DeepSeek
-                   ) {
-                    special_eot_id = t.second;
-                    if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                        LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                                __func__, t.second, t.first.c_str());
-                        id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                    }
-                }
-            }
-
-            // find EOM token: "<|eom_id|>"
-            if (special_eom_id == LLAMA_TOKEN_NULL) {
-                if (false
-                        || t.first == "<|eom_id|>"
-                        ) {
-                    special_eom_id = t.second;
-                    if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                        LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                                __func__, t.second, t.first.c_str());
-                        id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                    }
-                }
-            }
-
-            // find FIM_PRE token: "<|fim_prefix|>", "<fim-prefix>", "<PRE>", etc.
-            if (special_fim_pre_id == LLAMA_TOKEN_NULL) {
-                if (false
-                        || t.first == "<|fim_prefix|>"  // Qwen
-                        || t.first == "<fim-prefix>"
-                        || t.first == "<fim_prefix>"    // Granite
-                        || t.first == "<｜fim▁begin｜>" // DeepSeek
-                        || t.first == "<PRE>"
-                        || t.first == "▁<PRE>"          // CodeLlama
-                        ) {
-                    special_fim_pre_id = t.second;
-                    if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                        LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                                __func__, t.second, t.first.c_str());
-                        id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                    }
-                }
-            }
-
-            // find FIM_SUF token: "<|fim_suffix|>", "<fim-suffix>", "<SUF>", etc.
-            if (special_fim_suf_id == LLAMA_TOKEN_NULL) {
-                if (false
-                        || t.first == "<|fim_suffix|>" // Qwen
-                        || t.first == "<fim-suffix>"
-                        || t.first == "<fim_suffix>"   // Granite
-                        || t.first == "<｜fim▁hole｜>" // DeepSeek
-                        || t.first == "<SUF>"
-                        || t.first == "▁<SUF>"         // CodeLlama
-                        ) {
-                    special_fim_suf_id = t.second;
-                    if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                        LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                                __func__, t.second, t.first.c_str());
-                        id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                    }
-                }
-            }
-
-            // find FIM_MID token: "<|fim_middle|>", "<fim-middle>", "<MID>", etc.
-            if (special_fim_mid_id == LLAMA_TOKEN_NULL) {
-                if (false
-                        || t.first == "<|fim_middle|>" // Qwen
-                        || t.first == "<fim-middle>"
-                        || t.first == "<fim_middle>"   // Granite
-                        || t.first == "<｜fim▁end｜>"  // DeepSeek
-                        || t.first == "<MID>"
-                        || t.first == "▁<MID>"         // CodeLlama
-                        ) {
-                    special_fim_mid_id = t.second;
-                    if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                        LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                                __func__, t.second, t.first.c_str());
-                        id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                    }
-                }
-            }
-
-            // find FIM_PAD token: "<|fim_pad|>", "<fim-pad>", "<PAD>", etc.
-            if (special_fim_pad_id == LLAMA_TOKEN_NULL) {
-                if (false
-                        || t.first == "<|fim_pad|>" // Qwen
-                        || t.first == "<fim-pad>"
-                        || t.first == "<fim_pad>"   // Granite
-                        || t.first == "<PAD>"
-                        ) {
-                    special_fim_pad_id = t.second;
-                    if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                        LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                                __func__, t.second, t.first.c_str());
-                        id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                    }
-                }
+        const auto mark_control = [&](llama_token id) {
+            if ((id_to_token[id].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
+                LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
+                        __func__, id, id_to_token[id].text.c_str());
+                id_to_token[id].attr = LLAMA_TOKEN_ATTR_CONTROL;
             }
+        };
 
-            // find FIM_REP token: "<|fim_repo|>", "<fim-repo>", "<REP>", etc.
-            if (special_fim_rep_id == LLAMA_TOKEN_NULL) {
-                if (false
-                        || t.first == "<|fim_repo|>"  // Qwen
-                        || t.first == "<|repo_name|>"
-                        || t.first == "<fim-repo>"
-                        || t.first == "<REPO>"
-                        || t.first == "<reponame>"    // Granite
-                        ) {
-                    special_fim_rep_id = t.second;
-                    if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                        LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                                __func__, t.second, t.first.c_str());
-                        id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                    }
+        // looked up rather than compared against every token's text; the first text that is a token wins
+        const auto find_special = [&](llama_token & id, std::initializer_list<const char *> texts) {
+            if (id != LLAMA_TOKEN_NULL) {
+                return;
+            }
+            for (const char * text : texts) {
+                const llama_token found = token_to_id.find(text);
+                if (found != LLAMA_TOKEN_NULL) {
+                    id = found;
+                    mark_control(id);
+                    return;
                 }
             }
+        };
 
-            // find FIM_SEP token: "<|file_sep|>"
-            if (special_fim_sep_id == LLAMA_TOKEN_NULL) {
-                if (false
-                        || t.first == "<|file_sep|>" // Qwen
-                        ) {
-                    special_fim_sep_id = t.second;
-                    if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                        LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                                __func__, t.second, t.first.c_str());
-                        id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                    }
-                }
-            }
-        }
+        // find EOT token: "<|eot_id|>", "<|im_end|>", "<end_of_turn>", etc.
+        find_special(special_eot_id, {
+            "<|eot_id|>",
+            "<|im_end|>",
+            "<|end|>",
+            "<end_of_turn>",
+            "<|endoftext|>",
+            "<EOT>",
+            "_<EOT>",
+            "<｜end▁of▁sentence｜>", // DeepSeek
+        });
+
+        // find EOM token: "<|eom_id|>"
+        find_special(special_eom_id, {
+            "<|eom_id|>",
+        });
+
+        // find FIM_PRE token: "<|fim_prefix|>", "<fim-prefix>", "<PRE>", etc.
+        find_special(special_fim_pre_id, {
+            "<|fim_prefix|>",  // Qwen
+            "<fim-prefix>",
+            "<fim_prefix>",    // Granite
+            "<｜fim▁begin｜>", // DeepSeek
+            "<PRE>",
+            "▁<PRE>",          // CodeLlama
+        });
+
+        // find FIM_SUF token: "<|fim_suffix|>", "<fim-suffix>", "<SUF>", etc.
+        find_special(special_fim_suf_id, {
+            "<|fim_suffix|>", // Qwen
+            "<fim-suffix>",
+            "<fim_suffix>",   // Granite
+            "<｜fim▁hole｜>", // DeepSeek
+            "<SUF>",
+            "▁<SUF>",         // CodeLlama
+        });
+
+        // find FIM_MID token: "<|fim_middle|>", "<fim-middle>", "<MID>", etc.
+        find_special(special_fim_mid_id, {
+            "<|fim_middle|>", // Qwen
+            "<fim-middle>",
+            "<fim_middle>",   // Granite
+            "<｜fim▁end｜>",  // DeepSeek
+            "<MID>",
+            "▁<MID>",         // CodeLlama
+        });
+
+        // find FIM_PAD token: "<|fim_pad|>", "<fim-pad>", "<PAD>", etc.
+        find_special(special_fim_pad_id, {
+            "<|fim_pad|>", // Qwen
+            "<fim-pad>",
+            "<fim_pad>",   // Granite
+            "<PAD>",
+        });
+
+        // find FIM_REP token: "<|fim_repo|>", "<fim-repo>", "<REP>", etc.
+        find_special(special_fim_rep_id, {
+            "<|fim_repo|>",  // Qwen
+            "<|repo_name|>",
+            "<fim-repo>",
+            "<REPO>",
+            "<reponame>",    // Granite
+        });
+
+        // find FIM_SEP token: "<|file_sep|>"
+        find_special(special_fim_sep_id, {
+            "<|file_sep|>", // Qwen
+        });
 
         // maintain a list of tokens that cause end-of-generation
         // this is currently determined based on the token text, which is obviously not ideal
@@ -1961,29 +2071,28 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
             special_eog_ids.insert(special_fim_sep_id);
         }
 
-        for (const auto & t : token_to_id) {
-            if (false
-                    || t.first == "<|eot_id|>"
-                    || t.first == "<|im_end|>"
-                    || t.first == "<|end|>"
-                    || t.first == "<end_of_turn>"
-                    || t.first == "<|endoftext|>"
-                    || t.first == "<|eom_id|>"
-                    || t.first == "<EOT>"
-                    || t.first == "_<EOT>"
-               ) {
-                special_eog_ids.insert(t.second);
-                if ((id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL) == 0) {
-                    LLAMA_LOG_WARN("%s: control-looking token: %6d '%s' was not control-type; this is probably a bug in the model. its type will be overridden\n",
-                            __func__, t.second, t.first.c_str());
-                    id_to_token[t.second].attr = LLAMA_TOKEN_ATTR_CONTROL;
-                }
-            } else {
-                // token is control, but not marked as EOG -> print a debug log
-                if (id_to_token[t.second].attr & LLAMA_TOKEN_ATTR_CONTROL && special_eog_ids.count(t.second) == 0) {
-                    LLAMA_LOG_DEBUG("%s: control token: %6d '%s' is not marked as EOG\n",
-                            __func__, t.second, t.first.c_str());
-                }
+        for (const char * text : {
+                "<|eot_id|>",
+                "<|im_end|>",
+                "<|end|>",
+                "<end_of_turn>",
+                "<|endoftext|>",
+                "<|eom_id|>",
+                "<EOT>",
+                "_<EOT>",
+            }) {
+            const llama_token id = token_to_id.find(text);
+            if (id != LLAMA_TOKEN_NULL) {
+                special_eog_ids.insert(id);
+                mark_control(id);
+            }
+        }
+
+        for (llama_token id = 0; id < (llama_token) n_tokens; ++id) {
+            // token is control, but not marked as EOG -> print a debug log
+            if (id_to_token[id].attr & LLAMA_TOKEN_ATTR_CONTROL && special_eog_ids.count(id) == 0) {
+                LLAMA_LOG_DEBUG("%s: control token: %6d '%s' is not marked as EOG\n",
+                        __func__, id, id_to_token[id].text.c_str());
             }
         }
 
@@ -2021,21 +2130,12 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
         LLAMA_LOG_INFO("%s: special tokens cache size = %u\n", __func__, (uint32_t) cache_special_tokens.size());
     }
 
-    // build token to piece cache
+    // token to piece cache, filled as tokens are first used: most tokens of a
+    // large vocab never are, and filling it all took as long as the rest of
+    // the load
     {
-        size_t size_cache = 0;
-
-        std::vector<std::string> cache(n_tokens);
-
-        for (uint32_t id = 0; id < n_tokens; ++id) {
-            cache[id] = token_to_piece_for_cache(id, true);
-
-            size_cache += cache[id].size();
-        }
-
-        std::swap(cache_token_to_piece, cache);
-
-        LLAMA_LOG_INFO("%s: token to piece cache size = %.4f MB\n", __func__, size_cache / 1024.0 / 1024.0);
+        cache_token_to_piece.assign(n_tokens, std::string());
+        cache_token_to_piece_set.reset(new std::atomic<bool>[n_tokens]());
     }
 
     // Handle per token attributes
@@ -2320,10 +2420,10 @@ void llama_vocab::impl::tokenizer_st_partition(std::forward_list<fragment_buffer
 std::string llama_vocab::impl::token_to_piece_for_cache(llama_token token, bool special) const {
     std::string piece;
     piece.resize(piece.capacity());  // using string internal cache
-    const int n_chars = vocab.token_to_piece(token, &piece[0], piece.size(), 0, special);
+    const int n_chars = token_to_piece(token, &piece[0], piece.size(), 0, special, false);
     if (n_chars < 0) {
         piece.resize(-n_chars);
-        int check = vocab.token_to_piece(token, &piece[0], piece.size(), 0, special);
+        int check = token_to_piece(token, &piece[0], piece.size(), 0, special, false);
         GGML_ASSERT(check == -n_chars);
     }
     else {
@@ -2333,6 +2433,20 @@ std::string llama_vocab::impl::token_to_piece_for_cache(llama_token token, bool
     return piece;
 }
 
+const std::string & llama_vocab::impl::cached_piece(llama_token token) const {
+    const std::string & piece = cache_token_to_piece.at(token);
+    std::atomic<bool> & set = cache_token_to_piece_set[token];
+    if (!set.load(std::memory_order_acquire)) {
+        std::string filled = token_to_piece_for_cache(token, true);
+        std::lock_guard<std::mutex> lock(cache_token_to_piece_mutex);
+        if (!set.load(std::memory_order_relaxed)) {
+            cache_token_to_piece[token] = std::move(filled);
+            set.store(true, std::memory_order_release);
+        }
+    }
+    return piece;
+}
+
 static void llama_escape_whitespace(std::string & text) {
     replace_all(text, " ", "\xe2\x96\x81");
 }
@@ -2536,7 +2650,7 @@ std::vector<llama_token> llama_vocab::impl::tokenize(
     return output;
 }
 
-int32_t llama_vocab::impl::token_to_piece(llama_token token, char * buf, int32_t length, int32_t lstrip, bool special) const {
+int32_t llama_vocab::impl::token_to_piece(llama_token token, char * buf, int32_t length, int32_t lstrip, bool special, bool use_cache) const {
     // ref: https://github.com/ggerganov/llama.cpp/pull/7587#discussion_r1620983843
     static const int attr_special = LLAMA_TOKEN_ATTR_UNKNOWN | LLAMA_TOKEN_ATTR_CONTROL;
     const llama_token_attr attr = token_get_attr(token);
@@ -2559,13 +2673,9 @@ int32_t llama_vocab::impl::token_to_piece(llama_token token, char * buf, int32_t
     };
 
     // if we have a cache - use it
-    {
-        const auto & cache = cache_token_to_piece;
-
-        if (!cache.empty()) {
-            const auto & result = cache.at(token);
-            return _try_copy(result.data(), result.size());
-        }
+    if (use_cache && !cache_token_to_piece.empty()) {
+        const auto & result = cached_piece(token);
+        return _try_copy(result.data(), result.size());
     }
 
     if (0 <= token && token < (int32_t) id_to_token.size()) {
@@ -2622,7 +2732,7 @@ int32_t llama_vocab::impl::token_to_piece(llama_token token, char * buf, int32_t
 }
 
 const std::string & llama_vocab::impl::token_to_piece(llama_token token) const {
-    return cache_token_to_piece.at(token);
+    return cached_piece(token);
 }
 
 int32_t llama_vocab::impl::detokenize(
@@ -2740,7 +2850,7 @@ int32_t llama_vocab::impl::detokenize(
 void llama_vocab::impl::print_info() const {
     LLAMA_LOG_INFO("%s: vocab type       = %s\n",     __func__, type_name().c_str());
     LLAMA_LOG_INFO("%s: n_vocab          = %u\n",     __func__, vocab.n_tokens());
-    LLAMA_LOG_INFO("%s: n_merges         = %u\n",     __func__, (uint32_t) bpe_ranks.size());
+    LLAMA_LOG_INFO("%s: n_merges         = %u\n",     __func__, (uint32_t) (bpe_ranks.size() + bpe_ranks_text.size()));
 
     // special tokens
     if (special_bos_id  != LLAMA_TOKEN_NULL)    { LLAMA_LOG_INFO( "%s: BOS token        = %d '%s'\n", __func__, special_bos_id,     id_to_token[special_bos_id].text.c_str() );  }
@@ -2837,9 +2947,9 @@ llama_token llama_vocab::byte_to_token(uint8_t ch) const {
         case LLAMA_VOCAB_TYPE_SPM:
         case LLAMA_VOCAB_TYPE_UGM: {
             const char buf[7] = { '<', '0', 'x', hex[ch >> 4], hex[ch & 15], '>', 0 };
-            auto token = pimpl->token_to_id.find(buf);
-            if (token != pimpl->token_to_id.end()) {
-                return (*token).second;
+            const llama_token token = pimpl->token_to_id.find(buf);
+            if (token != LLAMA_TOKEN_NULL) {
+                return token;
             }
             // Try to fall back to just the byte as a string
             const char buf2[2] = { (char)ch, 0 };
@@ -2856,11 +2966,7 @@ llama_token llama_vocab::byte_to_token(uint8_t ch) const {
 
 llama_token llama_vocab::text_to_token(const std::string & text) const {
     GGML_ASSERT(pimpl->type != LLAMA_VOCAB_TYPE_NONE);
-    auto it = pimpl->token_to_id.find(text);
-    if (it != pimpl->token_to_id.end()) {
-        return (*it).second;
-    }
-    return LLAMA_TOKEN_NULL;
+    return pimpl->token_to_id.find(text);
 }
 
 const llama_vocab::token_data & llama_vocab::get_token_data(llama_token id) const {
@@ -2992,8 +3098,17 @@ int llama_vocab::find_bpe_rank(const std::string & token_left, const std::string
     GGML_ASSERT(token_right.find(' ')  == std::string::npos);
     GGML_ASSERT(token_right.find('\n') == std::string::npos);
 
-    auto it = pimpl->bpe_ranks.find(std::make_pair(token_left, token_right));
-    if (it == pimpl->bpe_ranks.end()) {
+    const llama_token id_left  = pimpl->token_to_id.find(token_left);
+    const llama_token id_right = pimpl->token_to_id.find(token_right);
+    if (id_left != LLAMA_TOKEN_NULL && id_right != LLAMA_TOKEN_NULL) {
+        return pimpl->bpe_ranks.find(llama_bpe_rank_map::key(id_left, id_right));
+    }
+
+    if (pimpl->bpe_ranks_text.empty()) {
+        return -1;
+    }
+    auto it = pimpl->bpe_ranks_text.find(std::make_pair(token_left, token_right));
+    if (it == pimpl->bpe_ranks_text.end()) {
         return -1;
     }
 
@@ -92,6 +92,9 @@ static int llama_model_load(const std::string & fname, std::vector<std::string>
     model.t_start_us = tm.t_start_us;
 
     try {
+        // contexts created from this model set it again for the KV cache and compute buffers
+        llama_hugepages_scope hugepages(params.use_hugepages);
+
         llama_model_loader ml(fname, splits, params.use_mmap, params.check_tensors, params.kv_overrides, params.tensor_buft_overrides);
 
         ml.print_info();
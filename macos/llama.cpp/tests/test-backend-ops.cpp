@@ -100,7 +100,8 @@ static void init_tensor_uniform(ggml_tensor * tensor, float min = -1.0f, float m
             };
 
             const size_t min_blocks_per_thread = 1;
-            const size_t n_threads = std::min<size_t>(std::thread::hardware_concurrency()/2,
+            // at least one thread, or a single-core machine leaves the tensor zeroed
+            const size_t n_threads = std::min<size_t>(std::max<size_t>(1, std::thread::hardware_concurrency()/2),
                                                       std::max<size_t>(1, n_blocks / min_blocks_per_thread));
             std::vector<std::future<void>> tasks;
             tasks.reserve(n_threads);
@@ -3864,6 +3865,26 @@ static const ggml_type other_types[] = {
     GGML_TYPE_BF16,
 };
 
+// single-token decode with few heads and a long KV: the CPU backend splits the KV sequence across threads
+static std::vector<std::unique_ptr<test_case>> make_test_cases_flash_attn_split() {
+    std::vector<std::unique_ptr<test_case>> test_cases;
+
+    for (int nh : { 1, 2, 3, }) {
+        for (int kv : { 2048, 4099, }) {
+            for (int nb : { 1, 2, }) {
+                for (ggml_type type_KV : {GGML_TYPE_F16, GGML_TYPE_Q8_0}) {
+                    test_cases.emplace_back(new test_flash_attn_ext(128, 128, nh, 1, kv, nb, true, 0.0f, 0.0f, GGML_PREC_F32, type_KV));
+                }
+            }
+        }
+        test_cases.emplace_back(new test_flash_attn_ext(128, 128, nh, 4, 4096, 1, true,  8.0f,  0.0f, GGML_PREC_F32, GGML_TYPE_F16));
+        test_cases.emplace_back(new test_flash_attn_ext(128, 128, nh, 1, 4096, 1, true,  0.0f, 10.0f, GGML_PREC_F32, GGML_TYPE_F16));
+        test_cases.emplace_back(new test_flash_attn_ext(128, 128, nh, 1, 4096, 1, false, 0.0f,  0.0f, GGML_PREC_F32, GGML_TYPE_F16));
+    }
+
+    return test_cases;
+}
+
 // Test cases for evaluation: should try to cover edge cases while using small input sizes to keep the runtime low
 static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
     std::vector<std::unique_ptr<test_case>> test_cases;
@@ -4469,6 +4490,10 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         }
     }
 
+    for (auto & test : make_test_cases_flash_attn_split()) {
+        test_cases.emplace_back(std::move(test));
+    }
+
     test_cases.emplace_back(new test_cross_entropy_loss     (GGML_TYPE_F32, {   10, 5, 4, 3}));
     test_cases.emplace_back(new test_cross_entropy_loss     (GGML_TYPE_F32, {30000, 1, 1, 1}));
     test_cases.emplace_back(new test_cross_entropy_loss_back(GGML_TYPE_F32, {   10, 5, 4, 3}));
@@ -4544,24 +4569,24 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_perf() {
     return test_cases;
 }
 
-static bool test_backend(ggml_backend_t backend, test_mode mode, const char * op_name, const char * params_filter) {
-    auto filter_test_cases = [](std::vector<std::unique_ptr<test_case>> & test_cases, const char * params_filter) {
-        if (params_filter == nullptr) {
-            return;
-        }
+static void filter_test_cases(std::vector<std::unique_ptr<test_case>> & test_cases, const char * params_filter) {
+    if (params_filter == nullptr) {
+        return;
+    }
 
-        std::regex params_filter_regex(params_filter);
+    std::regex params_filter_regex(params_filter);
 
-        for (auto it = test_cases.begin(); it != test_cases.end();) {
-            if (!std::regex_search((*it)->vars(), params_filter_regex)) {
-                it = test_cases.erase(it);
-                continue;
-            }
-
-            it++;
+    for (auto it = test_cases.begin(); it != test_cases.end();) {
+        if (!std::regex_search((*it)->vars(), params_filter_regex)) {
+            it = test_cases.erase(it);
+            continue;
         }
-    };
 
+        it++;
+    }
+}
+
+static bool test_backend(ggml_backend_t backend, test_mode mode, const char * op_name, const char * params_filter) {
     if (mode == MODE_TEST) {
         auto test_cases = make_test_cases_eval();
         filter_test_cases(test_cases, params_filter);
@@ -4610,6 +4635,40 @@ static bool test_backend(ggml_backend_t backend, test_mode mode, const char * op
     GGML_ABORT("fatal error");
 }
 
+// the CPU backend is the reference for the other backends, so its split flash attention
+// is checked against itself: a single thread never splits the KV sequence, many threads do
+static bool test_cpu_flash_attn_split(ggml_backend_dev_t dev, const char * op_name, const char * params_filter) {
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+    auto ggml_backend_set_n_threads_fn = (ggml_backend_set_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_n_threads");
+    if (!ggml_backend_set_n_threads_fn) {
+        printf("  Skipping CPU backend\n");
+        return true;
+    }
+
+    ggml_backend_ptr backend_split(ggml_backend_dev_init(dev, NULL));
+    ggml_backend_ptr backend_ref(ggml_backend_dev_init(dev, NULL));
+    GGML_ASSERT(backend_split && backend_ref);
+
+    // more threads than rows in every case, whatever the machine has
+    ggml_backend_set_n_threads_fn(backend_split.get(), 8);
+    ggml_backend_set_n_threads_fn(backend_ref.get(), 1);
+
+    printf("  Split flash attention, 8 threads against 1\n");
+
+    auto test_cases = make_test_cases_flash_attn_split();
+    filter_test_cases(test_cases, params_filter);
+
+    size_t n_ok = 0;
+    for (auto & test : test_cases) {
+        if (test->eval(backend_split.get(), backend_ref.get(), op_name)) {
+            n_ok++;
+        }
+    }
+    printf("  %zu/%zu tests passed\n", n_ok, test_cases.size());
+
+    return n_ok == test_cases.size();
+}
+
 static void usage(char ** argv) {
     printf("Usage: %s [mode] [-o <op>] [-b <backend>] [-p <params regex>]\n", argv[0]);
     printf("    valid modes:\n");
@@ -4678,8 +4737,15 @@ int main(int argc, char ** argv) {
         }
 
         if (backend_filter == NULL && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU && mode != MODE_GRAD) {
-            printf("  Skipping CPU backend\n");
-            n_ok++;
+            if (mode != MODE_TEST) {
+                printf("  Skipping CPU backend\n");
+                n_ok++;
+            } else if (test_cpu_flash_attn_split(dev, op_name_filter, params_filter)) {
+                printf("  Backend %s: \033[1;32mOK\033[0m\n\n", ggml_backend_dev_name(dev));
+                n_ok++;
+            } else {
+                printf("  Backend %s: \033[1;31mFAIL\033[0m\n\n", ggml_backend_dev_name(dev));
+            }
             continue;
         }
 
@@ -1,9 +1,25 @@
 #include "fllama.h"
 #include "clip.h"
+#include "fllama_backend.h"
 #include "fllama_chat_template.h"
+#include "fllama_continue.h"
+#include "fllama_cpp.h"
 #include "fllama_eos.h"
+#include "fllama_history.h"
+#include "fllama_host.h"
 #include "fllama_inference_queue.h"
+#include "fllama_kv_tier.h"
 #include "fllama_llava.h"
+#include "fllama_lookahead.h"
+#include "fllama_memory.h"
+#include "fllama_parallel.h"
+#include "fllama_penalties.h"
+#include "fllama_op_profile.h"
+#include "fllama_perf.h"
+#include "fllama_reasoning.h"
+#include "fllama_rpc.h"
+#include "fllama_tokenize.h"
+#include "fllama_weight_stream.h"
 #include "llava.h"
 
 // LLaMA.cpp cross-platform support
@@ -44,6 +60,7 @@
 #include "llama.cpp/include/llama.h"
 #endif
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
@@ -56,11 +73,13 @@
 #include <deque>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <limits.h>
 #include <mutex>
 #include <queue>
 #include <random>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_set>
@@ -141,6 +160,15 @@ static void log_message(const std::string &message,
 
 static InferenceQueue global_inference_queue;
 
+// Compute buffers shared by every context fllama creates. Contexts take
+// turns on the inference queue's worker, so the models it keeps loaded hold
+// one worst-case buffer between them instead of one each. Never freed:
+// contexts may outlive static destructors.
+static llama_compute_arena *fllama_compute_arena() {
+  static llama_compute_arena *arena = llama_compute_arena_init();
+  return arena;
+}
+
 enum stop_type {
   STOP_TYPE_NONE,
   STOP_TYPE_EOS,
@@ -424,6 +452,134 @@ static json to_json_oaicompat_chat(
   return res;
 }
 
+// The model's chat templates, or jinja_template if given. Falls back to
+// ChatML if the template isn't supported.
+static common_chat_templates_ptr
+fllama_chat_templates_init(const llama_model *model,
+                           const std::string &jinja_template,
+                           fllama_log_callback dart_logger) {
+  auto chat_templates = common_chat_templates_init(model, jinja_template);
+  try {
+    common_chat_format_example(chat_templates.get(), true);
+  } catch (const std::exception &e) {
+    log_message("Model's chat template not supported, falling back to chatml",
+                dart_logger);
+    chat_templates = common_chat_templates_init(model, "chatml");
+  }
+  return chat_templates;
+}
+
+// Template inputs for an OpenAI-style request body with messages.
+static common_chat_templates_inputs
+fllama_chat_inputs_from_oaicompat(const json &body) {
+  common_chat_templates_inputs tmpl_inputs;
+  tmpl_inputs.use_jinja = true;
+  tmpl_inputs.add_generation_prompt = true;
+  tmpl_inputs.messages =
+      common_chat_msgs_parse_oaicompat<json>(body.at("messages"));
+  if (body.contains("tools")) {
+    tmpl_inputs.tools =
+        common_chat_tools_parse_oaicompat(json_value(body, "tools", json()));
+    tmpl_inputs.tool_choice =
+        body.contains("tool_choice")
+            ? common_chat_tool_choice_parse_oaicompat(
+                  body.at("tool_choice").template get<std::string>())
+            : COMMON_CHAT_TOOL_CHOICE_AUTO;
+  }
+  return tmpl_inputs;
+}
+
+// "rpc_servers" lists "host:port" endpoints, "rpc_split" is "memory", "even"
+// or an array of weights, see fllama_rpc.h.
+static FllamaRpcOptions fllama_rpc_options(const json &request_options) {
+  FllamaRpcOptions rpc_options;
+  const json rpc_servers = json_value(request_options, "rpc_servers", json());
+  if (rpc_servers.is_string()) {
+    std::stringstream endpoints(rpc_servers.get<std::string>());
+    std::string endpoint;
+    while (std::getline(endpoints, endpoint, ',')) {
+      if (!endpoint.empty()) {
+        rpc_options.endpoints.push_back(endpoint);
+      }
+    }
+  } else if (rpc_servers.is_array()) {
+    for (const auto &endpoint : rpc_servers) {
+      if (endpoint.is_string()) {
+        rpc_options.endpoints.push_back(endpoint.get<std::string>());
+      }
+    }
+  }
+  const json rpc_split = json_value(request_options, "rpc_split", json());
+  if (rpc_split.is_string()) {
+    rpc_options.split = rpc_split.get<std::string>();
+  } else if (rpc_split.is_array()) {
+    rpc_options.split = "weights";
+    for (const auto &weight : rpc_split) {
+      rpc_options.weights.push_back(weight.is_number() ? weight.get<float>()
+                                                       : 0.0f);
+    }
+  }
+  return rpc_options;
+}
+
+// Key of the cached model a request with these options loads. The same file
+// loaded with other options, its layers on RPC servers, into huge pages or
+// streamed within another budget, is a different model. Weight streaming
+// keeps every layer on this machine in the mmap, see the chat request.
+static std::string fllama_model_cache_key(const std::string &model_path,
+                                          const json &request_options) {
+  const int64_t weight_stream_budget_mb =
+      json_value(request_options, "weight_stream_budget_mb", (int64_t)0);
+  if (weight_stream_budget_mb > 0 && WeightStreamer::is_supported()) {
+    return model_path + "|stream=" + std::to_string(weight_stream_budget_mb) +
+           "MiB";
+  }
+  std::string key = model_path + fllama_rpc_options(request_options).cache_key();
+  if (json_value(request_options, "use_hugepages", false)) {
+    key += "|hugepages";
+  }
+  return key;
+}
+
+// Number of leading tokens a and b share.
+static size_t fllama_common_prefix(const std::vector<llama_token> &a,
+                                   const std::vector<llama_token> &b) {
+  size_t n = 0;
+  while (n < a.size() && n < b.size() && a[n] == b[n]) {
+    n++;
+  }
+  return n;
+}
+
+// Sequence 0 of a cached context is about to hold tokens instead of
+// live_tokens. Through the KV tier, keeps the live conversation if most of it
+// would be discarded, and restores a kept one that shares more with tokens.
+// Returns how much of tokens sequence 0 now holds; live_tokens is updated.
+static size_t fllama_kv_tier_swap(const std::string &model_key,
+                                  llama_context *ctx,
+                                  std::vector<llama_token> &live_tokens,
+                                  const std::vector<llama_token> &tokens) {
+  size_t n_shared = fllama_common_prefix(live_tokens, tokens);
+  FllamaKvTier &tier = FllamaKvTier::instance();
+  if (!tier.enabled()) {
+    return n_shared;
+  }
+  if (live_tokens.size() >= n_shared + FllamaKvTier::kMinTokens) {
+    tier.store(model_key, ctx, live_tokens);
+  }
+  std::vector<llama_token> restored;
+  if (tier.restore(model_key, ctx, tokens, n_shared, &restored)) {
+    live_tokens = std::move(restored);
+    n_shared = fllama_common_prefix(live_tokens, tokens);
+    log_message("KV tier: restored " + std::to_string(n_shared) +
+                " prompt tokens.");
+  }
+  return n_shared;
+}
+
+// Set while fllama_inference_continue runs a parked generation on this thread.
+static thread_local FllamaParkedGeneration *resuming_generation = nullptr;
+
 extern "C" {
 EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void
 fllama_clear_model_cache(bool force_clear) {
@@ -435,8 +591,59 @@ fllama_clear_model_cache(bool force_clear) {
     std::cerr << "Unknown error clearing model cache" << std::endl;
   }
 }
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT int64_t fllama_trim_memory(int level) {
+  try {
+    if (level <= FLLAMA_TRIM_NONE) {
+      global_inference_queue.set_paused(false);
+      return 0;
+    }
+    const size_t footprint_before = fllama_memory_footprint();
+    if (level >= FLLAMA_TRIM_CRITICAL) {
+      global_inference_queue.set_paused(true);
+      global_inference_queue.clear_background_tasks();
+      fllama_clear_parked_generations();
+    }
+    // Without the tokenizers' vocabularies and idle KV caches, the next
+    // request pays a prefill, not a context allocation or a model load.
+    fllama_tokenize_clear_cache();
+    fllama_history_clear_cache();
+    global_inference_queue.release_idle_kv();
+    FllamaKvTier::instance().release_ram();
+    if (level >= FLLAMA_TRIM_SEVERE) {
+      global_inference_queue.release_idle_contexts();
+      llama_compute_arena_trim(fllama_compute_arena());
+      global_inference_queue.clear_model_cache(false);
+    }
+    fllama_memory_release_free_pages();
+    const size_t footprint_after = fllama_memory_footprint();
+    const int64_t released = footprint_before > footprint_after
+                                 ? (int64_t)(footprint_before - footprint_after)
+                                 : 0;
+    std::cout << "[fllama] Memory trim level " << level << " released "
+              << released / (1024 * 1024) << " MiB" << std::endl;
+    return released;
+  } catch (const std::exception &e) {
+    std::cerr << "Error trimming memory: " << e.what() << std::endl;
+  } catch (...) {
+    std::cerr << "Unknown error trimming memory" << std::endl;
+  }
+  return 0;
+}
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void
+fllama_kv_tier_configure(const char *cache_dir, int64_t ram_budget_bytes,
+                         int64_t disk_budget_bytes, int idle_seconds) {
+  FllamaKvTier::instance().configure(
+      cache_dir != nullptr ? cache_dir : "",
+      (size_t)std::max<int64_t>(ram_budget_bytes, 0),
+      (size_t)std::max<int64_t>(disk_budget_bytes, 0), idle_seconds);
+}
 EMSCRIPTEN_KEEPALIVE void fllama_inference(fllama_inference_request request,
                                            fllama_inference_callback callback) {
+  if (fllama_host_forward(request, callback)) {
+    std::cout << "[fllama] Forwarded your request to the inference host."
+              << std::endl;
+    return;
+  }
   std::cout << "[fllama] Hello from fllama.cpp! Queueing your request."
             << std::endl;
   global_inference_queue.enqueue(request, callback);
@@ -444,6 +651,9 @@ EMSCRIPTEN_KEEPALIVE void fllama_inference(fllama_inference_request request,
 
 EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void
 fllama_inference_cancel(int request_id) {
+  if (fllama_host_cancel(request_id)) {
+    return;
+  }
   global_inference_queue.cancel(request_id);
 }
 
@@ -565,6 +775,10 @@ static void log_callback_wrapper(enum ggml_log_level level, const char *text,
 EMSCRIPTEN_KEEPALIVE void
 fllama_inference_sync(fllama_inference_request request,
                       fllama_inference_callback callback) {
+  // eos_token is a malloc'd copy handed over with the request, freed however
+  // this returns.
+  const std::unique_ptr<char, decltype(&free)> eos_token_owner(
+      request.eos_token, &free);
   // Easier to do this up top: Gemma 3 multimodal requires some specific setup
   // throughout the method.
   bool is_gemma3_model_detected = is_gemma3_model(request.model_path);
@@ -572,10 +786,11 @@ fllama_inference_sync(fllama_inference_request request,
   int64_t start = ggml_time_ms();
   std::cout << "[fllama] Inference thread start" << std::endl;
   try {
-    ggml_backend_load_all();
+    fllama_backend_load_all();
     std::cout << "[fllama] Backend initialized." << std::endl;
 
     llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.compute_arena = fllama_compute_arena();
     std::cout << "[fllama] Initializing params." << std::endl;
     uint32_t requested_context_size = request.context_size;
     ctx_params.n_ctx = requested_context_size;
@@ -617,12 +832,8 @@ fllama_inference_sync(fllama_inference_request request,
     uint32_t random_seed = rd();
     log_message("Using random seed: " + std::to_string(random_seed), request.dart_logger);
     
-    llama_sampler *smpl =
-        llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(
-        smpl, llama_sampler_init_min_p((1.0f - request.top_p), 1));
-    llama_sampler_chain_add(smpl, llama_sampler_init_temp(request.temperature));
-    llama_sampler_chain_add(smpl, llama_sampler_init_dist(random_seed));
+    // Created once the model is loaded: penalties need its vocabulary.
+    llama_sampler *smpl = nullptr;
 
     llama_model_params model_params = llama_model_default_params();
     // std::vector<llama_sampler_type> samplers = {
@@ -642,12 +853,73 @@ fllama_inference_sync(fllama_inference_request request,
 // Otherwise, for physical iOS devices and other platforms
 #else
     model_params.n_gpu_layers = request.num_gpu_layers;
+    model_params.use_mmap = fllama_backend_use_mmap();
     // fllama_log("[fllama] Number of GPU layers requested: " +
     //  std::to_string(params.n_gpu_layers),
     //  request.dart_logger);
     std::cout << "[fllama] Number of GPU layers requested: "
               << model_params.n_gpu_layers << std::endl;
 #endif
+    // Load-time options ride along in the OpenAI JSON, so new knobs don't
+    // require changing the FFI struct.
+    json request_options = json::object();
+    if (request.openai_request_json_string != NULL) {
+      try {
+        request_options = json::parse(request.openai_request_json_string);
+      } catch (const std::exception &e) {
+        // Reported again, with context, when the messages are processed.
+      }
+    }
+    // Hardware counters per phase, see fllama_perf.h. Loading the model is
+    // the first phase.
+    std::unique_ptr<FllamaPerfCounters> perf_counters;
+    if (json_value(request_options, "perf_counters", false)) {
+      perf_counters.reset(new FllamaPerfCounters());
+    }
+    if (json_value(request_options, "use_hugepages", false)) {
+      // File-backed mmaps rarely get huge pages, so copy the weights into
+      // huge-page backed buffers instead. KV cache and compute buffers
+      // follow automatically.
+      model_params.use_hugepages = true;
+      model_params.use_mmap = false;
+      log_message("Huge pages requested, loading weights without mmap.",
+                  request.dart_logger);
+    }
+    // Weight streaming keeps only a window of layers resident, for models
+    // larger than RAM. It needs the weights to stay in the mmap on the CPU:
+    // no up-front populate, no repacked copies and no GPU offload.
+    std::shared_ptr<WeightStreamer> weight_streamer;
+    const int64_t weight_stream_budget_mb =
+        json_value(request_options, "weight_stream_budget_mb", (int64_t)0);
+    if (weight_stream_budget_mb > 0) {
+      if (WeightStreamer::is_supported()) {
+        weight_streamer = std::make_shared<WeightStreamer>(
+            (size_t)weight_stream_budget_mb * 1024 * 1024);
+        model_params.use_mmap = true;
+        model_params.use_mlock = false;
+        model_params.use_hugepages = false;
+        model_params.use_prefetch = false;
+        model_params.use_extra_bufts = false;
+        model_params.n_gpu_layers = 0;
+        ctx_params.cb_eval = WeightStreamer::eval_callback;
+        ctx_params.cb_eval_user_data = weight_streamer.get();
+        log_message("Streaming weights with a resident budget of " +
+                        std::to_string(weight_stream_budget_mb) + " MiB.",
+                    request.dart_logger);
+      } else {
+        log_message("Weight streaming is not supported on this platform, "
+                    "loading normally.",
+                    request.dart_logger);
+      }
+    }
+    // Offload layers to rpc-server processes on other machines.
+    FllamaRpcOptions rpc_options = fllama_rpc_options(request_options);
+    if (rpc_options.enabled() && weight_streamer) {
+      log_message("Weight streaming keeps every layer on this machine, "
+                  "ignoring rpc_servers.",
+                  request.dart_logger);
+      rpc_options = FllamaRpcOptions();
+    }
     // Check if a Dart logger function is provided, use it if available.
     if (request.dart_logger != NULL) {
       std::cout << "[fllama] Request log callback for llama.cpp detected";
@@ -676,6 +948,8 @@ fllama_inference_sync(fllama_inference_request request,
     // TODO: ???
     // log_set_target(stdout);
     log_message("Initialized llama logger.", request.dart_logger);
+    log_message("CPU backend: " + fllama_backend_cpu_description(),
+                request.dart_logger);
     // !!! Specific to multimodal
     bool prompt_contains_img = prompt_contains_image(request.input);
     bool should_load_clip = false;
@@ -708,6 +982,10 @@ fllama_inference_sync(fllama_inference_request request,
     char *c_result = nullptr;
     bool model_is_cached = false;
     std::string model_path_str = request.model_path ? request.model_path : "";
+    const std::string model_cache_key =
+        fllama_model_cache_key(model_path_str, request_options);
+    std::vector<ggml_backend_dev_t> rpc_devices;
+    std::vector<float> rpc_tensor_split;
     
     auto cleanup = [&]() {
       // Always free the sampler since we create a new one for each request
@@ -716,7 +994,7 @@ fllama_inference_sync(fllama_inference_request request,
       
       // If model was cached, decrement the active users counter
       if (model_is_cached && !model_path_str.empty()) {
-        global_inference_queue.decrement_model_users(model_path_str);
+        global_inference_queue.decrement_model_users(model_cache_key);
       }
       // Only free model and context resources if they weren't cached
       else if (!model_is_cached) {
@@ -731,25 +1009,41 @@ fllama_inference_sync(fllama_inference_request request,
     // Process OpenAI chat messages if provided
     log_message("Initializing llama model...", request.dart_logger);
     
+    if (rpc_options.enabled()) {
+      std::string rpc_error;
+      if (!fllama_rpc_init_devices(rpc_options, rpc_devices, rpc_tensor_split,
+                                   rpc_error)) {
+        const std::string error_message = "Error: " + rpc_error;
+        log_message(error_message, request.dart_logger);
+        callback(error_message.c_str(), "", true);
+        cleanup();
+        return;
+      }
+      model_params.devices = rpc_devices.data();
+      model_params.tensor_split = rpc_tensor_split.data();
+      log_message("Offloading to " +
+                      std::to_string(rpc_options.endpoints.size()) +
+                      " RPC server(s), split: " + rpc_options.split,
+                  request.dart_logger);
+    }
+
     // Check if the model is already cached
-    std::tie(model, ctx) = global_inference_queue.get_cached_model(model_path_str);
-    
-    // Create a new sampler for each request since samplers are lightweight
-    // and depend on request-specific parameters (temperature, top_p, seed)
-    smpl = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(smpl, llama_sampler_init_min_p((1.0f - request.top_p), 1));
-    llama_sampler_chain_add(smpl, llama_sampler_init_temp(request.temperature));
-    llama_sampler_chain_add(smpl, llama_sampler_init_dist(random_seed));
-    
+    std::tie(model, ctx) = global_inference_queue.get_cached_model(model_cache_key);
+
     if (model && ctx) {
       log_message("Using cached model: " + model_path_str, request.dart_logger);
       model_is_cached = true;
       // Note: get_cached_model already increments the active_users count
+      // The KV cache still holds earlier tokens; the prompt reuses what it
+      // shares with them once it is tokenized.
     } else {
       // Load the model if not cached
       log_message("Loading model from file: " + model_path_str, request.dart_logger);
       model = llama_model_load_from_file(request.model_path, model_params);
       ctx = llama_new_context_with_model(model, ctx_params);
+      if (weight_streamer && model) {
+        weight_streamer->add_model(model);
+      }
     }
     
     if (model == NULL || ctx == NULL) {
@@ -761,8 +1055,64 @@ fllama_inference_sync(fllama_inference_request request,
       return;
     }
 
+    const int n_pool_threads =
+        fllama_backend_attach_threadpool(ctx, request.num_threads);
+    if (n_pool_threads > 0) {
+      log_message("Running on " + std::to_string(n_pool_threads) +
+                      " threads of the shared threadpool.",
+                  request.dart_logger);
+    }
     log_message("Initialized model.", request.dart_logger);
+    if (perf_counters) {
+      perf_counters->mark("model_load");
+    }
+    // Per-op timings of the CPU backend, see fllama_op_profile.h.
+    std::unique_ptr<FllamaOpProfiler> op_profiler;
+    const std::string op_profile_path =
+        json_value(request_options, "op_profile_path", std::string());
+    if (json_value(request_options, "op_profile", false) ||
+        !op_profile_path.empty()) {
+      op_profiler.reset(new FllamaOpProfiler());
+      if (!op_profiler->installed()) {
+        log_message("Op profiling is unavailable: the CPU backend has no "
+                    "profile hook, or another request is profiling.",
+                    request.dart_logger);
+        op_profiler.reset();
+      }
+    }
+
+    if (resuming_generation != nullptr) {
+      // Carry on with the sampler that sampled the parked token, including
+      // its penalty window.
+      smpl = resuming_generation->sampler;
+      resuming_generation->sampler = nullptr;
+    } else {
+      // Create a new sampler for each request since samplers are lightweight
+      // and depend on request-specific parameters (temperature, top_p, seed)
+      smpl = llama_sampler_chain_init(llama_sampler_chain_default_params());
+      // OpenAI's presence_penalty is additive, unlike penalty_repeat.
+      const float penalty_present =
+          json_value(request_options, "presence_penalty", 0.0f);
+      // First in the chain, while candidates are still indexed by token id.
+      llama_sampler *penalties = fllama_sampler_init_penalties(
+          llama_vocab_n_tokens(llama_model_get_vocab(model)),
+          json_value(request_options, "repeat_last_n", 64),
+          request.penalty_repeat, request.penalty_freq, penalty_present);
+      if (penalties != nullptr) {
+        llama_sampler_chain_add(smpl, penalties);
+      }
+      llama_sampler_chain_add(smpl, llama_sampler_init_min_p((1.0f - request.top_p), 1));
+      llama_sampler_chain_add(smpl, llama_sampler_init_temp(request.temperature));
+      llama_sampler_chain_add(smpl, llama_sampler_init_dist(random_seed));
+    }
+    if (rpc_options.enabled()) {
+      // Per-request counters, the connections outlive the request.
+      fllama_rpc_reset_stats(rpc_options);
+    }
     std::string final_request_input = request.input;
+    // With trim_history, the prompt was tokenized to check it fits.
+    std::unique_ptr<FllamaHistoryTrim> history_trim;
+    std::vector<llama_token> history_prompt_tokens;
 
     nlohmann::ordered_json body = NULL;
 
@@ -781,24 +1131,31 @@ fllama_inference_sync(fllama_inference_request request,
                       request.dart_logger);
         }
 
-        auto chat_templates = common_chat_templates_init(model, jinja_template);
-        // Try to use model's built-in template, fallback to chatml
-        try {
-          common_chat_format_example(chat_templates.get(), true);
-        } catch (const std::exception &e) {
-          log_message(
-              "Model's chat template not supported, falling back to chatml",
-              request.dart_logger);
-          chat_templates = common_chat_templates_init(model, "chatml");
-        }
+        auto chat_templates = fllama_chat_templates_init(
+            model, jinja_template, request.dart_logger);
 
         // Format messages using chat template
         if (body.contains("messages") && body["messages"].is_array()) {
-          common_chat_templates_inputs tmpl_inputs;
-          tmpl_inputs.use_jinja = true;
-          tmpl_inputs.add_generation_prompt = true;
-          tmpl_inputs.messages =
-              common_chat_msgs_parse_oaicompat<json>(body["messages"]);
+          common_chat_templates_inputs tmpl_inputs =
+              fllama_chat_inputs_from_oaicompat(body);
+
+          // Drop the oldest turns if the prompt wouldn't fit, see
+          // fllama_history.h. Messages with images aren't counted: their
+          // base64 text isn't what ends up in the context.
+          bool trim_history = json_value(request_options, "trim_history", false) &&
+                              resuming_generation == nullptr;
+          for (const common_chat_msg &msg : tmpl_inputs.messages) {
+            trim_history = trim_history && !prompt_contains_image(msg.content);
+          }
+          if (trim_history) {
+            const int n_ctx = llama_n_ctx(ctx);
+            const int reserve = json_value(request_options, "trim_history_reserve",
+                                           std::min(request.max_tokens, n_ctx / 2));
+            history_trim.reset(new FllamaHistoryTrim(
+                model_cache_key, llama_model_get_vocab(model),
+                std::max(n_ctx - reserve, 1)));
+            history_trim->fit(tmpl_inputs);
+          }
 
           // Handle tools if present
           if (body.contains("tools")) {
@@ -812,13 +1169,6 @@ fllama_inference_sync(fllama_inference_request request,
             // Check the actual type
             log_message("DEBUG Tools type: " + std::string(tools.type_name()),
                         request.dart_logger);
-
-            tmpl_inputs.tools = common_chat_tools_parse_oaicompat(tools);
-            tmpl_inputs.tool_choice =
-                body.contains("tool_choice")
-                    ? common_chat_tool_choice_parse_oaicompat(
-                          body["tool_choice"].template get<std::string>())
-                    : COMMON_CHAT_TOOL_CHOICE_AUTO;
           }
           
           // Log tmpl_inputs before applying templates
@@ -850,7 +1200,30 @@ fllama_inference_sync(fllama_inference_request request,
           
           auto result =
               common_chat_templates_apply(chat_templates.get(), tmpl_inputs);
+          while (history_trim) {
+            history_prompt_tokens = common_tokenize(
+                llama_model_get_vocab(model), result.prompt, true, true);
+            if (!history_trim->refit(tmpl_inputs, history_prompt_tokens.size())) {
+              break;
+            }
+            result = common_chat_templates_apply(chat_templates.get(), tmpl_inputs);
+          }
+          if (history_trim) {
+            log_message("History trimmed to a budget of " +
+                            std::to_string(history_trim->budget()) +
+                            " tokens: dropped " +
+                            std::to_string(history_trim->dropped()) +
+                            " messages, rendered " +
+                            std::to_string(history_trim->renders()) +
+                            " times, " +
+                            std::to_string(history_prompt_tokens.size()) +
+                            " tokens.",
+                        request.dart_logger);
+          }
           final_request_input = result.prompt;
+          if (perf_counters) {
+            perf_counters->mark("template");
+          }
           auto formatted_content_contains_image =
               prompt_contains_image(final_request_input);
           if (formatted_content_contains_image) {
@@ -915,6 +1288,9 @@ fllama_inference_sync(fllama_inference_request request,
       // Use Gemma3-specific image processing if this is a Gemma3 model
       image_embeddings = llava_image_embed_make_with_prompt_base64(ctx_clip, request.num_threads, final_request_input);
       clip_free(ctx_clip);
+      if (perf_counters) {
+        perf_counters->mark("clip_encode");
+      }
     }
 
     // It is important that this runs regardless of whether CLIP needs to be
@@ -945,11 +1321,35 @@ fllama_inference_sync(fllama_inference_request request,
     const int n_ctx = llama_n_ctx(ctx);
     const llama_vocab *vocab = llama_model_get_vocab(model);
 
-    const int n_prompt_tokens =
-        -llama_tokenize(vocab, final_request_input.c_str(),
-                        final_request_input.length(), NULL, 0, true, true);
-    std::vector<llama_token> tokens_list(n_prompt_tokens);
-    if (llama_tokenize(vocab, final_request_input.c_str(),
+    int n_prompt_tokens = 0;
+    std::vector<llama_token> tokens_list;
+    const bool history_tokenized =
+        !history_prompt_tokens.empty() && !prompt_contains_img;
+    if (resuming_generation != nullptr) {
+      // Everything decoded so far plus the parked token. When the KV cache
+      // still holds the generation, only that token is decoded. Tokens a
+      // lookahead step sampled ahead are decoded too, all but the last, as
+      // the step would have.
+      n_prompt_tokens = resuming_generation->n_prompt_tokens;
+      tokens_list = resuming_generation->tokens;
+      tokens_list.push_back(resuming_generation->next_token);
+      const std::vector<llama_token> &pending =
+          resuming_generation->pending_tokens;
+      if (!pending.empty()) {
+        tokens_list.insert(tokens_list.end(), pending.begin(),
+                           pending.end() - 1);
+      }
+    } else if (history_tokenized) {
+      tokens_list = std::move(history_prompt_tokens);
+      n_prompt_tokens = tokens_list.size();
+    } else {
+      n_prompt_tokens =
+          -llama_tokenize(vocab, final_request_input.c_str(),
+                          final_request_input.length(), NULL, 0, true, true);
+      tokens_list.resize(n_prompt_tokens);
+    }
+    if (resuming_generation == nullptr && !history_tokenized &&
+        llama_tokenize(vocab, final_request_input.c_str(),
                        final_request_input.length(), tokens_list.data(),
                        tokens_list.size(), true, true) < 0) {
       fprintf(stderr, "%s: tokenization failed\n", __func__);
@@ -959,6 +1359,9 @@ fllama_inference_sync(fllama_inference_request request,
     }
     log_message("Input token count: " + std::to_string(tokens_list.size()),
                 request.dart_logger);
+    if (perf_counters) {
+      perf_counters->mark("tokenize");
+    }
     log_message("Output token count: " + std::to_string(request.max_tokens),
                 request.dart_logger);
     const int n_max_tokens = request.max_tokens;
@@ -966,7 +1369,37 @@ fllama_inference_sync(fllama_inference_request request,
                 request.dart_logger);
 
     // 2. Load the prompt into the context.
-    int n_past = 0;
+    const int64_t prefill_start_us = ggml_time_us();
+    // A cached context still holds the previous request's tokens, or a
+    // prefill hint's. Keep the prefix the prompt shares with them and only
+    // decode the rest; at least one token is decoded, for logits to sample.
+    // Image embeddings aren't tracked, so prompts with images start over.
+    std::vector<llama_token> kv_tokens;
+    size_t n_reused = 0;
+    if (model_is_cached) {
+      std::vector<llama_token> *cached_tokens =
+          global_inference_queue.get_kv_tokens(model_cache_key);
+      if (cached_tokens != nullptr && image_embeddings.empty() &&
+          !tokens_list.empty()) {
+        n_reused = std::min(fllama_kv_tier_swap(model_cache_key, ctx,
+                                                *cached_tokens, tokens_list),
+                            tokens_list.size() - 1);
+      }
+      if (n_reused > 0) {
+        llama_kv_self_seq_rm(ctx, 0, n_reused, -1);
+      } else {
+        llama_kv_self_clear(ctx);
+      }
+      kv_tokens.assign(tokens_list.begin(), tokens_list.begin() + n_reused);
+      if (cached_tokens != nullptr) {
+        *cached_tokens = kv_tokens;
+      }
+      log_message("Reusing " + std::to_string(n_reused) + " of " +
+                      std::to_string(tokens_list.size()) +
+                      " prompt tokens from the KV cache.",
+                  request.dart_logger);
+    }
+    int n_past = (int)n_reused;
     bool add_bos = llama_add_bos_token(vocab);
     int idx_embedding = 0;
     // Check if this is a Gemma 3 model
@@ -1025,8 +1458,24 @@ fllama_inference_sync(fllama_inference_request request,
     log_message("Context size: " + std::to_string(n_ctx), request.dart_logger);
     log_message("Input tokens: " + std::to_string(tokens_list.size()),
                 request.dart_logger);
-    add_tokens_to_context(ctx, tokens_list, n_batch, &n_past,
-                          request.dart_logger);
+    const std::vector<llama_token> prompt_tail(tokens_list.begin() + n_reused,
+                                               tokens_list.end());
+    if (add_tokens_to_context(ctx, prompt_tail, n_batch, &n_past,
+                              request.dart_logger) &&
+        image_embeddings.empty()) {
+      kv_tokens.insert(kv_tokens.end(), prompt_tail.begin(),
+                       prompt_tail.end());
+    }
+    if (perf_counters) {
+      perf_counters->mark("prefill", (int64_t)prompt_tail.size());
+    }
+    const int64_t decode_start_us = ggml_time_us();
+    if (op_profiler) {
+      op_profiler->span("prefill", prefill_start_us, decode_start_us);
+    }
+    // Only tracked while it matches the KV cache from position 0.
+    bool track_kv_tokens =
+        image_embeddings.empty() && kv_tokens.size() == tokens_list.size();
     if (tokens_list.size() > n_ctx) {
       log_message("Input tokens exceed context size.", request.dart_logger);
       auto error_message = "Error: Input exceeds context size. Input tokens: " +
@@ -1038,11 +1487,14 @@ fllama_inference_sync(fllama_inference_request request,
     }
 
     log_message("Added input to context.", request.dart_logger);
-    const char *eos_token_chars =
-        request.eos_token != NULL ? request.eos_token
-                                  : fllama_get_eos_token(request.model_path);
-    const std::string eos_token_as_string = std::string(eos_token_chars);
-    free((void *)eos_token_chars);
+    std::string eos_token_as_string;
+    if (request.eos_token != NULL) {
+      eos_token_as_string = request.eos_token;
+    } else {
+      const char *eos_token_chars = fllama_get_eos_token(request.model_path);
+      eos_token_as_string = eos_token_chars;
+      free((void *)eos_token_chars);
+    }
     const int64_t context_setup_complete = ggml_time_ms();
     log_message("Context setup complete & input added to context. Took " +
                     std::to_string(context_setup_complete - start) + " ms.",
@@ -1100,9 +1552,144 @@ fllama_inference_sync(fllama_inference_request request,
      * [decode "The"] -> sample "cat" ->
      * [decode "cat"] -> sample "sat" -> ...
      */
+    const auto send_partial_response = [&]() {
+      if (callback == NULL) {
+        return;
+      }
+      std::strcpy(c_result, result.c_str());
+      auto completion_response = to_json_oaicompat_chat(
+          result, request.model_path,
+          "cmpl-" + std::to_string(request.request_id),
+          fllama_backend_cpu_description(), STOP_TYPE_NONE,
+          common_chat_format, n_gen, n_prompt_tokens);
+
+      // Only update last_valid_json and call callback if we got a valid
+      // response (i.e. if the response isn't just echoing back
+      // last_valid_json)
+      if (completion_response != NULL &&
+          (!has_valid_json || completion_response != last_valid_json)) {
+        std::string json_str = completion_response.dump();
+        if (is_valid_utf8(json_str)) {
+          last_valid_json = completion_response;
+          last_valid_json_string = json_str;
+          has_valid_json = true;
+          callback(c_result, last_valid_json_string.c_str(), false);
+        } else {
+          log_message("[DEBUG] invalid UTF-8 in JSON response",
+                      request.dart_logger);
+        }
+      } else {
+        log_message(
+            "[DEBUG] skipping callback. completion_response null? " +
+                std::to_string(completion_response == NULL) +
+                ", has_valid_json? " + std::to_string(has_valid_json) +
+                ", response == last_valid_json? " +
+                std::to_string(completion_response == last_valid_json),
+            request.dart_logger);
+      }
+    };
+
+    // Thinking models can be held to a budget of reasoning tokens. When it
+    // runs out, the closing tag is decoded as if the model had generated it,
+    // so the next sampled token starts the answer.
+    FllamaReasoningBudget reasoning_budget(
+        common_chat_format, final_request_input,
+        json_value(request_options, "reasoning_budget", -1));
+    const auto force_reasoning_close = [&]() -> bool {
+      const std::string &text = reasoning_budget.close_text();
+      std::vector<llama_token> close_tokens(text.size() + 1);
+      const int n_close =
+          llama_tokenize(vocab, text.c_str(), text.size(), close_tokens.data(),
+                         close_tokens.size(), false, true);
+      if (n_close <= 0 ||
+          llama_kv_self_used_cells(ctx) + n_close > (int)llama_n_ctx(ctx)) {
+        log_message("[DEBUG] unable to close reasoning", request.dart_logger);
+        return false;
+      }
+      close_tokens.resize(n_close);
+      if (llama_decode(ctx, llama_batch_get_one(close_tokens.data(),
+                                                close_tokens.size()))) {
+        log_message("[DEBUG] decode failed", request.dart_logger);
+        return false;
+      }
+      for (llama_token token : close_tokens) {
+        llama_sampler_accept(smpl, token);
+      }
+      if (track_kv_tokens) {
+        kv_tokens.insert(kv_tokens.end(), close_tokens.begin(),
+                         close_tokens.end());
+      }
+      result += text;
+      n_gen += n_close;
+      reasoning_budget.closed();
+      log_message("Reasoning budget reached after " +
+                      std::to_string(reasoning_budget.tokens()) +
+                      " tokens, closed reasoning.",
+                  request.dart_logger);
+      return true;
+    };
+
+    if (resuming_generation != nullptr) {
+      // The parked token was decoded with the prompt; emit it as if it had
+      // just been sampled.
+      reasoning_budget = resuming_generation->reasoning_budget;
+      result = resuming_generation->result;
+      n_gen = resuming_generation->n_gen;
+      char token_text[256];
+      const int token_len = llama_token_to_piece(
+          vocab, resuming_generation->next_token, token_text,
+          sizeof(token_text), 0, true);
+      if (token_len > 0) {
+        result += std::string(token_text, token_len);
+      }
+      n_gen++;
+      reasoning_budget.on_token(result);
+      send_partial_response();
+      log_message("Resuming generation " + std::to_string(request_id) +
+                      " after " + std::to_string(n_gen) + " tokens.",
+                  request.dart_logger);
+    }
+
     log_message("[DEBUG] starting token generation loop", request.dart_logger);
-    llama_token new_token_id = llama_sampler_sample(smpl, ctx, -1);
+    if (reasoning_budget.should_close()) {
+      // A budget of 0, with the reasoning opened by the prompt.
+      force_reasoning_close();
+      send_partial_response();
+    }
+    // Lookahead decoding, see fllama_lookahead.h. Tokens it sampled ahead
+    // wait in lookahead_tokens; all but the last are already decoded.
+    std::unique_ptr<FllamaLookahead> lookahead;
+    std::deque<llama_token> lookahead_tokens;
+    llama_token new_token_id;
+    if (resuming_generation != nullptr &&
+        !resuming_generation->pending_tokens.empty()) {
+      // The sampler accepted these before the generation was parked. Those
+      // decoded with the prompt are tracked as they are emitted, as after a
+      // lookahead step.
+      const std::vector<llama_token> &pending =
+          resuming_generation->pending_tokens;
+      new_token_id = pending.front();
+      lookahead_tokens.assign(pending.begin() + 1, pending.end());
+      if (track_kv_tokens) {
+        kv_tokens.resize(kv_tokens.size() - (pending.size() - 1));
+      }
+    } else {
+      new_token_id = llama_sampler_sample(smpl, ctx, -1);
+    }
     llama_batch batch = llama_batch_get_one(&new_token_id, 1);
+    if (json_value(request_options, "lookahead", false)) {
+      lookahead.reset(new FllamaLookahead(
+          ctx, json_value(request_options, "lookahead_window", 4),
+          json_value(request_options, "lookahead_ngram", 3),
+          json_value(request_options, "lookahead_max_ngrams", 4)));
+      log_message("Lookahead decoding, up to " +
+                      std::to_string(lookahead->batch_size()) +
+                      " tokens per batch.",
+                  request.dart_logger);
+    }
+    // Stopped on max_tokens or a cancel, with new_token_id sampled but not
+    // emitted: the generation can be continued.
+    bool can_continue = false;
 
     while (true) {
       // Check context space
@@ -1127,46 +1714,44 @@ fllama_inference_sync(fllama_inference_request request,
       std::string piece(token_text, token_len);
       result += piece;
       n_gen++;
-      if (callback != NULL) {
-        std::strcpy(c_result, result.c_str());
-        auto completion_response = to_json_oaicompat_chat(
-            result, request.model_path,
-            "cmpl-" + std::to_string(request.request_id), "", STOP_TYPE_NONE,
-            common_chat_format, n_gen, n_prompt_tokens);
-
-        // Only update last_valid_json and call callback if we got a valid
-        // response (i.e. if the response isn't just echoing back
-        // last_valid_json)
-        if (completion_response != NULL &&
-            (!has_valid_json || completion_response != last_valid_json)) {
-          std::string json_str = completion_response.dump();
-          if (is_valid_utf8(json_str)) {
-            last_valid_json = completion_response;
-            last_valid_json_string = json_str;
-            has_valid_json = true;
-            callback(c_result, last_valid_json_string.c_str(), false);
-          } else {
-            log_message("[DEBUG] invalid UTF-8 in JSON response",
-                        request.dart_logger);
-          }
-        } else {
-          log_message(
-              "[DEBUG] skipping callback. completion_response null? " +
-                  std::to_string(completion_response == NULL) +
-                  ", has_valid_json? " + std::to_string(has_valid_json) +
-                  ", response == last_valid_json? " +
-                  std::to_string(completion_response == last_valid_json),
-              request.dart_logger);
+      reasoning_budget.on_token(result);
+      send_partial_response();
+
+      // Process current batch. A lookahead step decoded the token already if
+      // more wait; the reasoning close waits for them to be used up.
+      const bool decoded_ahead = !lookahead_tokens.empty();
+      const bool close_reasoning =
+          reasoning_budget.should_close() && !decoded_ahead;
+      if (!decoded_ahead) {
+        const bool decoded =
+            lookahead && !close_reasoning
+                ? lookahead->step(smpl, new_token_id, lookahead_tokens)
+                : llama_decode(ctx, batch) == 0;
+        if (!decoded) {
+          log_message("[DEBUG] decode failed", request.dart_logger);
+          break;
         }
       }
-
-      // Process current batch
-      if (llama_decode(ctx, batch)) {
-        log_message("[DEBUG] decode failed", request.dart_logger);
-        break;
+      if (track_kv_tokens) {
+        kv_tokens.push_back(new_token_id);
+      }
+      if (close_reasoning) {
+        if (!force_reasoning_close()) {
+          break;
+        }
+        send_partial_response();
+      }
+      if (lookahead && !decoded_ahead && lookahead_tokens.empty()) {
+        // Decoded into sequence 0 alone.
+        lookahead->sync();
       }
       // Sample next token
-      new_token_id = llama_sampler_sample(smpl, ctx, -1);
+      if (!lookahead_tokens.empty()) {
+        new_token_id = lookahead_tokens.front();
+        lookahead_tokens.pop_front();
+      } else {
+        new_token_id = llama_sampler_sample(smpl, ctx, -1);
+      }
 
       // Check for end conditions
       if (llama_token_is_eog(vocab, new_token_id)) {
@@ -1177,10 +1762,12 @@ fllama_inference_sync(fllama_inference_request request,
         log_message("[DEBUG] reached max tokens: " +
                         std::to_string(n_max_tokens),
                     request.dart_logger);
+        can_continue = true;
         break;
       }
       if (global_inference_queue.is_cancelled(request_id)) {
         log_message("[DEBUG] generation cancelled", request.dart_logger);
+        can_continue = true;
         break;
       }
 
@@ -1221,6 +1808,112 @@ fllama_inference_sync(fllama_inference_request request,
       //            request.dart_logger);
     }
     log_message("[DEBUG] token generation loop complete", request.dart_logger);
+    json lookahead_timings;
+    if (lookahead) {
+      lookahead_timings = {
+          {"steps", lookahead->steps()},
+          {"accepted", lookahead->accepted()},
+          {"tokens_per_step",
+           lookahead->steps() > 0
+               ? (double)(lookahead->steps() + lookahead->accepted()) /
+                     lookahead->steps()
+               : 0.0},
+      };
+      log_message("Lookahead: " + lookahead_timings.dump(),
+                  request.dart_logger);
+      lookahead.reset();
+    }
+    if (perf_counters) {
+      perf_counters->mark("decode", n_gen);
+    }
+    if (op_profiler) {
+      op_profiler->span("decode", decode_start_us, ggml_time_us());
+    }
+    if (reasoning_budget.tokens() > 0 && has_valid_json) {
+      last_valid_json["usage"]["completion_tokens_details"] = {
+          {"reasoning_tokens", reasoning_budget.tokens()},
+      };
+      last_valid_json_string = last_valid_json.dump();
+    }
+    if (rpc_options.enabled()) {
+      json device_timings = json::array();
+      for (const auto &timing :
+           fllama_rpc_device_timings(rpc_options, rpc_devices)) {
+        log_message("Device " + timing.name + ": " +
+                        std::to_string(timing.graph_computes) +
+                        " computes in " + std::to_string(timing.compute_ms) +
+                        " ms, sent " + std::to_string(timing.bytes_sent >> 10) +
+                        " KiB, received " +
+                        std::to_string(timing.bytes_recv >> 10) + " KiB, " +
+                        std::to_string(timing.memory_free >> 20) + "/" +
+                        std::to_string(timing.memory_total >> 20) +
+                        " MiB free",
+                    request.dart_logger);
+        device_timings.push_back({
+            {"name", timing.name},
+            {"endpoint", timing.endpoint},
+            {"graph_computes", timing.graph_computes},
+            {"compute_ms", timing.compute_ms},
+            {"bytes_sent", timing.bytes_sent},
+            {"bytes_received", timing.bytes_recv},
+            {"memory_free", timing.memory_free},
+            {"memory_total", timing.memory_total},
+        });
+      }
+      if (has_valid_json) {
+        last_valid_json["timings"] = {
+            {"prompt_n", n_prompt_tokens},
+            {"prompt_ms", context_setup_complete - model_load_end},
+            {"predicted_n", n_gen},
+            {"predicted_ms", ggml_time_ms() - start_t},
+            {"devices", device_timings},
+        };
+        last_valid_json_string = last_valid_json.dump();
+      }
+    }
+    if (perf_counters) {
+      const json perf = perf_counters->to_json();
+      log_message("Performance counters: " + perf.dump(), request.dart_logger);
+      const std::string report_path =
+          json_value(request_options, "perf_report_path", std::string());
+      if (!report_path.empty()) {
+        std::ofstream report(report_path);
+        report << perf.dump(2) << "\n";
+        if (!report) {
+          log_message("Unable to write " + report_path, request.dart_logger);
+        }
+      }
+      if (has_valid_json) {
+        last_valid_json["timings"]["perf"] = perf;
+        last_valid_json_string = last_valid_json.dump();
+      }
+    }
+    if (history_trim && has_valid_json) {
+      last_valid_json["timings"]["history_trim"] = {
+          {"budget", history_trim->budget()},
+          {"dropped_messages", history_trim->dropped()},
+          {"renders", history_trim->renders()},
+      };
+      last_valid_json_string = last_valid_json.dump();
+    }
+    if (!lookahead_timings.is_null() && has_valid_json) {
+      last_valid_json["timings"]["lookahead"] = lookahead_timings;
+      last_valid_json_string = last_valid_json.dump();
+    }
+    if (op_profiler) {
+      // Stop timing before the summary and trace are built.
+      const json ops = op_profiler->summary();
+      if (!op_profile_path.empty() &&
+          !op_profiler->write_chrome_trace(op_profile_path)) {
+        log_message("Unable to write " + op_profile_path, request.dart_logger);
+      }
+      op_profiler.reset();
+      log_message("Op profile: " + ops.dump(), request.dart_logger);
+      if (has_valid_json) {
+        last_valid_json["timings"]["ops"] = ops;
+        last_valid_json_string = last_valid_json.dump();
+      }
+    }
     // If EOS token is found, above loop does not add it to buffer, and the
     // loop stops immediately.
     //
@@ -1252,7 +1945,8 @@ fllama_inference_sync(fllama_inference_request request,
         // If we never got valid JSON, return empty content
         auto completion_response = to_json_oaicompat_chat(
             "", request.model_path,
-            "cmpl-" + std::to_string(request.request_id), "" /* build info */,
+            "cmpl-" + std::to_string(request.request_id),
+            fllama_backend_cpu_description() /* build info */,
             STOP_TYPE_LIMIT, common_chat_format, n_gen, n_prompt_tokens);
         json_string = completion_response == NULL
                           ? NULL
@@ -1314,10 +2008,31 @@ fllama_inference_sync(fllama_inference_request request,
     // If model is not already cached, register it for caching
     if (model && ctx && !model_is_cached) {
       log_message("Caching model for future use", request.dart_logger);
-      global_inference_queue.register_model(model_path_str, model, ctx);
+      // Registered with this request as its user, so a trim can't free the
+      // context before the request releases it.
+      global_inference_queue.register_model(model_cache_key, model, ctx,
+                                            weight_streamer, &ctx_params,
+                                            /*users=*/1);
       model_is_cached = true;
-      // We must explicitly increment since we're registering a new model
-      global_inference_queue.increment_model_users(model_path_str);
+    }
+    if (std::vector<llama_token> *cached_tokens =
+            global_inference_queue.get_kv_tokens(model_cache_key)) {
+      *cached_tokens = track_kv_tokens ? kv_tokens : std::vector<llama_token>();
+    }
+    if (can_continue && track_kv_tokens) {
+      std::unique_ptr<FllamaParkedGeneration> parked(
+          new FllamaParkedGeneration(request, reasoning_budget));
+      parked->eos_token = eos_token_as_string;
+      parked->tokens = kv_tokens;
+      parked->next_token = new_token_id;
+      parked->pending_tokens.assign(lookahead_tokens.begin(),
+                                    lookahead_tokens.end());
+      parked->sampler = smpl;
+      smpl = nullptr;
+      parked->result = result;
+      parked->n_gen = n_gen;
+      parked->n_prompt_tokens = n_prompt_tokens;
+      fllama_park_generation(request_id, std::move(parked));
     }
     
     // Now call cleanup() which will decrement the active users counter
@@ -1341,4 +2056,1025 @@ fllama_inference_sync(fllama_inference_request request,
   }
 }
 
-} // extern "C"
\ No newline at end of file
+} // extern "C"
+// Handler of the inference running on this thread, see fllama_cpp.h. The
+// FFI callback has no user data, so the queue's worker passes it along here.
+static thread_local const fllama_inference_handler *current_inference_handler =
+    nullptr;
+
+static void inference_handler_trampoline(const char *response,
+                                         const char *openai_response_json,
+                                         uint8_t done) {
+  if (current_inference_handler != nullptr) {
+    (*current_inference_handler)(response, openai_response_json, done != 0);
+  }
+}
+
+void fllama_inference_enqueue(fllama_inference_request request,
+                              fllama_inference_handler handler) {
+  global_inference_queue.enqueue_task(
+      [request, handler]() {
+        current_inference_handler = &handler;
+        fllama_inference_sync(request, inference_handler_trampoline);
+        current_inference_handler = nullptr;
+      },
+      request.request_id, [handler]() { handler("", "", true); });
+}
+
+// Runs the generation parked for request_id, see fllama_inference_continue.
+static void fllama_inference_continue_sync(int request_id,
+                                           int extra_max_tokens,
+                                           fllama_inference_callback callback) {
+  std::unique_ptr<FllamaParkedGeneration> parked =
+      fllama_take_parked_generation(request_id);
+  if (!parked) {
+    const std::string error_message =
+        "Error: No stopped generation to continue for request " +
+        std::to_string(request_id) + ".";
+    log_message(error_message);
+    callback(error_message.c_str(), "", true);
+    return;
+  }
+  resuming_generation = parked.get();
+  fllama_inference_sync(parked->resume_request(extra_max_tokens), callback);
+  resuming_generation = nullptr;
+}
+
+void fllama_inference_continue(int request_id, int extra_max_tokens,
+                               fllama_inference_callback callback) {
+  global_inference_queue.enqueue_task(
+      [request_id, extra_max_tokens, callback]() {
+        fllama_inference_continue_sync(request_id, extra_max_tokens, callback);
+      },
+      request_id, [callback]() { callback("", "", true); });
+}
+
+// Holds a user of a cached model, see fllama_acquire_model, until it goes out
+// of scope.
+struct FllamaModelUser {
+  explicit FllamaModelUser(const std::string &model_key)
+      : model_key(model_key) {}
+  ~FllamaModelUser() { global_inference_queue.decrement_model_users(model_key); }
+  FllamaModelUser(const FllamaModelUser &) = delete;
+  FllamaModelUser &operator=(const FllamaModelUser &) = delete;
+
+  const std::string model_key;
+};
+
+// The same model, context and cache entry as chat requests for this file
+// without load options, so a server doesn't hold a second copy of the
+// weights. Loads it unless it is cached; either way the caller holds a user of
+// it, under *model_key, until it calls decrement_model_users. Returns false if
+// the model can't be loaded.
+static bool fllama_acquire_model(const std::string &model_path,
+                                 int context_size, int num_gpu_layers,
+                                 llama_model **model, llama_context **ctx,
+                                 std::string *model_key) {
+  fllama_backend_load_all();
+  *model_key = fllama_model_cache_key(model_path, json::object());
+  std::tie(*model, *ctx) = global_inference_queue.get_cached_model(*model_key);
+  if (*model != nullptr && *ctx != nullptr) {
+    fllama_backend_attach_threadpool(*ctx, 0);
+    return true;
+  }
+  llama_model_params model_params = llama_model_default_params();
+  model_params.n_gpu_layers = num_gpu_layers;
+  model_params.use_mmap = fllama_backend_use_mmap();
+  *model = llama_model_load_from_file(model_path.c_str(), model_params);
+  *ctx = nullptr;
+  llama_context_params ctx_params = llama_context_default_params();
+  ctx_params.compute_arena = fllama_compute_arena();
+  ctx_params.n_ctx = context_size;
+  ctx_params.n_batch = context_size;
+  if (*model != nullptr) {
+    *ctx = llama_init_from_model(*model, ctx_params);
+  }
+  if (*model == nullptr || *ctx == nullptr) {
+    if (*model != nullptr) {
+      llama_model_free(*model);
+    }
+    return false;
+  }
+  fllama_backend_attach_threadpool(*ctx, 0);
+  global_inference_queue.register_model(*model_key, *model, *ctx, nullptr,
+                                        &ctx_params, /*users=*/1);
+  return true;
+}
+
+static void fllama_embedding_sync(const fllama_embedding_request &request,
+                                  const fllama_embedding_handler &handler) {
+  std::vector<std::vector<float>> embeddings;
+  int n_prompt_tokens = 0;
+
+  llama_model *model = nullptr;
+  llama_context *ctx = nullptr;
+  std::string model_key;
+  if (!fllama_acquire_model(request.model_path, request.context_size,
+                            request.num_gpu_layers, &model, &ctx,
+                            &model_key)) {
+    handler(embeddings, 0, "Unable to load model.");
+    return;
+  }
+
+  std::string error;
+  const llama_vocab *vocab = llama_model_get_vocab(model);
+  const int n_embd = llama_model_n_embd(model);
+  const int n_batch = (int)llama_n_batch(ctx);
+  const enum llama_pooling_type pooling = llama_pooling_type(ctx);
+  llama_set_embeddings(ctx, true);
+  for (const auto &input : request.inputs) {
+    if (global_inference_queue.is_cancelled(request.request_id)) {
+      error = "Cancelled.";
+      break;
+    }
+    std::vector<llama_token> tokens(input.size() + 2);
+    int n_tokens = llama_tokenize(vocab, input.c_str(), input.size(),
+                                  tokens.data(), tokens.size(), true, false);
+    if (n_tokens < 0) {
+      tokens.resize(-n_tokens);
+      n_tokens = llama_tokenize(vocab, input.c_str(), input.size(),
+                                tokens.data(), tokens.size(), true, false);
+    }
+    if (n_tokens < 0) {
+      error = "Unable to tokenize input.";
+      break;
+    }
+    // Like the OpenAI API, inputs longer than the batch are truncated.
+    n_tokens = std::min(n_tokens, n_batch);
+    n_prompt_tokens += n_tokens;
+
+    llama_batch batch = llama_batch_init(n_tokens, 0, 1);
+    for (int i = 0; i < n_tokens; i++) {
+      batch.token[i] = tokens[i];
+      batch.pos[i] = i;
+      batch.n_seq_id[i] = 1;
+      batch.seq_id[i][0] = 0;
+      batch.logits[i] = true;
+    }
+    batch.n_tokens = n_tokens;
+    llama_kv_self_clear(ctx);
+    const int status = llama_decode(ctx, batch);
+    llama_batch_free(batch);
+    if (status != 0) {
+      error = "Unable to compute embeddings, llama_decode returned " +
+              std::to_string(status) + ".";
+      break;
+    }
+
+    std::vector<float> embedding(n_embd, 0.0f);
+    if (pooling != LLAMA_POOLING_TYPE_NONE) {
+      const float *pooled = llama_get_embeddings_seq(ctx, 0);
+      if (pooled != nullptr) {
+        std::copy(pooled, pooled + n_embd, embedding.begin());
+      }
+    } else {
+      for (int i = 0; i < n_tokens; i++) {
+        const float *token_embd = llama_get_embeddings_ith(ctx, i);
+        for (int j = 0; token_embd != nullptr && j < n_embd; j++) {
+          embedding[j] += token_embd[j] / n_tokens;
+        }
+      }
+    }
+    double norm = 0.0;
+    for (float v : embedding) {
+      norm += (double)v * v;
+    }
+    norm = std::sqrt(norm);
+    if (norm > 0.0) {
+      for (float &v : embedding) {
+        v = (float)(v / norm);
+      }
+    }
+    embeddings.push_back(std::move(embedding));
+  }
+  // Leave the context as inference expects it.
+  llama_kv_self_clear(ctx);
+  llama_set_embeddings(ctx, false);
+  if (std::vector<llama_token> *kv_tokens =
+          global_inference_queue.get_kv_tokens(model_key)) {
+    kv_tokens->clear();
+  }
+  global_inference_queue.decrement_model_users(model_key);
+
+  if (!error.empty()) {
+    embeddings.clear();
+  }
+  handler(embeddings, n_prompt_tokens, error);
+}
+
+void fllama_embedding_enqueue(fllama_embedding_request request,
+                              fllama_embedding_handler handler) {
+  const int request_id = request.request_id;
+  global_inference_queue.enqueue_task(
+      [request, handler]() {
+        try {
+          fllama_embedding_sync(request, handler);
+        } catch (const std::exception &e) {
+          handler({}, 0, std::string("Unhandled error: ") + e.what());
+        }
+      },
+      request_id, [handler]() { handler({}, 0, "Cancelled."); });
+}
+
+// log p(token) under logits, via log-softmax.
+static double fllama_token_log_prob(const float *logits, int n_vocab,
+                                    llama_token token) {
+  const float max_logit = *std::max_element(logits, logits + n_vocab);
+  double sum = 0.0;
+  for (int i = 0; i < n_vocab; i++) {
+    sum += std::exp((double)(logits[i] - max_logit));
+  }
+  return (double)(logits[token] - max_logit) - std::log(sum);
+}
+
+// Tokens of text. Prompts get BOS and special tokens parsed, continuations
+// and documents neither.
+static std::vector<llama_token> fllama_tokenize_text(const llama_vocab *vocab,
+                                                     const std::string &text,
+                                                     bool is_prompt) {
+  std::vector<llama_token> tokens(text.size() + 2);
+  int n_tokens = llama_tokenize(vocab, text.c_str(), text.size(), tokens.data(),
+                                tokens.size(), is_prompt, is_prompt);
+  if (n_tokens < 0) {
+    tokens.resize(-n_tokens);
+    n_tokens = llama_tokenize(vocab, text.c_str(), text.size(), tokens.data(),
+                              tokens.size(), is_prompt, is_prompt);
+  }
+  tokens.resize(std::max(n_tokens, 0));
+  return tokens;
+}
+
+// Scores candidates in sequence 0's KV cache, see fllama_score in fllama.h.
+// Returns an error message, empty on success.
+static std::string fllama_score_sync(const std::string &model_path,
+                                     const fllama_score_request &request,
+                                     const std::vector<std::string> &candidates,
+                                     float *log_probs, int *n_tokens) {
+  llama_model *model = nullptr;
+  llama_context *ctx = nullptr;
+  std::string model_key;
+  if (!fllama_acquire_model(model_path, request.context_size,
+                            request.num_gpu_layers, &model, &ctx,
+                            &model_key)) {
+    return "Unable to load model.";
+  }
+  const llama_vocab *vocab = llama_model_get_vocab(model);
+  const int n_vocab = llama_vocab_n_tokens(vocab);
+  const int n_ctx = (int)llama_n_ctx(ctx);
+  const int n_batch = (int)llama_n_batch(ctx);
+  std::vector<llama_token> *kv_tokens =
+      global_inference_queue.get_kv_tokens(model_key);
+
+  const std::vector<llama_token> prompt =
+      fllama_tokenize_text(vocab, request.prompt ? request.prompt : "", true);
+  std::vector<std::vector<llama_token>> candidate_tokens;
+  for (const auto &candidate : candidates) {
+    candidate_tokens.push_back(fllama_tokenize_text(vocab, candidate, false));
+  }
+  std::string error;
+  if (prompt.empty()) {
+    error = "The prompt is empty.";
+  } else if ((int)prompt.size() >= n_ctx) {
+    error = "The prompt doesn't fit in the context.";
+  }
+
+  // 1. The prompt, decoded once into sequence 0. Like chat requests, reuse
+  // what the KV cache already holds of it.
+  size_t n_reused = 0;
+  if (error.empty() && kv_tokens != nullptr) {
+    n_reused = std::min(fllama_common_prefix(*kv_tokens, prompt),
+                        prompt.size() - 1);
+  }
+  llama_kv_self_seq_rm(ctx, -1, n_reused, -1);
+  if (kv_tokens != nullptr) {
+    kv_tokens->assign(prompt.begin(), prompt.begin() + n_reused);
+  }
+  std::vector<float> prompt_logits;
+  for (size_t start = n_reused; error.empty() && start < prompt.size();
+       start += n_batch) {
+    const int n = (int)std::min<size_t>(n_batch, prompt.size() - start);
+    llama_batch batch = llama_batch_init(n, 0, 1);
+    for (int i = 0; i < n; i++) {
+      batch.token[i] = prompt[start + i];
+      batch.pos[i] = (llama_pos)(start + i);
+      batch.n_seq_id[i] = 1;
+      batch.seq_id[i][0] = 0;
+      batch.logits[i] = start + i == prompt.size() - 1;
+    }
+    batch.n_tokens = n;
+    if (llama_decode(ctx, batch) != 0) {
+      error = "Unable to decode the prompt.";
+    } else if (start + n == prompt.size()) {
+      const float *logits = llama_get_logits_ith(ctx, n - 1);
+      prompt_logits.assign(logits, logits + n_vocab);
+    }
+    llama_batch_free(batch);
+    if (error.empty() && kv_tokens != nullptr) {
+      kv_tokens->insert(kv_tokens->end(), prompt.begin() + start,
+                        prompt.begin() + start + n);
+    }
+  }
+
+  // 2. Each candidate in its own sequence, a copy of sequence 0, teacher
+  // forced: the logits after its token i give log p(token i + 1), those after
+  // the prompt give its first. Its last token never needs decoding. As many
+  // candidates as fit in a batch and the free KV cells go in one decode.
+  const int n_free = std::min(n_batch, n_ctx - (int)prompt.size());
+  size_t next = 0;
+  while (error.empty() && next < candidate_tokens.size()) {
+    if (global_inference_queue.is_cancelled(request.request_id)) {
+      error = "Cancelled.";
+      break;
+    }
+    size_t end = next;
+    int n_round = 0;
+    while (end < candidate_tokens.size()) {
+      const int n = std::max((int)candidate_tokens[end].size() - 1, 0);
+      if (n_round + n > n_free) {
+        break;
+      }
+      n_round += n;
+      end++;
+    }
+    if (end == next) {
+      error = "Candidate " + std::to_string(next) +
+              " doesn't fit in the context.";
+      break;
+    }
+
+    llama_batch batch = llama_batch_init(std::max(n_round, 1), 0, 1);
+    for (size_t c = next; c < end; c++) {
+      const llama_seq_id seq = (llama_seq_id)(c - next + 1);
+      const auto &tokens = candidate_tokens[c];
+      if (tokens.size() > 1) {
+        llama_kv_self_seq_cp(ctx, 0, seq, -1, -1);
+      }
+      for (size_t i = 0; i + 1 < tokens.size(); i++) {
+        const int j = batch.n_tokens++;
+        batch.token[j] = tokens[i];
+        batch.pos[j] = (llama_pos)(prompt.size() + i);
+        batch.n_seq_id[j] = 1;
+        batch.seq_id[j][0] = seq;
+        batch.logits[j] = true;
+      }
+    }
+    if (batch.n_tokens > 0 && llama_decode(ctx, batch) != 0) {
+      error = "Unable to decode the candidates.";
+    }
+    int j = 0;
+    for (size_t c = next; error.empty() && c < end; c++) {
+      const auto &tokens = candidate_tokens[c];
+      double log_prob = 0.0;
+      for (size_t i = 0; i < tokens.size(); i++) {
+        const float *logits =
+            i == 0 ? prompt_logits.data() : llama_get_logits_ith(ctx, j++);
+        log_prob += fllama_token_log_prob(logits, n_vocab, tokens[i]);
+      }
+      log_probs[c] = (float)log_prob;
+      n_tokens[c] = (int)tokens.size();
+    }
+    llama_batch_free(batch);
+    for (size_t c = next; c < end; c++) {
+      llama_kv_self_seq_rm(ctx, (llama_seq_id)(c - next + 1), -1, -1);
+    }
+    next = end;
+  }
+
+  if (!error.empty() && kv_tokens != nullptr &&
+      kv_tokens->size() != prompt.size()) {
+    // The prompt may be partly decoded; start over next time.
+    kv_tokens->clear();
+    llama_kv_self_clear(ctx);
+  }
+  global_inference_queue.decrement_model_users(model_key);
+  return error;
+}
+
+int fllama_score(struct fllama_score_request request, float *log_probs,
+                 int *n_tokens) {
+  if (request.model_path == NULL || request.prompt == NULL ||
+      (request.n_candidates > 0 && request.candidates == NULL)) {
+    log_message("Score request is missing its model path, prompt or "
+                "candidates.");
+    return -1;
+  }
+  const std::string model_path = request.model_path;
+  std::vector<std::string> candidates;
+  for (int i = 0; i < request.n_candidates; i++) {
+    candidates.push_back(request.candidates[i] ? request.candidates[i] : "");
+  }
+  auto score = [&]() -> std::string {
+    try {
+      return fllama_score_sync(model_path, request, candidates, log_probs,
+                               n_tokens);
+    } catch (const std::exception &e) {
+      return std::string("Unhandled error: ") + e.what();
+    }
+  };
+  std::string message;
+  if (global_inference_queue.is_worker_thread()) {
+    // Called from a task, ex. a callback: the queue would wait for this one.
+    message = score();
+  } else {
+    auto done = std::make_shared<std::promise<std::string>>();
+    std::future<std::string> error = done->get_future();
+    global_inference_queue.enqueue_task(
+        [&, done]() { done->set_value(score()); }, request.request_id,
+        [done]() { done->set_value("Cancelled."); });
+    message = error.get();
+  }
+  if (!message.empty()) {
+    log_message("Scoring failed: " + message);
+    return -1;
+  }
+  return 0;
+}
+
+static std::string fllama_detokenize_text(const llama_vocab *vocab,
+                                          const llama_token *tokens,
+                                          int n_tokens) {
+  std::string text(n_tokens * 4 + 16, '\0');
+  int n = llama_detokenize(vocab, tokens, n_tokens, &text[0], text.size(),
+                           false, false);
+  if (n < 0) {
+    text.resize(-n);
+    n = llama_detokenize(vocab, tokens, n_tokens, &text[0], text.size(), false,
+                         false);
+  }
+  text.resize(std::max(n, 0));
+  return text;
+}
+
+// The chat-formatted prompt for one user message.
+static std::string fllama_user_prompt(const common_chat_templates *templates,
+                                      const std::string &content) {
+  json body = {{"messages", json::array({{{"role", "user"},
+                                          {"content", content}}})}};
+  return common_chat_templates_apply(templates,
+                                     fllama_chat_inputs_from_oaicompat(body))
+      .prompt;
+}
+
+// Splits a document into parts of at most chunk_tokens tokens. A part ends
+// after a newline in its last fifth when there is one, so parts rarely cut a
+// sentence.
+static std::vector<std::string>
+fllama_split_document(const llama_vocab *vocab,
+                      const std::vector<llama_token> &tokens,
+                      int chunk_tokens) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (start < tokens.size()) {
+    size_t end = std::min(tokens.size(), start + chunk_tokens);
+    if (end < tokens.size()) {
+      for (size_t i = end; i > end - chunk_tokens / 5; i--) {
+        char piece[64];
+        const int n = llama_token_to_piece(vocab, tokens[i - 1], piece,
+                                           sizeof(piece), 0, false);
+        if (n > 0 && std::memchr(piece, '\n', n) != nullptr) {
+          end = i;
+          break;
+        }
+      }
+    }
+    parts.push_back(
+        fllama_detokenize_text(vocab, tokens.data() + start, end - start));
+    start = end;
+  }
+  return parts;
+}
+
+static const char *const FLLAMA_MAP_INSTRUCTIONS =
+    "Summarize the following part of a longer document. Keep names, numbers "
+    "and conclusions, leave out filler.";
+static const char *const FLLAMA_REDUCE_INSTRUCTIONS =
+    "The following are summaries of consecutive parts of one document. "
+    "Combine them into one coherent summary of the whole document.";
+// Rounds of summarizing summaries before giving up on fitting the context.
+static const int FLLAMA_SUMMARIZE_MAX_LEVELS = 4;
+
+// Summarizes a document of any length, see fllama_summarize in fllama.h.
+static void fllama_summarize_sync(const fllama_summarize_request &request,
+                                  const std::string &model_path,
+                                  const std::string &document,
+                                  const std::string &instructions,
+                                  fllama_inference_callback callback) {
+  llama_model *model = nullptr;
+  llama_context *ctx = nullptr;
+  std::string model_key;
+  if (!fllama_acquire_model(model_path, request.context_size,
+                            request.num_gpu_layers, &model, &ctx,
+                            &model_key)) {
+    callback("Error: Unable to load model.", "", true);
+    return;
+  }
+  if (std::vector<llama_token> *kv_tokens =
+          global_inference_queue.get_kv_tokens(model_key)) {
+    // The generator uses the whole KV cache.
+    kv_tokens->clear();
+  }
+  const int64_t start_ms = ggml_time_ms();
+  const llama_vocab *vocab = llama_model_get_vocab(model);
+  const int n_ctx = (int)llama_n_ctx(ctx);
+  const int max_tokens = std::max(request.max_tokens, 1);
+  auto templates = fllama_chat_templates_init(model, "", nullptr);
+  std::string focus;
+  if (!instructions.empty()) {
+    focus = "\nFocus on: " + instructions;
+  }
+  const std::string map_instructions = FLLAMA_MAP_INSTRUCTIONS + focus + "\n\n";
+  const std::string reduce_instructions =
+      FLLAMA_REDUCE_INSTRUCTIONS + focus + "\n\n";
+
+  // Parts are sized so n_parallel of them, each with its instructions and
+  // summary, fit in the context at once. Fewer at once beats tiny parts.
+  const int overhead =
+      (int)fllama_tokenize_text(
+          vocab, fllama_user_prompt(templates.get(), map_instructions), true)
+          .size() +
+      8;
+  int n_parallel = request.n_parallel > 0 ? request.n_parallel : 4;
+  int chunk_tokens = n_ctx / n_parallel - overhead - max_tokens;
+  while (chunk_tokens < 256 && n_parallel > 1) {
+    n_parallel--;
+    chunk_tokens = n_ctx / n_parallel - overhead - max_tokens;
+  }
+
+  FllamaParallelGenerator generator(ctx, n_parallel, request.temperature,
+                                    (uint32_t)start_ms);
+  generator.should_stop = [&]() {
+    return global_inference_queue.is_cancelled(request.request_id);
+  };
+  std::string error;
+  std::string summary;
+  std::string text = document;
+  int64_t n_decoded = 0;
+  int n_generated = 0;
+  int n_parts_total = 0;
+  int level = 0;
+  if (chunk_tokens < 32) {
+    error = "The context is too small for max_tokens.";
+  }
+  while (error.empty()) {
+    // Summarize in one go once it fits: the document itself, or the
+    // summaries of its parts.
+    const std::string &instruction =
+        level == 0 ? map_instructions : reduce_instructions;
+    std::vector<FllamaParallelJob> jobs(1);
+    jobs[0].prompt = fllama_tokenize_text(
+        vocab, fllama_user_prompt(templates.get(), instruction + text), true);
+    jobs[0].max_tokens = max_tokens;
+    if ((int)jobs[0].prompt.size() + max_tokens <= n_ctx) {
+      const json progress = {{"stage", "reduce"}, {"level", level}};
+      const std::string progress_string = progress.dump();
+      generator.on_job_done = nullptr;
+      generator.on_token = [&](size_t, const std::string &piece) {
+        summary += piece;
+        callback(summary.c_str(), progress_string.c_str(), false);
+      };
+      error = generator.run(jobs);
+      n_decoded += generator.n_decoded();
+      n_generated += jobs[0].n_generated;
+      summary = jobs[0].text;
+      break;
+    }
+    if (level == FLLAMA_SUMMARIZE_MAX_LEVELS) {
+      error = "The summaries don't fit in the context, use a smaller "
+              "max_tokens or a larger context.";
+      break;
+    }
+
+    // Map: summarize the parts, n_parallel at a time.
+    const std::vector<std::string> parts = fllama_split_document(
+        vocab, fllama_tokenize_text(vocab, text, false), chunk_tokens);
+    jobs.assign(parts.size(), FllamaParallelJob());
+    for (size_t i = 0; i < parts.size(); i++) {
+      jobs[i].prompt = fllama_tokenize_text(
+          vocab, fllama_user_prompt(templates.get(), map_instructions + parts[i]),
+          true);
+      jobs[i].max_tokens = max_tokens;
+    }
+    n_parts_total += (int)parts.size();
+    int n_parts_done = 0;
+    generator.on_token = nullptr;
+    generator.on_job_done = [&](size_t) {
+      n_parts_done++;
+      const json progress = {{"stage", "map"},
+                             {"level", level},
+                             {"parts", parts.size()},
+                             {"parts_done", n_parts_done}};
+      callback("", progress.dump().c_str(), false);
+    };
+    error = generator.run(jobs);
+    n_decoded += generator.n_decoded();
+    text.clear();
+    for (size_t i = 0; i < jobs.size(); i++) {
+      n_generated += jobs[i].n_generated;
+      text += "Part " + std::to_string(i + 1) + ":\n" + jobs[i].text + "\n\n";
+    }
+    level++;
+  }
+
+  global_inference_queue.decrement_model_users(model_key);
+  const double seconds = (ggml_time_ms() - start_ms) / 1000.0;
+  const json result = {
+      {"stage", "done"},
+      {"levels", level},
+      {"parts", n_parts_total},
+      {"completion_tokens", n_generated},
+      {"decoded_tokens", n_decoded},
+      {"seconds", seconds},
+      {"tokens_per_second", seconds > 0 ? n_decoded / seconds : 0.0},
+  };
+  log_message("Summarized " + std::to_string(n_parts_total) + " parts in " +
+              std::to_string(level) + " levels, " + std::to_string(n_decoded) +
+              " tokens decoded in " + std::to_string(seconds) + " s.");
+  if (!error.empty() && error != "Cancelled.") {
+    const std::string message = "Error: " + error;
+    callback(message.c_str(), "", true);
+    return;
+  }
+  callback(summary.c_str(), result.dump().c_str(), true);
+}
+
+void fllama_summarize(struct fllama_summarize_request request,
+                      fllama_inference_callback callback) {
+  if (request.model_path == NULL || request.document == NULL) {
+    callback("Error: A summary needs a model path and a document.", "", true);
+    return;
+  }
+  const std::string model_path = request.model_path;
+  const std::string document = request.document;
+  const std::string instructions =
+      request.instructions ? request.instructions : "";
+  request.model_path = NULL;
+  request.document = NULL;
+  request.instructions = NULL;
+  global_inference_queue.enqueue_task(
+      [request, model_path, document, instructions, callback]() {
+        try {
+          fllama_summarize_sync(request, model_path, document, instructions,
+                                callback);
+        } catch (const std::exception &e) {
+          const std::string message =
+              std::string("Unhandled error: ") + e.what();
+          callback(message.c_str(), "", true);
+        }
+      },
+      request.request_id, [callback]() { callback("", "", true); });
+}
+
+// A request of a batch, see fllama_batch.
+struct FllamaBatchEntry {
+  std::string id;
+  std::vector<llama_token> prompt;
+  int max_tokens;
+};
+
+// Ids already in a batch's output file, and in *failed those with an error
+// line. Makes sure the file ends with a newline, in case the last run was
+// interrupted while writing.
+static std::unordered_set<std::string>
+fllama_batch_read_done(const std::string &output_path,
+                       std::unordered_set<std::string> *failed) {
+  std::unordered_set<std::string> done;
+  std::ifstream output(output_path);
+  std::string line;
+  bool ends_with_newline = true;
+  while (std::getline(output, line)) {
+    ends_with_newline = !output.eof();
+    try {
+      const json result = json::parse(line);
+      if (!result.contains("id")) {
+        continue;
+      }
+      if (result.contains("error")) {
+        failed->insert(result["id"].get<std::string>());
+      } else {
+        done.insert(result["id"].get<std::string>());
+      }
+    } catch (const std::exception &) {
+      // A line cut short by the interruption; it runs again.
+    }
+  }
+  if (!ends_with_newline) {
+    std::ofstream(output_path, std::ios::app) << "\n";
+  }
+  return done;
+}
+
+// Runs a JSONL file of chat requests, see fllama_batch in fllama.h.
+static void fllama_batch_sync(const fllama_batch_request &request,
+                              const std::string &model_path,
+                              const std::string &input_path,
+                              const std::string &output_path,
+                              fllama_inference_callback callback) {
+  std::ifstream input(input_path);
+  if (!input) {
+    const std::string message = "Error: Unable to read " + input_path;
+    callback(message.c_str(), "", true);
+    return;
+  }
+  std::unordered_set<std::string> failed;
+  const std::unordered_set<std::string> done =
+      fllama_batch_read_done(output_path, &failed);
+  std::ofstream output(output_path, std::ios::app);
+  if (!output) {
+    const std::string message = "Error: Unable to write " + output_path;
+    callback(message.c_str(), "", true);
+    return;
+  }
+  llama_model *model = nullptr;
+  llama_context *ctx = nullptr;
+  std::string model_key;
+  if (!fllama_acquire_model(model_path, request.context_size,
+                            request.num_gpu_layers, &model, &ctx,
+                            &model_key)) {
+    callback("Error: Unable to load model.", "", true);
+    return;
+  }
+  const FllamaModelUser model_user(model_key);
+  if (std::vector<llama_token> *kv_tokens =
+          global_inference_queue.get_kv_tokens(model_key)) {
+    // The generator uses the whole KV cache.
+    kv_tokens->clear();
+  }
+  const int64_t start_ms = ggml_time_ms();
+  const llama_vocab *vocab = llama_model_get_vocab(model);
+  const int n_ctx = (int)llama_n_ctx(ctx);
+  const int n_batch = (int)llama_n_batch(ctx);
+  auto templates = fllama_chat_templates_init(model, "", nullptr);
+
+  // Requests that can't run are answered with an error line right away, and
+  // retried by the next run. One error line per request, however many runs
+  // it fails.
+  int n_failed = 0;
+  const auto write_error = [&](const std::string &id, const std::string &error) {
+    if (failed.insert(id).second) {
+      output << json({{"id", id}, {"error", error}}).dump() << "\n";
+      output.flush();
+    }
+    n_failed++;
+  };
+  std::vector<FllamaBatchEntry> entries;
+  std::string line;
+  int line_number = 0;
+  int n_skipped = 0;
+  while (std::getline(input, line)) {
+    line_number++;
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    std::string id = "line-" + std::to_string(line_number);
+    try {
+      const json body = json::parse(line);
+      for (const char *key : {"custom_id", "id"}) {
+        if (body.contains(key)) {
+          id = body[key].is_string() ? body[key].get<std::string>()
+                                     : body[key].dump();
+          break;
+        }
+      }
+      if (done.count(id)) {
+        n_skipped++;
+        continue;
+      }
+      FllamaBatchEntry entry{id, {}, 0};
+      entry.prompt = fllama_tokenize_text(
+          vocab,
+          common_chat_templates_apply(templates.get(),
+                                      fllama_chat_inputs_from_oaicompat(body))
+              .prompt,
+          true);
+      entry.max_tokens = std::max(
+          json_value(body, "max_tokens", std::max(request.max_tokens, 1)), 1);
+      if ((int)entry.prompt.size() > n_batch ||
+          (int)entry.prompt.size() + entry.max_tokens > n_ctx) {
+        write_error(id, "The prompt and max_tokens don't fit in the context.");
+        continue;
+      }
+      entries.push_back(std::move(entry));
+    } catch (const std::exception &e) {
+      write_error(id, std::string("Invalid request: ") + e.what());
+    }
+  }
+
+  // Similar lengths run side by side, so slots free up together and the
+  // KV cache packs well; a bucket also shares its prompts' common prefix,
+  // ex. a system prompt.
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const FllamaBatchEntry &a, const FllamaBatchEntry &b) {
+                     return a.prompt.size() < b.prompt.size();
+                   });
+  const int n_parallel = request.n_parallel > 0 ? request.n_parallel : 8;
+  const size_t bucket_size = (size_t)n_parallel * 4;
+  FllamaParallelGenerator generator(ctx, n_parallel, request.temperature,
+                                    (uint32_t)start_ms);
+  generator.should_stop = [&]() {
+    return global_inference_queue.is_cancelled(request.request_id);
+  };
+  int64_t n_prompt = 0;
+  int64_t n_generated = 0;
+  int64_t n_decoded = 0;
+  int64_t n_shared = 0;
+  int n_done = 0;
+  std::string error;
+  for (size_t start = 0; start < entries.size() && error.empty();
+       start += bucket_size) {
+    const size_t end = std::min(entries.size(), start + bucket_size);
+    std::vector<FllamaParallelJob> jobs(end - start);
+    for (size_t i = start; i < end; i++) {
+      jobs[i - start].prompt = entries[i].prompt;
+      jobs[i - start].max_tokens = entries[i].max_tokens;
+    }
+    generator.on_job_done = [&](size_t j) {
+      const FllamaParallelJob &job = jobs[j];
+      const json result = {
+          {"id", entries[start + j].id},
+          {"content", job.text},
+          {"finish_reason", job.stopped ? "stop" : "length"},
+          {"usage",
+           {{"prompt_tokens", job.prompt.size()},
+            {"completion_tokens", job.n_generated},
+            {"total_tokens", job.prompt.size() + job.n_generated}}},
+      };
+      // Flushed per result: the output file is the checkpoint.
+      output << result.dump() << "\n";
+      output.flush();
+      n_prompt += job.prompt.size();
+      n_generated += job.n_generated;
+      n_done++;
+      const double seconds = (ggml_time_ms() - start_ms) / 1000.0;
+      const json progress = {
+          {"done", n_done},
+          {"total", entries.size()},
+          {"tokens_per_second", seconds > 0 ? n_generated / seconds : 0.0},
+      };
+      callback("", progress.dump().c_str(), false);
+    };
+    error = generator.run(jobs);
+    n_decoded += generator.n_decoded();
+    n_shared += generator.n_shared();
+  }
+
+  const double seconds = (ggml_time_ms() - start_ms) / 1000.0;
+  const json stats = {
+      {"done", n_done},
+      {"total", entries.size()},
+      {"already_done", n_skipped},
+      {"failed", n_failed},
+      {"prompt_tokens", n_prompt},
+      {"completion_tokens", n_generated},
+      {"shared_prefix_tokens", n_shared},
+      {"decoded_tokens", n_decoded},
+      {"seconds", seconds},
+      {"tokens_per_second", seconds > 0 ? n_generated / seconds : 0.0},
+      {"decoded_tokens_per_second", seconds > 0 ? n_decoded / seconds : 0.0},
+  };
+  log_message("Batch: " + stats.dump());
+  if (!error.empty()) {
+    // Finished requests are in the output; the next run resumes from there.
+    const std::string message = "Error: " + error;
+    callback(message.c_str(), stats.dump().c_str(), true);
+    return;
+  }
+  callback("", stats.dump().c_str(), true);
+}
+
+void fllama_batch(struct fllama_batch_request request,
+                  fllama_inference_callback callback) {
+  if (request.model_path == NULL || request.input_path == NULL ||
+      request.output_path == NULL) {
+    callback("Error: A batch needs a model path, an input and an output path.",
+             "", true);
+    return;
+  }
+  const std::string model_path = request.model_path;
+  const std::string input_path = request.input_path;
+  const std::string output_path = request.output_path;
+  request.model_path = NULL;
+  request.input_path = NULL;
+  request.output_path = NULL;
+  global_inference_queue.enqueue_task(
+      [request, model_path, input_path, output_path, callback]() {
+        try {
+          fllama_batch_sync(request, model_path, input_path, output_path,
+                            callback);
+        } catch (const std::exception &e) {
+          const std::string message =
+              std::string("Unhandled error: ") + e.what();
+          callback(message.c_str(), "", true);
+        }
+      },
+      request.request_id, [callback]() { callback("", "", true); });
+}
+
+// Prefills the stable prefix of a chat that is still being typed, see
+// fllama_prefill_hint in fllama.h.
+static void fllama_prefill_hint_sync(const std::string &model_path,
+                                     const std::string &openai_json) {
+  // The model the chat request will use, loaded with the same options.
+  const json body = json::parse(openai_json, nullptr, false);
+  if (body.is_discarded()) {
+    log_message("Prefill hint ignored: the request isn't valid JSON.");
+    return;
+  }
+  const std::string model_key = fllama_model_cache_key(model_path, body);
+  llama_model *model = nullptr;
+  llama_context *ctx = nullptr;
+  std::tie(model, ctx) = global_inference_queue.get_cached_model(model_key);
+  if (model == nullptr || ctx == nullptr) {
+    // Hints are cheap by design; loading a model is not.
+    return;
+  }
+  std::vector<llama_token> *kv_tokens =
+      global_inference_queue.get_kv_tokens(model_key);
+  std::vector<llama_token> tokens;
+  try {
+    const json &messages = body.at("messages");
+    if (kv_tokens == nullptr || !messages.is_array() || messages.empty()) {
+      global_inference_queue.decrement_model_users(model_key);
+      return;
+    }
+    const std::string jinja_template = json_value(body, "jinja_template",
+                                                  std::string());
+    auto chat_templates =
+        fllama_chat_templates_init(model, jinja_template, nullptr);
+    const std::string prompt =
+        common_chat_templates_apply(chat_templates.get(),
+                                    fllama_chat_inputs_from_oaicompat(body))
+            .prompt;
+
+    // The last message's final word may still change, and everything the
+    // template puts after it with it. Stop before that word.
+    const std::string content =
+        json_value(messages.back(), "content", std::string());
+    const size_t content_pos =
+        content.empty() ? std::string::npos : prompt.rfind(content);
+    if (content_pos == std::string::npos || prompt_contains_image(prompt)) {
+      global_inference_queue.decrement_model_users(model_key);
+      return;
+    }
+    const size_t word_start = content.find_last_of(" \n\t");
+    const size_t stable_size =
+        content_pos + (word_start == std::string::npos ? 0 : word_start + 1);
+    const std::string stable_prompt = prompt.substr(0, stable_size);
+
+    const llama_vocab *vocab = llama_model_get_vocab(model);
+    const int n_tokens = -llama_tokenize(vocab, stable_prompt.c_str(),
+                                         stable_prompt.size(), NULL, 0, true,
+                                         true);
+    tokens.resize(std::max(n_tokens, 0));
+    if (n_tokens <= 0 ||
+        llama_tokenize(vocab, stable_prompt.c_str(), stable_prompt.size(),
+                       tokens.data(), tokens.size(), true, true) < 0) {
+      tokens.clear();
+    }
+  } catch (const std::exception &e) {
+    log_message(std::string("Prefill hint ignored: ") + e.what());
+    tokens.clear();
+  }
+  // The last token can merge with text typed after it.
+  if (!tokens.empty()) {
+    tokens.pop_back();
+  }
+  if (tokens.empty() || tokens.size() >= llama_n_ctx(ctx)) {
+    global_inference_queue.decrement_model_users(model_key);
+    return;
+  }
+
+  const size_t n_reused =
+      fllama_kv_tier_swap(model_key, ctx, *kv_tokens, tokens);
+  llama_kv_self_seq_rm(ctx, 0, n_reused, -1);
+  kv_tokens->resize(n_reused);
+  // Small batches, so a request that arrives meanwhile waits for at most
+  // one of them.
+  const size_t chunk_size = 64;
+  size_t n_past = n_reused;
+  while (n_past < tokens.size() && !global_inference_queue.has_pending_tasks()) {
+    const size_t n = std::min(chunk_size, tokens.size() - n_past);
+    if (llama_decode(ctx, llama_batch_get_one(&tokens[n_past], n)) != 0) {
+      break;
+    }
+    kv_tokens->insert(kv_tokens->end(), tokens.begin() + n_past,
+                      tokens.begin() + n_past + n);
+    n_past += n;
+  }
+  log_message("Prefill hint: reused " + std::to_string(n_reused) +
+              ", decoded " + std::to_string(n_past - n_reused) + " of " +
+              std::to_string(tokens.size()) + " tokens.");
+  global_inference_queue.decrement_model_users(model_key);
+}
+
+void fllama_prefill_hint(struct fllama_inference_request request) {
+  if (request.model_path == NULL || request.openai_request_json_string == NULL) {
+    return;
+  }
+  const std::string model_path = request.model_path;
+  const std::string openai_json = request.openai_request_json_string;
+  global_inference_queue.enqueue_background(
+      [model_path, openai_json]() {
+        fllama_prefill_hint_sync(model_path, openai_json);
+      },
+      request.request_id);
+}
@@ -38,8 +38,11 @@ struct fllama_inference_request {
   float top_p; // Optional: 0 < top_p <= 1. Defaults to 1. (llama.cpp behavior)
   float penalty_freq;   // Optional: 0 <= penalty_freq <= 1. Defaults to 0.0,
                         // which means disabled. (llama.cpp behavior)
-  float penalty_repeat; // Optional: 0 <= penalty_repeat <= 1. Defaults to 1.0,
+  float penalty_repeat; // Optional: penalty_repeat >= 1. Defaults to 1.0,
                         // which means disabled. (llama.cpp behavior)
+                        // Both apply to the last 64 generated tokens, or
+                        // "repeat_last_n" in the OpenAI JSON, along with its
+                        // "presence_penalty".
   char *
       grammar; // Optional: BNF-like grammar to constrain sampling. Defaults to
                // "" (llama.cpp behavior). See
@@ -58,6 +61,114 @@ EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void fllama_inference(struct fllama_infer
 EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void fllama_inference_sync(struct fllama_inference_request request,
                            fllama_inference_callback callback);
 EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void fllama_inference_cancel(int request_id);
+// Resumes a request that stopped on max_tokens or was cancelled, generating up
+// to extra_max_tokens more. The callback gets the whole response, including
+// what was generated before. A stopped request is kept for a few minutes, or
+// until a handful of newer ones stopped; resuming it soon after, with no
+// other request in between, doesn't decode the prompt again. Requests whose
+// prompt had images, or that ran in the inference host, can't be continued:
+// the callback gets an error.
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void fllama_inference_continue(int request_id, int extra_max_tokens,
+                                                 fllama_inference_callback callback);
+struct fllama_score_request {
+  int request_id;     // Used for cancellation, like inference requests.
+  int context_size;   // Used if the model isn't cached yet.
+  char *model_path;   // Shares the cached model with inference.
+  int num_gpu_layers; // Used if the model isn't cached yet.
+  char *prompt;       // Decoded once, shared by all candidates.
+  char **candidates;  // Continuations of prompt to score, ex. " positive".
+  int n_candidates;
+};
+// Scores how likely each candidate is to follow the prompt, without
+// generating: for classification and reranking, all labels cost about one
+// forward pass. log_probs[i] gets the sum of candidate i's token
+// log-probabilities and n_tokens[i] its token count; their ratio is the mean.
+// Candidates are tokenized on their own, so give them the leading space they
+// would have after the prompt. Runs on the inference queue and blocks until
+// it is done; called from the queue's own thread, ex. from an inference
+// callback, it runs right away. Returns 0 on success, -1 on error or if
+// cancelled.
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT int fllama_score(struct fllama_score_request request, float *log_probs,
+                                   int *n_tokens);
+struct fllama_summarize_request {
+  int request_id;     // Used for cancellation, like inference requests.
+  int context_size;   // Used if the model isn't cached yet.
+  char *model_path;   // Shares the cached model with inference.
+  int num_gpu_layers; // Used if the model isn't cached yet.
+  char *document;     // Text to summarize, any length.
+  char *instructions; // Optional: what to focus on, ex. "decisions and action
+                      // items". NULL for a general summary.
+  int max_tokens;     // Length of each summary: the parts' and the final one.
+  int n_parallel;     // Optional: parts summarized at once. 0 for 4.
+  float temperature;  // 0 samples greedily.
+};
+// Summarizes a document longer than the context: splits it into parts that
+// fit, summarizes several parts at once as separate sequences of one batch,
+// then summarizes the summaries, again if need be. While parts are summarized
+// the callback gets an empty response and progress JSON, ex.
+// {"stage":"map","level":0,"parts":12,"parts_done":3}; the final summary then
+// streams like an inference response, and the done callback's JSON reports
+// the totals and tokens_per_second. Runs on the inference queue; cancel with
+// fllama_inference_cancel(request_id). Strings are copied before returning.
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void fllama_summarize(struct fllama_summarize_request request,
+                                        fllama_inference_callback callback);
+struct fllama_batch_request {
+  int request_id;     // Used for cancellation, like inference requests.
+  int context_size;   // Used if the model isn't cached yet.
+  char *model_path;   // Shares the cached model with inference.
+  int num_gpu_layers; // Used if the model isn't cached yet.
+  char *input_path;   // JSONL, one OpenAI-style chat request per line.
+  char *output_path;  // JSONL results, appended to.
+  int max_tokens;     // For requests without max_tokens.
+  int n_parallel;     // Optional: sequences decoded together. 0 for 8.
+  float temperature;  // For all requests. 0 samples greedily.
+};
+// Offline batch inference: runs every chat request in input_path and writes
+// one line per request to output_path, with its "id" (the request's
+// "custom_id" or "id", else "line-N"), "content", "finish_reason" and
+// "usage", or an "error". Requests are sorted by prompt length and run many
+// sequences per batch, sharing common prompt prefixes. Lines already in the
+// output file without an error are skipped, so an interrupted batch resumes
+// where it stopped; failed requests are retried, but their error is written
+// once. The callback gets progress JSON after each request, and
+// the totals including tokens_per_second when done. Runs on the inference
+// queue; cancel with fllama_inference_cancel(request_id). Strings are copied
+// before returning. The fllama_batch command line tool wraps this.
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void fllama_batch(struct fllama_batch_request request,
+                                    fllama_inference_callback callback);
+// Type-ahead prefill: call with the chat so far while the user is still
+// composing the last message. The prompt up to the word being typed is
+// decoded into the cached model's KV cache at low priority, so the request
+// that sends the message only decodes the last few tokens. Only model_path and
+// openai_request_json_string are used, and the model must already be loaded.
+// request_id identifies the composing session: a newer hint replaces one that
+// hasn't started. Returns immediately.
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void fllama_prefill_hint(struct fllama_inference_request request);
+// Memory pressure levels for fllama_trim_memory; each includes the ones below.
+enum fllama_trim_level {
+  FLLAMA_TRIM_NONE = 0,     // Pressure is over: resumes paused work.
+  FLLAMA_TRIM_MODERATE = 1, // Tokenizer caches, idle models' KV caches.
+  FLLAMA_TRIM_SEVERE = 2,   // Idle models, their contexts, compute buffers.
+  FLLAMA_TRIM_CRITICAL = 3, // Pauses queued work, drops parked generations.
+};
+// Releases memory in response to an OS memory warning, without touching the
+// model that is generating. KV caches emptied at MODERATE cost the next
+// request a prefill, which is much cheaper than reloading the weights freed
+// at SEVERE.
+// After CRITICAL, queued requests wait until fllama_trim_memory(
+// FLLAMA_TRIM_NONE); the running one finishes. Returns the bytes the process
+// footprint shrank by, 0 where it can't be measured.
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT int64_t fllama_trim_memory(int level);
+// Keeps the KV cache of conversations a loaded model moves on from, so going
+// back to one, e.g. switching chat threads, doesn't decode its history again.
+// Up to ram_budget_bytes stay in memory; the least recently used, and any
+// unused for idle_seconds (0: no limit), are written to files in cache_dir,
+// up to disk_budget_bytes, and read back on next use. cache_dir is the app's
+// own cache directory: files there from earlier runs are deleted. A NULL
+// cache_dir keeps snapshots in memory only. ram_budget_bytes 0, the default,
+// disables this and drops everything kept.
+EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT void fllama_kv_tier_configure(const char *cache_dir, int64_t ram_budget_bytes,
+                                                                   int64_t disk_budget_bytes, int idle_seconds);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,191 @@
+#include "fllama_backend.h"
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/ggml/include/ggml-backend.h"
+#include "../ios/llama.cpp/include/llama.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/ggml/include/ggml-backend.h"
+#include "../macos/llama.cpp/include/llama.h"
+#else
+#include "llama.cpp/ggml/include/ggml-backend.h"
+#include "llama.cpp/include/llama.h"
+#endif
+
+#ifdef __EMSCRIPTEN__
+#include "llama.cpp/ggml/include/ggml-cpu.h"
+#include <emscripten/threading.h>
+
+// Threads the module's pthread pool has room for, besides the inference
+// queue's two. Set by build-wasm.sh.
+#ifndef FLLAMA_WASM_THREADS
+#define FLLAMA_WASM_THREADS 8
+#endif
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#include <dlfcn.h>
+#endif
+
+static std::once_flag fllama_backend_once;
+static std::string fllama_backend_cpu_desc = "unknown";
+
+// Path of the shared library containing addr, empty if it cannot be found.
+static std::string fllama_backend_module_path(const void *addr) {
+#if defined(_WIN32)
+  HMODULE module = NULL;
+  if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                              GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                          (LPCSTR)addr, &module)) {
+    return "";
+  }
+  char path[MAX_PATH];
+  const DWORD n = GetModuleFileNameA(module, path, MAX_PATH);
+  return n > 0 && n < MAX_PATH ? std::string(path, n) : "";
+#elif !defined(__EMSCRIPTEN__)
+  Dl_info info;
+  if (dladdr(addr, &info) == 0 || info.dli_fname == nullptr) {
+    return "";
+  }
+  return info.dli_fname;
+#else
+  (void)addr;
+  return "";
+#endif
+}
+
+static std::string fllama_backend_dirname(const std::string &path) {
+  const size_t sep = path.find_last_of("/\\");
+  return sep == std::string::npos ? "" : path.substr(0, sep);
+}
+
+#ifdef GGML_BACKEND_DL
+// Name of a backend module, ex. "ggml-cpu-haswell".
+static std::string fllama_backend_basename(const std::string &path) {
+  const size_t sep = path.find_last_of("/\\");
+  std::string name = sep == std::string::npos ? path : path.substr(sep + 1);
+  if (name.rfind("lib", 0) == 0) {
+    name = name.substr(3);
+  }
+  const size_t dot = name.rfind('.');
+  return dot == std::string::npos ? name : name.substr(0, dot);
+}
+#endif
+
+static std::string fllama_backend_describe_cpu() {
+  ggml_backend_dev_t dev =
+      ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+  if (dev == nullptr) {
+    return "no CPU backend";
+  }
+  ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+  auto get_features = (ggml_backend_get_features_t)
+      ggml_backend_reg_get_proc_address(reg, "ggml_backend_get_features");
+
+  std::string desc = "ggml-cpu";
+#ifdef GGML_BACKEND_DL
+  // The variant is the module the registry function was loaded from.
+  if (get_features != nullptr) {
+    const std::string module =
+        fllama_backend_module_path((const void *)get_features);
+    if (!module.empty()) {
+      desc = fllama_backend_basename(module);
+    }
+  }
+#endif
+
+  if (get_features != nullptr) {
+    std::string features;
+    for (ggml_backend_feature *f = get_features(reg); f->name; f++) {
+      if (strcmp(f->value, "1") != 0) {
+        continue;
+      }
+      features += features.empty() ? "" : " ";
+      features += f->name;
+    }
+    if (!features.empty()) {
+      desc += " (" + features + ")";
+    }
+  }
+  return desc;
+}
+
+void fllama_backend_load_all() {
+  std::call_once(fllama_backend_once, [] {
+#ifdef GGML_BACKEND_DL
+    // ggml only searches the executable's directory and the working
+    // directory. Flutter bundles put the modules next to libfllama instead
+    // (bundle/lib on Linux, the app's native library dir on Android).
+    const std::string dir = fllama_backend_library_dir();
+    if (!dir.empty()) {
+      ggml_backend_load_all_from_path(dir.c_str());
+    }
+    if (ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU) == nullptr) {
+      ggml_backend_load_all();
+    }
+#else
+    ggml_backend_load_all();
+#endif
+    fllama_backend_cpu_desc = fllama_backend_describe_cpu();
+    std::cout << "[fllama] CPU backend: " << fllama_backend_cpu_desc
+              << std::endl;
+  });
+}
+
+const std::string &fllama_backend_cpu_description() {
+  return fllama_backend_cpu_desc;
+}
+
+std::string fllama_backend_library_dir() {
+  return fllama_backend_dirname(
+      fllama_backend_module_path((const void *)&fllama_backend_library_dir));
+}
+
+bool fllama_backend_use_mmap() {
+#ifdef __EMSCRIPTEN__
+  return false;
+#else
+  return true;
+#endif
+}
+
+int fllama_backend_attach_threadpool(llama_context *ctx,
+                                     int requested_threads) {
+#ifdef __EMSCRIPTEN__
+  static const int n_max = std::max(
+      1, std::min(FLLAMA_WASM_THREADS, emscripten_num_logical_cores()));
+  // Never freed: its workers are parked in the pthread pool either way.
+  static ggml_threadpool *threadpool = [] {
+    ggml_threadpool_params params = ggml_threadpool_params_default(n_max);
+    return ggml_threadpool_new(&params);
+  }();
+  if (ctx == nullptr || threadpool == nullptr) {
+    return 0;
+  }
+  const int n_threads =
+      requested_threads > 0 ? std::min(requested_threads, n_max) : n_max;
+  llama_set_n_threads(ctx, n_threads, n_threads);
+  llama_attach_threadpool(ctx, threadpool, threadpool);
+  return n_threads;
+#else
+  (void)ctx;
+  (void)requested_threads;
+  return 0;
+#endif
+}
@@ -0,0 +1,42 @@
+#ifndef FLLAMA_BACKEND_H
+#define FLLAMA_BACKEND_H
+
+#include <string>
+
+struct llama_context;
+
+// Registers the ggml backends once per process.
+//
+// With FLLAMA_CPU_ALL_VARIANTS (GGML_BACKEND_DL) the CPU backend ships as one
+// module per ISA level next to libfllama, e.g. libggml-cpu-haswell.so or
+// libggml-cpu-armv8_6.so, and ggml loads the highest scoring one the CPU
+// supports. Static builds (iOS, macOS, web) have their backends linked in.
+void fllama_backend_load_all();
+
+// The CPU backend in use, e.g. "ggml-cpu-haswell (SSE3 SSSE3 AVX AVX2 F16C
+// FMA BMI2)". Used in logs and as the response's system_fingerprint.
+const std::string &fllama_backend_cpu_description();
+
+// Directory of the library fllama is linked into, empty if unknown.
+std::string fllama_backend_library_dir();
+
+// Whether to mmap model files. Not on the web: there files live in MEMFS,
+// WORKERFS or NODEFS, where an mmap copies the whole file into the wasm heap
+// or isn't supported at all. Without it llama.cpp reads each tensor straight
+// into its buffer, a chunk at a time, so the weights are in memory once.
+bool fllama_backend_use_mmap();
+
+// On the web, runs ctx on a process-wide ggml threadpool with
+// requested_threads threads, or all of them if <= 0. Its workers come from
+// the pthread pool the module starts with (FLLAMA_WASM_THREADS, see
+// build-wasm.sh): threads created during a request would wait for the
+// blocked calling thread to start them, and a pool spawned per graph costs a
+// worker round trip every decoded token.
+//
+// Native contexts keep llama.cpp's own threads, so this does nothing there.
+// Returns the threads ctx runs on, 0 if it keeps its own. Callers log it with
+// the request's log callback.
+int fllama_backend_attach_threadpool(llama_context *ctx,
+                                     int requested_threads);
+
+#endif // FLLAMA_BACKEND_H
@@ -0,0 +1,145 @@
+// fllama_batch: offline batch inference over a JSONL file of chat requests,
+// see fllama_batch in fllama.h.
+//
+//   fllama_batch -m model.gguf -i requests.jsonl -o results.jsonl [-np 8]
+//
+// Each input line is an OpenAI-style chat completion request, optionally with
+// a "custom_id". Results are appended to the output as they finish; running
+// the same command again after an interruption skips the finished requests.
+
+#include "fllama.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+struct BatchParams {
+  std::string model_path;
+  std::string input_path;
+  std::string output_path;
+  int context_size = 4096;
+  int num_gpu_layers = 99;
+  int n_parallel = 8;
+  int max_tokens = 512;
+  float temperature = 0.0f;
+};
+
+static std::mutex batch_mutex;
+static std::condition_variable batch_finished;
+static bool batch_done = false;
+static int batch_exit_code = 0;
+
+static const int batch_request_id = 1;
+
+// Set by the signal handler, which can't take the inference queue's locks;
+// main cancels the batch when it sees it.
+static volatile sig_atomic_t batch_interrupted = 0;
+
+static void signal_handler(int) { batch_interrupted = 1; }
+
+static void batch_callback(const char *response, const char *json,
+                           uint8_t done) {
+  if (response != nullptr && response[0] != '\0') {
+    fprintf(stderr, "%s\n", response);
+  }
+  if (!done) {
+    fprintf(stderr, "\r[fllama_batch] %s", json);
+    fflush(stderr);
+    return;
+  }
+  if (json != nullptr && json[0] != '\0') {
+    fprintf(stderr, "\n");
+    printf("%s\n", json);
+  }
+  std::lock_guard<std::mutex> lock(batch_mutex);
+  batch_exit_code = response != nullptr && response[0] != '\0' ? 1 : 0;
+  batch_done = true;
+  batch_finished.notify_all();
+}
+
+static void print_usage(const char *argv0) {
+  fprintf(stderr, "usage: %s -m MODEL -i INPUT -o OUTPUT [options]\n\n", argv0);
+  fprintf(stderr, "  -m,  --model PATH        model file (.gguf)\n");
+  fprintf(stderr, "  -i,  --input PATH        JSONL chat requests\n");
+  fprintf(stderr, "  -o,  --output PATH       JSONL results, appended to\n");
+  fprintf(stderr, "  -c,  --ctx-size N        context size (default: 4096)\n");
+  fprintf(stderr, "  -np, --parallel N        sequences decoded together (default: 8)\n");
+  fprintf(stderr, "  -n,  --max-tokens N      for requests without max_tokens (default: 512)\n");
+  fprintf(stderr, "       --temp T            sampling temperature (default: 0, greedy)\n");
+  fprintf(stderr, "  -ngl,--n-gpu-layers N    layers to offload (default: 99)\n");
+}
+
+static bool parse_args(int argc, char **argv, BatchParams &params) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto next = [&]() -> const char * {
+      return i + 1 < argc ? argv[++i] : nullptr;
+    };
+    const char *value = nullptr;
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if ((arg == "-m" || arg == "--model") && (value = next())) {
+      params.model_path = value;
+    } else if ((arg == "-i" || arg == "--input") && (value = next())) {
+      params.input_path = value;
+    } else if ((arg == "-o" || arg == "--output") && (value = next())) {
+      params.output_path = value;
+    } else if ((arg == "-c" || arg == "--ctx-size") && (value = next())) {
+      params.context_size = atoi(value);
+    } else if ((arg == "-np" || arg == "--parallel") && (value = next())) {
+      params.n_parallel = atoi(value);
+    } else if ((arg == "-n" || arg == "--max-tokens") && (value = next())) {
+      params.max_tokens = atoi(value);
+    } else if (arg == "--temp" && (value = next())) {
+      params.temperature = (float)atof(value);
+    } else if ((arg == "-ngl" || arg == "--n-gpu-layers") &&
+               (value = next())) {
+      params.num_gpu_layers = atoi(value);
+    } else {
+      fprintf(stderr, "error: invalid argument: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return !params.model_path.empty() && !params.input_path.empty() &&
+         !params.output_path.empty();
+}
+
+int main(int argc, char **argv) {
+  BatchParams params;
+  if (!parse_args(argc, argv, params)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  signal(SIGINT, signal_handler);
+  signal(SIGTERM, signal_handler);
+
+  fllama_batch_request request = {};
+  request.request_id = batch_request_id;
+  request.context_size = params.context_size;
+  request.model_path = (char *)params.model_path.c_str();
+  request.num_gpu_layers = params.num_gpu_layers;
+  request.input_path = (char *)params.input_path.c_str();
+  request.output_path = (char *)params.output_path.c_str();
+  request.max_tokens = params.max_tokens;
+  request.n_parallel = params.n_parallel;
+  request.temperature = params.temperature;
+  fllama_batch(request, batch_callback);
+
+  std::unique_lock<std::mutex> lock(batch_mutex);
+  bool cancelled = false;
+  while (!batch_finished.wait_for(lock, std::chrono::milliseconds(100),
+                                  [] { return batch_done; })) {
+    if (batch_interrupted && !cancelled) {
+      // Finished results are already in the output file.
+      cancelled = true;
+      lock.unlock();
+      fllama_inference_cancel(batch_request_id);
+      lock.lock();
+    }
+  }
+  return batch_exit_code;
+}
@@ -0,0 +1,109 @@
+#include "fllama_continue.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+static const int FLLAMA_PARKED_TTL_SEC = 300;
+static const size_t FLLAMA_PARKED_MAX = 8;
+
+static std::mutex parked_lock;
+static std::map<int, std::unique_ptr<FllamaParkedGeneration>> parked;
+
+static std::string fllama_parked_string(const char *s) {
+  return s == NULL ? std::string() : std::string(s);
+}
+
+static const char *fllama_parked_c_str(const std::string &s) {
+  return s.empty() ? NULL : s.c_str();
+}
+
+FllamaParkedGeneration::FllamaParkedGeneration(
+    const fllama_inference_request &request,
+    const FllamaReasoningBudget &reasoning_budget)
+    : request(request), model_path(fllama_parked_string(request.model_path)),
+      model_mmproj_path(fllama_parked_string(request.model_mmproj_path)),
+      input(fllama_parked_string(request.input)),
+      grammar(fllama_parked_string(request.grammar)),
+      openai_request_json_string(
+          fllama_parked_string(request.openai_request_json_string)),
+      reasoning_budget(reasoning_budget),
+      parked_at(std::chrono::steady_clock::now()) {
+  this->request.input = NULL;
+  this->request.model_path = NULL;
+  this->request.model_mmproj_path = NULL;
+  this->request.grammar = NULL;
+  this->request.eos_token = NULL;
+  this->request.openai_request_json_string = NULL;
+  // The Dart logger may be gone by the time the generation is resumed.
+  this->request.dart_logger = NULL;
+}
+
+FllamaParkedGeneration::~FllamaParkedGeneration() {
+  if (sampler != nullptr) {
+    llama_sampler_free(sampler);
+  }
+}
+
+fllama_inference_request
+FllamaParkedGeneration::resume_request(int extra_max_tokens) const {
+  fllama_inference_request resumed = request;
+  resumed.model_path = (char *)fllama_parked_c_str(model_path);
+  resumed.model_mmproj_path = (char *)fllama_parked_c_str(model_mmproj_path);
+  resumed.input = (char *)input.c_str();
+  resumed.grammar = (char *)fllama_parked_c_str(grammar);
+  resumed.eos_token = strdup(eos_token.c_str());
+  resumed.openai_request_json_string =
+      (char *)fllama_parked_c_str(openai_request_json_string);
+  resumed.max_tokens = n_gen + extra_max_tokens;
+  return resumed;
+}
+
+static void fllama_expire_parked_generations() {
+  const auto now = std::chrono::steady_clock::now();
+  for (auto it = parked.begin(); it != parked.end();) {
+    if (now - it->second->parked_at >
+        std::chrono::seconds(FLLAMA_PARKED_TTL_SEC)) {
+      it = parked.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void fllama_park_generation(
+    int request_id, std::unique_ptr<FllamaParkedGeneration> generation) {
+  std::lock_guard<std::mutex> lock(parked_lock);
+  fllama_expire_parked_generations();
+  parked[request_id] = std::move(generation);
+  while (parked.size() > FLLAMA_PARKED_MAX) {
+    auto oldest = parked.begin();
+    for (auto it = parked.begin(); it != parked.end(); ++it) {
+      if (it->second->parked_at < oldest->second->parked_at) {
+        oldest = it;
+      }
+    }
+    parked.erase(oldest);
+  }
+}
+
+std::unique_ptr<FllamaParkedGeneration>
+fllama_take_parked_generation(int request_id) {
+  std::lock_guard<std::mutex> lock(parked_lock);
+  fllama_expire_parked_generations();
+  auto it = parked.find(request_id);
+  if (it == parked.end()) {
+    return nullptr;
+  }
+  std::unique_ptr<FllamaParkedGeneration> generation = std::move(it->second);
+  parked.erase(it);
+  return generation;
+}
+
+int fllama_clear_parked_generations() {
+  std::lock_guard<std::mutex> lock(parked_lock);
+  const int cleared = (int)parked.size();
+  parked.clear();
+  return cleared;
+}
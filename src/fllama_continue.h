@@ -0,0 +1,62 @@
+#ifndef FLLAMA_CONTINUE_H
+#define FLLAMA_CONTINUE_H
+
+#include "fllama.h"
+#include "fllama_reasoning.h"
+#include "llama.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A generation that stopped on max_tokens or a cancel, kept so
+// fllama_inference_continue can pick it up where it left off. The KV cache
+// isn't copied: it stays in the cached model's context, and resuming only
+// decodes what a later request replaced there.
+struct FllamaParkedGeneration {
+  // The request's settings; its strings are owned by the fields below.
+  fllama_inference_request request = {};
+  std::string model_path;
+  std::string model_mmproj_path;
+  std::string input;
+  std::string grammar;
+  std::string eos_token;
+  std::string openai_request_json_string;
+
+  // Prompt and generated tokens, as decoded into the KV cache.
+  std::vector<llama_token> tokens;
+  // Sampled when generation stopped, but not decoded or emitted yet.
+  llama_token next_token = LLAMA_TOKEN_NULL;
+  // Sampled after next_token by a lookahead step and accepted by the
+  // sampler, but not emitted yet; they come out first when resumed.
+  std::vector<llama_token> pending_tokens;
+  // Owned. Keeps the RNG and any penalty history going.
+  llama_sampler *sampler = nullptr;
+  FllamaReasoningBudget reasoning_budget;
+  std::string result;
+  int n_gen = 0;
+  int n_prompt_tokens = 0;
+  std::chrono::steady_clock::time_point parked_at;
+
+  FllamaParkedGeneration(const fllama_inference_request &request,
+                         const FllamaReasoningBudget &reasoning_budget);
+  ~FllamaParkedGeneration();
+  FllamaParkedGeneration(const FllamaParkedGeneration &) = delete;
+  FllamaParkedGeneration &operator=(const FllamaParkedGeneration &) = delete;
+
+  // The request to resume with, generating up to extra_max_tokens more. Its
+  // eos_token is malloc'd, fllama_inference_sync frees it.
+  fllama_inference_request resume_request(int extra_max_tokens) const;
+};
+
+// Parked generations expire after a few minutes; beyond a handful, the
+// oldest is dropped.
+void fllama_park_generation(int request_id,
+                            std::unique_ptr<FllamaParkedGeneration> generation);
+// Removes and returns the generation parked for request_id, or null.
+std::unique_ptr<FllamaParkedGeneration> fllama_take_parked_generation(int request_id);
+// Drops every parked generation, ex. under memory pressure. Returns how many.
+int fllama_clear_parked_generations();
+
+#endif // FLLAMA_CONTINUE_H
@@ -0,0 +1,50 @@
+#ifndef FLLAMA_CPP_H
+#define FLLAMA_CPP_H
+
+// C++ entry points for hosts that link libfllama directly, such as
+// fllama_server. Unlike the FFI functions in fllama.h, the handlers carry
+// their own state, so many callers can share the inference queue and its
+// cached models. Not part of the Dart bindings.
+
+#include "fllama.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Exported for FFI in fllama.cpp, without a declaration in fllama.h.
+extern "C" FFI_PLUGIN_EXPORT void fllama_clear_model_cache(bool force_clear);
+
+// Same arguments as fllama_inference_callback.
+typedef std::function<void(const char *response,
+                           const char *openai_response_json_string,
+                           bool done)>
+    fllama_inference_handler;
+
+// Like fllama_inference: runs on the inference queue and calls the handler on
+// its worker thread. The request's strings must stay valid until the handler
+// is called with done, or until the request is cancelled.
+FFI_PLUGIN_EXPORT void
+fllama_inference_enqueue(struct fllama_inference_request request,
+                         fllama_inference_handler handler);
+
+struct fllama_embedding_request {
+  int request_id;          // Used for cancellation, like inference requests.
+  std::string model_path;  // Shares the cached model with inference.
+  int context_size;        // Used if the model isn't cached yet.
+  int num_gpu_layers;      // Used if the model isn't cached yet.
+  std::vector<std::string> inputs;
+};
+
+// One L2-normalized vector per input. error is empty on success.
+typedef std::function<void(const std::vector<std::vector<float>> &embeddings,
+                           int n_prompt_tokens, const std::string &error)>
+    fllama_embedding_handler;
+
+// Computes embeddings on the inference queue. Models with a pooling layer use
+// it, others are mean-pooled over the input's tokens.
+FFI_PLUGIN_EXPORT void
+fllama_embedding_enqueue(fllama_embedding_request request,
+                         fllama_embedding_handler handler);
+
+#endif // FLLAMA_CPP_H
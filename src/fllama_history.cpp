@@ -0,0 +1,135 @@
+#include "fllama_history.h"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+// Token counts by vocabulary and text. A collision only skews an estimate
+// that refit checks against the rendered prompt.
+static std::mutex history_mutex;
+static std::unordered_map<size_t, int> history_message_tokens;
+// Tokens the template added around each message in the last render, on
+// average, by model.
+static std::unordered_map<std::string, int> history_template_tokens;
+static const size_t kHistoryMaxCachedMessages = 16384;
+
+void fllama_history_clear_cache() {
+  std::lock_guard<std::mutex> lock(history_mutex);
+  history_message_tokens.clear();
+  history_template_tokens.clear();
+}
+
+FllamaHistoryTrim::FllamaHistoryTrim(const std::string &model_key,
+                                     const llama_vocab *vocab, int budget)
+    : model_key(model_key), vocab(vocab), n_budget(budget) {}
+
+int FllamaHistoryTrim::message_tokens(const common_chat_msg &msg) {
+  std::string text = msg.content + msg.reasoning_content;
+  for (const common_chat_msg_content_part &part : msg.content_parts) {
+    text += part.text;
+  }
+  for (const common_chat_tool_call &call : msg.tool_calls) {
+    text += call.name + call.arguments;
+  }
+  const size_t key = std::hash<std::string>()(text) ^
+                     std::hash<const void *>()(vocab) * 31;
+  {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    auto it = history_message_tokens.find(key);
+    if (it != history_message_tokens.end()) {
+      return it->second;
+    }
+  }
+  const int n_tokens = -llama_tokenize(vocab, text.c_str(), text.size(),
+                                       nullptr, 0, false, true);
+  std::lock_guard<std::mutex> lock(history_mutex);
+  if (history_message_tokens.size() >= kHistoryMaxCachedMessages) {
+    history_message_tokens.clear();
+  }
+  history_message_tokens[key] = n_tokens;
+  return n_tokens;
+}
+
+int FllamaHistoryTrim::content_tokens(
+    const common_chat_templates_inputs &inputs) {
+  int n_tokens = 0;
+  for (const common_chat_msg &msg : inputs.messages) {
+    n_tokens += message_tokens(msg);
+  }
+  return n_tokens;
+}
+
+void FllamaHistoryTrim::fit(common_chat_templates_inputs &inputs) {
+  {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    auto it = history_template_tokens.find(model_key);
+    if (it != history_template_tokens.end()) {
+      n_template = it->second;
+    }
+  }
+  const int estimate =
+      content_tokens(inputs) + n_template * (int)inputs.messages.size();
+  if (estimate > n_budget) {
+    drop(inputs, estimate - n_budget);
+  }
+}
+
+bool FllamaHistoryTrim::refit(common_chat_templates_inputs &inputs,
+                              int n_tokens) {
+  n_renders++;
+  if (!inputs.messages.empty()) {
+    // Includes what the template adds once, like tool definitions, so it
+    // overestimates what dropping a message saves; the next render tells.
+    n_template = std::max(n_tokens - content_tokens(inputs), 0) /
+                 (int)inputs.messages.size();
+    std::lock_guard<std::mutex> lock(history_mutex);
+    history_template_tokens[model_key] = n_template;
+  }
+  return n_tokens > n_budget && drop(inputs, n_tokens - n_budget);
+}
+
+bool FllamaHistoryTrim::drop(common_chat_templates_inputs &inputs,
+                             int excess) {
+  std::vector<common_chat_msg> &messages = inputs.messages;
+  // The newest turn starts at the last user message.
+  size_t newest = messages.empty() ? 0 : messages.size() - 1;
+  for (size_t i = messages.size(); i-- > 0;) {
+    if (messages[i].role == "user") {
+      newest = i;
+      break;
+    }
+  }
+
+  std::vector<bool> dropped(messages.size(), false);
+  bool any = false;
+  size_t i = 0;
+  while (excess > 0 && i < newest) {
+    if (messages[i].role == "system") {
+      i++;
+      continue;
+    }
+    // One turn: up to the next user message.
+    do {
+      if (messages[i].role != "system") {
+        dropped[i] = true;
+        excess -= message_tokens(messages[i]) + n_template;
+        n_dropped++;
+        any = true;
+      }
+      i++;
+    } while (i < newest && messages[i].role != "user");
+  }
+  if (!any) {
+    return false;
+  }
+  std::vector<common_chat_msg> kept;
+  kept.reserve(messages.size());
+  for (size_t j = 0; j < messages.size(); j++) {
+    if (!dropped[j]) {
+      kept.push_back(std::move(messages[j]));
+    }
+  }
+  messages = std::move(kept);
+  return true;
+}
@@ -0,0 +1,64 @@
+#ifndef FLLAMA_HISTORY_H
+#define FLLAMA_HISTORY_H
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/common/chat.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/common/chat.h"
+#else
+#include "llama.cpp/common/chat.h"
+#endif
+
+#include <string>
+
+// Drops the oldest turns of a chat so its prompt fits in a token budget,
+// instead of the request failing once the prompt is tokenized. System
+// messages and the newest turn are always kept; a turn is a user message and
+// the assistant and tool messages answering it, dropped together so tool
+// results never lose their call.
+//
+// Each message's tokens are counted once and cached across requests, and the
+// tokens the template adds around them are remembered per model, so a
+// conversation that has grown too long is usually trimmed before its first
+// render.
+class FllamaHistoryTrim {
+public:
+  FllamaHistoryTrim(const std::string &model_key, const llama_vocab *vocab,
+                    int budget);
+
+  // Before rendering: drops the turns the cached counts say can't fit.
+  void fit(common_chat_templates_inputs &inputs);
+
+  // After rendering inputs into n_tokens tokens. Returns true if more turns
+  // were dropped and inputs should be rendered again; false if it fits, or
+  // nothing more can be dropped.
+  bool refit(common_chat_templates_inputs &inputs, int n_tokens);
+
+  int budget() const { return n_budget; }
+  int dropped() const { return n_dropped; }
+  int renders() const { return n_renders; }
+
+private:
+  int message_tokens(const common_chat_msg &msg);
+  int content_tokens(const common_chat_templates_inputs &inputs);
+  // Drops the oldest turns until their messages add up to excess tokens.
+  // Returns false if there were none to drop.
+  bool drop(common_chat_templates_inputs &inputs, int excess);
+
+  std::string model_key;
+  const llama_vocab *vocab;
+  int n_budget;
+  // Tokens the template adds per message, on average.
+  int n_template = 0;
+  int n_dropped = 0;
+  int n_renders = 0;
+};
+
+// Frees the cached message token counts.
+void fllama_history_clear_cache();
+
+#endif // FLLAMA_HISTORY_H
@@ -0,0 +1,922 @@
+#include "fllama_host.h"
+#include "fllama_backend.h"
+#include "fllama_cpp.h"
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/common/json.hpp"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/common/json.hpp"
+#else
+#include "llama.cpp/common/json.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#if (defined(__linux__) && !defined(__ANDROID__)) || TARGET_OS_OSX
+#define FLLAMA_HOST_SUPPORTED 1
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using json = nlohmann::ordered_json;
+
+#ifdef FLLAMA_HOST_SUPPORTED
+
+// Shared-memory ring, one per request. The host writes records, the client
+// reads them; positions only grow and are taken modulo the capacity.
+struct FllamaHostRing {
+  std::atomic<uint64_t> write_pos;
+  std::atomic<uint64_t> read_pos;
+  // Set by the client before it blocks on the socket. The host only sends a
+  // wakeup byte when it sees this, so a client that keeps up is never woken.
+  std::atomic<uint32_t> reader_waiting;
+  uint32_t capacity;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the ring's positions are shared between processes");
+
+static const size_t FLLAMA_HOST_RING_CAPACITY = 1 << 20;
+static const size_t FLLAMA_HOST_RING_OFFSET = 64;
+static const size_t FLLAMA_HOST_RING_SIZE =
+    FLLAMA_HOST_RING_OFFSET + FLLAMA_HOST_RING_CAPACITY;
+// Upper bound for a request frame, which includes the chat messages.
+static const uint32_t FLLAMA_HOST_MAX_REQUEST = 256u << 20;
+// Marks a record's JSON as unchanged since the previous record.
+static const uint32_t FLLAMA_HOST_JSON_UNCHANGED = 0xFFFFFFFFu;
+// The inference worker is shared by all clients, so it only waits this long
+// for a full ring to make room for a partial update; one that doesn't fit is
+// dropped, and the next record carries its text.
+static const auto FLLAMA_HOST_PARTIAL_WAIT = std::chrono::milliseconds(5);
+// The final record is written by the client's connection thread, which gives
+// up on a client that reads nothing for this long.
+static const auto FLLAMA_HOST_STALL_TIMEOUT = std::chrono::seconds(10);
+
+// Socket messages. Client to host: the request frame, then CANCEL. Host to
+// client: READY with the ring's fd or REJECTED, then WAKE bytes.
+static const char FLLAMA_HOST_READY = 'R';
+static const char FLLAMA_HOST_REJECTED = 'E';
+static const char FLLAMA_HOST_WAKE = 'W';
+static const char FLLAMA_HOST_CANCEL = 'C';
+
+#ifdef MSG_NOSIGNAL
+static const int FLLAMA_HOST_SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int FLLAMA_HOST_SEND_FLAGS = 0;
+#endif
+
+static std::atomic<bool> fllama_host_stopping(false);
+
+static bool fllama_host_send_all(int fd, const void *data, size_t n) {
+  const char *p = (const char *)data;
+  while (n > 0) {
+    const ssize_t sent = send(fd, p, n, FLLAMA_HOST_SEND_FLAGS);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    p += sent;
+    n -= (size_t)sent;
+  }
+  return true;
+}
+
+static bool fllama_host_recv_all(int fd, void *data, size_t n) {
+  char *p = (char *)data;
+  while (n > 0) {
+    const ssize_t got = recv(fd, p, n, 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    p += got;
+    n -= (size_t)got;
+  }
+  return true;
+}
+
+// Sends one byte, with fd attached if it isn't -1.
+static bool fllama_host_send_byte(int sock, char byte, int fd) {
+  struct iovec iov = {&byte, 1};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  char control[CMSG_SPACE(sizeof(int))] = {};
+  if (fd >= 0) {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  ssize_t sent;
+  do {
+    sent = sendmsg(sock, &msg, FLLAMA_HOST_SEND_FLAGS);
+  } while (sent < 0 && errno == EINTR);
+  return sent == 1;
+}
+
+static bool fllama_host_recv_byte(int sock, char &byte, int &fd) {
+  fd = -1;
+  struct iovec iov = {&byte, 1};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  char control[CMSG_SPACE(sizeof(int))] = {};
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t got;
+  do {
+    got = recvmsg(sock, &msg, 0);
+  } while (got < 0 && errno == EINTR);
+  if (got != 1) {
+    return false;
+  }
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  return true;
+}
+
+static FllamaHostRing *fllama_host_map_ring(int fd) {
+  void *addr = mmap(nullptr, FLLAMA_HOST_RING_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  return addr == MAP_FAILED ? nullptr : (FllamaHostRing *)addr;
+}
+
+static char *fllama_host_ring_data(FllamaHostRing *ring) {
+  return (char *)ring + FLLAMA_HOST_RING_OFFSET;
+}
+
+// Anonymous shared memory: the name is unlinked right away and the fd is
+// passed over the socket.
+static int fllama_host_create_shm() {
+  static std::atomic<int> counter(0);
+  const std::string name = "/fllama-" + std::to_string(getpid()) + "-" +
+                           std::to_string(counter++);
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return -1;
+  }
+  shm_unlink(name.c_str());
+  if (ftruncate(fd, FLLAMA_HOST_RING_SIZE) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void fllama_host_append_u32(std::string &out, uint32_t value) {
+  out.append((const char *)&value, sizeof(value));
+}
+
+std::string fllama_host_default_socket_path() {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir != nullptr && runtime_dir[0] != '\0') {
+    return std::string(runtime_dir) + "/fllama.sock";
+  }
+  // Like XDG_RUNTIME_DIR, a directory only this user can enter, so nobody
+  // else can put a socket or a log file where the client looks.
+  const std::string dir = "/tmp/fllama-" + std::to_string(geteuid());
+  if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+    return "";
+  }
+  struct stat st;
+  if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & 0077) != 0) {
+    std::cerr << "[fllama_host] " << dir
+              << " isn't a directory private to this user." << std::endl;
+    return "";
+  }
+  return dir + "/fllama.sock";
+}
+
+// Whether the process on the other end of a connected Unix socket runs as
+// this user: a host or client of anyone else could read or forge the
+// conversation.
+static bool fllama_host_peer_is_same_user(int fd) {
+#if defined(SO_PEERCRED)
+  struct ucred cred = {};
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+    return false;
+  }
+  return cred.uid == geteuid();
+#else
+  uid_t uid = 0;
+  gid_t gid = 0;
+  if (getpeereid(fd, &uid, &gid) != 0) {
+    return false;
+  }
+  return uid == geteuid();
+#endif
+}
+
+static int fllama_host_connect(const std::string &path) {
+  struct sockaddr_un addr = {};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (!fllama_host_peer_is_same_user(fd)) {
+    std::cerr << "[fllama_host] " << path
+              << " is served by another user, not connecting." << std::endl;
+    close(fd);
+    return -1;
+  }
+#ifdef SO_NOSIGPIPE
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  return fd;
+}
+
+// ---------------------------------------------------------------------------
+// Host
+
+// One forwarded request. Shared by the connection thread and the inference
+// handler, which can outlive the connection.
+struct FllamaHostSession {
+  int sock = -1;
+  int host_request_id = 0;
+  FllamaHostRing *ring = nullptr;
+  std::atomic<bool> done{false};
+  std::atomic<bool> client_gone{false};
+
+  // Owned copies of the request's strings.
+  std::string input, model_path, mmproj_path, grammar, eos_token,
+      openai_json;
+  fllama_inference_request request = {};
+
+  // What the client has already been sent.
+  std::string last_response;
+  std::string last_json;
+  bool sent_json = false;
+  // The done record, if it didn't fit in the ring: the connection thread
+  // writes it once done is set.
+  std::string final_record;
+
+  ~FllamaHostSession() {
+    if (ring != nullptr) {
+      munmap(ring, FLLAMA_HOST_RING_SIZE);
+    }
+    if (sock >= 0) {
+      close(sock);
+    }
+  }
+
+  void wake_reader() {
+    if (ring->reader_waiting.exchange(0) != 0) {
+      char byte = FLLAMA_HOST_WAKE;
+      send(sock, &byte, 1, FLLAMA_HOST_SEND_FLAGS | MSG_DONTWAIT);
+    }
+  }
+
+  uint64_t space() const {
+    return ring->capacity -
+           (ring->write_pos.load(std::memory_order_relaxed) -
+            ring->read_pos.load(std::memory_order_acquire));
+  }
+
+  // Waits up to FLLAMA_HOST_PARTIAL_WAIT for room for n bytes.
+  bool wait_for_space(size_t n) {
+    if (n > ring->capacity) {
+      return false;
+    }
+    const auto deadline =
+        std::chrono::steady_clock::now() + FLLAMA_HOST_PARTIAL_WAIT;
+    while (space() < n) {
+      if (client_gone || std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      wake_reader();
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return true;
+  }
+
+  // Blocks while the ring is full. Returns false if the client went away, or
+  // read nothing for FLLAMA_HOST_STALL_TIMEOUT.
+  bool write(const char *data, size_t n) {
+    const uint64_t capacity = ring->capacity;
+    char *buf = fllama_host_ring_data(ring);
+    uint64_t w = ring->write_pos.load(std::memory_order_relaxed);
+    uint64_t last_read = ring->read_pos.load(std::memory_order_acquire);
+    auto last_progress = std::chrono::steady_clock::now();
+    while (n > 0) {
+      const uint64_t read = ring->read_pos.load(std::memory_order_acquire);
+      const uint64_t space = capacity - (w - read);
+      if (space == 0) {
+        if (client_gone) {
+          return false;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (read != last_read) {
+          last_read = read;
+          last_progress = now;
+        } else if (now - last_progress > FLLAMA_HOST_STALL_TIMEOUT) {
+          return false;
+        }
+        wake_reader();
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        continue;
+      }
+      size_t chunk = (size_t)std::min<uint64_t>(n, space);
+      const size_t offset = (size_t)(w % capacity);
+      chunk = std::min(chunk, (size_t)(capacity - offset));
+      memcpy(buf + offset, data, chunk);
+      w += chunk;
+      ring->write_pos.store(w, std::memory_order_seq_cst);
+      data += chunk;
+      n -= chunk;
+    }
+    return true;
+  }
+
+  // Record: u8 done, u32 kept prefix of the previous response, u32 length
+  // and bytes appended to it, u32 JSON length (or unchanged) and bytes.
+  // Responses are cumulative, so most records carry one token's text, and a
+  // record dropped for a client that is behind loses nothing: the next one
+  // is relative to what was last sent.
+  void on_response(const char *response, const char *openai_json,
+                   bool is_done) {
+    const std::string text = response != nullptr ? response : "";
+    const std::string json_text = openai_json != nullptr ? openai_json : "";
+    size_t keep = 0;
+    const size_t max_keep = std::min(text.size(), last_response.size());
+    while (keep < max_keep && text[keep] == last_response[keep]) {
+      keep++;
+    }
+    const bool json_unchanged = sent_json && json_text == last_json;
+    std::string record;
+    record.push_back(is_done ? 1 : 0);
+    fllama_host_append_u32(record, (uint32_t)keep);
+    fllama_host_append_u32(record, (uint32_t)(text.size() - keep));
+    record.append(text, keep, std::string::npos);
+    if (json_unchanged) {
+      fllama_host_append_u32(record, FLLAMA_HOST_JSON_UNCHANGED);
+    } else {
+      fllama_host_append_u32(record, (uint32_t)json_text.size());
+      record.append(json_text);
+    }
+    if (!wait_for_space(record.size())) {
+      wake_reader();
+      if (is_done) {
+        // The connection thread waits for the client to make room.
+        final_record = std::move(record);
+        done = true;
+      }
+      return;
+    }
+    last_response = text;
+    if (!json_unchanged) {
+      last_json = json_text;
+      sent_json = true;
+    }
+    // Fits, so this doesn't block.
+    write(record.data(), record.size());
+    wake_reader();
+    if (is_done) {
+      done = true;
+    }
+  }
+};
+
+static bool fllama_host_parse_request(const std::string &frame,
+                                      FllamaHostSession &session) {
+  json body;
+  try {
+    body = json::parse(frame);
+  } catch (const std::exception &e) {
+    std::cerr << "[fllama_host] Invalid request: " << e.what() << std::endl;
+    return false;
+  }
+  session.input = body.value("input", "");
+  session.model_path = body.value("model_path", "");
+  session.mmproj_path = body.value("model_mmproj_path", "");
+  session.grammar = body.value("grammar", "");
+  session.eos_token = body.value("eos_token", "");
+  session.openai_json = body.value("openai_request_json_string", "");
+
+  fllama_inference_request &request = session.request;
+  request.request_id = session.host_request_id;
+  request.context_size = body.value("context_size", 2048);
+  request.max_tokens = body.value("max_tokens", 512);
+  request.num_gpu_layers = body.value("num_gpu_layers", 0);
+  request.num_threads = body.value("num_threads", 2);
+  request.temperature = body.value("temperature", 0.0f);
+  request.top_p = body.value("top_p", 1.0f);
+  request.penalty_freq = body.value("penalty_freq", 0.0f);
+  request.penalty_repeat = body.value("penalty_repeat", 1.0f);
+  request.input = (char *)session.input.c_str();
+  request.model_path = (char *)session.model_path.c_str();
+  request.model_mmproj_path =
+      session.mmproj_path.empty() ? nullptr : (char *)session.mmproj_path.c_str();
+  request.grammar = (char *)session.grammar.c_str();
+  // Like the Dart side, hands over a malloc'd copy: inference frees it.
+  request.eos_token =
+      session.eos_token.empty() ? nullptr : strdup(session.eos_token.c_str());
+  request.dart_logger = nullptr; // Logs go to the host's stderr.
+  request.openai_request_json_string =
+      session.openai_json.empty() ? nullptr : (char *)session.openai_json.c_str();
+  return !session.model_path.empty();
+}
+
+static void fllama_host_handle_connection(int sock) {
+  static std::atomic<int> next_host_request_id(1);
+  auto session = std::make_shared<FllamaHostSession>();
+  session->sock = sock;
+  session->host_request_id = next_host_request_id++;
+
+  uint32_t frame_size = 0;
+  if (!fllama_host_recv_all(sock, &frame_size, sizeof(frame_size)) ||
+      frame_size > FLLAMA_HOST_MAX_REQUEST) {
+    return;
+  }
+  std::string frame(frame_size, '\0');
+  if (!fllama_host_recv_all(sock, &frame[0], frame_size)) {
+    return;
+  }
+  if (!fllama_host_parse_request(frame, *session)) {
+    fllama_host_send_byte(sock, FLLAMA_HOST_REJECTED, -1);
+    return;
+  }
+
+  const int shm_fd = fllama_host_create_shm();
+  if (shm_fd >= 0) {
+    session->ring = fllama_host_map_ring(shm_fd);
+  }
+  if (session->ring == nullptr) {
+    std::cerr << "[fllama_host] Unable to create shared memory: "
+              << strerror(errno) << std::endl;
+    if (shm_fd >= 0) {
+      close(shm_fd);
+    }
+    fllama_host_send_byte(sock, FLLAMA_HOST_REJECTED, -1);
+    return;
+  }
+  new (session->ring) FllamaHostRing();
+  session->ring->capacity = (uint32_t)FLLAMA_HOST_RING_CAPACITY;
+  const bool sent = fllama_host_send_byte(sock, FLLAMA_HOST_READY, shm_fd);
+  close(shm_fd);
+  if (!sent) {
+    return;
+  }
+
+  fllama_inference_enqueue(
+      session->request,
+      [session](const char *response, const char *openai_json, bool done) {
+        session->on_response(response, openai_json, done);
+      });
+
+  // Watch the socket until the inference is done: a cancel byte or the
+  // client closing both cancel it.
+  while (!session->done) {
+    struct pollfd pfd = {sock, POLLIN, 0};
+    const int ready = poll(&pfd, 1, 100);
+    if (ready <= 0) {
+      continue;
+    }
+    char byte = 0;
+    const ssize_t got = recv(sock, &byte, 1, 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      session->client_gone = true;
+      fllama_inference_cancel(session->host_request_id);
+      break;
+    }
+    if (byte == FLLAMA_HOST_CANCEL) {
+      fllama_inference_cancel(session->host_request_id);
+    }
+  }
+  if (session->done && !session->client_gone &&
+      !session->final_record.empty()) {
+    if (session->write(session->final_record.data(),
+                       session->final_record.size())) {
+      session->wake_reader();
+    } else {
+      std::cerr << "[fllama_host] Client stopped reading, dropping it."
+                << std::endl;
+    }
+  }
+}
+
+void fllama_host_stop() { fllama_host_stopping = true; }
+
+bool fllama_host_serve(const std::string &socket_path) {
+  struct sockaddr_un addr = {};
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "[fllama_host] Socket path too long: " << socket_path
+              << std::endl;
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, socket_path.c_str(), socket_path.size());
+
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return false;
+  }
+  // A previous host that crashed leaves its socket file behind.
+  unlink(socket_path.c_str());
+  const mode_t old_umask = umask(0077);
+  const bool bound =
+      bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(old_umask);
+  if (!bound || listen(listen_fd, 64) != 0) {
+    std::cerr << "[fllama_host] Unable to listen on " << socket_path << ": "
+              << strerror(errno) << std::endl;
+    close(listen_fd);
+    return false;
+  }
+  std::cout << "[fllama_host] Listening on " << socket_path << std::endl;
+
+  while (!fllama_host_stopping) {
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0) {
+      continue;
+    }
+    const int sock = accept(listen_fd, nullptr, nullptr);
+    if (sock < 0) {
+      continue;
+    }
+    if (!fllama_host_peer_is_same_user(sock)) {
+      std::cerr << "[fllama_host] Refused a connection from another user."
+                << std::endl;
+      close(sock);
+      continue;
+    }
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    std::thread(fllama_host_handle_connection, sock).detach();
+  }
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// Client
+
+static std::mutex fllama_host_clients_mutex;
+// Socket of each forwarded request, by the app's request_id.
+static std::unordered_map<int, int> fllama_host_clients;
+
+// Starts the host detached from this process, so it outlives the app and
+// never becomes a zombie of it.
+static bool fllama_host_launch(const std::string &executable,
+                               const std::string &socket_path) {
+  if (access(executable.c_str(), X_OK) != 0) {
+    return false;
+  }
+  // Built before fork: only async-signal-safe calls are allowed after it.
+  std::string socket_arg = socket_path;
+  const std::string log_path = socket_path + ".log";
+  const char *argv[] = {executable.c_str(), "--socket", socket_arg.c_str(),
+                        nullptr};
+  const pid_t pid = fork();
+  if (pid < 0) {
+    return false;
+  }
+  if (pid == 0) {
+    setsid();
+    if (fork() == 0) {
+      // Detached from the app's stdio, which it would otherwise hold open.
+      const int null_fd = open("/dev/null", O_RDWR);
+      if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+      }
+      const int log_fd =
+          open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+      if (log_fd >= 0) {
+        dup2(log_fd, STDOUT_FILENO);
+        dup2(log_fd, STDERR_FILENO);
+      }
+      execv(executable.c_str(), (char *const *)argv);
+    }
+    _exit(0);
+  }
+  waitpid(pid, nullptr, 0);
+  return true;
+}
+
+static int fllama_host_connect_or_launch(const std::string &socket_path,
+                                         const std::string &executable,
+                                         std::string &error) {
+  if (socket_path.empty()) {
+    error = "no private directory for the inference host's socket";
+    return -1;
+  }
+  int sock = fllama_host_connect(socket_path);
+  if (sock >= 0) {
+    return sock;
+  }
+  if (!fllama_host_launch(executable, socket_path)) {
+    error = "no inference host on " + socket_path + " and unable to start " +
+            executable;
+    return -1;
+  }
+  std::cout << "[fllama] Started inference host " << executable << std::endl;
+  for (int attempt = 0; attempt < 100 && sock < 0; attempt++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    sock = fllama_host_connect(socket_path);
+  }
+  if (sock < 0) {
+    error = "inference host did not start listening on " + socket_path;
+  }
+  return sock;
+}
+
+// Reads records until the done record, calling the callback for each.
+// Returns false if the host went away first.
+static bool fllama_host_read_stream(int sock, FllamaHostRing *ring,
+                                    fllama_inference_callback callback) {
+  const uint64_t capacity = ring->capacity;
+  const char *buf = fllama_host_ring_data(ring);
+  std::string pending; // Bytes of an incomplete record.
+  std::string response;
+  std::string openai_json;
+  bool host_closed = false;
+  uint64_t r = ring->read_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    uint64_t w = ring->write_pos.load(std::memory_order_acquire);
+    if (w == r) {
+      if (host_closed) {
+        return false;
+      }
+      // Nothing yet: spin briefly, then ask for a wakeup and block.
+      for (int spin = 0; spin < 2000 && w == r; spin++) {
+        w = ring->write_pos.load(std::memory_order_acquire);
+      }
+      if (w == r) {
+        ring->reader_waiting.store(1, std::memory_order_seq_cst);
+        w = ring->write_pos.load(std::memory_order_seq_cst);
+        if (w == r) {
+          struct pollfd pfd = {sock, POLLIN, 0};
+          if (poll(&pfd, 1, 1000) > 0) {
+            char wake[64];
+            const ssize_t got = recv(sock, wake, sizeof(wake), 0);
+            if (got == 0 || (got < 0 && errno != EINTR)) {
+              // Drain what the host wrote before it closed.
+              host_closed = true;
+            }
+          }
+          ring->reader_waiting.store(0, std::memory_order_relaxed);
+          continue;
+        }
+        ring->reader_waiting.store(0, std::memory_order_relaxed);
+      }
+    }
+    while (r < w) {
+      const size_t offset = (size_t)(r % capacity);
+      const size_t chunk =
+          (size_t)std::min<uint64_t>(w - r, capacity - offset);
+      pending.append(buf + offset, chunk);
+      r += chunk;
+    }
+    ring->read_pos.store(r, std::memory_order_release);
+
+    size_t pos = 0;
+    for (;;) {
+      const size_t header = 1 + 2 * sizeof(uint32_t);
+      if (pending.size() - pos < header + sizeof(uint32_t)) {
+        break;
+      }
+      const bool is_done = pending[pos] != 0;
+      uint32_t keep, append, json_size;
+      memcpy(&keep, &pending[pos + 1], sizeof(keep));
+      memcpy(&append, &pending[pos + 1 + sizeof(uint32_t)], sizeof(append));
+      if (pending.size() - pos < header + append + sizeof(uint32_t)) {
+        break;
+      }
+      memcpy(&json_size, &pending[pos + header + append], sizeof(json_size));
+      const size_t json_bytes =
+          json_size == FLLAMA_HOST_JSON_UNCHANGED ? 0 : json_size;
+      const size_t record_size =
+          header + append + sizeof(uint32_t) + json_bytes;
+      if (pending.size() - pos < record_size) {
+        break;
+      }
+      response.resize(std::min<size_t>(keep, response.size()));
+      response.append(pending, pos + header, append);
+      if (json_size != FLLAMA_HOST_JSON_UNCHANGED) {
+        openai_json.assign(pending, pos + header + append + sizeof(uint32_t),
+                           json_bytes);
+      }
+      pos += record_size;
+      callback(response.c_str(), openai_json.c_str(), is_done);
+      if (is_done) {
+        return true;
+      }
+    }
+    pending.erase(0, pos);
+  }
+}
+
+static void fllama_host_run_request(int request_id, std::string frame,
+                                    std::string socket_path,
+                                    std::string executable,
+                                    fllama_inference_callback callback) {
+  std::string error;
+  const int sock = fllama_host_connect_or_launch(socket_path, executable, error);
+  if (sock < 0) {
+    {
+      std::lock_guard<std::mutex> lock(fllama_host_clients_mutex);
+      fllama_host_clients.erase(request_id);
+    }
+    error = "Error: " + error;
+    callback(error.c_str(), "", true);
+    return;
+  }
+  bool cancelled;
+  {
+    std::lock_guard<std::mutex> lock(fllama_host_clients_mutex);
+    // -2 marks a request cancelled before it was connected.
+    cancelled = fllama_host_clients[request_id] == -2;
+    fllama_host_clients[request_id] = sock;
+  }
+
+  const uint32_t frame_size = (uint32_t)frame.size();
+  char reply = 0;
+  int shm_fd = -1;
+  FllamaHostRing *ring = nullptr;
+  if (fllama_host_send_all(sock, &frame_size, sizeof(frame_size)) &&
+      fllama_host_send_all(sock, frame.data(), frame.size()) &&
+      fllama_host_recv_byte(sock, reply, shm_fd) &&
+      reply == FLLAMA_HOST_READY && shm_fd >= 0) {
+    ring = fllama_host_map_ring(shm_fd);
+  }
+  if (shm_fd >= 0) {
+    close(shm_fd);
+  }
+
+  bool completed = false;
+  if (ring != nullptr) {
+    if (cancelled) {
+      char byte = FLLAMA_HOST_CANCEL;
+      fllama_host_send_all(sock, &byte, 1);
+    }
+    completed = fllama_host_read_stream(sock, ring, callback);
+    munmap(ring, FLLAMA_HOST_RING_SIZE);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(fllama_host_clients_mutex);
+    fllama_host_clients.erase(request_id);
+  }
+  close(sock);
+  if (!completed) {
+    const char *message = reply == FLLAMA_HOST_REJECTED
+                              ? "Error: inference host rejected the request"
+                              : "Error: inference host exited unexpectedly";
+    callback(message, "", true);
+  }
+}
+
+bool fllama_host_forward(const fllama_inference_request &request,
+                         fllama_inference_callback callback) {
+  if (request.openai_request_json_string == nullptr) {
+    return false;
+  }
+  json options;
+  try {
+    options = json::parse(request.openai_request_json_string);
+  } catch (const std::exception &) {
+    return false;
+  }
+  if (!options.is_object() || !options.contains("inference_host")) {
+    return false;
+  }
+  const json &host = options["inference_host"];
+  std::string socket_path;
+  if (host.is_string()) {
+    socket_path = host.get<std::string>();
+  } else if (host.is_boolean() && host.get<bool>()) {
+    socket_path = fllama_host_default_socket_path();
+  } else {
+    return false;
+  }
+  std::string executable;
+  if (options.contains("inference_host_executable") &&
+      options["inference_host_executable"].is_string()) {
+    executable = options["inference_host_executable"].get<std::string>();
+  } else {
+    executable = fllama_backend_library_dir() + "/fllama_host";
+  }
+
+  // Copied now: the request's strings only have to outlive this call.
+  json frame = {
+      {"context_size", request.context_size},
+      {"input", request.input != nullptr ? request.input : ""},
+      {"max_tokens", request.max_tokens},
+      {"model_path", request.model_path != nullptr ? request.model_path : ""},
+      {"model_mmproj_path",
+       request.model_mmproj_path != nullptr ? request.model_mmproj_path : ""},
+      {"num_gpu_layers", request.num_gpu_layers},
+      {"num_threads", request.num_threads},
+      {"temperature", request.temperature},
+      {"top_p", request.top_p},
+      {"penalty_freq", request.penalty_freq},
+      {"penalty_repeat", request.penalty_repeat},
+      {"grammar", request.grammar != nullptr ? request.grammar : ""},
+      {"eos_token", request.eos_token != nullptr ? request.eos_token : ""},
+      {"openai_request_json_string", request.openai_request_json_string},
+  };
+  // Handed over like to a local inference, which would free it.
+  free(request.eos_token);
+  {
+    std::lock_guard<std::mutex> lock(fllama_host_clients_mutex);
+    fllama_host_clients[request.request_id] = -1;
+  }
+  std::thread(fllama_host_run_request, request.request_id, frame.dump(),
+              socket_path, executable, callback)
+      .detach();
+  return true;
+}
+
+bool fllama_host_cancel(int request_id) {
+  std::lock_guard<std::mutex> lock(fllama_host_clients_mutex);
+  auto it = fllama_host_clients.find(request_id);
+  if (it == fllama_host_clients.end()) {
+    return false;
+  }
+  if (it->second < 0) {
+    it->second = -2;
+  } else {
+    char byte = FLLAMA_HOST_CANCEL;
+    send(it->second, &byte, 1, FLLAMA_HOST_SEND_FLAGS | MSG_DONTWAIT);
+  }
+  return true;
+}
+
+#else // FLLAMA_HOST_SUPPORTED
+
+bool fllama_host_forward(const fllama_inference_request &request,
+                         fllama_inference_callback callback) {
+  (void)request;
+  (void)callback;
+  return false;
+}
+
+bool fllama_host_cancel(int request_id) {
+  (void)request_id;
+  return false;
+}
+
+bool fllama_host_serve(const std::string &socket_path) {
+  std::cerr << "[fllama_host] Not supported on this platform: "
+            << socket_path << std::endl;
+  return false;
+}
+
+void fllama_host_stop() {}
+
+std::string fllama_host_default_socket_path() { return ""; }
+
+#endif // FLLAMA_HOST_SUPPORTED
@@ -0,0 +1,47 @@
+#ifndef FLLAMA_HOST_H
+#define FLLAMA_HOST_H
+
+#include "fllama.h"
+
+#include <string>
+
+// Out-of-process inference. A request with the "inference_host" option is
+// forwarded to a long-lived fllama_host process over a Unix socket instead of
+// running in the app, so a crash in llama.cpp only takes down the host, and
+// every app on the machine shares the host's cached model.
+//
+// Request options:
+//   "inference_host": true for the default socket, or a socket path.
+//   "inference_host_executable": fllama_host binary started when nothing is
+//       listening on the socket. Defaults to fllama_host next to libfllama.
+//       It logs to the socket path with ".log" appended.
+//
+// The socket only carries the request, cancellation and wakeups. Responses
+// stream back through a shared-memory ring buffer that the host creates per
+// request, so tokens cost no syscalls while the client keeps up. Host and
+// client hang up on a peer that runs as another user.
+//
+// Supported on Linux and macOS; elsewhere requests run in process.
+
+// Forwards the request if it asks for a host. Returns false, without calling
+// the callback, if it should run in process instead. Like fllama_inference,
+// returns before the callback is called.
+bool fllama_host_forward(const fllama_inference_request &request,
+                         fllama_inference_callback callback);
+
+// Cancels a forwarded request. Returns false if the request isn't forwarded.
+bool fllama_host_cancel(int request_id);
+
+// Host side: serves requests on socket_path until fllama_host_stop is called.
+// Returns false if the socket can't be set up.
+bool fllama_host_serve(const std::string &socket_path);
+
+// Async-signal-safe.
+void fllama_host_stop();
+
+// The socket used when "inference_host" is true: in XDG_RUNTIME_DIR, else in
+// a /tmp directory private to the user, created if needed. Empty if that
+// directory exists but isn't private.
+std::string fllama_host_default_socket_path();
+
+#endif // FLLAMA_HOST_H
@@ -0,0 +1,148 @@
+// fllama_host: runs inference for apps that set the "inference_host" request
+// option, see fllama_host.h. Apps start it on demand, so it is rarely run by
+// hand:
+//
+//   fllama_host [--socket PATH] [--no-supervise]
+//
+// By default a supervisor process keeps one serving process alive and starts
+// a new one whenever it crashes; clients that were streaming from it get an
+// error, later requests go to the new process. Only one host runs per socket.
+
+#include "fllama_cpp.h"
+#include "fllama_host.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t supervisor_stopping = 0;
+static volatile pid_t serving_pid = 0;
+
+static void serve_signal_handler(int) { fllama_host_stop(); }
+
+static void supervisor_signal_handler(int sig) {
+  supervisor_stopping = 1;
+  if (serving_pid > 0) {
+    kill(serving_pid, sig);
+  }
+}
+
+static void print_usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [options]\n\n", argv0);
+  fprintf(stderr, "  --socket PATH     Unix socket to listen on (default: %s)\n",
+          fllama_host_default_socket_path().c_str());
+  fprintf(stderr, "  --no-supervise    serve in this process, without restarts\n");
+}
+
+static int serve(const std::string &socket_path) {
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, serve_signal_handler);
+  signal(SIGTERM, serve_signal_handler);
+  const bool ok = fllama_host_serve(socket_path);
+  fllama_clear_model_cache(true);
+  return ok ? 0 : 1;
+}
+
+// Restarts the serving process until it exits cleanly or we are told to stop.
+// Crashing right after a start (a bad model, no memory) backs off so it
+// doesn't spin.
+static int supervise(const char *argv0, const std::string &socket_path) {
+  signal(SIGINT, supervisor_signal_handler);
+  signal(SIGTERM, supervisor_signal_handler);
+  int backoff_sec = 0;
+  while (!supervisor_stopping) {
+    const auto started = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid < 0) {
+      perror("[fllama_host] fork");
+      return 1;
+    }
+    if (pid == 0) {
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      execlp(argv0, argv0, "--socket", socket_path.c_str(), "--no-supervise",
+             "--serving", (char *)nullptr);
+      perror("[fllama_host] exec");
+      _exit(127);
+    }
+    serving_pid = pid;
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    serving_pid = 0;
+    if (supervisor_stopping ||
+        (WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+      break;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+      return 1;
+    }
+    if (WIFSIGNALED(status)) {
+      fprintf(stderr, "[fllama_host] Serving process killed by signal %d, "
+                      "restarting.\n", WTERMSIG(status));
+    } else {
+      fprintf(stderr, "[fllama_host] Serving process exited with %d, "
+                      "restarting.\n", WEXITSTATUS(status));
+    }
+    const auto lifetime = std::chrono::steady_clock::now() - started;
+    backoff_sec = lifetime < std::chrono::seconds(10)
+                      ? std::min(backoff_sec == 0 ? 1 : backoff_sec * 2, 30)
+                      : 0;
+    for (int i = 0; i < backoff_sec * 10 && !supervisor_stopping; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  std::string socket_path = fllama_host_default_socket_path();
+  bool supervised = true;
+  bool serving = false; // Started by a supervisor, which holds the lock.
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--socket" && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (arg == "--no-supervise") {
+      supervised = false;
+    } else if (arg == "--serving") {
+      serving = true;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (!serving) {
+    // Clients that find no host start one, so several can race here. The
+    // loser exits and its client connects to the winner.
+    const std::string lock_path = socket_path + ".lock";
+    const int lock_fd =
+        open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+      fprintf(stderr, "[fllama_host] Another host is serving %s.\n",
+              socket_path.c_str());
+      return 0;
+    }
+  }
+  return supervised ? supervise(argv[0], socket_path) : serve(socket_path);
+}
+
+#else
+
+int main() {
+  fprintf(stderr, "fllama_host is only supported on Linux and macOS.\n");
+  return 1;
+}
+
+#endif
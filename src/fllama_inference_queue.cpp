@@ -1,17 +1,25 @@
 #include "fllama_inference_queue.h"
+#include "fllama_kv_tier.h"
+#include <cstdlib>
 #include <atomic>
 #include <exception>
 #include <iostream>
 #include <unordered_map>
 #include <chrono>
 #include <thread>
+#if defined(__linux__)
+#include <pthread.h>
+#endif
 
 // If fllama_inference_request and fllama_inference_callback types are defined
 // in an external header, include that here.
-InferenceQueue::InferenceQueue()
-    : done(false), 
-      worker(&InferenceQueue::process_inference, this),
-      cleanup_thread(&InferenceQueue::cleanup_inactive_models, this) {}
+InferenceQueue::InferenceQueue() : done(false), paused(false) {
+  // Started here rather than in the initializer list: members are
+  // initialized in declaration order, and the threads must not see the
+  // mutexes, condition variables or queue before they are constructed.
+  worker = std::thread(&InferenceQueue::process_inference, this);
+  cleanup_thread = std::thread(&InferenceQueue::cleanup_inactive_models, this);
+}
 
 InferenceQueue::~InferenceQueue() {
   {
@@ -19,7 +27,10 @@ InferenceQueue::~InferenceQueue() {
     cancel_flags.clear();
   }
   {
-    std::lock_guard<std::mutex> lock(inference_lock);
+    // Set under the locks the threads wait with, or a wakeup can be missed
+    // and the join below never returns.
+    std::lock_guard<std::mutex> lock(queue_lock);
+    std::lock_guard<std::mutex> models_guard(models_lock);
     done = true;
   }
   cond_var.notify_one();
@@ -45,14 +56,46 @@ InferenceQueue::~InferenceQueue() {
 
 void InferenceQueue::enqueue(fllama_inference_request request,
                              fllama_inference_callback callback) {
-  std::lock_guard<std::mutex> lock(queue_lock);
-  TaskWrapper taskWrapper(
+  // A request cancelled before it starts still gets its final callback, and
+  // its eos_token is freed as fllama_inference_sync would have.
+  enqueue_task(
       [request, callback]() { fllama_inference_sync(request, callback); },
-      request.request_id);
+      request.request_id, [request, callback]() {
+        free(request.eos_token);
+        callback("", "", true);
+      });
+}
+
+void InferenceQueue::enqueue_task(std::function<void()> task, int request_id,
+                                  std::function<void()> on_cancelled) {
+  std::lock_guard<std::mutex> lock(queue_lock);
+  TaskWrapper taskWrapper(std::move(task), request_id,
+                          std::move(on_cancelled));
   tasks.emplace(std::move(taskWrapper));
   cond_var.notify_one();
 }
 
+void InferenceQueue::enqueue_background(std::function<void()> task, int key) {
+  std::lock_guard<std::mutex> lock(queue_lock);
+  for (auto& queued : background_tasks) {
+    if (queued.request_id == key) {
+      queued.task = std::move(task);
+      return;
+    }
+  }
+  background_tasks.emplace_back(std::move(task), key);
+  cond_var.notify_one();
+}
+
+bool InferenceQueue::has_pending_tasks() {
+  std::lock_guard<std::mutex> lock(queue_lock);
+  return !tasks.empty();
+}
+
+bool InferenceQueue::is_worker_thread() const {
+  return std::this_thread::get_id() == worker.get_id();
+}
+
 void InferenceQueue::cancel(int request_id) {
   {
     std::lock_guard<std::mutex> lock(queue_lock);
@@ -68,7 +111,10 @@ bool InferenceQueue::is_cancelled(int request_id) {
 }
 
 void InferenceQueue::register_model(const std::string& model_path, llama_model* model, 
-                               llama_context* ctx) {
+                               llama_context* ctx,
+                               std::shared_ptr<WeightStreamer> weight_streamer,
+                               const llama_context_params* ctx_params,
+                               int users) {
   std::lock_guard<std::mutex> lock(models_lock);
   
   // Check if model already exists
@@ -76,12 +122,18 @@ void InferenceQueue::register_model(const std::string& model_path, llama_model*
   if (it != cached_models.end()) {
     // Model exists, update its last_used timestamp
     it->second->last_used = std::chrono::steady_clock::now();
+    it->second->active_users += users;
     return;
   }
   
   // Create a new model resource entry - note: we don't store the sampler anymore
   cached_models[model_path] = 
-      std::unique_ptr<ModelResources>(new ModelResources(model, ctx));
+      std::unique_ptr<ModelResources>(new ModelResources(model, ctx, std::move(weight_streamer)));
+  if (ctx_params != nullptr) {
+    cached_models[model_path]->has_ctx_params = true;
+    cached_models[model_path]->ctx_params = *ctx_params;
+  }
+  cached_models[model_path]->active_users = users;
   
   std::cout << "[InferenceQueue] Registered model: " << model_path << std::endl;
 }
@@ -91,6 +143,19 @@ InferenceQueue::get_cached_model(const std::string& model_path) {
   std::lock_guard<std::mutex> lock(models_lock);
   
   auto it = cached_models.find(model_path);
+  if (it != cached_models.end() && it->second->ctx == nullptr) {
+    // Released under memory pressure; the weights are still loaded.
+    it->second->ctx =
+        llama_init_from_model(it->second->model, it->second->ctx_params);
+    if (it->second->ctx == nullptr) {
+      std::cout << "[InferenceQueue] Unable to recreate context for "
+                << model_path << ", reloading the model" << std::endl;
+      free_model_resources(model_path);
+      return std::make_tuple(nullptr, nullptr);
+    }
+    std::cout << "[InferenceQueue] Recreated context for " << model_path
+              << std::endl;
+  }
   if (it != cached_models.end()) {
     // Update the last_used timestamp
     it->second->last_used = std::chrono::steady_clock::now();
@@ -141,6 +206,13 @@ void InferenceQueue::decrement_model_users(const std::string& model_path) {
   }
 }
 
+std::vector<llama_token>*
+InferenceQueue::get_kv_tokens(const std::string& model_path) {
+  std::lock_guard<std::mutex> lock(models_lock);
+  auto it = cached_models.find(model_path);
+  return it == cached_models.end() ? nullptr : &it->second->kv_tokens;
+}
+
 void InferenceQueue::check_inactive_models() {
   cleanup_cond_var.notify_one();
 }
@@ -160,7 +232,12 @@ void InferenceQueue::free_model_resources(const std::string& model_path) {
     
     std::cout << "[InferenceQueue] Freeing model resources for: " << model_path << std::endl;
     
-    if (resources->ctx) llama_free(resources->ctx);
+    if (resources->ctx) {
+      // Its conversation can come back without the prompt being decoded.
+      FllamaKvTier::instance().store(model_path, resources->ctx,
+                                     resources->kv_tokens);
+      llama_free(resources->ctx);
+    }
     if (resources->model) llama_model_free(resources->model);
     
     cached_models.erase(it);
@@ -207,6 +284,11 @@ void InferenceQueue::cleanup_inactive_models() {
 }
 
 void InferenceQueue::process_inference() {
+#if defined(__linux__)
+  // Inherited by the ggml worker threads it starts, which is how
+  // fllama_perf.h tells them from the app's threads.
+  pthread_setname_np(pthread_self(), "fllama");
+#endif
   while (true) {
 
     std::unique_ptr<TaskWrapper> taskWrapperPtr;
@@ -214,12 +296,33 @@ void InferenceQueue::process_inference() {
 
     { // Scope for the queue lock
       std::unique_lock<std::mutex> queueLock(queue_lock);
-      cond_var.wait(queueLock, [this] { return !tasks.empty() || done; });
+      cond_var.wait(queueLock, [this] {
+        return (!paused && (!tasks.empty() || !background_tasks.empty())) ||
+               done;
+      });
 
       if (done && tasks.empty()) {
         break;
       }
 
+      if (tasks.empty()) {
+        // Background tasks have their own keys, never cancelled.
+        taskWrapperPtr = std::unique_ptr<TaskWrapper>(
+            new TaskWrapper(std::move(background_tasks.front())));
+        background_tasks.pop_front();
+        queueLock.unlock();
+        try {
+          (*taskWrapperPtr)();
+        } catch (const std::exception &e) {
+          std::cerr << "[InferenceQueue] Exception in background task: "
+                    << e.what() << std::endl;
+        } catch (...) {
+          std::cerr << "[InferenceQueue] Unknown exception in background task"
+                    << std::endl;
+        }
+        continue;
+      }
+
       // Use std::make_unique for C++14 and above. For C++11, use new
       // TaskWrapper(...)
       taskWrapperPtr = std::unique_ptr<TaskWrapper>(
@@ -240,6 +343,9 @@ void InferenceQueue::process_inference() {
         // If the task is cancelled, do not execute it. Clean up cancellation
         // flag after checking.
         cancel_flags.erase(current_request_id);
+        if (taskWrapperPtr->on_cancelled) {
+          taskWrapperPtr->on_cancelled();
+        }
         continue;
       }
     } // Release the inference lock
@@ -258,6 +364,11 @@ void InferenceQueue::process_inference() {
         std::cerr << "[InferenceQueue] Unknown exception in task execution" << std::endl;
       }
     }
+    {
+      // The request is over; a continuation may reuse its id.
+      std::lock_guard<std::mutex> lock(queue_lock);
+      cancel_flags.erase(current_request_id);
+    }
     
     // Trigger cleanup check after each task completes
     cleanup_cond_var.notify_one();
@@ -290,4 +401,61 @@ void InferenceQueue::clear_model_cache(bool force_clear) {
 
   std::cout << "[InferenceQueue] Cleared " << models_to_free.size()
             << " models from cache" << std::endl;
-}
\ No newline at end of file
+}
+
+int InferenceQueue::release_idle_kv() {
+  std::lock_guard<std::mutex> lock(models_lock);
+  int released = 0;
+  for (auto& pair : cached_models) {
+    auto& resources = pair.second;
+    if (resources->active_users > 0 || resources->ctx == nullptr) {
+      continue;
+    }
+    FllamaKvTier::instance().store(pair.first, resources->ctx,
+                                   resources->kv_tokens);
+    llama_kv_self_release(resources->ctx);
+    resources->kv_tokens.clear();
+    released++;
+    std::cout << "[InferenceQueue] Released KV cache for " << pair.first
+              << std::endl;
+  }
+  return released;
+}
+
+int InferenceQueue::release_idle_contexts() {
+  std::lock_guard<std::mutex> lock(models_lock);
+  int released = 0;
+  for (auto& pair : cached_models) {
+    auto& resources = pair.second;
+    if (resources->active_users > 0 || resources->ctx == nullptr ||
+        !resources->has_ctx_params) {
+      continue;
+    }
+    FllamaKvTier::instance().store(pair.first, resources->ctx,
+                                   resources->kv_tokens);
+    llama_free(resources->ctx);
+    resources->ctx = nullptr;
+    resources->kv_tokens.clear();
+    released++;
+    std::cout << "[InferenceQueue] Released context for " << pair.first
+              << std::endl;
+  }
+  return released;
+}
+
+void InferenceQueue::set_paused(bool paused) {
+  {
+    std::lock_guard<std::mutex> lock(queue_lock);
+    this->paused = paused;
+  }
+  cond_var.notify_one();
+  std::cout << "[InferenceQueue] " << (paused ? "Paused" : "Resumed")
+            << std::endl;
+}
+
+int InferenceQueue::clear_background_tasks() {
+  std::lock_guard<std::mutex> lock(queue_lock);
+  const int cleared = (int)background_tasks.size();
+  background_tasks.clear();
+  return cleared;
+}
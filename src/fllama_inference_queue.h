@@ -12,8 +12,11 @@
 #include <thread>
 #include <unordered_map>
 #include <chrono>
+#include <deque>
 #include <memory>
+#include <vector>
 #include "fllama.h"
+#include "fllama_weight_stream.h"
 #include "llama.h"
 
 #if defined(__GNUC__) && __GNUC__ < 5 && !defined(__clang__)
@@ -37,19 +40,34 @@ struct ModelResources {
   llama_context* ctx;
   std::chrono::time_point<std::chrono::steady_clock> last_used;
   std::atomic<int> active_users;
+  // Set when weights are streamed; ctx calls into it, so it lives as long as ctx.
+  std::shared_ptr<WeightStreamer> weight_streamer;
+  // Tokens held in ctx's KV cache (sequence 0), so the next prompt only has
+  // to decode what differs. Empty if unknown, e.g. after image embeddings.
+  std::vector<llama_token> kv_tokens;
+  // How ctx was created, so it can be freed under memory pressure and created
+  // again on next use. Unset if the creator didn't say; ctx then stays.
+  bool has_ctx_params;
+  llama_context_params ctx_params;
   
-  ModelResources(llama_model* m, llama_context* c)
+  ModelResources(llama_model* m, llama_context* c,
+                 std::shared_ptr<WeightStreamer> streamer = nullptr)
       : model(m), ctx(c),
         last_used(std::chrono::steady_clock::now()),
-        active_users(0) {}
+        active_users(0), weight_streamer(std::move(streamer)),
+        has_ctx_params(false), ctx_params() {}
 };
 
 struct TaskWrapper {
   std::function<void()> task; // Actual task to execute
   int request_id;             // Unique ID for the request
+  // Runs instead of task if the request is cancelled while still queued.
+  std::function<void()> on_cancelled;
 
-  TaskWrapper(std::function<void()> task, int request_id)
-      : task(std::move(task)), request_id(request_id) {}
+  TaskWrapper(std::function<void()> task, int request_id,
+              std::function<void()> on_cancelled = nullptr)
+      : task(std::move(task)), request_id(request_id),
+        on_cancelled(std::move(on_cancelled)) {}
 
   void operator()() const { task(); }
 };
@@ -65,19 +83,52 @@ public:
   // Enqueue a new inference request
   void enqueue(fllama_inference_request request,
                fllama_inference_callback callback);
+  // Enqueue arbitrary work that needs the models, ex. embeddings. Runs on the
+  // same worker, so it never overlaps an inference.
+  void enqueue_task(std::function<void()> task, int request_id,
+                    std::function<void()> on_cancelled = nullptr);
+  // Speculative work, ex. prefill hints: runs only when no other task is
+  // queued, and replaces a queued background task with the same key.
+  void enqueue_background(std::function<void()> task, int key);
+  // True while a task is waiting; background work should stop early.
+  bool has_pending_tasks();
+  // True on the worker, where waiting for a queued task would deadlock.
+  bool is_worker_thread() const;
   void cancel(int request_id);
   bool is_cancelled(int request_id);
   
   // Model caching methods
+  // With ctx_params, the context can be released by release_idle_contexts.
+  // The caller becomes one of `users`, counted under the same lock, so the
+  // model can't be trimmed before it holds it.
   void register_model(const std::string& model_path, llama_model* model, 
-                      llama_context* ctx);
+                      llama_context* ctx,
+                      std::shared_ptr<WeightStreamer> weight_streamer = nullptr,
+                      const llama_context_params* ctx_params = nullptr,
+                      int users = 0);
   std::tuple<llama_model*, llama_context*> get_cached_model(const std::string& model_path);
   void mark_model_used(const std::string& model_path);
   void increment_model_users(const std::string& model_path);
   void decrement_model_users(const std::string& model_path);
+  // Tokens in the cached context's KV cache. Only the worker thread may use
+  // them, while it holds a user of the model.
+  std::vector<llama_token>* get_kv_tokens(const std::string& model_path);
   void check_inactive_models();
   void clear_model_cache(bool force_clear = false);
 
+  // Memory pressure, see fllama_trim_memory.
+  // Empties the KV caches of models nobody is using and gives their memory
+  // back, keeping the contexts; the next request decodes its prompt again.
+  // Returns how many were emptied.
+  int release_idle_kv();
+  // Frees the contexts (KV cache, output buffers) of models nobody is using,
+  // keeping the weights; get_cached_model creates them again. Returns how
+  // many were freed.
+  int release_idle_contexts();
+  // While paused, queued tasks wait; the running one finishes.
+  void set_paused(bool paused);
+  // Drops speculative work, ex. prefill hints. Returns how many.
+  int clear_background_tasks();
 private:
   std::thread worker;               // Worker thread to process tasks
   std::thread cleanup_thread;       // Thread for checking inactive models
@@ -87,7 +138,9 @@ private:
   std::condition_variable cond_var; // Condition variable for task signaling
   std::condition_variable cleanup_cond_var; // Condition variable for cleanup signaling
   std::queue<TaskWrapper> tasks;    // Queue of tasks
+  std::deque<TaskWrapper> background_tasks; // Run when tasks is empty
   bool done; // Flag to control the lifecycle of the worker thread
+  bool paused; // Set under critical memory pressure
 
   std::unordered_map<int, std::atomic<bool>> cancel_flags;
   std::unordered_map<std::string, std::unique_ptr<ModelResources>> cached_models;
@@ -0,0 +1,339 @@
+#include "fllama_kv_tier.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <process.h>
+#define fllama_getpid _getpid
+#else
+#include <dirent.h>
+#include <unistd.h>
+#define fllama_getpid getpid
+#endif
+
+static const char *kKvTierFilePrefix = "fllama-kv-";
+
+static size_t kv_tier_common_prefix(const std::vector<llama_token> &a,
+                            const std::vector<llama_token> &b) {
+  const size_t n = std::min(a.size(), b.size());
+  return std::mismatch(a.begin(), a.begin() + n, b.begin()).first - a.begin();
+}
+
+static bool kv_tier_write_file(const std::string &path,
+                       const std::vector<uint8_t> &data) {
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  const bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && ok;
+}
+
+static bool kv_tier_read_file(const std::string &path, size_t size,
+                      std::vector<uint8_t> *data) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  data->resize(size);
+  const bool ok = fread(data->data(), 1, size, file) == size;
+  fclose(file);
+  return ok;
+}
+
+// Snapshot files left by an earlier process, which can't be restored.
+static void kv_tier_remove_stale_files(const std::string &dir) {
+#if defined(_WIN32)
+  WIN32_FIND_DATAA found;
+  const std::string pattern = dir + "\\" + kKvTierFilePrefix + "*";
+  HANDLE handle = FindFirstFileA(pattern.c_str(), &found);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  do {
+    std::remove((dir + "\\" + found.cFileName).c_str());
+  } while (FindNextFileA(handle, &found));
+  FindClose(handle);
+#else
+  DIR *handle = opendir(dir.c_str());
+  if (handle == nullptr) {
+    return;
+  }
+  while (dirent *found = readdir(handle)) {
+    if (strncmp(found->d_name, kKvTierFilePrefix, strlen(kKvTierFilePrefix)) == 0) {
+      std::remove((dir + "/" + found->d_name).c_str());
+    }
+  }
+  closedir(handle);
+#endif
+}
+
+FllamaKvTier &FllamaKvTier::instance() {
+  static FllamaKvTier tier;
+  return tier;
+}
+
+FllamaKvTier::~FllamaKvTier() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  cond_var.notify_all();
+  if (worker.joinable()) {
+    worker.join();
+  }
+  while (!entries.empty()) {
+    remove_locked(entries.front());
+  }
+}
+
+void FllamaKvTier::configure(const std::string &dir, size_t ram_budget_bytes,
+                             size_t disk_budget_bytes, int idle_seconds) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (dir != cache_dir) {
+    // Snapshots already on disk stay where they are.
+    if (!dir.empty()) {
+      kv_tier_remove_stale_files(dir);
+    }
+    cache_dir = dir;
+  }
+  ram_budget = ram_budget_bytes;
+  disk_budget = disk_budget_bytes;
+  idle_timeout = std::chrono::seconds(std::max(idle_seconds, 0));
+  if (ram_budget == 0) {
+    while (!entries.empty()) {
+      remove_locked(entries.front());
+    }
+    return;
+  }
+  if (!worker.joinable()) {
+    worker = std::thread(&FllamaKvTier::run, this);
+  }
+  enforce_disk_budget_locked();
+  wake_locked();
+}
+
+bool FllamaKvTier::enabled() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return ram_budget > 0;
+}
+
+void FllamaKvTier::store(const std::string &model_key, llama_context *ctx,
+                         const std::vector<llama_token> &tokens) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ram_budget == 0 || tokens.size() < kMinTokens) {
+      return;
+    }
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      const std::shared_ptr<Entry> &entry = *it;
+      if (entry->model_key == model_key &&
+          kv_tier_common_prefix(entry->tokens, tokens) == tokens.size()) {
+        // Already kept, with as much or more.
+        entry->last_used = std::chrono::steady_clock::now();
+        entries.splice(entries.begin(), entries, it);
+        return;
+      }
+    }
+  }
+
+  const size_t size = llama_state_seq_get_size(ctx, 0);
+  auto state = std::make_shared<std::vector<uint8_t>>(size);
+  if (size == 0 ||
+      llama_state_seq_get_data(ctx, state->data(), size, 0) != size) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (ram_budget == 0) {
+    return;
+  }
+  for (auto it = entries.begin(); it != entries.end();) {
+    std::shared_ptr<Entry> entry = *it++;
+    if (entry->model_key == model_key &&
+        kv_tier_common_prefix(entry->tokens, tokens) == entry->tokens.size()) {
+      remove_locked(entry);
+    }
+  }
+  auto entry = std::make_shared<Entry>();
+  entry->model_key = model_key;
+  entry->tokens = tokens;
+  entry->state = std::move(state);
+  entry->size = size;
+  entry->last_used = std::chrono::steady_clock::now();
+  entries.push_front(entry);
+  ram_bytes += size;
+  wake_locked();
+}
+
+bool FllamaKvTier::restore(const std::string &model_key, llama_context *ctx,
+                           const std::vector<llama_token> &tokens,
+                           size_t min_prefix,
+                           std::vector<llama_token> *restored) {
+  std::shared_ptr<Entry> best;
+  size_t best_prefix = min_prefix;
+  std::unique_lock<std::mutex> lock(mutex);
+  for (const std::shared_ptr<Entry> &entry : entries) {
+    if (entry->model_key != model_key) {
+      continue;
+    }
+    const size_t prefix = kv_tier_common_prefix(entry->tokens, tokens);
+    if (prefix > best_prefix) {
+      best = entry;
+      best_prefix = prefix;
+    }
+  }
+  if (best == nullptr) {
+    return false;
+  }
+  // The snapshot moves into ctx; storing it again is up to the caller.
+  std::shared_ptr<const std::vector<uint8_t>> state = best->state;
+  const std::string path = best->path;
+  remove_locked(best, /* delete_file */ false);
+  lock.unlock();
+
+  if (state == nullptr) {
+    auto data = std::make_shared<std::vector<uint8_t>>();
+    if (kv_tier_read_file(path, best->size, data.get())) {
+      state = std::move(data);
+    }
+    std::remove(path.c_str());
+  }
+  llama_kv_self_seq_rm(ctx, 0, -1, -1);
+  if (state != nullptr &&
+      llama_state_seq_set_data(ctx, state->data(), state->size(), 0) ==
+          state->size()) {
+    *restored = best->tokens;
+  } else {
+    std::cerr << "[fllama] KV tier: couldn't restore a snapshot of "
+              << best->tokens.size() << " tokens" << std::endl;
+    llama_kv_self_seq_rm(ctx, 0, -1, -1);
+    restored->clear();
+  }
+  return true;
+}
+
+void FllamaKvTier::release_ram() {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    std::shared_ptr<Entry> next;
+    for (const std::shared_ptr<Entry> &entry : entries) {
+      if (entry->state != nullptr && !entry->writing) {
+        next = entry;
+        break;
+      }
+    }
+    if (next == nullptr) {
+      return;
+    }
+    spill(next, lock);
+  }
+}
+
+void FllamaKvTier::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stop) {
+    const auto now = std::chrono::steady_clock::now();
+    std::shared_ptr<Entry> victim;
+    auto next_deadline = std::chrono::steady_clock::time_point::max();
+    // Least recently used first.
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+      const std::shared_ptr<Entry> &entry = *it;
+      if (entry->state == nullptr || entry->writing) {
+        continue;
+      }
+      const auto idle_deadline = entry->last_used + idle_timeout;
+      if (ram_bytes > ram_budget ||
+          (idle_timeout.count() > 0 && idle_deadline <= now)) {
+        victim = entry;
+        break;
+      }
+      if (idle_timeout.count() > 0) {
+        next_deadline = std::min(next_deadline, idle_deadline);
+      }
+    }
+    if (victim != nullptr) {
+      spill(victim, lock);
+    } else if (next_deadline == std::chrono::steady_clock::time_point::max()) {
+      cond_var.wait(lock);
+    } else {
+      cond_var.wait_until(lock, next_deadline);
+    }
+  }
+}
+
+void FllamaKvTier::wake_locked() { cond_var.notify_all(); }
+
+bool FllamaKvTier::spill(const std::shared_ptr<Entry> &entry,
+                         std::unique_lock<std::mutex> &lock) {
+  if (cache_dir.empty() || entry->size > disk_budget) {
+    remove_locked(entry);
+    return false;
+  }
+  const std::string dir = cache_dir;
+  const std::string path = dir + "/" + kKvTierFilePrefix +
+                           std::to_string(fllama_getpid()) + "-" +
+                           std::to_string(next_file_id++) + ".bin";
+  std::shared_ptr<const std::vector<uint8_t>> state = entry->state;
+  entry->writing = true;
+  lock.unlock();
+  const bool ok = kv_tier_write_file(path, *state);
+  lock.lock();
+  entry->writing = false;
+  if (!ok || entry->removed || dir != cache_dir) {
+    std::remove(path.c_str());
+    if (!ok) {
+      std::cerr << "[fllama] KV tier: couldn't write " << path << std::endl;
+    }
+    remove_locked(entry);
+    return false;
+  }
+  entry->state.reset();
+  entry->path = path;
+  ram_bytes -= entry->size;
+  disk_bytes += entry->size;
+  enforce_disk_budget_locked();
+  return true;
+}
+
+// By value: entry may be the list's own pointer, which remove destroys.
+void FllamaKvTier::remove_locked(std::shared_ptr<Entry> entry,
+                                 bool delete_file) {
+  if (entry->removed) {
+    return;
+  }
+  entry->removed = true;
+  entries.remove(entry);
+  if (entry->state != nullptr) {
+    ram_bytes -= entry->size;
+    entry->state.reset();
+  }
+  if (!entry->path.empty()) {
+    disk_bytes -= entry->size;
+    if (delete_file) {
+      std::remove(entry->path.c_str());
+    }
+  }
+}
+
+void FllamaKvTier::enforce_disk_budget_locked() {
+  std::vector<std::shared_ptr<Entry>> on_disk;
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+    if (!(*it)->path.empty()) {
+      on_disk.push_back(*it);
+    }
+  }
+  for (size_t i = 0; i < on_disk.size() && disk_bytes > disk_budget; i++) {
+    remove_locked(on_disk[i]);
+  }
+}
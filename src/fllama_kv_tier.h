@@ -0,0 +1,104 @@
+#ifndef FLLAMA_KV_TIER_H
+#define FLLAMA_KV_TIER_H
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/include/llama.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/include/llama.h"
+#endif
+#else
+#include "llama.cpp/include/llama.h"
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps the KV state of conversations a cached context has moved on from, so
+// switching back to one restores it instead of decoding its prompt again.
+//
+// Snapshots of sequence 0 start out in RAM. A background thread writes the
+// least recently used ones to files in the cache directory once RAM use is
+// over budget, and any that sat idle too long, and deletes the oldest files
+// once disk use is over budget. Snapshots are found by content: the one
+// sharing the longest prefix with the next prompt wins, so callers need no
+// conversation ids. Files only live as long as the process.
+class FllamaKvTier {
+public:
+  // Snapshots shorter than this cost less to decode again than to keep.
+  static const size_t kMinTokens = 64;
+
+  static FllamaKvTier &instance();
+
+  // Enables the tier with the given budgets, or disables it and drops every
+  // snapshot if ram_budget is 0. Without a cache_dir, snapshots over the RAM
+  // budget are dropped instead of written.
+  void configure(const std::string &cache_dir, size_t ram_budget,
+                 size_t disk_budget, int idle_seconds);
+  bool enabled();
+
+  // Snapshots sequence 0 of ctx, which holds tokens, for model_key. Older
+  // snapshots that tokens continues are dropped.
+  void store(const std::string &model_key, llama_context *ctx,
+             const std::vector<llama_token> &tokens);
+
+  // Restores into sequence 0 of ctx the snapshot for model_key sharing the
+  // longest prefix with tokens, if that's longer than min_prefix. Returns
+  // false if there's none and ctx is untouched; otherwise restored is what
+  // sequence 0 now holds, empty if the snapshot couldn't be loaded.
+  bool restore(const std::string &model_key, llama_context *ctx,
+               const std::vector<llama_token> &tokens, size_t min_prefix,
+               std::vector<llama_token> *restored);
+
+  // Moves every snapshot out of RAM: to disk if there's a cache directory,
+  // otherwise they are dropped. For memory pressure, so it doesn't wait for
+  // the background thread.
+  void release_ram();
+
+  ~FllamaKvTier();
+
+private:
+  struct Entry {
+    std::string model_key;
+    std::vector<llama_token> tokens;
+    // Set while in RAM; shared so a write can run without the lock.
+    std::shared_ptr<const std::vector<uint8_t>> state;
+    std::string path; // Set once on disk.
+    size_t size;
+    std::chrono::steady_clock::time_point last_used;
+    bool writing = false; // Being written to path.
+    bool removed = false;
+  };
+
+  FllamaKvTier() = default;
+  void run();
+  void wake_locked();
+  bool spill(const std::shared_ptr<Entry> &entry,
+             std::unique_lock<std::mutex> &lock);
+  void remove_locked(std::shared_ptr<Entry> entry, bool delete_file = true);
+  void enforce_disk_budget_locked();
+
+  std::mutex mutex;
+  std::condition_variable cond_var;
+  std::thread worker;
+  bool stop = false;
+  std::string cache_dir;
+  size_t ram_budget = 0;
+  size_t disk_budget = 0;
+  std::chrono::seconds idle_timeout{0};
+  // Most recently used first.
+  std::list<std::shared_ptr<Entry>> entries;
+  size_t ram_bytes = 0;
+  size_t disk_bytes = 0;
+  uint64_t next_file_id = 0;
+};
+
+#endif // FLLAMA_KV_TIER_H
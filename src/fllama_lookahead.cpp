@@ -0,0 +1,204 @@
+#include "fllama_lookahead.h"
+
+#include <algorithm>
+
+static void fllama_lookahead_batch_add(llama_batch &batch, llama_token token,
+                                       llama_pos pos, llama_seq_id seq_first,
+                                       llama_seq_id seq_last, bool logits) {
+  const int i = batch.n_tokens++;
+  batch.token[i] = token;
+  batch.pos[i] = pos;
+  batch.n_seq_id[i] = seq_last - seq_first + 1;
+  for (llama_seq_id s = seq_first; s <= seq_last; s++) {
+    batch.seq_id[i][s - seq_first] = s;
+  }
+  batch.logits[i] = logits;
+}
+
+FllamaLookahead::FllamaLookahead(llama_context *ctx, int window, int ngram,
+                                 int max_ngrams)
+    : ctx(ctx), W(std::max(window, 2)), N(std::max(ngram, 3)),
+      G(std::max(max_ngrams, 1)) {
+  n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(llama_get_model(ctx)));
+  batch = llama_batch_init(batch_size(), 0, W + G + 1);
+  // Initial guesses are arbitrary; they converge over the first steps.
+  levels.resize(N - 1);
+  for (int j = 0; j < N - 1; j++) {
+    levels[j].resize(W);
+    for (int i = 0; i < W; i++) {
+      levels[j][i] = (100 + i) % n_vocab;
+    }
+  }
+  sync();
+}
+
+FllamaLookahead::~FllamaLookahead() {
+  llama_kv_self_seq_keep(ctx, 0);
+  llama_batch_free(batch);
+}
+
+int FllamaLookahead::batch_size() const {
+  return 1 + G * (N - 1) + (W - 1) + W * (N - 2);
+}
+
+void FllamaLookahead::sync() {
+  for (llama_seq_id s = 1; s < W + G + 1; s++) {
+    llama_kv_self_seq_rm(ctx, s, -1, -1);
+    llama_kv_self_seq_cp(ctx, 0, s, -1, -1);
+  }
+}
+
+llama_token FllamaLookahead::argmax(int i_batch) const {
+  const float *logits = llama_get_logits_ith(ctx, i_batch);
+  return (llama_token)(std::max_element(logits, logits + n_vocab) - logits);
+}
+
+void FllamaLookahead::observe(const std::vector<llama_token> &first) {
+  // The n-grams each guess of the previous first level started, read down
+  // the levels; see
+  // https://github.com/hao-ai-lab/LookaheadDecoding/issues/14#issuecomment-1826198518
+  std::vector<llama_token> ngram(N - 1);
+  for (int f = 0; f < W; f++) {
+    for (int j = 0; j < N - 1; j++) {
+      ngram[j] = levels[j][f];
+    }
+    Ngrams &seen = observed[first[f]];
+    if (seen.tokens.empty()) {
+      seen.tokens.resize(G * (N - 1));
+    }
+    bool is_unique = true;
+    for (int k = 0; k < seen.count && is_unique; k++) {
+      is_unique = !std::equal(ngram.begin(), ngram.end(),
+                              seen.tokens.begin() + k * (N - 1));
+    }
+    if (!is_unique) {
+      continue;
+    }
+    std::copy(ngram.begin(), ngram.end(),
+              seen.tokens.begin() + seen.head * (N - 1));
+    seen.count = std::min(G, seen.count + 1);
+    seen.head = (seen.head + 1) % G;
+  }
+}
+
+bool FllamaLookahead::step(llama_sampler *smpl, llama_token token,
+                           std::deque<llama_token> &next) {
+  const llama_pos n_past = llama_kv_self_seq_pos_max(ctx, 0) + 1;
+  // Without room for the guesses, decode the token alone, still in every
+  // sequence so they stay in step.
+  const bool lookahead =
+      llama_kv_self_used_cells(ctx) + batch_size() <= (int)llama_n_ctx(ctx) &&
+      batch_size() <= (int)llama_n_batch(ctx);
+
+  // The batch: token, in every sequence; the candidate n-grams that start
+  // with it, each in its own sequence; then the guesses, level by level,
+  // guess i of each level in sequence i + 1. Level 0's guesses are also in
+  // the sequences of the guesses after them, which attend to them. See
+  // examples/lookahead and https://lmsys.org/blog/2023-11-21-lookahead-decoding/
+  batch.n_tokens = 0;
+  fllama_lookahead_batch_add(batch, token, n_past, 0, W + G, true);
+  candidates.clear();
+  if (lookahead) {
+    auto seen = observed.find(token);
+    const int g_cur = seen == observed.end() ? 0 : seen->second.count;
+    candidates.resize(g_cur);
+    for (int g = 0; g < g_cur; g++) {
+      candidates[g].active = true;
+      candidates[g].seq_id = W + 1 + g;
+      candidates[g].tokens.assign(N, token);
+      candidates[g].i_batch.assign(N, 0);
+    }
+    // Verification n-grams before the guesses, for less fragmentation.
+    for (int j = 0; j < N - 1; j++) {
+      for (int g = 0; g < g_cur; g++) {
+        const llama_token t = seen->second.tokens[g * (N - 1) + j];
+        candidates[g].tokens[j + 1] = t;
+        candidates[g].i_batch[j + 1] = batch.n_tokens;
+        fllama_lookahead_batch_add(batch, t, n_past + j + 1, W + 1 + g,
+                                   W + 1 + g, true);
+      }
+    }
+    for (int i = 1; i < W; i++) {
+      fllama_lookahead_batch_add(batch, levels[0][i], n_past + i, i + 1, W,
+                                 false);
+    }
+    for (int j = 1; j < N - 1; j++) {
+      for (int i = 0; i < W; i++) {
+        fllama_lookahead_batch_add(batch, levels[j][i], n_past + j + i, i + 1,
+                                   i + 1, j == N - 2);
+      }
+    }
+  }
+
+  if (llama_decode(ctx, batch) != 0) {
+    llama_kv_self_seq_rm(ctx, -1, n_past, -1);
+    return false;
+  }
+  n_steps++;
+
+  const llama_vocab *vocab = llama_model_get_vocab(llama_get_model(ctx));
+  llama_seq_id seq_id_best = 0;
+  llama_pos n_kept = n_past;
+  for (int v = 0; v < N; v++) {
+    int i_batch = 0;
+    if (v > 0) {
+      // The token sampled last matched these candidates' next token, which
+      // was decoded: its logits give the token after.
+      for (const Candidate &candidate : candidates) {
+        if (candidate.active) {
+          i_batch = candidate.i_batch[v];
+          seq_id_best = candidate.seq_id;
+          n_accepted++;
+          break;
+        }
+      }
+      if (i_batch == 0) {
+        break;
+      }
+    }
+
+    const llama_token id = llama_sampler_sample(smpl, ctx, i_batch);
+    next.push_back(id);
+    n_kept++;
+    if (llama_vocab_is_eog(vocab, id) || !lookahead) {
+      break;
+    }
+
+    for (Candidate &candidate : candidates) {
+      if (candidate.active &&
+          (v == N - 1 || id != candidate.tokens[v + 1])) {
+        candidate.active = false;
+      }
+    }
+
+    // Shift the guesses a level up. After the first token, the last level is
+    // the model's prediction for each guess; after later ones, the positions
+    // have moved on, so it starts again from the first level.
+    const std::vector<llama_token> first = levels[0];
+    for (int j = 0; j < N - 2; j++) {
+      levels[j] = levels[j + 1];
+    }
+    if (v == 0) {
+      const int i_last = (int)candidates.size() * (N - 1) + W * (N - 2);
+      for (int i = 0; i < W; i++) {
+        levels[N - 2][i] = argmax(i_last + i);
+      }
+      observe(first);
+    } else {
+      levels[N - 2] = levels[0];
+    }
+  }
+
+  // Keep token and the verified tokens, in every sequence; the last token
+  // sampled isn't decoded yet.
+  llama_kv_self_seq_rm(ctx, -1, n_kept, -1);
+  if (seq_id_best != 0) {
+    llama_kv_self_seq_keep(ctx, seq_id_best);
+    llama_kv_self_seq_cp(ctx, seq_id_best, 0, -1, -1);
+    llama_kv_self_seq_rm(ctx, seq_id_best, -1, -1);
+    for (llama_seq_id s = 1; s < W + G + 1; s++) {
+      llama_kv_self_seq_cp(ctx, 0, s, -1, -1);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,74 @@
+#ifndef FLLAMA_LOOKAHEAD_H
+#define FLLAMA_LOOKAHEAD_H
+
+#include "llama.h"
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// Lookahead (Jacobi) decoding, after examples/lookahead in llama.cpp: every
+// decode also refines a window of guessed tokens in extra KV cache sequences,
+// and checks n-grams collected from earlier guesses that start with the
+// current token. When the model agrees with one, several tokens come out of
+// one decode, with no draft model. Each token is still sampled from the
+// model's distribution at its position, so the output doesn't change.
+//
+// Sequences 1 to window + max_ngrams of the context are used for the guesses,
+// and share sequence 0's cells. Create it once the prompt is decoded.
+class FllamaLookahead {
+public:
+  FllamaLookahead(llama_context *ctx, int window, int ngram, int max_ngrams);
+  // Leaves only sequence 0 in the KV cache.
+  ~FllamaLookahead();
+  FllamaLookahead(const FllamaLookahead &) = delete;
+  FllamaLookahead &operator=(const FllamaLookahead &) = delete;
+
+  // Decodes token, the last one sampled, and appends to next what smpl
+  // samples after it: one token, or more when an n-gram is verified. All but
+  // the last of them are decoded too. Returns false if decoding failed.
+  bool step(llama_sampler *smpl, llama_token token,
+            std::deque<llama_token> &next);
+
+  // Call after sequence 0 changed other than through step.
+  void sync();
+
+  // Tokens in the batch step decodes, at most.
+  int batch_size() const;
+  int steps() const { return n_steps; }
+  // Tokens generated beyond one per step.
+  int accepted() const { return n_accepted; }
+
+private:
+  // Up to max_ngrams n-grams that followed a token in earlier guesses, minus
+  // that first token; a ring buffer.
+  struct Ngrams {
+    int count = 0;
+    int head = 0;
+    std::vector<llama_token> tokens;
+  };
+  struct Candidate {
+    bool active = false;
+    llama_seq_id seq_id = -1;
+    std::vector<int> i_batch;
+    std::vector<llama_token> tokens;
+  };
+
+  llama_token argmax(int i_batch) const;
+  void observe(const std::vector<llama_token> &first);
+
+  llama_context *ctx;
+  const int W;
+  const int N;
+  const int G;
+  int n_vocab;
+  llama_batch batch;
+  // Guesses of the last N - 1 Jacobi iterations, W tokens each.
+  std::vector<std::vector<llama_token>> levels;
+  std::unordered_map<llama_token, Ngrams> observed;
+  std::vector<Candidate> candidates;
+  int n_steps = 0;
+  int n_accepted = 0;
+};
+
+#endif // FLLAMA_LOOKAHEAD_H
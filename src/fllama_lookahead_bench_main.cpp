@@ -0,0 +1,200 @@
+// fllama_lookahead_bench: lookahead decoding against plain decoding on the
+// same greedy chat request, see fllama_lookahead.h.
+//
+//   fllama_lookahead_bench -m model.gguf [-p prompt] [-n max_tokens]
+//                          [-r repetitions] [-t threads] [-c context_size]
+//                          [-w window] [-g ngram] [-G max_ngrams]
+//                          [-R repeat_penalty]
+//
+// Each mode runs once to load the model and warm the caches, then -r times;
+// the median wall time is reported, prompt included. At temperature 0
+// lookahead must produce the same text as plain decoding, and so must a
+// lookahead generation stopped halfway and continued with
+// fllama_inference_continue; both are checked. A repeat penalty makes the
+// continuation depend on the sampler having seen exactly the tokens that were
+// emitted.
+
+#include "fllama.h"
+#include "llama.cpp/common/json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using json = nlohmann::ordered_json;
+
+struct LookaheadBenchParams {
+  std::string model_path;
+  std::string prompt =
+      "Count from one to fifty in words, separated by commas: one, two, "
+      "three, four";
+  int max_tokens = 256;
+  int repetitions = 3;
+  int num_threads = 2;
+  int context_size = 2048;
+  int window = 4;
+  int ngram = 3;
+  int max_ngrams = 4;
+  float repeat_penalty = 1.0f;
+};
+
+static std::mutex lookahead_bench_mutex;
+static std::condition_variable lookahead_bench_finished;
+static bool lookahead_bench_done = false;
+static std::string lookahead_bench_text;
+static std::string lookahead_bench_json;
+
+static void lookahead_bench_callback(const char *response, const char *json,
+                                     uint8_t done) {
+  if (!done) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(lookahead_bench_mutex);
+  lookahead_bench_text = response != nullptr ? response : "";
+  lookahead_bench_json = json != nullptr ? json : "";
+  lookahead_bench_done = true;
+  lookahead_bench_finished.notify_all();
+}
+
+// fllama_inference_continue runs on the inference queue.
+static void lookahead_bench_wait() {
+  std::unique_lock<std::mutex> lock(lookahead_bench_mutex);
+  lookahead_bench_finished.wait(lock, [] { return lookahead_bench_done; });
+  lookahead_bench_done = false;
+}
+
+static void lookahead_bench_quiet(const char *) {}
+
+// Runs one request; returns its wall time in milliseconds.
+static double lookahead_bench_run(const LookaheadBenchParams &params,
+                                  int request_id, bool lookahead,
+                                  int max_tokens) {
+  json body = {
+      {"messages", {{{"role", "user"}, {"content", params.prompt}}}},
+      {"temperature", 0.0},
+  };
+  if (lookahead) {
+    body["lookahead"] = true;
+    body["lookahead_window"] = params.window;
+    body["lookahead_ngram"] = params.ngram;
+    body["lookahead_max_ngrams"] = params.max_ngrams;
+  }
+  const std::string body_string = body.dump();
+
+  fllama_inference_request request = {};
+  request.request_id = request_id;
+  request.context_size = params.context_size;
+  request.input = (char *)"";
+  request.max_tokens = max_tokens;
+  request.model_path = (char *)params.model_path.c_str();
+  request.num_threads = params.num_threads;
+  request.temperature = 0.0f;
+  request.top_p = 1.0f;
+  request.penalty_repeat = params.repeat_penalty;
+  // The model's.
+  request.eos_token = nullptr;
+  request.dart_logger = lookahead_bench_quiet;
+  request.openai_request_json_string = (char *)body_string.c_str();
+
+  const auto start = std::chrono::steady_clock::now();
+  fllama_inference_sync(request, lookahead_bench_callback);
+  lookahead_bench_wait();
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// The timings of the last response, or an empty object.
+static json lookahead_bench_timings() {
+  const json response = json::parse(lookahead_bench_json, nullptr, false);
+  if (response.is_discarded() || !response.contains("timings")) {
+    return json::object();
+  }
+  return response["timings"];
+}
+
+int main(int argc, char **argv) {
+  LookaheadBenchParams params;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string arg = argv[i];
+    const char *value = argv[i + 1];
+    if (arg == "-m") {
+      params.model_path = value;
+    } else if (arg == "-p") {
+      params.prompt = value;
+    } else if (arg == "-n") {
+      params.max_tokens = std::max(atoi(value), 2);
+    } else if (arg == "-r") {
+      params.repetitions = std::max(atoi(value), 1);
+    } else if (arg == "-t") {
+      params.num_threads = std::max(atoi(value), 1);
+    } else if (arg == "-c") {
+      params.context_size = atoi(value);
+    } else if (arg == "-w") {
+      params.window = atoi(value);
+    } else if (arg == "-g") {
+      params.ngram = atoi(value);
+    } else if (arg == "-G") {
+      params.max_ngrams = atoi(value);
+    } else if (arg == "-R") {
+      params.repeat_penalty = (float)atof(value);
+    } else {
+      params.model_path.clear();
+      break;
+    }
+  }
+  if (params.model_path.empty()) {
+    fprintf(stderr,
+            "usage: %s -m model.gguf [-p prompt] [-n max_tokens] "
+            "[-r repetitions] [-t threads] [-c context_size] [-w window] "
+            "[-g ngram] [-G max_ngrams] [-R repeat_penalty]\n",
+            argv[0]);
+    return 1;
+  }
+
+  int request_id = 1;
+  std::string plain_text;
+  double plain_ms = 0;
+  printf("%-10s %10s %8s %12s %8s\n", "mode", "ms", "speedup",
+         "tokens/step", "output");
+  for (const bool lookahead : {false, true}) {
+    lookahead_bench_run(params, request_id++, lookahead, params.max_tokens);
+    std::vector<double> ms;
+    for (int r = 0; r < params.repetitions; r++) {
+      ms.push_back(lookahead_bench_run(params, request_id++, lookahead,
+                                       params.max_tokens));
+    }
+    std::sort(ms.begin(), ms.end());
+    const double median = ms[ms.size() / 2];
+    if (!lookahead) {
+      plain_text = lookahead_bench_text;
+      plain_ms = median;
+    }
+    const json timings = lookahead_bench_timings();
+    const double tokens_per_step =
+        lookahead && timings.contains("lookahead")
+            ? timings["lookahead"].value("tokens_per_step", 0.0)
+            : 1.0;
+    printf("%-10s %10.1f %8.2f %12.2f %8s\n",
+           lookahead ? "lookahead" : "plain", median, plain_ms / median,
+           tokens_per_step,
+           lookahead_bench_text == plain_text ? "same" : "DIFFERS");
+  }
+
+  // Stop halfway, likely with tokens sampled ahead, and continue.
+  const int continued_id = request_id++;
+  lookahead_bench_run(params, continued_id, true, params.max_tokens / 2);
+  fllama_inference_continue(continued_id,
+                            params.max_tokens - params.max_tokens / 2,
+                            lookahead_bench_callback);
+  lookahead_bench_wait();
+  const bool continued_same = lookahead_bench_text == plain_text;
+  printf("%-10s %10s %8s %12s %8s\n", "continued", "-", "-", "-",
+         continued_same ? "same" : "DIFFERS");
+  return plain_text.empty() || !continued_same ? 1 : 0;
+}
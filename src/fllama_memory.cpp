@@ -0,0 +1,54 @@
+#include "fllama_memory.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#elif defined(__linux__)
+#include <cstdio>
+#include <malloc.h>
+#include <unistd.h>
+#endif
+
+size_t fllama_memory_footprint() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.WorkingSetSize;
+  }
+  return 0;
+#elif defined(__APPLE__)
+  task_vm_info_data_t info;
+  mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+  if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) !=
+      KERN_SUCCESS) {
+    return 0;
+  }
+  return info.phys_footprint;
+#elif defined(__linux__)
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm == nullptr) {
+    return 0;
+  }
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  const int n = fscanf(statm, "%lu %lu", &size, &resident);
+  fclose(statm);
+  return n == 2 ? resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+  return 0;
+#endif
+}
+
+void fllama_memory_release_free_pages() {
+#if defined(__GLIBC__)
+  malloc_trim(0);
+#endif
+}
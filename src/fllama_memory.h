@@ -0,0 +1,16 @@
+#ifndef FLLAMA_MEMORY_H
+#define FLLAMA_MEMORY_H
+
+#include <cstddef>
+
+// Memory the OS counts against the process, in bytes: the physical footprint
+// on Apple platforms (what jetsam acts on), the resident set elsewhere. 0 if
+// it can't be measured, e.g. on web.
+size_t fllama_memory_footprint();
+
+// Hands memory the allocator keeps for reuse back to the OS, where the
+// allocator supports it (glibc). Freed model and context buffers are usually
+// mmapped and returned right away; this gets the smaller ones too.
+void fllama_memory_release_free_pages();
+
+#endif // FLLAMA_MEMORY_H
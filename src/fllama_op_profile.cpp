@@ -0,0 +1,252 @@
+#include "fllama_op_profile.h"
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/ggml/include/ggml-backend.h"
+#include "../ios/llama.cpp/ggml/include/ggml-cpu.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/ggml/include/ggml-backend.h"
+#include "../macos/llama.cpp/ggml/include/ggml-cpu.h"
+#else
+#include "llama.cpp/ggml/include/ggml-backend.h"
+#include "llama.cpp/ggml/include/ggml-cpu.h"
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+typedef void (*fllama_set_op_profile_callback_t)(ggml_cpu_op_profile_callback,
+                                                 void *);
+
+static std::atomic<bool> fllama_op_profiler_active{false};
+
+// The loaded CPU backend's setter: with GGML_BACKEND_DL it lives in the
+// ggml-cpu module picked at runtime, not in a library fllama links.
+static fllama_set_op_profile_callback_t fllama_op_profile_setter() {
+  ggml_backend_reg_t reg = ggml_backend_reg_by_name("CPU");
+  if (reg == nullptr) {
+    return nullptr;
+  }
+  return (fllama_set_op_profile_callback_t)ggml_backend_reg_get_proc_address(
+      reg, "ggml_cpu_set_op_profile_callback");
+}
+
+FllamaOpProfiler::FllamaOpProfiler(size_t max_events)
+    : max_events(max_events), events(GGML_DEFAULT_N_THREADS) {
+  fllama_set_op_profile_callback_t setter = fllama_op_profile_setter();
+  bool expected = false;
+  if (setter == nullptr ||
+      !fllama_op_profiler_active.compare_exchange_strong(expected, true)) {
+    return;
+  }
+  // Room for the largest thread count ggml allows, so threads never resize
+  // the outer vector under each other.
+  events.resize(GGML_MAX_N_THREADS);
+  setter(&FllamaOpProfiler::on_node, this);
+  is_installed = true;
+}
+
+FllamaOpProfiler::~FllamaOpProfiler() {
+  if (!is_installed) {
+    return;
+  }
+  fllama_op_profile_setter()(nullptr, nullptr);
+  fllama_op_profiler_active = false;
+}
+
+void FllamaOpProfiler::on_node(const struct ggml_tensor *node, int ith,
+                               int64_t t_start_us, int64_t t_end_us,
+                               void *user_data) {
+  switch (node->op) {
+  case GGML_OP_NONE:
+  case GGML_OP_VIEW:
+  case GGML_OP_RESHAPE:
+  case GGML_OP_PERMUTE:
+  case GGML_OP_TRANSPOSE:
+    return;
+  default:
+    break;
+  }
+  auto *profiler = (FllamaOpProfiler *)user_data;
+  if (profiler->n_events.fetch_add(1, std::memory_order_relaxed) >=
+          profiler->max_events ||
+      ith < 0 || ith >= (int)profiler->events.size()) {
+    return;
+  }
+  Event event;
+  event.t_start_us = t_start_us;
+  event.t_end_us = t_end_us;
+  event.op = (uint16_t)node->op;
+  event.unary_op =
+      node->op == GGML_OP_UNARY ? (uint8_t)ggml_get_unary_op(node) : 0;
+  event.type = (int8_t)node->type;
+  const ggml_tensor *src0 = node->src[0];
+  const ggml_tensor *src1 = node->src[1];
+  event.src0_type = src0 != nullptr ? (int8_t)src0->type : -1;
+  event.src1_type = src1 != nullptr ? (int8_t)src1->type : -1;
+  for (int i = 0; i < 4; i++) {
+    event.ne[i] = (int32_t)node->ne[i];
+    event.src0_ne[i] = src0 != nullptr ? (int32_t)src0->ne[i] : 0;
+    event.src1_ne[i] = src1 != nullptr ? (int32_t)src1->ne[i] : 0;
+  }
+  strncpy(event.name, node->name, sizeof(event.name) - 1);
+  event.name[sizeof(event.name) - 1] = '\0';
+  profiler->events[ith].push_back(event);
+}
+
+void FllamaOpProfiler::span(const std::string &name, int64_t t_start_us,
+                            int64_t t_end_us) {
+  spans.push_back({name, t_start_us, t_end_us});
+}
+
+std::string FllamaOpProfiler::label(const Event &event) {
+  const ggml_op op = (ggml_op)event.op;
+  if (op == GGML_OP_UNARY) {
+    return ggml_unary_op_name((ggml_unary_op)event.unary_op);
+  }
+  std::string label = ggml_op_name(op);
+  // Kernels differ per weight type, so they are worth telling apart.
+  if ((op == GGML_OP_MUL_MAT || op == GGML_OP_MUL_MAT_ID ||
+       op == GGML_OP_GET_ROWS) &&
+      event.src0_type >= 0) {
+    label += " ";
+    label += ggml_type_name((ggml_type)event.src0_type);
+  }
+  return label;
+}
+
+nlohmann::ordered_json FllamaOpProfiler::summary(size_t top_n) const {
+  struct Total {
+    int64_t us = 0;
+    int64_t count = 0;
+  };
+  std::map<std::string, Total> totals;
+  int64_t total_us = 0;
+  size_t n_kept = 0;
+  for (const auto &thread_events : events) {
+    for (const Event &event : thread_events) {
+      Total &total = totals[label(event)];
+      total.us += event.t_end_us - event.t_start_us;
+      total.count++;
+      total_us += event.t_end_us - event.t_start_us;
+      n_kept++;
+    }
+  }
+  std::vector<std::pair<std::string, Total>> sorted(totals.begin(),
+                                                    totals.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<std::string, Total> &a,
+               const std::pair<std::string, Total> &b) {
+              return a.second.us > b.second.us;
+            });
+  if (sorted.size() > top_n) {
+    sorted.resize(top_n);
+  }
+  nlohmann::ordered_json ops = nlohmann::ordered_json::array();
+  for (const auto &entry : sorted) {
+    ops.push_back({
+        {"op", entry.first},
+        {"ms", entry.second.us / 1000.0},
+        {"count", entry.second.count},
+        {"share", total_us > 0 ? (double)entry.second.us / total_us : 0.0},
+    });
+  }
+  // Thread time: with n threads on a node, it counts n times.
+  return {
+      {"total_ms", total_us / 1000.0},
+      {"events", n_kept},
+      {"dropped", n_events.load() - n_kept},
+      {"ops", ops},
+  };
+}
+
+static void fllama_op_profile_write_string(FILE *file, const char *s) {
+  fputc('"', file);
+  for (; *s != '\0'; s++) {
+    const unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+static void fllama_op_profile_write_shape(FILE *file, const int32_t ne[4]) {
+  fprintf(file, "[%d,%d,%d,%d]", ne[0], ne[1], ne[2], ne[3]);
+}
+
+bool FllamaOpProfiler::write_chrome_trace(const std::string &path) const {
+  // Streamed by hand: a trace easily holds a few hundred thousand events.
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+  int64_t t_origin = INT64_MAX;
+  for (const auto &thread_events : events) {
+    if (!thread_events.empty()) {
+      t_origin = std::min(t_origin, thread_events.front().t_start_us);
+    }
+  }
+  for (const Span &span : spans) {
+    t_origin = std::min(t_origin, span.t_start_us);
+  }
+  if (t_origin == INT64_MAX) {
+    t_origin = 0;
+  }
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"ph\":\"M\",\"pid\":0,\"tid\":0,\"name\":\"process_name\","
+                "\"args\":{\"name\":\"fllama\"}}");
+  fprintf(file, ",\n{\"ph\":\"M\",\"pid\":0,\"tid\":0,\"name\":\"thread_name\","
+                "\"args\":{\"name\":\"fllama\"}}");
+  for (const Span &span : spans) {
+    fprintf(file, ",\n{\"ph\":\"X\",\"pid\":0,\"tid\":0,\"cat\":\"phase\","
+                  "\"name\":");
+    fllama_op_profile_write_string(file, span.name.c_str());
+    fprintf(file, ",\"ts\":%lld,\"dur\":%lld}",
+            (long long)(span.t_start_us - t_origin),
+            (long long)(span.t_end_us - span.t_start_us));
+  }
+  for (size_t ith = 0; ith < events.size(); ith++) {
+    if (events[ith].empty()) {
+      continue;
+    }
+    // Track 0 is fllama's own.
+    const int tid = (int)ith + 1;
+    fprintf(file, ",\n{\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"name\":"
+                  "\"thread_name\",\"args\":{\"name\":\"ggml thread %d\"}}",
+            tid, (int)ith);
+    for (const Event &event : events[ith]) {
+      fprintf(file, ",\n{\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"cat\":", tid);
+      fllama_op_profile_write_string(file, ggml_op_name((ggml_op)event.op));
+      fprintf(file, ",\"name\":");
+      fllama_op_profile_write_string(file, label(event).c_str());
+      fprintf(file, ",\"ts\":%lld,\"dur\":%lld,\"args\":{\"node\":",
+              (long long)(event.t_start_us - t_origin),
+              (long long)(event.t_end_us - event.t_start_us));
+      fllama_op_profile_write_string(file, event.name);
+      fprintf(file, ",\"type\":\"%s\",\"shape\":",
+              ggml_type_name((ggml_type)event.type));
+      fllama_op_profile_write_shape(file, event.ne);
+      if (event.src0_type >= 0) {
+        fprintf(file, ",\"src0\":\"%s\",\"src0_shape\":",
+                ggml_type_name((ggml_type)event.src0_type));
+        fllama_op_profile_write_shape(file, event.src0_ne);
+      }
+      if (event.src1_type >= 0) {
+        fprintf(file, ",\"src1\":\"%s\",\"src1_shape\":",
+                ggml_type_name((ggml_type)event.src1_type));
+        fllama_op_profile_write_shape(file, event.src1_ne);
+      }
+      fprintf(file, "}}");
+    }
+  }
+  fprintf(file, "\n]}\n");
+  const bool ok = !ferror(file);
+  return fclose(file) == 0 && ok;
+}
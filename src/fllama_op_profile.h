@@ -0,0 +1,88 @@
+#ifndef FLLAMA_OP_PROFILE_H
+#define FLLAMA_OP_PROFILE_H
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/common/json.hpp"
+#include "../ios/llama.cpp/ggml/include/ggml.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/common/json.hpp"
+#include "../macos/llama.cpp/ggml/include/ggml.h"
+#else
+#include "llama.cpp/common/json.hpp"
+#include "llama.cpp/ggml/include/ggml.h"
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Times every ggml node on every CPU compute thread, through the CPU
+// backend's op profile callback, for "op_profile": true or "op_profile_path"
+// in the OpenAI JSON. Costs two clock reads and a few stores per node and
+// thread, so it can run on device.
+//
+// Events carry the op, with the weight type for matrix multiplications (ex.
+// "MUL_MAT q4_K"), the node's name and the shapes of the node and its first
+// two sources. Ops that don't compute anything (views, reshapes, permutes)
+// are left out. Past max_events, events are counted but not kept.
+class FllamaOpProfiler {
+public:
+  explicit FllamaOpProfiler(size_t max_events = 1 << 18);
+  ~FllamaOpProfiler();
+  FllamaOpProfiler(const FllamaOpProfiler &) = delete;
+  FllamaOpProfiler &operator=(const FllamaOpProfiler &) = delete;
+
+  // False if the CPU backend has no profile callback, or another profiler
+  // is installed.
+  bool installed() const { return is_installed; }
+
+  // A span on the trace's own "fllama" track, ex. "prefill", "decode".
+  void span(const std::string &name, int64_t t_start_us, int64_t t_end_us);
+
+  // Time per op and weight type, largest first: {"total_ms", "events",
+  // "dropped", "ops": [{"op", "ms", "count", "share"}]}.
+  nlohmann::ordered_json summary(size_t top_n = 16) const;
+
+  // Chrome trace event format, also read by Perfetto (ui.perfetto.dev).
+  // One track per compute thread. Returns false if the file can't be
+  // written.
+  bool write_chrome_trace(const std::string &path) const;
+
+private:
+  struct Event {
+    int64_t t_start_us;
+    int64_t t_end_us;
+    int32_t ne[4];
+    int32_t src0_ne[4];
+    int32_t src1_ne[4];
+    uint16_t op;
+    uint8_t unary_op;
+    int8_t type;
+    int8_t src0_type; // -1 without a source.
+    int8_t src1_type;
+    char name[32];
+  };
+  struct Span {
+    std::string name;
+    int64_t t_start_us;
+    int64_t t_end_us;
+  };
+
+  static void on_node(const struct ggml_tensor *node, int ith,
+                      int64_t t_start_us, int64_t t_end_us, void *user_data);
+  static std::string label(const Event &event);
+
+  bool is_installed = false;
+  size_t max_events;
+  std::atomic<size_t> n_events{0};
+  // Indexed by compute thread; each thread only appends to its own.
+  std::vector<std::vector<Event>> events;
+  std::vector<Span> spans;
+};
+
+#endif // FLLAMA_OP_PROFILE_H
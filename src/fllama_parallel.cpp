@@ -0,0 +1,206 @@
+#include "fllama_parallel.h"
+
+#include <algorithm>
+
+FllamaParallelGenerator::FllamaParallelGenerator(llama_context *ctx,
+                                                 int n_parallel,
+                                                 float temperature,
+                                                 uint32_t seed)
+    : ctx(ctx), n_parallel(std::max(n_parallel, 1)) {
+  for (int i = 0; i < this->n_parallel; i++) {
+    llama_sampler *smpl =
+        llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (temperature <= 0.0f) {
+      llama_sampler_chain_add(smpl, llama_sampler_init_greedy());
+    } else {
+      llama_sampler_chain_add(smpl, llama_sampler_init_temp(temperature));
+      llama_sampler_chain_add(smpl, llama_sampler_init_dist(seed + i));
+    }
+    samplers.push_back(smpl);
+  }
+}
+
+FllamaParallelGenerator::~FllamaParallelGenerator() {
+  for (llama_sampler *smpl : samplers) {
+    llama_sampler_free(smpl);
+  }
+}
+
+static void fllama_parallel_batch_add(llama_batch &batch, llama_token token,
+                                      llama_pos pos, llama_seq_id seq,
+                                      bool logits) {
+  const int i = batch.n_tokens++;
+  batch.token[i] = token;
+  batch.pos[i] = pos;
+  batch.n_seq_id[i] = 1;
+  batch.seq_id[i][0] = seq;
+  batch.logits[i] = logits;
+}
+
+// Decodes batch; if the KV cache's free cells are too scattered to take it,
+// defragments it once and retries. A batch that doesn't fit in one run of
+// free cells is normally split over several, see find_slot.
+static int fllama_parallel_decode(llama_context *ctx, llama_batch &batch) {
+  int status = llama_decode(ctx, batch);
+  if (status == 1) {
+    llama_kv_self_defrag(ctx);
+    llama_kv_self_update(ctx);
+    status = llama_decode(ctx, batch);
+  }
+  return status;
+}
+
+std::string FllamaParallelGenerator::run(std::vector<FllamaParallelJob> &jobs) {
+  decoded = 0;
+  shared = 0;
+  llama_kv_self_clear(ctx);
+  if (jobs.empty()) {
+    return "";
+  }
+  const llama_vocab *vocab = llama_model_get_vocab(llama_get_model(ctx));
+  const int n_ctx = (int)llama_n_ctx(ctx);
+  const int n_batch = (int)llama_n_batch(ctx);
+
+  // The common prefix, decoded once into its own sequence. Each job keeps at
+  // least one prompt token of its own, for the logits to sample from.
+  size_t n_prefix = jobs[0].prompt.size();
+  for (const auto &job : jobs) {
+    if (job.prompt.empty()) {
+      return "A prompt is empty.";
+    }
+    size_t n = 0;
+    while (n < n_prefix && n < job.prompt.size() &&
+           job.prompt[n] == jobs[0].prompt[n]) {
+      n++;
+    }
+    n_prefix = std::min(n, job.prompt.size() - 1);
+  }
+  if (jobs.size() < 2) {
+    n_prefix = 0;
+  }
+  for (const auto &job : jobs) {
+    const int n_own = (int)(job.prompt.size() - n_prefix);
+    if (n_own > n_batch || (int)n_prefix + n_own + job.max_tokens > n_ctx) {
+      return "A prompt doesn't fit in the context.";
+    }
+  }
+
+  std::string error;
+  llama_batch batch = llama_batch_init(n_batch, 0, 1);
+  const llama_seq_id prefix_seq = n_parallel;
+  for (size_t start = 0; start < n_prefix && error.empty(); start += n_batch) {
+    batch.n_tokens = 0;
+    for (size_t i = start; i < std::min(n_prefix, start + n_batch); i++) {
+      fllama_parallel_batch_add(batch, jobs[0].prompt[i], (llama_pos)i,
+                                prefix_seq, false);
+    }
+    if (fllama_parallel_decode(ctx, batch) != 0) {
+      error = "Unable to decode the shared prompt prefix.";
+    }
+    decoded += batch.n_tokens;
+  }
+
+  struct Slot {
+    int job = -1;
+    llama_token next = LLAMA_TOKEN_NULL;
+    llama_pos n_past = 0;
+    int i_batch = -1;
+    int reserved = 0; // KV cells set aside for the job
+  };
+  std::vector<Slot> slots(n_parallel);
+  int cells_free = n_ctx - (int)n_prefix;
+  size_t next_job = 0;
+  size_t n_done = 0;
+  while (error.empty() && n_done < jobs.size()) {
+    if (should_stop && should_stop()) {
+      error = "Cancelled.";
+      break;
+    }
+    batch.n_tokens = 0;
+    // Running jobs advance by one token each...
+    for (int s = 0; s < n_parallel; s++) {
+      Slot &slot = slots[s];
+      if (slot.job >= 0) {
+        slot.i_batch = batch.n_tokens;
+        fllama_parallel_batch_add(batch, slot.next, slot.n_past++, s, true);
+      }
+    }
+    // ...and waiting jobs start in free slots while there is room.
+    for (int s = 0; s < n_parallel && next_job < jobs.size(); s++) {
+      Slot &slot = slots[s];
+      if (slot.job >= 0) {
+        continue;
+      }
+      const FllamaParallelJob &job = jobs[next_job];
+      const int n_own = (int)(job.prompt.size() - n_prefix);
+      const int need = n_own + job.max_tokens;
+      if (need > cells_free || batch.n_tokens + n_own > n_batch) {
+        break;
+      }
+      if (n_prefix > 0) {
+        llama_kv_self_seq_cp(ctx, prefix_seq, s, -1, -1);
+        shared += n_prefix;
+      }
+      for (size_t i = n_prefix; i < job.prompt.size(); i++) {
+        fllama_parallel_batch_add(batch, job.prompt[i], (llama_pos)i, s,
+                                  i == job.prompt.size() - 1);
+      }
+      slot.job = (int)next_job++;
+      slot.i_batch = batch.n_tokens - 1;
+      slot.n_past = (llama_pos)job.prompt.size();
+      slot.reserved = need;
+      cells_free -= need;
+      llama_sampler_reset(samplers[s]);
+    }
+    if (batch.n_tokens == 0) {
+      error = "No job fits in the context.";
+      break;
+    }
+    if (fllama_parallel_decode(ctx, batch) != 0) {
+      error = "Unable to decode, the KV cache may be full.";
+      break;
+    }
+    decoded += batch.n_tokens;
+
+    for (int s = 0; s < n_parallel; s++) {
+      Slot &slot = slots[s];
+      if (slot.job < 0 || slot.i_batch < 0) {
+        continue;
+      }
+      FllamaParallelJob &job = jobs[slot.job];
+      const llama_token token =
+          llama_sampler_sample(samplers[s], ctx, slot.i_batch);
+      slot.i_batch = -1;
+      bool done = llama_vocab_is_eog(vocab, token);
+      if (done) {
+        job.stopped = true;
+      } else {
+        char piece[256];
+        const int n = llama_token_to_piece(vocab, token, piece, sizeof(piece),
+                                           0, false);
+        if (n > 0) {
+          job.text.append(piece, n);
+          if (on_token) {
+            on_token(slot.job, std::string(piece, n));
+          }
+        }
+        job.n_generated++;
+        slot.next = token;
+        done = job.n_generated >= job.max_tokens;
+      }
+      if (done) {
+        llama_kv_self_seq_rm(ctx, s, -1, -1);
+        cells_free += slot.reserved;
+        const size_t index = (size_t)slot.job;
+        slot = Slot();
+        n_done++;
+        if (on_job_done) {
+          on_job_done(index);
+        }
+      }
+    }
+  }
+  llama_batch_free(batch);
+  llama_kv_self_clear(ctx);
+  return error;
+}
@@ -0,0 +1,62 @@
+#ifndef FLLAMA_PARALLEL_H
+#define FLLAMA_PARALLEL_H
+
+#include "llama.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A prompt for FllamaParallelGenerator and, once run, what it generated.
+struct FllamaParallelJob {
+  std::vector<llama_token> prompt;
+  int max_tokens = 256;
+
+  std::string text;
+  int n_generated = 0;
+  // Ended with an end-of-generation token, rather than on max_tokens.
+  bool stopped = false;
+};
+
+// Generates for several prompts at once, each in its own KV cache sequence of
+// one context, so every decode advances all of them: batched throughput
+// instead of one request after another. The prompts' common prefix is decoded
+// once and shared by all sequences. A job starts as soon as a slot is free and
+// its prompt plus max_tokens fit in the free KV cells, so short jobs don't
+// hold up long ones.
+//
+// The context's KV cache is cleared before and after a run.
+class FllamaParallelGenerator {
+public:
+  // temperature <= 0 samples greedily.
+  FllamaParallelGenerator(llama_context *ctx, int n_parallel,
+                          float temperature, uint32_t seed);
+  ~FllamaParallelGenerator();
+  FllamaParallelGenerator(const FllamaParallelGenerator &) = delete;
+  FllamaParallelGenerator &operator=(const FllamaParallelGenerator &) = delete;
+
+  // Called with a job's index and the text it just generated.
+  std::function<void(size_t, const std::string &)> on_token;
+  // Called with a job's index once it is done.
+  std::function<void(size_t)> on_job_done;
+  // Polled before each decode; the run stops when it returns true.
+  std::function<bool()> should_stop;
+
+  // Runs all jobs. Returns an error message, empty on success.
+  std::string run(std::vector<FllamaParallelJob> &jobs);
+
+  // Tokens decoded by the last run, prompts included.
+  int64_t n_decoded() const { return decoded; }
+  // Prompt tokens the last run didn't decode, thanks to the shared prefix.
+  int64_t n_shared() const { return shared; }
+
+private:
+  llama_context *ctx;
+  int n_parallel;
+  std::vector<llama_sampler *> samplers;
+  int64_t decoded = 0;
+  int64_t shared = 0;
+};
+
+#endif // FLLAMA_PARALLEL_H
@@ -0,0 +1,153 @@
+#include "fllama_penalties.h"
+
+#include <vector>
+
+struct FllamaPenalties {
+  int32_t last_n;
+  float penalty_repeat;
+  float penalty_freq;
+  float penalty_present;
+
+  // The window, oldest first from `head` once it is full.
+  std::vector<llama_token> window;
+  size_t head = 0;
+  // Per token id: occurrences in the window, and where the token is in
+  // `distinct` while that is above 0.
+  std::vector<int32_t> counts;
+  std::vector<int32_t> distinct_index;
+  std::vector<llama_token> distinct;
+
+  void add(llama_token token) {
+    if (counts[token]++ == 0) {
+      distinct_index[token] = (int32_t)distinct.size();
+      distinct.push_back(token);
+    }
+  }
+
+  void remove(llama_token token) {
+    if (--counts[token] > 0) {
+      return;
+    }
+    // Swap with the last distinct token.
+    const int32_t index = distinct_index[token];
+    const llama_token last = distinct.back();
+    distinct[index] = last;
+    distinct_index[last] = index;
+    distinct.pop_back();
+  }
+
+  void penalize(llama_token_data &candidate, int32_t count) const {
+    // Dividing a negative logit would make the token more likely.
+    if (candidate.logit <= 0) {
+      candidate.logit *= penalty_repeat;
+    } else {
+      candidate.logit /= penalty_repeat;
+    }
+    candidate.logit -= float(count) * penalty_freq + penalty_present;
+  }
+};
+
+static const char *fllama_penalties_name(const llama_sampler * /*smpl*/) {
+  return "fllama-penalties";
+}
+
+static void fllama_penalties_accept(llama_sampler *smpl, llama_token token) {
+  auto *p = (FllamaPenalties *)smpl->ctx;
+  if (token < 0 || token >= (llama_token)p->counts.size()) {
+    return;
+  }
+  if (p->window.size() < (size_t)p->last_n) {
+    p->window.push_back(token);
+  } else {
+    p->remove(p->window[p->head]);
+    p->window[p->head] = token;
+    p->head = (p->head + 1) % p->window.size();
+  }
+  p->add(token);
+}
+
+static void fllama_penalties_apply(llama_sampler *smpl,
+                                   llama_token_data_array *cur_p) {
+  const auto *p = (const FllamaPenalties *)smpl->ctx;
+  if (p->distinct.empty()) {
+    return;
+  }
+  bool by_id = true;
+  for (const llama_token token : p->distinct) {
+    if ((size_t)token >= cur_p->size || cur_p->data[token].id != token) {
+      by_id = false;
+      break;
+    }
+  }
+  if (by_id) {
+    for (const llama_token token : p->distinct) {
+      p->penalize(cur_p->data[token], p->counts[token]);
+    }
+  } else {
+    // An earlier sampler reordered or filtered the candidates. Still no
+    // hashing: one pass with flat lookups.
+    const llama_token n_vocab = (llama_token)p->counts.size();
+    for (size_t i = 0; i < cur_p->size; i++) {
+      const llama_token token = cur_p->data[i].id;
+      if (token >= 0 && token < n_vocab && p->counts[token] > 0) {
+        p->penalize(cur_p->data[i], p->counts[token]);
+      }
+    }
+  }
+  cur_p->sorted = false;
+}
+
+static void fllama_penalties_reset(llama_sampler *smpl) {
+  auto *p = (FllamaPenalties *)smpl->ctx;
+  for (const llama_token token : p->distinct) {
+    p->counts[token] = 0;
+  }
+  p->distinct.clear();
+  p->window.clear();
+  p->head = 0;
+}
+
+static llama_sampler *fllama_penalties_clone(const llama_sampler *smpl);
+
+static void fllama_penalties_free(llama_sampler *smpl) {
+  delete (FllamaPenalties *)smpl->ctx;
+}
+
+static llama_sampler_i fllama_penalties_i = {
+    /* .name   = */ fllama_penalties_name,
+    /* .accept = */ fllama_penalties_accept,
+    /* .apply  = */ fllama_penalties_apply,
+    /* .reset  = */ fllama_penalties_reset,
+    /* .clone  = */ fllama_penalties_clone,
+    /* .free   = */ fllama_penalties_free,
+};
+
+static llama_sampler *fllama_penalties_clone(const llama_sampler *smpl) {
+  return llama_sampler_init(
+      &fllama_penalties_i,
+      new FllamaPenalties(*(const FllamaPenalties *)smpl->ctx));
+}
+
+llama_sampler *fllama_sampler_init_penalties(int32_t n_vocab, int32_t last_n,
+                                             float penalty_repeat,
+                                             float penalty_freq,
+                                             float penalty_present) {
+  // 0 would divide by zero; it has always meant "unset" for callers.
+  if (penalty_repeat <= 0.0f) {
+    penalty_repeat = 1.0f;
+  }
+  if (n_vocab <= 0 || last_n <= 0 ||
+      (penalty_repeat == 1.0f && penalty_freq == 0.0f &&
+       penalty_present == 0.0f)) {
+    return nullptr;
+  }
+  auto *p = new FllamaPenalties();
+  p->last_n = last_n;
+  p->penalty_repeat = penalty_repeat;
+  p->penalty_freq = penalty_freq;
+  p->penalty_present = penalty_present;
+  p->window.reserve(last_n);
+  p->counts.assign(n_vocab, 0);
+  p->distinct_index.assign(n_vocab, 0);
+  return llama_sampler_init(&fllama_penalties_i, p);
+}
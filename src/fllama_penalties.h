@@ -0,0 +1,32 @@
+#ifndef FLLAMA_PENALTIES_H
+#define FLLAMA_PENALTIES_H
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/include/llama.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/include/llama.h"
+#else
+#include "llama.cpp/include/llama.h"
+#endif
+
+// Repetition, frequency and presence penalties over the last `last_n`
+// generated tokens, with the same math as llama.cpp's penalties sampler.
+//
+// llama.cpp's looks every candidate up in a hash map on each step, so a step
+// costs a hash per vocabulary entry. This one keeps a flat count per token id,
+// updated as tokens are accepted and leave the window, plus the list of
+// distinct tokens in the window; a step only touches those tokens' logits.
+// Add it first in the chain, while candidates are still indexed by token id.
+//
+// Returns null if every penalty is disabled (repeat 1, freq and present 0) or
+// last_n is 0, so callers can skip adding it.
+llama_sampler *fllama_sampler_init_penalties(int32_t n_vocab, int32_t last_n,
+                                             float penalty_repeat,
+                                             float penalty_freq,
+                                             float penalty_present);
+
+#endif // FLLAMA_PENALTIES_H
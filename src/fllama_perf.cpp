@@ -0,0 +1,238 @@
+#include "fllama_perf.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static int64_t fllama_perf_now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+#if defined(__linux__)
+struct FllamaPerfCounter {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+static const FllamaPerfCounter fllama_perf_counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"stalled_cycles_frontend", PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+    {"stalled_cycles_backend", PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+    {"task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+static int fllama_perf_open(const FllamaPerfCounter &counter, pid_t tid) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = counter.type;
+  attr.config = counter.config;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // Not inherited: a child's counts would only reach this fd when it
+  // exits, and the OpenMP pool never does. Workers get their own fds.
+  // Allowed at the default perf_event_paranoid of 2.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, tid, -1, -1,
+                      PERF_FLAG_FD_CLOEXEC);
+}
+
+static std::string fllama_perf_thread_name(pid_t tid) {
+  const std::string path = "/proc/self/task/" + std::to_string(tid) + "/comm";
+  std::string name;
+  if (FILE *file = fopen(path.c_str(), "r")) {
+    char buffer[64];
+    if (fgets(buffer, sizeof(buffer), file) != nullptr) {
+      name = buffer;
+    }
+    fclose(file);
+  }
+  while (!name.empty() && name.back() == '\n') {
+    name.pop_back();
+  }
+  return name;
+}
+
+// Threads named `name`, in no particular order.
+static std::vector<pid_t> fllama_perf_threads(const std::string &name) {
+  std::vector<pid_t> tids;
+  DIR *dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    return tids;
+  }
+  while (dirent *entry = readdir(dir)) {
+    const pid_t tid = (pid_t)atoi(entry->d_name);
+    if (tid > 0 && fllama_perf_thread_name(tid) == name) {
+      tids.push_back(tid);
+    }
+  }
+  closedir(dir);
+  return tids;
+}
+#endif
+
+FllamaPerfCounters::FllamaPerfCounters() : last_ms(fllama_perf_now_ms()) {
+#if defined(__linux__)
+  const pid_t self = (pid_t)syscall(SYS_gettid);
+  thread_name = fllama_perf_thread_name(self);
+  tids.push_back(self);
+  const size_t n_counters =
+      sizeof(fllama_perf_counters) / sizeof(fllama_perf_counters[0]);
+  for (size_t i = 0; i < n_counters; i++) {
+    const FllamaPerfCounter &counter = fllama_perf_counters[i];
+    // Probed on this thread first, so a missing counter costs one syscall.
+    const int fd = fllama_perf_open(counter, self);
+    if (fd < 0) {
+      unavailable.push_back(std::string(counter.name) + ": " +
+                            strerror(errno));
+      continue;
+    }
+    names.push_back(counter.name);
+    counter_ids.push_back(i);
+    fds.push_back({fd});
+  }
+  if (names.empty()) {
+    error = "No counters available";
+  } else {
+    attach_threads();
+  }
+#else
+  error = "perf_event_open is only available on Linux and Android";
+#endif
+  last_values = read();
+}
+
+void FllamaPerfCounters::attach_threads() {
+#if defined(__linux__)
+  if (names.empty() || thread_name.empty()) {
+    return;
+  }
+  for (const pid_t tid : fllama_perf_threads(thread_name)) {
+    if (std::find(tids.begin(), tids.end(), tid) != tids.end()) {
+      continue;
+    }
+    tids.push_back(tid);
+    for (size_t i = 0; i < counter_ids.size(); i++) {
+      // Threads may exit in between; whatever they counted is lost either
+      // way.
+      const int fd =
+          fllama_perf_open(fllama_perf_counters[counter_ids[i]], tid);
+      if (fd >= 0) {
+        fds[i].push_back(fd);
+      }
+    }
+  }
+#endif
+}
+
+FllamaPerfCounters::~FllamaPerfCounters() {
+#if defined(__linux__)
+  for (const auto &counter_fds : fds) {
+    for (const int fd : counter_fds) {
+      close(fd);
+    }
+  }
+#endif
+}
+
+std::vector<double> FllamaPerfCounters::read() const {
+  std::vector<double> values(fds.size(), 0.0);
+#if defined(__linux__)
+  for (size_t i = 0; i < fds.size(); i++) {
+    for (const int fd : fds[i]) {
+      uint64_t data[3] = {0, 0, 0}; // value, time enabled, time running
+      if (::read(fd, data, sizeof(data)) != (ssize_t)sizeof(data) ||
+          data[2] == 0) {
+        continue;
+      }
+      // Scaled up when the PMU was shared with other counters.
+      values[i] += (double)data[0] * ((double)data[1] / (double)data[2]);
+    }
+  }
+#endif
+  return values;
+}
+
+void FllamaPerfCounters::mark(const std::string &phase, int64_t n) {
+  // Threads attached now count from zero, so they add nothing to earlier
+  // phases.
+  attach_threads();
+  const std::vector<double> values = read();
+  const int64_t now_ms = fllama_perf_now_ms();
+  Phase *target = nullptr;
+  for (Phase &existing : phases) {
+    if (existing.name == phase) {
+      target = &existing;
+      break;
+    }
+  }
+  if (target == nullptr) {
+    phases.push_back(Phase());
+    target = &phases.back();
+    target->name = phase;
+    target->values.assign(values.size(), 0.0);
+  }
+  target->n += n;
+  target->ms += now_ms - last_ms;
+  for (size_t i = 0; i < values.size(); i++) {
+    target->values[i] += values[i] - last_values[i];
+  }
+  last_values = values;
+  last_ms = now_ms;
+}
+
+nlohmann::ordered_json FllamaPerfCounters::to_json() const {
+  using json = nlohmann::ordered_json;
+  if (!error.empty()) {
+    return {{"available", false}, {"reason", error},
+            {"unavailable", unavailable}};
+  }
+  json out_phases = json::object();
+  for (const Phase &phase : phases) {
+    json out = {{"ms", phase.ms}, {"n", phase.n}};
+    json per_n = json::object();
+    double cycles = -1;
+    double instructions = -1;
+    for (size_t i = 0; i < names.size(); i++) {
+      out[names[i]] = (uint64_t)phase.values[i];
+      if (phase.n > 1) {
+        per_n[names[i]] = phase.values[i] / phase.n;
+      }
+      if (names[i] == "cycles") {
+        cycles = phase.values[i];
+      } else if (names[i] == "instructions") {
+        instructions = phase.values[i];
+      }
+    }
+    if (cycles > 0 && instructions >= 0) {
+      out["ipc"] = instructions / cycles;
+    }
+    if (!per_n.empty()) {
+      out["per_n"] = per_n;
+    }
+    out_phases[phase.name] = out;
+  }
+  return {
+      {"available", true},     {"threads", tids.size()},
+      {"counters", names},     {"unavailable", unavailable},
+      {"phases", out_phases},
+  };
+}
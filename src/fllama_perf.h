@@ -0,0 +1,82 @@
+#ifndef FLLAMA_PERF_H
+#define FLLAMA_PERF_H
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/common/json.hpp"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/common/json.hpp"
+#else
+#include "llama.cpp/common/json.hpp"
+#endif
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Hardware performance counters per inference phase, opted into with
+// "perf_counters": true in the OpenAI JSON. Linux and Android only, through
+// perf_event_open.
+//
+// Counts user-space cycles, instructions, last level cache misses and
+// frontend/backend stalled cycles, plus task-clock, on the calling thread and
+// the ggml worker threads: those with the calling thread's name, which
+// threads inherit from the one that starts them (the inference queue names
+// its thread "fllama"). The app's other threads, ex. Flutter's UI and raster
+// threads, are left out. The OpenMP pool lives as long as the calling thread
+// and is picked up at each mark; on the process's first request it starts
+// during the prefill, which then only counts the calling thread. Threads a
+// build without OpenMP starts for each graph aren't counted. Counters the
+// CPU, kernel or sandbox don't provide (perf_event_paranoid, VMs, SELinux on
+// Android) are left out and listed as unavailable; multiplexed counters are
+// scaled.
+class FllamaPerfCounters {
+public:
+  FllamaPerfCounters();
+  ~FllamaPerfCounters();
+  FllamaPerfCounters(const FllamaPerfCounters &) = delete;
+  FllamaPerfCounters &operator=(const FllamaPerfCounters &) = delete;
+
+  // Attributes everything counted since the previous mark, or since
+  // construction, to `phase`. Marking a phase again adds to it; `n` is how
+  // many units (ex. tokens) the span covered, for per-unit averages.
+  void mark(const std::string &phase, int64_t n = 1);
+
+  // {"threads", "counters", "unavailable", "phases": {phase: {"ms", "n",
+  // counter..., "ipc", "per_n": {...}}}}, or {"available": false, "reason"}.
+  nlohmann::ordered_json to_json() const;
+
+private:
+  struct Phase {
+    std::string name;
+    int64_t n = 0;
+    int64_t ms = 0;
+    std::vector<double> values;
+  };
+
+  // Opens the available counters on worker threads not counted yet.
+  void attach_threads();
+
+  // Scaled totals of each counter, over all threads.
+  std::vector<double> read() const;
+
+  std::vector<std::string> names;
+  // Index of each available counter in the table in fllama_perf.cpp.
+  std::vector<size_t> counter_ids;
+  std::vector<std::string> unavailable;
+  std::string error;
+  // The calling thread's name, shared by its workers.
+  std::string thread_name;
+  // Threads counted, the calling thread first.
+  std::vector<int> tids;
+  // One fd per thread and counter, counter-major.
+  std::vector<std::vector<int>> fds;
+  std::vector<double> last_values;
+  int64_t last_ms = 0;
+  std::vector<Phase> phases;
+};
+
+#endif // FLLAMA_PERF_H
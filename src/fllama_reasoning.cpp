@@ -0,0 +1,69 @@
+#include "fllama_reasoning.h"
+
+#include <algorithm>
+
+static bool fllama_reasoning_is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+FllamaReasoningBudget::FllamaReasoningBudget(common_chat_format format,
+                                             const std::string &prompt,
+                                             int budget)
+    : budget(budget) {
+  if (format == COMMON_CHAT_FORMAT_COMMAND_R7B ||
+      format == COMMON_CHAT_FORMAT_COMMAND_R7B_EXTRACT_REASONING) {
+    open_tag = "<|START_THINKING|>";
+    close_tag = "<|END_THINKING|>";
+    close = close_tag;
+  } else {
+    // DeepSeek R1 and Hermes 2 Pro (Qwen3) parse <think> spans; other
+    // formats leave them in the content, but models still emit them.
+    open_tag = "<think>";
+    close_tag = "</think>";
+    close = "\n" + close_tag + "\n\n";
+  }
+  size_t end = prompt.size();
+  while (end > 0 && fllama_reasoning_is_space(prompt[end - 1])) {
+    end--;
+  }
+  const bool opened_by_prompt =
+      end >= open_tag.size() &&
+      prompt.compare(end - open_tag.size(), open_tag.size(), open_tag) == 0;
+  state = opened_by_prompt ? REASONING : NOT_STARTED;
+}
+
+void FllamaReasoningBudget::on_token(const std::string &response) {
+  if (state == NOT_STARTED) {
+    // Reasoning can only open the response, after optional whitespace.
+    size_t start = 0;
+    while (start < response.size() &&
+           fllama_reasoning_is_space(response[start])) {
+      start++;
+    }
+    const size_t n = std::min(response.size() - start, open_tag.size());
+    if (response.compare(start, n, open_tag, 0, n) != 0) {
+      state = DONE;
+    } else if (n == open_tag.size()) {
+      state = REASONING;
+      reasoning_start = start + open_tag.size();
+    }
+    return;
+  }
+  if (state != REASONING) {
+    return;
+  }
+  if (response.find(close_tag, reasoning_start) != std::string::npos) {
+    state = DONE;
+    return;
+  }
+  n_tokens++;
+}
+
+bool FllamaReasoningBudget::should_close() const {
+  return budget >= 0 && state == REASONING && n_tokens >= budget;
+}
+
+void FllamaReasoningBudget::closed() {
+  state = DONE;
+  forced = true;
+}
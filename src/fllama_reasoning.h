@@ -0,0 +1,56 @@
+#ifndef FLLAMA_REASONING_H
+#define FLLAMA_REASONING_H
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/common/chat.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/common/chat.h"
+#else
+#include "llama.cpp/common/chat.h"
+#endif
+
+#include <string>
+
+// Caps how long a reasoning model (DeepSeek R1 distills, Qwen3, Command R7B)
+// thinks before answering. Tracks the reasoning span in the generated text
+// and, once it holds `budget` tokens, asks for the closing tag to be forced
+// so the model moves on to the answer.
+class FllamaReasoningBudget {
+public:
+  // budget < 0 only counts the tokens. prompt is the formatted prompt: templates
+  // for R1 distills end it with the opening tag.
+  FllamaReasoningBudget(common_chat_format format, const std::string &prompt,
+                        int budget);
+
+  // Call after each generated token is appended to the response.
+  void on_token(const std::string &response);
+
+  // True when the closing text should be decoded next.
+  bool should_close() const;
+  // Text to decode, including the closing tag.
+  const std::string &close_text() const { return close; }
+  // Call after close_text was decoded and appended.
+  void closed();
+
+  int tokens() const { return n_tokens; }
+  bool was_forced() const { return forced; }
+
+private:
+  enum State { NOT_STARTED, REASONING, DONE };
+
+  int budget;
+  State state = DONE;
+  std::string open_tag;
+  std::string close_tag;
+  std::string close;
+  // Where the reasoning starts in the response.
+  size_t reasoning_start = 0;
+  int n_tokens = 0;
+  bool forced = false;
+};
+
+#endif // FLLAMA_REASONING_H
@@ -0,0 +1,152 @@
+#include "fllama_rpc.h"
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/ggml/include/ggml-backend.h"
+#include "../ios/llama.cpp/ggml/include/ggml-rpc.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/ggml/include/ggml-backend.h"
+#include "../macos/llama.cpp/ggml/include/ggml-rpc.h"
+#else
+#include "llama.cpp/ggml/include/ggml-backend.h"
+#include "llama.cpp/ggml/include/ggml-rpc.h"
+#endif
+
+#include <algorithm>
+
+// The RPC backend can be a module loaded at runtime, so everything goes
+// through the registry rather than the ggml-rpc.h functions.
+typedef ggml_backend_dev_t (*fllama_rpc_add_device_t)(const char *endpoint);
+typedef void (*fllama_rpc_get_device_memory_t)(const char *endpoint,
+                                               size_t *free, size_t *total);
+typedef void (*fllama_rpc_get_stats_t)(const char *endpoint,
+                                       struct ggml_backend_rpc_stats *stats);
+typedef void (*fllama_rpc_reset_stats_t)(const char *endpoint);
+
+static void *fllama_rpc_proc(const char *name) {
+  ggml_backend_reg_t reg = ggml_backend_reg_by_name("RPC");
+  if (reg == nullptr) {
+    return nullptr;
+  }
+  return ggml_backend_reg_get_proc_address(reg, name);
+}
+
+std::string FllamaRpcOptions::cache_key() const {
+  if (endpoints.empty()) {
+    return "";
+  }
+  std::string key = "|rpc=";
+  for (const auto &endpoint : endpoints) {
+    key += endpoint + ",";
+  }
+  key += "|split=" + split;
+  for (float w : weights) {
+    key += "," + std::to_string(w);
+  }
+  return key;
+}
+
+bool fllama_rpc_init_devices(const FllamaRpcOptions &options,
+                             std::vector<ggml_backend_dev_t> &devices,
+                             std::vector<float> &tensor_split,
+                             std::string &error) {
+  auto add_device =
+      (fllama_rpc_add_device_t)fllama_rpc_proc("ggml_backend_rpc_add_device");
+  auto get_device_memory = (fllama_rpc_get_device_memory_t)fllama_rpc_proc(
+      "ggml_backend_rpc_get_device_memory");
+  if (add_device == nullptr || get_device_memory == nullptr) {
+    error = "this build of fllama does not include the RPC backend";
+    return false;
+  }
+
+  devices.clear();
+  for (const auto &endpoint : options.endpoints) {
+    // Also opens the connection, which the model's buffers then share.
+    size_t free = 0;
+    size_t total = 0;
+    get_device_memory(endpoint.c_str(), &free, &total);
+    if (total == 0) {
+      error = "unable to connect to RPC server " + endpoint;
+      return false;
+    }
+    ggml_backend_dev_t dev = add_device(endpoint.c_str());
+    if (dev == nullptr) {
+      error = "unable to add RPC device " + endpoint;
+      return false;
+    }
+    devices.push_back(dev);
+  }
+  // Local GPUs keep taking part, after the servers as llama.cpp orders them.
+  for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+    ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+    if (ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_GPU &&
+        ggml_backend_dev_backend_reg(dev) != ggml_backend_reg_by_name("RPC")) {
+      devices.push_back(dev);
+    }
+  }
+
+  const size_t n_devices = devices.size();
+  if (n_devices > llama_max_devices()) {
+    error = "too many devices: " + std::to_string(n_devices) + ", maximum " +
+            std::to_string(llama_max_devices());
+    return false;
+  }
+  // All zeros lets llama.cpp split by free memory.
+  tensor_split.assign(llama_max_devices(), 0.0f);
+  if (options.split == "even") {
+    std::fill(tensor_split.begin(), tensor_split.begin() + n_devices, 1.0f);
+  } else if (options.split == "weights") {
+    if (options.weights.size() != n_devices) {
+      error = "rpc_split has " + std::to_string(options.weights.size()) +
+              " weights for " + std::to_string(n_devices) + " devices";
+      return false;
+    }
+    std::copy(options.weights.begin(), options.weights.end(),
+              tensor_split.begin());
+  } else if (options.split != "memory") {
+    error = "unknown rpc_split: " + options.split;
+    return false;
+  }
+  devices.push_back(nullptr);
+  return true;
+}
+
+void fllama_rpc_reset_stats(const FllamaRpcOptions &options) {
+  auto reset_stats =
+      (fllama_rpc_reset_stats_t)fllama_rpc_proc("ggml_backend_rpc_reset_stats");
+  if (reset_stats == nullptr) {
+    return;
+  }
+  for (const auto &endpoint : options.endpoints) {
+    reset_stats(endpoint.c_str());
+  }
+}
+
+std::vector<FllamaDeviceTiming>
+fllama_rpc_device_timings(const FllamaRpcOptions &options,
+                          const std::vector<ggml_backend_dev_t> &devices) {
+  auto get_stats =
+      (fllama_rpc_get_stats_t)fllama_rpc_proc("ggml_backend_rpc_get_stats");
+  std::vector<FllamaDeviceTiming> timings;
+  for (size_t i = 0; i < devices.size() && devices[i] != nullptr; i++) {
+    FllamaDeviceTiming timing;
+    timing.name = ggml_backend_dev_name(devices[i]);
+    ggml_backend_dev_memory(devices[i], &timing.memory_free,
+                            &timing.memory_total);
+    // RPC devices come first, in the order of the endpoints.
+    if (i < options.endpoints.size() && get_stats != nullptr) {
+      timing.endpoint = options.endpoints[i];
+      struct ggml_backend_rpc_stats stats = {};
+      get_stats(timing.endpoint.c_str(), &stats);
+      timing.graph_computes = stats.n_graph_compute;
+      timing.compute_ms = stats.t_graph_compute_us / 1000.0;
+      timing.bytes_sent = stats.bytes_sent;
+      timing.bytes_recv = stats.bytes_recv;
+    }
+    timings.push_back(timing);
+  }
+  return timings;
+}
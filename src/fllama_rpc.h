@@ -0,0 +1,60 @@
+#ifndef FLLAMA_RPC_H
+#define FLLAMA_RPC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+// Offloads model layers to ggml RPC servers (llama.cpp's rpc-server) on other
+// machines, so a model too large for any one of them can be split across a
+// LAN. Each server is a "host:port" endpoint and becomes one more offload
+// device next to the local GPUs; layers that are not offloaded
+// (n_gpu_layers) stay on this machine's CPU.
+//
+// The connections belong to the model's weight buffers, so they stay open for
+// as long as the model is cached.
+struct FllamaRpcOptions {
+  std::vector<std::string> endpoints;
+  // How offloaded layers are divided over the devices: "memory" (by free
+  // memory), "even", or "weights" with one weight per device, RPC servers
+  // first in the order given, then local GPUs.
+  std::string split = "memory";
+  std::vector<float> weights;
+
+  bool enabled() const { return !endpoints.empty(); }
+  // Distinguishes models loaded with different RPC setups in the cache.
+  std::string cache_key() const;
+};
+
+// Per-device usage for one request.
+struct FllamaDeviceTiming {
+  std::string name;
+  std::string endpoint; // empty for local devices
+  size_t memory_free = 0;
+  size_t memory_total = 0;
+  uint64_t graph_computes = 0;
+  double compute_ms = 0.0; // round trip, including the transfer
+  uint64_t bytes_sent = 0;
+  uint64_t bytes_recv = 0;
+};
+
+// Connects to the servers and fills the NULL-terminated device list and the
+// tensor split for llama_model_params. Returns false with a message if the
+// RPC backend is missing, a server is unreachable or the split is invalid.
+bool fllama_rpc_init_devices(const FllamaRpcOptions &options,
+                             std::vector<ggml_backend_dev_t> &devices,
+                             std::vector<float> &tensor_split,
+                             std::string &error);
+
+// Starts a new measurement for fllama_rpc_device_timings.
+void fllama_rpc_reset_stats(const FllamaRpcOptions &options);
+
+// Usage of every device in the list since the last fllama_rpc_reset_stats.
+std::vector<FllamaDeviceTiming>
+fllama_rpc_device_timings(const FllamaRpcOptions &options,
+                          const std::vector<ggml_backend_dev_t> &devices);
+
+#endif // FLLAMA_RPC_H
@@ -0,0 +1,578 @@
+// fllama_server: an OpenAI-compatible HTTP server on top of libfllama.
+//
+// Requests go through the same inference queue, model cache and
+// fllama_inference_sync pipeline as the plugin, so every local tool that
+// talks to this server shares one loaded model. HTTP connections are handled
+// concurrently and kept alive; inference itself is serialized by the queue.
+//
+//   fllama_server -m model.gguf [--host 127.0.0.1] [--port 8080]
+//
+// Endpoints: POST /v1/chat/completions (optionally streamed as server-sent
+// events), POST /v1/embeddings, GET /v1/models, GET /health, GET /metrics.
+
+#include "fllama.h"
+#include "fllama_cpp.h"
+
+#include "llama.cpp/common/base64.hpp"
+#include "llama.cpp/common/json.hpp"
+#include "llama.cpp/examples/server/httplib.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::ordered_json;
+
+struct ServerParams {
+  std::string host = "127.0.0.1";
+  int port = 8080;
+  std::string model_path;
+  std::string mmproj_path;
+  int context_size = 4096;
+  int num_gpu_layers = 99;
+  int num_threads = 4;
+  int http_threads = (int)CPPHTTPLIB_THREAD_POOL_COUNT;
+  int keep_alive_timeout_sec = 30;
+};
+
+static void print_usage(const char *argv0) {
+  fprintf(stderr, "usage: %s -m MODEL [options]\n\n", argv0);
+  fprintf(stderr, "  -m,  --model PATH        model file (.gguf)\n");
+  fprintf(stderr, "       --mmproj PATH       multimodal projector file\n");
+  fprintf(stderr, "       --host HOST         address to listen on (default: 127.0.0.1)\n");
+  fprintf(stderr, "       --port PORT         port to listen on (default: 8080)\n");
+  fprintf(stderr, "  -c,  --ctx-size N        context size (default: 4096)\n");
+  fprintf(stderr, "  -ngl,--n-gpu-layers N    layers to offload (default: 99)\n");
+  fprintf(stderr, "  -t,  --threads N         inference threads (default: 4)\n");
+  fprintf(stderr, "       --threads-http N    HTTP worker threads (default: %d)\n",
+          (int)CPPHTTPLIB_THREAD_POOL_COUNT);
+  fprintf(stderr, "       --keep-alive N      keep-alive timeout in seconds (default: 30)\n");
+}
+
+static bool parse_args(int argc, char **argv, ServerParams &params) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto next = [&]() -> const char * {
+      return i + 1 < argc ? argv[++i] : nullptr;
+    };
+    const char *value = nullptr;
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if ((arg == "-m" || arg == "--model") && (value = next())) {
+      params.model_path = value;
+    } else if (arg == "--mmproj" && (value = next())) {
+      params.mmproj_path = value;
+    } else if (arg == "--host" && (value = next())) {
+      params.host = value;
+    } else if (arg == "--port" && (value = next())) {
+      params.port = atoi(value);
+    } else if ((arg == "-c" || arg == "--ctx-size") && (value = next())) {
+      params.context_size = atoi(value);
+    } else if ((arg == "-ngl" || arg == "--n-gpu-layers") &&
+               (value = next())) {
+      params.num_gpu_layers = atoi(value);
+    } else if ((arg == "-t" || arg == "--threads") && (value = next())) {
+      params.num_threads = atoi(value);
+    } else if (arg == "--threads-http" && (value = next())) {
+      params.http_threads = atoi(value);
+    } else if (arg == "--keep-alive" && (value = next())) {
+      params.keep_alive_timeout_sec = atoi(value);
+    } else {
+      fprintf(stderr, "error: invalid argument: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return !params.model_path.empty();
+}
+
+template <typename T>
+static T json_value(const json &body, const std::string &key,
+                    const T &default_value) {
+  if (body.contains(key) && !body.at(key).is_null()) {
+    try {
+      return body.at(key);
+    } catch (NLOHMANN_JSON_NAMESPACE::detail::type_error const &) {
+      return default_value;
+    }
+  }
+  return default_value;
+}
+
+static json error_json(const std::string &message, const std::string &type) {
+  return {{"error", {{"message", message}, {"type", type}}}};
+}
+
+// Counters for /metrics, in the Prometheus text format.
+struct ServerMetrics {
+  std::atomic<uint64_t> chat_requests{0};
+  std::atomic<uint64_t> embedding_requests{0};
+  std::atomic<uint64_t> failed_requests{0};
+  std::atomic<int64_t> requests_in_flight{0};
+  std::atomic<uint64_t> prompt_tokens{0};
+  std::atomic<uint64_t> completion_tokens{0};
+  std::atomic<uint64_t> embedding_inputs{0};
+  std::atomic<int64_t> completion_ms{0};
+
+  std::string to_prometheus() const {
+    std::ostringstream out;
+    auto metric = [&](const char *name, const char *type, const char *help,
+                      const std::string &value) {
+      out << "# HELP " << name << " " << help << "\n"
+          << "# TYPE " << name << " " << type << "\n"
+          << name << " " << value << "\n";
+    };
+    out << "# HELP fllama_requests_total Requests received, by endpoint.\n"
+        << "# TYPE fllama_requests_total counter\n"
+        << "fllama_requests_total{endpoint=\"chat\"} " << chat_requests << "\n"
+        << "fllama_requests_total{endpoint=\"embeddings\"} "
+        << embedding_requests << "\n";
+    metric("fllama_requests_failed_total", "counter",
+           "Requests that ended with an error.",
+           std::to_string(failed_requests));
+    metric("fllama_requests_in_flight", "gauge",
+           "Requests queued or running.", std::to_string(requests_in_flight));
+    metric("fllama_prompt_tokens_total", "counter",
+           "Prompt tokens processed, including embedding inputs.",
+           std::to_string(prompt_tokens));
+    metric("fllama_completion_tokens_total", "counter", "Tokens generated.",
+           std::to_string(completion_tokens));
+    metric("fllama_embedding_inputs_total", "counter", "Inputs embedded.",
+           std::to_string(embedding_inputs));
+    metric("fllama_completion_seconds_total", "counter",
+           "Time from enqueueing a chat request until its last token.",
+           std::to_string(completion_ms / 1000.0));
+    return out.str();
+  }
+};
+
+// One chat completion: owns the strings the fllama request points at, and
+// receives the updates from the inference worker.
+struct PendingCompletion {
+  int request_id;
+  std::string body;
+  std::string model_path;
+  std::string mmproj_path;
+  std::string input;
+  fllama_inference_request request = {};
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  uint64_t version = 0;
+  bool done = false;
+  std::string response;
+  std::string response_json;
+
+  void update(const char *text, const char *text_json, bool is_done) {
+    std::lock_guard<std::mutex> lock(mutex);
+    response = text != nullptr ? text : "";
+    response_json = text_json != nullptr ? text_json : "";
+    done = is_done;
+    version++;
+    cond.notify_all();
+  }
+};
+
+// The final JSON of a successful completion, or an error message.
+static bool parse_final_response(const PendingCompletion &completion,
+                                 json &result, std::string &error) {
+  try {
+    result = json::parse(completion.response_json);
+    if (result.contains("choices")) {
+      return true;
+    }
+  } catch (const std::exception &) {
+  }
+  error = completion.response.empty() ? completion.response_json
+                                      : completion.response;
+  if (error.empty()) {
+    error = "Cancelled.";
+  }
+  return false;
+}
+
+static std::string sse_event(const json &data) {
+  return "data: " + data.dump(-1, ' ', false, json::error_handler_t::replace) +
+         "\n\n";
+}
+
+static json chunk_json(const json &base, const json &delta,
+                       const json &finish_reason) {
+  return {
+      {"id", base.value("id", "")},
+      {"object", "chat.completion.chunk"},
+      {"created", base.value("created", 0)},
+      {"model", base.value("model", "")},
+      {"choices",
+       json::array({{{"index", 0},
+                     {"delta", delta},
+                     {"finish_reason", finish_reason}}})},
+  };
+}
+
+static httplib::Server *running_server = nullptr;
+
+static void handle_signal(int) {
+  if (running_server != nullptr) {
+    running_server->stop();
+  }
+}
+
+int main(int argc, char **argv) {
+  ServerParams params;
+  if (!parse_args(argc, argv, params)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  ServerMetrics metrics;
+  std::atomic<int> next_request_id{1};
+
+  httplib::Server svr;
+  svr.new_task_queue = [&params] {
+    return new httplib::ThreadPool(params.http_threads);
+  };
+  svr.set_keep_alive_max_count(1000);
+  svr.set_keep_alive_timeout(params.keep_alive_timeout_sec);
+  // Non-streamed completions only respond once generation has finished.
+  svr.set_write_timeout(600, 0);
+  svr.set_default_headers({{"Server", "fllama"},
+                           {"Access-Control-Allow-Origin", "*"}});
+
+  svr.Get("/health", [](const httplib::Request &, httplib::Response &res) {
+    res.set_content("{\"status\":\"ok\"}", "application/json");
+  });
+
+  svr.Get("/metrics",
+          [&metrics](const httplib::Request &, httplib::Response &res) {
+            res.set_content(metrics.to_prometheus(),
+                            "text/plain; version=0.0.4");
+          });
+
+  svr.Get("/v1/models",
+          [&params](const httplib::Request &, httplib::Response &res) {
+            json models = {
+                {"object", "list"},
+                {"data", json::array({{{"id", params.model_path},
+                                       {"object", "model"},
+                                       {"owned_by", "fllama"}}})},
+            };
+            res.set_content(models.dump(), "application/json");
+          });
+
+  svr.Post("/v1/chat/completions", [&](const httplib::Request &req,
+                                       httplib::Response &res) {
+    metrics.chat_requests++;
+    json body;
+    try {
+      body = json::parse(req.body);
+    } catch (const std::exception &e) {
+      metrics.failed_requests++;
+      res.status = 400;
+      res.set_content(error_json(std::string("Invalid JSON: ") + e.what(),
+                                 "invalid_request_error")
+                          .dump(),
+                      "application/json");
+      return;
+    }
+    if (!body.contains("messages") || !body["messages"].is_array()) {
+      metrics.failed_requests++;
+      res.status = 400;
+      res.set_content(
+          error_json("'messages' is required", "invalid_request_error").dump(),
+          "application/json");
+      return;
+    }
+
+    auto completion = std::make_shared<PendingCompletion>();
+    completion->request_id = next_request_id++;
+    completion->body = body.dump();
+    completion->model_path = params.model_path;
+    completion->mmproj_path = params.mmproj_path;
+    fllama_inference_request &request = completion->request;
+    request.request_id = completion->request_id;
+    request.context_size = params.context_size;
+    request.input = (char *)completion->input.c_str();
+    request.max_tokens = json_value(
+        body, "max_completion_tokens",
+        json_value(body, "max_tokens", params.context_size));
+    request.model_path = (char *)completion->model_path.c_str();
+    request.model_mmproj_path = completion->mmproj_path.empty()
+                                    ? nullptr
+                                    : (char *)completion->mmproj_path.c_str();
+    request.num_gpu_layers = params.num_gpu_layers;
+    request.num_threads = params.num_threads;
+    request.temperature = json_value(body, "temperature", 1.0f);
+    request.top_p = json_value(body, "top_p", 1.0f);
+    request.penalty_freq = json_value(body, "frequency_penalty", 0.0f);
+    request.penalty_repeat = 1.0f;
+    request.openai_request_json_string = (char *)completion->body.c_str();
+
+    const auto t_start = std::chrono::steady_clock::now();
+    auto finish = [&metrics, t_start](const json *final_response) {
+      metrics.requests_in_flight--;
+      metrics.completion_ms +=
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - t_start)
+              .count();
+      if (final_response == nullptr) {
+        metrics.failed_requests++;
+        return;
+      }
+      const json usage = final_response->value("usage", json::object());
+      metrics.prompt_tokens += usage.value("prompt_tokens", 0);
+      metrics.completion_tokens += usage.value("completion_tokens", 0);
+    };
+
+    metrics.requests_in_flight++;
+    fllama_inference_enqueue(
+        request, [completion](const char *response, const char *response_json,
+                              bool done) {
+          completion->update(response, response_json, done);
+        });
+
+    if (!json_value(body, "stream", false)) {
+      std::unique_lock<std::mutex> lock(completion->mutex);
+      completion->cond.wait(lock, [&] { return completion->done; });
+      json result;
+      std::string error;
+      if (parse_final_response(*completion, result, error)) {
+        finish(&result);
+        res.set_content(result.dump(-1, ' ', false,
+                                    json::error_handler_t::replace),
+                        "application/json");
+      } else {
+        finish(nullptr);
+        res.status = 500;
+        res.set_content(error_json(error, "server_error").dump(),
+                        "application/json");
+      }
+      return;
+    }
+
+    const bool include_usage =
+        json_value(json_value(body, "stream_options", json::object()),
+                   "include_usage", false);
+    auto sent_content = std::make_shared<std::string>();
+    auto sent_role = std::make_shared<bool>(false);
+    auto seen_version = std::make_shared<uint64_t>(0);
+    auto finished = std::make_shared<bool>(false);
+    res.set_chunked_content_provider(
+        "text/event-stream",
+        [completion, include_usage, sent_content, sent_role, seen_version,
+         finished, finish](size_t, httplib::DataSink &sink) {
+          std::unique_lock<std::mutex> lock(completion->mutex);
+          completion->cond.wait(lock, [&] {
+            return completion->version != *seen_version || completion->done;
+          });
+          *seen_version = completion->version;
+          const bool done = completion->done;
+
+          json current;
+          std::string error;
+          const bool ok = parse_final_response(*completion, current, error);
+          lock.unlock();
+
+          if (!ok) {
+            if (!done) {
+              return true;
+            }
+            *finished = true;
+            finish(nullptr);
+            const std::string event =
+                sse_event(error_json(error, "server_error"));
+            sink.write(event.data(), event.size());
+            sink.done();
+            return false;
+          }
+
+          // fllama reports the whole message so far, stream the new part.
+          const json message =
+              current["choices"][0].value("message", json::object());
+          const std::string content =
+              message.contains("content") && message["content"].is_string()
+                  ? message["content"].get<std::string>()
+                  : "";
+          std::string events;
+          if (!*sent_role) {
+            *sent_role = true;
+            events += sse_event(chunk_json(
+                current, {{"role", "assistant"}, {"content", ""}}, nullptr));
+          }
+          if (content.size() > sent_content->size() &&
+              content.compare(0, sent_content->size(), *sent_content) == 0) {
+            events += sse_event(chunk_json(
+                current, {{"content", content.substr(sent_content->size())}},
+                nullptr));
+            *sent_content = content;
+          }
+          if (done) {
+            if (message.contains("tool_calls")) {
+              json tool_calls = message["tool_calls"];
+              for (size_t i = 0; i < tool_calls.size(); i++) {
+                tool_calls[i]["index"] = i;
+              }
+              events += sse_event(
+                  chunk_json(current, {{"tool_calls", tool_calls}}, nullptr));
+            }
+            events += sse_event(chunk_json(
+                current, json::object(),
+                current["choices"][0].value("finish_reason", "stop")));
+            if (include_usage && current.contains("usage")) {
+              json usage_chunk = chunk_json(current, json::object(), nullptr);
+              usage_chunk["choices"] = json::array();
+              usage_chunk["usage"] = current["usage"];
+              events += sse_event(usage_chunk);
+            }
+            events += "data: [DONE]\n\n";
+          }
+          if (!events.empty() && !sink.write(events.data(), events.size())) {
+            return false;
+          }
+          if (done) {
+            *finished = true;
+            finish(&current);
+            sink.done();
+            return false;
+          }
+          return true;
+        },
+        [completion, finished, finish](bool) {
+          // The client went away before the end, stop generating for it.
+          if (!*finished) {
+            fllama_inference_cancel(completion->request_id);
+            finish(nullptr);
+          }
+        });
+  });
+
+  svr.Post("/v1/embeddings", [&](const httplib::Request &req,
+                                 httplib::Response &res) {
+    metrics.embedding_requests++;
+    json body;
+    fllama_embedding_request request;
+    try {
+      body = json::parse(req.body);
+      const json input = body.at("input");
+      if (input.is_string()) {
+        request.inputs.push_back(input.get<std::string>());
+      } else {
+        request.inputs = input.get<std::vector<std::string>>();
+      }
+    } catch (const std::exception &e) {
+      metrics.failed_requests++;
+      res.status = 400;
+      res.set_content(
+          error_json(std::string("'input' must be a string or an array of "
+                                 "strings: ") +
+                         e.what(),
+                     "invalid_request_error")
+              .dump(),
+          "application/json");
+      return;
+    }
+    request.request_id = next_request_id++;
+    request.model_path = params.model_path;
+    request.context_size = params.context_size;
+    request.num_gpu_layers = params.num_gpu_layers;
+    const bool base64 =
+        json_value(body, "encoding_format", std::string("float")) == "base64";
+
+    struct EmbeddingResult {
+      std::mutex mutex;
+      std::condition_variable cond;
+      bool done = false;
+      std::vector<std::vector<float>> embeddings;
+      int n_prompt_tokens = 0;
+      std::string error;
+    };
+    auto result = std::make_shared<EmbeddingResult>();
+    metrics.requests_in_flight++;
+    fllama_embedding_enqueue(
+        request,
+        [result](const std::vector<std::vector<float>> &embeddings,
+                 int n_prompt_tokens, const std::string &error) {
+          std::lock_guard<std::mutex> lock(result->mutex);
+          result->embeddings = embeddings;
+          result->n_prompt_tokens = n_prompt_tokens;
+          result->error = error;
+          result->done = true;
+          result->cond.notify_all();
+        });
+    std::unique_lock<std::mutex> lock(result->mutex);
+    result->cond.wait(lock, [&] { return result->done; });
+    metrics.requests_in_flight--;
+
+    if (!result->error.empty()) {
+      metrics.failed_requests++;
+      res.status = 500;
+      res.set_content(error_json(result->error, "server_error").dump(),
+                      "application/json");
+      return;
+    }
+    metrics.embedding_inputs += result->embeddings.size();
+    metrics.prompt_tokens += result->n_prompt_tokens;
+    json data = json::array();
+    for (size_t i = 0; i < result->embeddings.size(); i++) {
+      const auto &embedding = result->embeddings[i];
+      json item = {{"object", "embedding"}, {"index", i}};
+      if (base64) {
+        item["embedding"] = base64::encode(
+            reinterpret_cast<const char *>(embedding.data()),
+            embedding.size() * sizeof(float));
+      } else {
+        item["embedding"] = embedding;
+      }
+      data.push_back(item);
+    }
+    json response = {
+        {"object", "list"},
+        {"data", data},
+        {"model", json_value(body, "model", params.model_path)},
+        {"usage",
+         {{"prompt_tokens", result->n_prompt_tokens},
+          {"total_tokens", result->n_prompt_tokens}}},
+    };
+    res.set_content(response.dump(), "application/json");
+  });
+
+  svr.set_exception_handler([&metrics](const httplib::Request &,
+                                       httplib::Response &res,
+                                       std::exception_ptr ep) {
+    metrics.failed_requests++;
+    std::string message = "Unknown error";
+    try {
+      std::rethrow_exception(ep);
+    } catch (const std::exception &e) {
+      message = e.what();
+    } catch (...) {
+    }
+    res.status = 500;
+    res.set_content(error_json(message, "server_error").dump(),
+                    "application/json");
+  });
+
+  running_server = &svr;
+  std::signal(SIGINT, handle_signal);
+  std::signal(SIGTERM, handle_signal);
+
+  std::cout << "[fllama] Serving " << params.model_path << " on http://"
+            << params.host << ":" << params.port << std::endl;
+  if (!svr.listen(params.host, params.port)) {
+    fprintf(stderr, "error: unable to listen on %s:%d\n", params.host.c_str(),
+            params.port);
+    return 1;
+  }
+  running_server = nullptr;
+  fllama_clear_model_cache(true);
+  return 0;
+}
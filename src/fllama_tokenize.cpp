@@ -1,4 +1,5 @@
 #include "fllama_tokenize.h"
+#include "fllama_backend.h"
 
 #include <cstring>
 #include <iostream>
@@ -111,6 +112,13 @@ void cleanup_cache() {
   }
 }
 
+int fllama_tokenize_clear_cache() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  const int cleared = (int)model_cache.size();
+  model_cache.clear();
+  return cleared;
+}
+
 std::shared_ptr<llama_model> _get_or_load_model(const std::string &model_path) {
   std::lock_guard<std::mutex> lock(cache_mutex);
   cleanup_cache();
@@ -123,7 +131,7 @@ std::shared_ptr<llama_model> _get_or_load_model(const std::string &model_path) {
     // Initialize model params with defaults
     llama_model_params mparams = llama_model_default_params();
     mparams.vocab_only = true;
-    mparams.use_mmap = true;
+    mparams.use_mmap = fllama_backend_use_mmap();
     mparams.n_gpu_layers = 0;
     llama_backend_init();
     // Using llama_load_model_from_file instead of llama_init_from_gpt_params
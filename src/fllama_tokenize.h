@@ -30,5 +30,9 @@ struct fllama_tokenize_request
 EMSCRIPTEN_KEEPALIVE FFI_PLUGIN_EXPORT size_t fllama_tokenize(struct fllama_tokenize_request request);
 #ifdef __cplusplus
 }
+
+// Frees the vocab-only models kept for tokenizing, ex. under memory pressure.
+// Tokenizations in progress keep theirs. Returns how many were cached.
+int fllama_tokenize_clear_cache();
 #endif
 #endif // FLLAMA_TOKENIZE_H
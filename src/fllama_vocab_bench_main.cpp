@@ -0,0 +1,257 @@
+// fllama_vocab_bench: how long loading a tokenizer takes, for vocabularies
+// the sizes of real ones. Every model load, and every vocab-only load by
+// fllama_tokenize, pays this.
+//
+//   fllama_vocab_bench [-r repetitions] [-d scratch_dir]
+//
+// The vocabularies are synthetic, written to vocab-only GGUF files: SPM ones
+// with byte tokens and scored pieces, BPE ones grown by merging random pairs
+// of tokens, as training a BPE tokenizer does, so each has about one merge
+// per token.
+
+#include "llama.h"
+#include "gguf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define VOCAB_BENCH_HEAP 1
+#endif
+
+struct VocabBenchSpec {
+  const char *name;
+  const char *model; // tokenizer.ggml.model
+  int n_tokens;
+};
+
+static const VocabBenchSpec kVocabBenchSpecs[] = {
+    {"llama2-spm-32k", "llama", 32000},
+    {"gpt2-bpe-50k", "gpt2", 50257},
+    {"llama3-bpe-128k", "gpt2", 128256},
+    {"qwen2-bpe-152k", "gpt2", 151936},
+    {"gemma-spm-256k", "llama", 256000},
+};
+
+// GGUF token types, see llama_token_type.
+static const int kTokenNormal = 1;
+static const int kTokenControl = 3;
+static const int kTokenByte = 6;
+
+static const char *kVocabBenchSpecials[] = {
+    "<|im_start|>", "<|im_end|>", "<|endoftext|>", "<|eot_id|>",
+    "<|fim_prefix|>", "<|fim_suffix|>", "<|fim_middle|>",
+};
+
+static std::string vocab_bench_utf8(uint32_t cpt) {
+  std::string out;
+  if (cpt < 0x80) {
+    out += (char)cpt;
+  } else if (cpt < 0x800) {
+    out += (char)(0xC0 | (cpt >> 6));
+    out += (char)(0x80 | (cpt & 0x3F));
+  } else {
+    out += (char)(0xE0 | (cpt >> 12));
+    out += (char)(0x80 | ((cpt >> 6) & 0x3F));
+    out += (char)(0x80 | (cpt & 0x3F));
+  }
+  return out;
+}
+
+// GPT-2's byte-level alphabet: printable bytes stand for themselves, the rest
+// for code points from 256 up.
+static std::vector<std::string> vocab_bench_byte_tokens() {
+  std::vector<std::string> tokens(256);
+  int n = 0;
+  for (int b = 0; b < 256; b++) {
+    const bool printable = (b >= 33 && b <= 126) || (b >= 161 && b <= 172) ||
+                           (b >= 174 && b <= 255);
+    tokens[b] = vocab_bench_utf8(printable ? b : 256 + n++);
+  }
+  return tokens;
+}
+
+static bool vocab_bench_write(const VocabBenchSpec &spec,
+                              const std::string &path, size_t *n_merges) {
+  std::mt19937 rng(spec.n_tokens);
+  std::vector<std::string> tokens;
+  std::vector<int> types;
+  std::vector<float> scores;
+  std::vector<std::string> merges;
+  std::unordered_set<std::string> seen;
+  const bool bpe = strcmp(spec.model, "gpt2") == 0;
+
+  const auto add = [&](const std::string &text, int type) {
+    if (!seen.insert(text).second) {
+      return false;
+    }
+    tokens.push_back(text);
+    types.push_back(type);
+    scores.push_back(-(float)tokens.size());
+    return true;
+  };
+  if (bpe) {
+    for (const std::string &byte : vocab_bench_byte_tokens()) {
+      add(byte, kTokenNormal);
+    }
+  } else {
+    add("<unk>", 2);
+    add("<s>", kTokenControl);
+    add("</s>", kTokenControl);
+    char byte[8];
+    for (int b = 0; b < 256; b++) {
+      snprintf(byte, sizeof(byte), "<0x%02X>", b);
+      add(byte, kTokenByte);
+    }
+    for (char c = 'a'; c <= 'z'; c++) {
+      add(std::string(1, c), kTokenNormal);
+      add("\xE2\x96\x81" + std::string(1, c), kTokenNormal); // "▁" + c
+    }
+  }
+  const size_t n_specials =
+      sizeof(kVocabBenchSpecials) / sizeof(kVocabBenchSpecials[0]);
+  const size_t n_normal = spec.n_tokens - n_specials;
+  // Earlier, shorter tokens are merged more often.
+  std::geometric_distribution<size_t> pick(8.0 / n_normal);
+  while (tokens.size() < n_normal) {
+    const std::string &a = tokens[std::min(pick(rng), tokens.size() - 1)];
+    const std::string &b = tokens[std::min(pick(rng), tokens.size() - 1)];
+    // Real tokens are rarely longer.
+    if (a.size() + b.size() > 16 || (!bpe && (a[0] == '<' || b[0] == '<'))) {
+      continue;
+    }
+    const std::string first = a;
+    const std::string second = b;
+    if (add(first + second, kTokenNormal) && bpe) {
+      merges.push_back(first + " " + second);
+    }
+  }
+  for (const char *special : kVocabBenchSpecials) {
+    add(special, kTokenControl);
+  }
+
+  gguf_context *ctx = gguf_init_empty();
+  gguf_set_val_str(ctx, "general.architecture", "llama");
+  gguf_set_val_str(ctx, "general.name", spec.name);
+  gguf_set_val_u32(ctx, "llama.context_length", 4096);
+  gguf_set_val_u32(ctx, "llama.embedding_length", 64);
+  gguf_set_val_u32(ctx, "llama.feed_forward_length", 128);
+  gguf_set_val_u32(ctx, "llama.block_count", 1);
+  gguf_set_val_u32(ctx, "llama.attention.head_count", 4);
+  gguf_set_val_f32(ctx, "llama.attention.layer_norm_rms_epsilon", 1e-5f);
+  gguf_set_val_str(ctx, "tokenizer.ggml.model", spec.model);
+  std::vector<const char *> texts;
+  for (const std::string &token : tokens) {
+    texts.push_back(token.c_str());
+  }
+  gguf_set_arr_str(ctx, "tokenizer.ggml.tokens", texts.data(), texts.size());
+  gguf_set_arr_data(ctx, "tokenizer.ggml.token_type", GGUF_TYPE_INT32,
+                    types.data(), types.size());
+  if (bpe) {
+    std::vector<const char *> merge_texts;
+    for (const std::string &merge : merges) {
+      merge_texts.push_back(merge.c_str());
+    }
+    gguf_set_arr_str(ctx, "tokenizer.ggml.merges", merge_texts.data(),
+                     merge_texts.size());
+    gguf_set_val_u32(ctx, "tokenizer.ggml.bos_token_id", spec.n_tokens - 5);
+    gguf_set_val_u32(ctx, "tokenizer.ggml.eos_token_id", spec.n_tokens - 5);
+  } else {
+    gguf_set_arr_data(ctx, "tokenizer.ggml.scores", GGUF_TYPE_FLOAT32,
+                      scores.data(), scores.size());
+  }
+  const bool ok = gguf_write_to_file(ctx, path.c_str(), false);
+  gguf_free(ctx);
+  *n_merges = merges.size();
+  return ok;
+}
+
+static size_t vocab_bench_heap_bytes() {
+#ifdef VOCAB_BENCH_HEAP
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+static void vocab_bench_quiet(ggml_log_level level, const char *text, void *) {
+  if (level == GGML_LOG_LEVEL_ERROR) {
+    fputs(text, stderr);
+  }
+}
+
+int main(int argc, char **argv) {
+  int repetitions = 5;
+  std::string dir = ".";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-r") == 0) {
+      repetitions = std::max(atoi(argv[i + 1]), 1);
+    } else if (strcmp(argv[i], "-d") == 0) {
+      dir = argv[i + 1];
+    } else {
+      fprintf(stderr, "usage: %s [-r repetitions] [-d scratch_dir]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  llama_log_set(vocab_bench_quiet, nullptr);
+  llama_backend_init();
+
+  printf("%-18s %8s %8s %10s %10s %12s\n", "vocab", "tokens", "merges",
+         "load ms", "heap MiB", "detok all ms");
+  for (const VocabBenchSpec &spec : kVocabBenchSpecs) {
+    const std::string path = dir + "/fllama-vocab-bench-" + spec.name + ".gguf";
+    size_t n_merges = 0;
+    if (!vocab_bench_write(spec, path, &n_merges)) {
+      fprintf(stderr, "couldn't write %s\n", path.c_str());
+      return 1;
+    }
+    llama_model_params params = llama_model_default_params();
+    params.vocab_only = true;
+
+    std::vector<double> load_ms;
+    size_t heap_bytes = 0;
+    double detokenize_ms = 0;
+    for (int r = 0; r < repetitions; r++) {
+      const size_t heap_before = vocab_bench_heap_bytes();
+      const auto start = std::chrono::steady_clock::now();
+      llama_model *model = llama_model_load_from_file(path.c_str(), params);
+      const auto loaded = std::chrono::steady_clock::now();
+      if (model == nullptr) {
+        fprintf(stderr, "couldn't load %s\n", path.c_str());
+        return 1;
+      }
+      load_ms.push_back(
+          std::chrono::duration<double, std::milli>(loaded - start).count());
+      heap_bytes = vocab_bench_heap_bytes() - heap_before;
+
+      // Every piece once, as streaming a long generation eventually does.
+      const llama_vocab *vocab = llama_model_get_vocab(model);
+      const int n_vocab = llama_vocab_n_tokens(vocab);
+      char piece[256];
+      const auto detokenize_start = std::chrono::steady_clock::now();
+      for (llama_token token = 0; token < n_vocab; token++) {
+        llama_token_to_piece(vocab, token, piece, sizeof(piece), 0, true);
+      }
+      detokenize_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - detokenize_start)
+                          .count();
+      llama_model_free(model);
+    }
+    std::sort(load_ms.begin(), load_ms.end());
+    printf("%-18s %8d %8zu %10.1f %10.1f %12.1f\n", spec.name, spec.n_tokens,
+           n_merges, load_ms[load_ms.size() / 2],
+           heap_bytes / 1048576.0, detokenize_ms);
+    std::remove(path.c_str());
+  }
+  llama_backend_free();
+  return 0;
+}
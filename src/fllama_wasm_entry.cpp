@@ -40,7 +40,7 @@ void fllama_inference_export(
     float penalty_repeat, char *grammar, char *eos_token,
     void (*inference_callback_js)(const char *, const char *, uint8_t),
     void (*log_callback_js)(const char *)) {
-  struct fllama_inference_request request;
+  struct fllama_inference_request request = {};
   request.request_id = request_id;
   request.context_size = context_size;
   request.input = input;
@@ -0,0 +1,241 @@
+#include "fllama_weight_stream.h"
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+#if TARGET_OS_IOS
+#include "../ios/llama.cpp/ggml/include/ggml-backend.h"
+#include "../ios/llama.cpp/ggml/include/ggml.h"
+#include "../ios/llama.cpp/include/llama.h"
+#elif TARGET_OS_OSX
+#include "../macos/llama.cpp/ggml/include/ggml-backend.h"
+#include "../macos/llama.cpp/ggml/include/ggml.h"
+#include "../macos/llama.cpp/include/llama.h"
+#else
+#include "llama.cpp/ggml/include/ggml-backend.h"
+#include "llama.cpp/ggml/include/ggml.h"
+#include "llama.cpp/include/llama.h"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define FLLAMA_WEIGHT_STREAM_MADVISE
+// Linux 5.4; older C libraries don't define it.
+#if defined(__linux__) && !defined(MADV_PAGEOUT)
+#define MADV_PAGEOUT 21
+#endif
+#endif
+
+// Node names are "<name>-<il>" for per-layer nodes, see llm_graph_context::cb.
+static int weight_stream_node_layer(const struct ggml_tensor *t) {
+  const char *dash = strrchr(t->name, '-');
+  if (dash == nullptr || dash[1] < '0' || dash[1] > '9') {
+    return -1;
+  }
+  char *end = nullptr;
+  const long il = strtol(dash + 1, &end, 10);
+  return *end == '\0' ? (int)il : -1;
+}
+
+// Weight names are "blk.<il>.<tensor>.weight".
+static int weight_stream_weight_layer(const struct ggml_tensor *w) {
+  int il = -1;
+  if (sscanf(w->name, "blk.%d.", &il) != 1) {
+    return -1;
+  }
+  return il;
+}
+
+WeightStreamer::WeightStreamer(size_t budget_bytes)
+    : budget_bytes(budget_bytes), page_size(4096) {
+#ifdef FLLAMA_WEIGHT_STREAM_MADVISE
+  const long ps = sysconf(_SC_PAGESIZE);
+  if (ps > 0) {
+    page_size = (size_t)ps;
+  }
+#endif
+}
+
+bool WeightStreamer::is_supported() {
+#ifdef FLLAMA_WEIGHT_STREAM_MADVISE
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool WeightStreamer::eval_callback(struct ggml_tensor *t, bool ask,
+                                   void *user_data) {
+  return static_cast<WeightStreamer *>(user_data)->on_eval(t, ask);
+}
+
+void WeightStreamer::add_model(const struct llama_model *model) {
+  const int32_t n_tensors = llama_model_n_tensors(model);
+  for (int32_t i = 0; i < n_tensors; i++) {
+    add_weight(llama_model_get_tensor_by_index(model, i));
+  }
+  const int n_layer = (int)layer_ranges.size();
+  if (n_layer == 0) {
+    return;
+  }
+  std::vector<bool> in_window;
+  const size_t window_bytes = window(0, in_window);
+  std::cout << "[fllama] Weight streaming: " << n_layer << " layers, "
+            << (window_bytes >> 20) << " MiB resident window ("
+            << std::count(in_window.begin(), in_window.end(), true)
+            << " layers), budget " << (budget_bytes >> 20) << " MiB"
+            << std::endl;
+  for (int l = 0; l < n_layer; l++) {
+    if (in_window[l]) {
+      advise(l, /* willneed */ true);
+      layer_resident[l] = true;
+    }
+  }
+}
+
+bool WeightStreamer::on_eval(struct ggml_tensor *t, bool ask) {
+  if (ask) {
+    // Only stop at the first node of each layer, so the graph is split into
+    // one chunk per layer rather than one per node.
+    const int il = weight_stream_node_layer(t);
+    if (il >= 0 && il != current_layer) {
+      current_layer = il;
+      return true;
+    }
+    return false;
+  }
+
+  enter_layer(weight_stream_node_layer(t));
+  // Returning false would abort the graph computation.
+  return true;
+}
+
+void WeightStreamer::add_weight(const struct ggml_tensor *w) {
+  if (w == nullptr || w->data == nullptr || w->buffer == nullptr ||
+      ggml_backend_buffer_get_usage(w->buffer) !=
+          GGML_BACKEND_BUFFER_USAGE_WEIGHTS ||
+      !ggml_backend_buffer_is_host(w->buffer)) {
+    return;
+  }
+  const int il = weight_stream_weight_layer(w);
+  if (il < 0) {
+    // Embeddings and the output head stay resident.
+    return;
+  }
+  if ((size_t)il >= layer_ranges.size()) {
+    layer_ranges.resize(il + 1);
+    layer_bytes.resize(il + 1, 0);
+    layer_resident.resize(il + 1, false);
+  }
+
+  const uintptr_t begin = (uintptr_t)w->data;
+  const uintptr_t end = begin + ggml_nbytes(w);
+  auto &ranges = layer_ranges[il];
+  // Tensors of a layer are usually adjacent in the file, merge them.
+  bool merged = false;
+  for (auto &r : ranges) {
+    if (begin <= r.end + page_size && end + page_size >= r.begin) {
+      r.begin = std::min(r.begin, begin);
+      r.end = std::max(r.end, end);
+      merged = true;
+      break;
+    }
+  }
+  if (!merged) {
+    ranges.push_back({begin, end});
+  }
+  layer_bytes[il] += end - begin;
+}
+
+void WeightStreamer::advise(int il, bool willneed) {
+#ifdef FLLAMA_WEIGHT_STREAM_MADVISE
+  const uintptr_t mask = ~(uintptr_t)(page_size - 1);
+  for (const auto &r : layer_ranges[il]) {
+    uintptr_t begin;
+    uintptr_t end;
+    if (willneed) {
+      begin = r.begin & mask;
+      end = (r.end + page_size - 1) & mask;
+    } else {
+      // Shrink to whole pages so a neighbouring layer's pages survive.
+      begin = (r.begin + page_size - 1) & mask;
+      end = r.end & mask;
+    }
+    if (end <= begin) {
+      continue;
+    }
+    int advice = willneed ? MADV_WILLNEED : MADV_DONTNEED;
+#ifdef MADV_PAGEOUT
+    // MADV_DONTNEED only unmaps the pages of a shared file mapping; they stay
+    // in the page cache. MADV_PAGEOUT reclaims them.
+    if (!willneed && use_pageout) {
+      advice = MADV_PAGEOUT;
+    }
+#endif
+    int ret = madvise((void *)begin, end - begin, advice);
+#ifdef MADV_PAGEOUT
+    if (ret != 0 && advice == MADV_PAGEOUT && errno == EINVAL) {
+      use_pageout = false;
+      ret = madvise((void *)begin, end - begin, MADV_DONTNEED);
+    }
+#endif
+    if (ret != 0) {
+      std::cout << "[fllama] Weight streaming: madvise failed for layer " << il
+                << ": " << strerror(errno) << std::endl;
+    }
+  }
+#else
+  (void)il;
+  (void)willneed;
+#endif
+}
+
+size_t WeightStreamer::window(int il, std::vector<bool> &in_window) const {
+  // The window starts at the layer and wraps around, since the next decode
+  // starts again from layer 0.
+  const int n_layer = (int)layer_ranges.size();
+  in_window.assign(n_layer, false);
+  size_t window_bytes = 0;
+  for (int i = 0; i < n_layer; i++) {
+    const int l = (il + i) % n_layer;
+    if (i > 0 && window_bytes + layer_bytes[l] > budget_bytes) {
+      break;
+    }
+    in_window[l] = true;
+    window_bytes += layer_bytes[l];
+  }
+  return window_bytes;
+}
+
+void WeightStreamer::enter_layer(int il) {
+  const int n_layer = (int)layer_ranges.size();
+  if (il < 0 || il >= n_layer) {
+    return;
+  }
+
+  std::vector<bool> in_window;
+  window(il, in_window);
+
+  // The current layer is being computed, so its pages are in memory whether
+  // or not they were prefetched.
+  layer_resident[il] = true;
+
+  for (int l = 0; l < n_layer; l++) {
+    if (in_window[l] && !layer_resident[l]) {
+      advise(l, /* willneed */ true);
+      layer_resident[l] = true;
+    } else if (!in_window[l] && layer_resident[l]) {
+      advise(l, /* willneed */ false);
+      layer_resident[l] = false;
+    }
+  }
+}
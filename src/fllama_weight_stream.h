@@ -0,0 +1,59 @@
+#ifndef FLLAMA_WEIGHT_STREAM_H
+#define FLLAMA_WEIGHT_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct ggml_tensor;
+struct llama_model;
+
+// Keeps only a window of transformer layers resident when the weights are
+// mmapped and computed on the CPU, so models larger than RAM decode at a
+// predictable speed instead of thrashing.
+//
+// Installed as the context's cb_eval. The graph is split at the first node of
+// each layer; when a layer starts, the layers ahead of it are prefetched with
+// MADV_WILLNEED until the budget is reached, and layers that fell out of the
+// window are paged out with MADV_PAGEOUT, or MADV_DONTNEED where that isn't
+// available. Layer weight ranges come from the model's tensors once it is
+// loaded, see add_model.
+class WeightStreamer {
+public:
+  explicit WeightStreamer(size_t budget_bytes);
+
+  // Whether madvise based streaming is available on this platform.
+  static bool is_supported();
+
+  // Finds each layer's weights in the mmap and prefetches the first window.
+  // Call once the model is loaded, before its first decode.
+  void add_model(const struct llama_model *model);
+
+  // ggml_backend_sched_eval_callback, user_data is the WeightStreamer.
+  static bool eval_callback(struct ggml_tensor *t, bool ask, void *user_data);
+
+private:
+  struct Range {
+    uintptr_t begin;
+    uintptr_t end;
+  };
+
+  bool on_eval(struct ggml_tensor *t, bool ask);
+  void add_weight(const struct ggml_tensor *w);
+  // Marks the layers of the window starting at il, returns its size.
+  size_t window(int il, std::vector<bool> &in_window) const;
+  void enter_layer(int il);
+  void advise(int il, bool willneed);
+
+  size_t budget_bytes;
+  size_t page_size;
+  int current_layer = -1;
+  // Cleared once the kernel rejects MADV_PAGEOUT.
+  bool use_pageout = true;
+
+  std::vector<std::vector<Range>> layer_ranges;
+  std::vector<size_t> layer_bytes;
+  std::vector<bool> layer_resident;
+};
+
+#endif // FLLAMA_WEIGHT_STREAM_H
@@ -66,6 +66,23 @@ GGML_API bool ggml_gallocr_alloc_graph(ggml_gallocr_t galloc, struct ggml_cgraph
 
 GGML_API size_t ggml_gallocr_get_buffer_size(ggml_gallocr_t galloc, int buffer_id);
 
+// Compute buffers shared by several graph allocators, one per buffer type, sized for the largest graph any of them
+// has reserved. Allocators that never compute at the same time, ex. the contexts of several models run by one
+// worker, then hold a single worst-case buffer instead of one each.
+// The caller must make sure that a graph allocated from the arena has finished computing before another allocator
+// using the same arena allocates a graph or reserves: a reserve can replace the arena's buffers with larger ones.
+typedef struct ggml_gallocr_arena * ggml_gallocr_arena_t;
+
+GGML_API ggml_gallocr_arena_t ggml_gallocr_arena_new(void);
+GGML_API void                 ggml_gallocr_arena_free(ggml_gallocr_arena_t arena);
+// frees the buffers; allocators using the arena allocate them again when they next need them
+GGML_API void                 ggml_gallocr_arena_reset(ggml_gallocr_arena_t arena);
+// total size of the arena's buffers
+GGML_API size_t               ggml_gallocr_arena_get_size(ggml_gallocr_arena_t arena);
+
+// allocate from the arena instead of owned buffers, call before the first reserve
+GGML_API void ggml_gallocr_set_arena(ggml_gallocr_t galloc, ggml_gallocr_arena_t arena);
+
 // Utils
 // Create a buffer and allocate all the tensors in a ggml_context
 GGML_API struct ggml_backend_buffer * ggml_backend_alloc_ctx_tensors_from_buft(struct ggml_context * ctx, ggml_backend_buffer_type_t buft);
@@ -303,6 +303,8 @@ extern "C" {
     GGML_API int                  ggml_backend_sched_get_n_copies(ggml_backend_sched_t sched);
 
     GGML_API size_t               ggml_backend_sched_get_buffer_size(ggml_backend_sched_t sched, ggml_backend_t backend);
+    // Allocate compute buffers from a shared arena, see ggml_gallocr_arena_t - must be called before the first reserve
+    GGML_API void                 ggml_backend_sched_set_arena(ggml_backend_sched_t sched, ggml_gallocr_arena_t arena);
 
     GGML_API void                 ggml_backend_sched_set_tensor_backend(ggml_backend_sched_t sched, struct ggml_tensor * node, ggml_backend_t backend);
     GGML_API ggml_backend_t       ggml_backend_sched_get_tensor_backend(ggml_backend_sched_t sched, struct ggml_tensor * node);
@@ -349,6 +351,12 @@ extern "C" {
     GGML_API ggml_backend_buffer_t      ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size);
     GGML_API ggml_backend_buffer_type_t ggml_backend_cpu_buffer_type(void);
 
+    // Back large CPU buffers allocated by the calling thread with huge pages (off by default)
+    // Linux: explicit MAP_HUGETLB pages if the pool has room, otherwise transparent huge pages via MADV_HUGEPAGE
+    // Other platforms, or when neither is available: regular aligned allocations
+    GGML_API void ggml_backend_cpu_buffer_set_hugepages(bool enable);
+    GGML_API bool ggml_backend_cpu_buffer_get_hugepages(void);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -14,6 +14,7 @@
 #include "ggml-impl.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -22,12 +23,17 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 
 #ifdef __APPLE__
 #include <sys/types.h>
 #include <sys/sysctl.h>
 #endif
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
 
 // backend buffer type
 
@@ -1625,6 +1631,10 @@ size_t ggml_backend_sched_get_buffer_size(ggml_backend_sched_t sched, ggml_backe
     return ggml_gallocr_get_buffer_size(sched->galloc, backend_index);
 }
 
+void ggml_backend_sched_set_arena(ggml_backend_sched_t sched, ggml_gallocr_arena_t arena) {
+    ggml_gallocr_set_arena(sched->galloc, arena);
+}
+
 void ggml_backend_sched_set_tensor_backend(ggml_backend_sched_t sched, struct ggml_tensor * node, ggml_backend_t backend) {
     int backend_index = ggml_backend_sched_backend_id(sched, backend);
     GGML_ASSERT(backend_index >= 0 && backend_index < sched->n_backends);
@@ -1925,6 +1935,107 @@ static const struct ggml_backend_buffer_i ggml_backend_cpu_buffer_from_ptr_i = {
     /* .reset           = */ NULL,
 };
 
+// CPU backend - huge page buffers
+
+// per thread, so that loads with different settings on different threads don't race
+static thread_local bool ggml_backend_cpu_hugepages_enabled = false;
+
+void ggml_backend_cpu_buffer_set_hugepages(bool enable) {
+    ggml_backend_cpu_hugepages_enabled = enable;
+}
+
+bool ggml_backend_cpu_buffer_get_hugepages(void) {
+    return ggml_backend_cpu_hugepages_enabled;
+}
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+// transparent huge pages; explicit (hugetlb) pages use the size the kernel reports, see below
+#define GGML_HUGEPAGE_SIZE ((size_t) 2*1024*1024)
+
+// munmap needs the exact length that was mapped, which for hugetlb is a multiple of its page size
+struct ggml_backend_cpu_hugepage_buffer_context {
+    void * data;
+    size_t mapped;
+    bool   hugetlb;
+};
+
+#ifdef MAP_HUGETLB
+// the default hugetlb page size, which MAP_HUGETLB without a size flag uses, or 0 if unknown
+static size_t ggml_backend_cpu_hugetlb_page_size(void) {
+    static const size_t page_size = [] {
+        size_t kb = 0;
+        FILE * f = fopen("/proc/meminfo", "r");
+        if (f != NULL) {
+            char line[128];
+            while (fgets(line, sizeof(line), f) != NULL) {
+                if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) {
+                    break;
+                }
+            }
+            fclose(f);
+        }
+        return kb*1024;
+    }();
+    return page_size;
+}
+#endif
+
+static ggml_backend_cpu_hugepage_buffer_context * ggml_backend_cpu_hugepage_alloc(size_t size) {
+#ifdef MAP_HUGETLB
+    // explicit huge pages: only succeeds if the administrator reserved a pool (vm.nr_hugepages)
+    const size_t hugetlb_page_size = ggml_backend_cpu_hugetlb_page_size();
+    if (hugetlb_page_size != 0 && size >= hugetlb_page_size) {
+        const size_t n = GGML_PAD(size, hugetlb_page_size);
+        void * data = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+            return new ggml_backend_cpu_hugepage_buffer_context { data, n, true };
+        }
+    }
+#endif
+
+    // transparent huge pages: over-allocate and trim so that the region starts on a huge page boundary,
+    // otherwise the first and last partial huge pages of every buffer would stay on 4 KB pages
+    const size_t n = GGML_PAD(size, GGML_HUGEPAGE_SIZE);
+    uint8_t * raw = (uint8_t *) mmap(NULL, n + GGML_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == (uint8_t *) MAP_FAILED) {
+        return NULL;
+    }
+    uint8_t * aligned = (uint8_t *) GGML_PAD((uintptr_t) raw, GGML_HUGEPAGE_SIZE);
+    if (aligned > raw) {
+        munmap(raw, aligned - raw);
+    }
+    const size_t tail = (raw + n + GGML_HUGEPAGE_SIZE) - (aligned + n);
+    if (tail > 0) {
+        munmap(aligned + n, tail);
+    }
+
+    if (madvise(aligned, n, MADV_HUGEPAGE) != 0) {
+        // THP disabled (e.g. /sys/kernel/mm/transparent_hugepage/enabled = never): the memory is still usable
+        GGML_LOG_DEBUG("%s: madvise(MADV_HUGEPAGE) failed: %s\n", __func__, strerror(errno));
+    }
+    return new ggml_backend_cpu_hugepage_buffer_context { aligned, n, false };
+}
+
+static void ggml_backend_cpu_hugepage_buffer_free_buffer(ggml_backend_buffer_t buffer) {
+    ggml_backend_cpu_hugepage_buffer_context * ctx = (ggml_backend_cpu_hugepage_buffer_context *) buffer->context;
+    if (munmap(ctx->data, ctx->mapped) != 0) {
+        GGML_LOG_ERROR("%s: munmap of %zu bytes (%s) failed: %s\n", __func__, ctx->mapped,
+            ctx->hugetlb ? "hugetlb" : "transparent huge pages", strerror(errno));
+    }
+    delete ctx;
+}
+
+static void * ggml_backend_cpu_hugepage_buffer_get_base(ggml_backend_buffer_t buffer) {
+    ggml_backend_cpu_hugepage_buffer_context * ctx = (ggml_backend_cpu_hugepage_buffer_context *) buffer->context;
+    return ctx->data;
+}
+
+static void ggml_backend_cpu_hugepage_buffer_clear(ggml_backend_buffer_t buffer, uint8_t value) {
+    ggml_backend_cpu_hugepage_buffer_context * ctx = (ggml_backend_cpu_hugepage_buffer_context *) buffer->context;
+    memset(ctx->data, value, buffer->size);
+}
+#endif
+
 // CPU backend buffer type
 
 // this buffer type is defined here to make it available to all backends
@@ -1936,6 +2047,21 @@ static const char * ggml_backend_cpu_buffer_type_get_name(ggml_backend_buffer_ty
 }
 
 static ggml_backend_buffer_t ggml_backend_cpu_buffer_type_alloc_buffer(ggml_backend_buffer_type_t buft, size_t size) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // small buffers would waste most of a huge page
+    if (ggml_backend_cpu_hugepages_enabled && size >= GGML_HUGEPAGE_SIZE) {
+        ggml_backend_cpu_hugepage_buffer_context * ctx = ggml_backend_cpu_hugepage_alloc(size);
+        if (ctx != NULL) {
+            struct ggml_backend_buffer_i iface = ggml_backend_cpu_buffer_i;
+            iface.free_buffer = ggml_backend_cpu_hugepage_buffer_free_buffer;
+            iface.get_base    = ggml_backend_cpu_hugepage_buffer_get_base;
+            iface.clear       = ggml_backend_cpu_hugepage_buffer_clear;
+            return ggml_backend_buffer_init(buft, iface, ctx, size);
+        }
+        GGML_LOG_WARN("%s: huge page allocation of %zu bytes failed, falling back to regular pages\n", __func__, size);
+    }
+#endif
+
     void * data = ggml_aligned_malloc(size);
 
     if (data == NULL) {
@@ -1,5 +1,6 @@
 #include "llama-impl.h"
 
+#include "ggml-backend.h"
 #include "gguf.h"
 #include "llama.h"
 
@@ -25,6 +26,14 @@ time_meas::~time_meas() {
         }
     }
 
+llama_hugepages_scope::llama_hugepages_scope(bool enable) : prev(ggml_backend_cpu_buffer_get_hugepages()) {
+    ggml_backend_cpu_buffer_set_hugepages(enable);
+}
+
+llama_hugepages_scope::~llama_hugepages_scope() {
+    ggml_backend_cpu_buffer_set_hugepages(prev);
+}
+
 void llama_log_set(ggml_log_callback log_callback, void * user_data) {
     ggml_log_set(log_callback, user_data);
     g_logger_state.log_callback = log_callback ? log_callback : llama_log_callback_default;
@@ -129,7 +138,7 @@ static std::string gguf_data_to_str(enum gguf_type type, const void * data, int
     }
 }
 
-std::string gguf_kv_to_str(const struct gguf_context * ctx_gguf, int i) {
+std::string gguf_kv_to_str(const struct gguf_context * ctx_gguf, int i, size_t max_len) {
     const enum gguf_type type = gguf_get_kv_type(ctx_gguf, i);
 
     switch (type) {
@@ -156,6 +165,10 @@ std::string gguf_kv_to_str(const struct gguf_context * ctx_gguf, int i) {
                     }
                     if (j < arr_n - 1) {
                         ss << ", ";
+                        if ((size_t) ss.tellp() > max_len) {
+                            ss << "...";
+                            break;
+                        }
                     }
                 }
                 ss << "]";
@@ -9,6 +9,10 @@
 #include <stdexcept>
 #include <cerrno>
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #ifdef __has_include
     #if __has_include(<unistd.h>)
@@ -39,6 +43,17 @@
 #include <TargetConditionals.h>
 #endif
 
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #include <sys/syscall.h>
+        #include <sys/uio.h>
+        #if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+            #define LLAMA_USE_IO_URING
+        #endif
+    #endif
+#endif
+
 // TODO: consider moving to llama-impl.h if needed in more places
 #if defined(_WIN32)
 static std::string llama_format_win_err(DWORD err) {
@@ -273,7 +288,7 @@ struct llama_mmap::impl {
 #ifdef _POSIX_MAPPED_FILES
     std::vector<std::pair<size_t, size_t>> mapped_fragments;
 
-    impl(struct llama_file * file, size_t prefetch, bool numa) {
+    impl(struct llama_file * file, size_t prefetch, bool numa, bool hugepages) {
         size = file->size();
         int fd = file->file_id();
         int flags = MAP_SHARED;
@@ -302,6 +317,18 @@ struct llama_mmap::impl {
                         strerror(errno));
             }
         }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        // only effective for file mappings on kernels with CONFIG_READ_ONLY_THP_FOR_FS,
+        // use_mmap = false copies the weights into huge page backed CPU buffers instead
+        if (hugepages) {
+            if (madvise(addr, file->size(), MADV_HUGEPAGE)) {
+                LLAMA_LOG_DEBUG("%s: madvise(.., MADV_HUGEPAGE) failed: %s\n", __func__,
+                        strerror(errno));
+            }
+        }
+#else
+        GGML_UNUSED(hugepages);
+#endif
 
         mapped_fragments.emplace_back(0, file->size());
     }
@@ -362,8 +389,9 @@ struct llama_mmap::impl {
         }
     }
 #elif defined(_WIN32)
-    impl(struct llama_file * file, size_t prefetch, bool numa) {
+    impl(struct llama_file * file, size_t prefetch, bool numa, bool hugepages) {
         GGML_UNUSED(numa);
+        GGML_UNUSED(hugepages);
 
         size = file->size();
 
@@ -418,10 +446,11 @@ struct llama_mmap::impl {
         }
     }
 #else
-    impl(struct llama_file * file, size_t prefetch, bool numa) {
+    impl(struct llama_file * file, size_t prefetch, bool numa, bool hugepages) {
         GGML_UNUSED(file);
         GGML_UNUSED(prefetch);
         GGML_UNUSED(numa);
+        GGML_UNUSED(hugepages);
 
         throw std::runtime_error("mmap not supported");
     }
@@ -438,7 +467,7 @@ struct llama_mmap::impl {
     size_t size;
 };
 
-llama_mmap::llama_mmap(struct llama_file * file, size_t prefetch, bool numa) : pimpl(std::make_unique<impl>(file, prefetch, numa)) {}
+llama_mmap::llama_mmap(struct llama_file * file, size_t prefetch, bool numa, bool hugepages) : pimpl(std::make_unique<impl>(file, prefetch, numa, hugepages)) {}
 llama_mmap::~llama_mmap() = default;
 
 size_t llama_mmap::size() const { return pimpl->size; }
@@ -595,6 +624,426 @@ const bool llama_mlock::SUPPORTED = true;
 const bool llama_mlock::SUPPORTED = false;
 #endif
 
+// llama_file_reader
+
+#if defined(_POSIX_MAPPED_FILES)
+// large tensors are split so that several reads of the same tensor are in flight at once
+static constexpr size_t LLAMA_READ_CHUNK = 4*1024*1024;
+
+#ifdef LLAMA_USE_IO_URING
+// minimal io_uring ring driven with raw syscalls, liburing is not available on most of our targets
+struct llama_uring {
+    int fd = -1;
+
+    void * sq_ptr = MAP_FAILED;
+    void * cq_ptr = MAP_FAILED;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+
+    struct io_uring_sqe * sqes = (struct io_uring_sqe *) MAP_FAILED;
+    size_t sqes_size = 0;
+
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_mask;
+    unsigned * sq_array;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned * cq_mask;
+    struct io_uring_cqe * cqes;
+
+    unsigned n_entries = 0;
+
+    bool init(unsigned entries) {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+        if (fd < 0) {
+            // ENOSYS / EPERM when the kernel is too old or io_uring is blocked by seccomp
+            return false;
+        }
+        n_entries = p.sq_entries;
+
+        sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+        cq_size = p.cq_off.cqes  + p.cq_entries*sizeof(struct io_uring_cqe);
+        const bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+
+        sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            return false;
+        }
+        cq_ptr = single_mmap ? sq_ptr : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            return false;
+        }
+        sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe *) mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == (struct io_uring_sqe *) MAP_FAILED) {
+            return false;
+        }
+
+        sq_head  = (unsigned *) ((char *) sq_ptr + p.sq_off.head);
+        sq_tail  = (unsigned *) ((char *) sq_ptr + p.sq_off.tail);
+        sq_mask  = (unsigned *) ((char *) sq_ptr + p.sq_off.ring_mask);
+        sq_array = (unsigned *) ((char *) sq_ptr + p.sq_off.array);
+        cq_head  = (unsigned *) ((char *) cq_ptr + p.cq_off.head);
+        cq_tail  = (unsigned *) ((char *) cq_ptr + p.cq_off.tail);
+        cq_mask  = (unsigned *) ((char *) cq_ptr + p.cq_off.ring_mask);
+        cqes     = (struct io_uring_cqe *) ((char *) cq_ptr + p.cq_off.cqes);
+        return true;
+    }
+
+    ~llama_uring() {
+        if (sqes != (struct io_uring_sqe *) MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+            munmap(cq_ptr, cq_size);
+        }
+        if (sq_ptr != MAP_FAILED) {
+            munmap(sq_ptr, sq_size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // the caller guarantees that no more than n_entries operations are in flight
+    void push_readv(int file_fd, const struct iovec * iov, size_t offs, uint64_t user_data) {
+        const unsigned tail = *sq_tail;
+        const unsigned idx  = tail & *sq_mask;
+        struct io_uring_sqe * sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = IORING_OP_READV;
+        sqe->fd        = file_fd;
+        sqe->off       = offs;
+        sqe->addr      = (uint64_t) (uintptr_t) iov;
+        sqe->len       = 1;
+        sqe->user_data = user_data;
+        sq_array[idx]  = idx;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    int enter(unsigned to_submit, unsigned min_complete) {
+        const unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+    }
+
+    template <typename F>
+    void reap(F && fn) {
+        unsigned head = *cq_head;
+        const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            const struct io_uring_cqe & cqe = cqes[head & *cq_mask];
+            fn(cqe.user_data, cqe.res);
+            head++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+};
+#endif
+
+struct llama_file_reader::impl {
+    struct op {
+        size_t tag;
+        size_t n_chunks_left;
+    };
+
+    struct chunk {
+        int    fd;
+        size_t offs;
+        char * dst;
+        size_t len;
+        size_t op_idx;
+    };
+
+    std::vector<op>   ops;
+    std::deque<chunk> queued;
+    std::vector<size_t> done_tags;
+    size_t n_pending_ops = 0;
+    std::string error;
+
+    // pread thread pool
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cv_work;
+    std::condition_variable cv_done;
+    bool stop = false;
+
+#ifdef LLAMA_USE_IO_URING
+    std::unique_ptr<llama_uring> ring;
+    std::vector<chunk>        slots;      // in-flight chunk per ring slot
+    std::vector<struct iovec> slot_iovs;
+    std::vector<size_t>       free_slots;
+    unsigned n_unsubmitted = 0;
+#endif
+
+    impl(size_t n_threads) {
+#ifdef LLAMA_USE_IO_URING
+        ring = std::make_unique<llama_uring>();
+        if (ring->init(64)) {
+            slots.resize(ring->n_entries);
+            slot_iovs.resize(ring->n_entries);
+            for (size_t i = 0; i < ring->n_entries; i++) {
+                free_slots.push_back(ring->n_entries - 1 - i);
+            }
+            return;
+        }
+        LLAMA_LOG_DEBUG("%s: io_uring unavailable (%s), using a pread thread pool\n", __func__, strerror(errno));
+        ring.reset();
+#endif
+        n_threads = std::max<size_t>(1, n_threads);
+        for (size_t i = 0; i < n_threads; i++) {
+            workers.emplace_back([this] { worker(); });
+        }
+    }
+
+    ~impl() {
+#ifdef LLAMA_USE_IO_URING
+        if (ring) {
+            // the kernel may still be writing into caller buffers, drain before they go away;
+            // returning with reads in flight would let them land in freed memory
+            const size_t n_in_flight = slots.size() - free_slots.size();
+            size_t n_reaped = 0;
+            while (n_reaped < n_in_flight) {
+                const int n_submitted = ring->enter(n_unsubmitted, 1);
+                if (n_submitted < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    GGML_ABORT("io_uring_enter failed with %zu reads in flight: %s", n_in_flight - n_reaped, strerror(errno));
+                }
+                n_unsubmitted -= (unsigned) n_submitted;
+                ring->reap([&](uint64_t, int) { n_reaped++; });
+            }
+            return;
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.clear();
+            stop = true;
+        }
+        cv_work.notify_all();
+        for (auto & w : workers) {
+            w.join();
+        }
+    }
+
+    const char * name() const {
+#ifdef LLAMA_USE_IO_URING
+        if (ring) {
+            return "io_uring";
+        }
+#endif
+        return "pread";
+    }
+
+    void submit(int fd, size_t offs, void * dst, size_t len, size_t tag) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (len == 0) {
+            done_tags.push_back(tag);
+            lock.unlock();
+            cv_done.notify_one();
+            return;
+        }
+        const size_t op_idx = ops.size();
+        const size_t n_chunks = std::max<size_t>(1, (len + LLAMA_READ_CHUNK - 1)/LLAMA_READ_CHUNK);
+        ops.push_back({ tag, n_chunks });
+        n_pending_ops++;
+        for (size_t i = 0; i < n_chunks; i++) {
+            const size_t chunk_offs = i*LLAMA_READ_CHUNK;
+            queued.push_back({ fd, offs + chunk_offs, (char *) dst + chunk_offs, std::min(LLAMA_READ_CHUNK, len - chunk_offs), op_idx });
+        }
+        lock.unlock();
+        cv_work.notify_all();
+    }
+
+    // must hold the mutex when called from the thread pool
+    void chunk_done(size_t op_idx) {
+        auto & o = ops[op_idx];
+        if (--o.n_chunks_left == 0) {
+            done_tags.push_back(o.tag);
+            n_pending_ops--;
+        }
+    }
+
+    void worker() {
+        while (true) {
+            chunk c;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv_work.wait(lock, [this] { return stop || !queued.empty(); });
+                if (stop) {
+                    return;
+                }
+                c = queued.front();
+                queued.pop_front();
+            }
+
+            std::string err;
+            while (c.len > 0) {
+                const ssize_t ret = pread(c.fd, c.dst, c.len, (off_t) c.offs);
+                if (ret < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    err = format("read error: %s", strerror(errno));
+                    break;
+                }
+                if (ret == 0) {
+                    err = "unexpectedly reached end of file";
+                    break;
+                }
+                c.offs += ret;
+                c.dst  += ret;
+                c.len  -= ret;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!err.empty() && error.empty()) {
+                    error = err;
+                }
+                chunk_done(c.op_idx);
+            }
+            cv_done.notify_one();
+        }
+    }
+
+#ifdef LLAMA_USE_IO_URING
+    void ring_fill() {
+        while (!queued.empty() && !free_slots.empty()) {
+            const size_t slot = free_slots.back();
+            free_slots.pop_back();
+            slots[slot] = queued.front();
+            queued.pop_front();
+            slot_iovs[slot].iov_base = slots[slot].dst;
+            slot_iovs[slot].iov_len  = slots[slot].len;
+            ring->push_readv(slots[slot].fd, &slot_iovs[slot], slots[slot].offs, slot);
+            n_unsubmitted++;
+        }
+    }
+
+    bool ring_wait(std::vector<size_t> & done) {
+        while (done_tags.empty()) {
+            if (n_pending_ops == 0) {
+                return false;
+            }
+            ring_fill();
+            const int n_submitted = ring->enter(n_unsubmitted, 1);
+            if (n_submitted < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(format("io_uring_enter failed: %s", strerror(errno)));
+            }
+            // the kernel can take fewer entries than offered, the rest go with the next enter
+            n_unsubmitted -= (unsigned) n_submitted;
+            ring->reap([&](uint64_t slot, int res) {
+                chunk & c = slots[slot];
+                if (res == -EINTR || res == -EAGAIN) {
+                    queued.push_front(c);
+                } else if (res < 0) {
+                    if (error.empty()) {
+                        error = format("read error: %s", strerror(-res));
+                    }
+                    chunk_done(c.op_idx);
+                } else if (res == 0) {
+                    if (error.empty()) {
+                        error = "unexpectedly reached end of file";
+                    }
+                    chunk_done(c.op_idx);
+                } else if ((size_t) res < c.len) {
+                    // short read: queue the remainder
+                    queued.push_front({ c.fd, c.offs + res, c.dst + res, c.len - res, c.op_idx });
+                } else {
+                    chunk_done(c.op_idx);
+                }
+                free_slots.push_back(slot);
+            });
+        }
+        done.insert(done.end(), done_tags.begin(), done_tags.end());
+        done_tags.clear();
+        return true;
+    }
+#endif
+
+    bool wait(std::vector<size_t> & done) {
+#ifdef LLAMA_USE_IO_URING
+        if (ring) {
+            const bool ret = ring_wait(done);
+            if (!error.empty()) {
+                throw std::runtime_error(error);
+            }
+            return ret;
+        }
+#endif
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_done.wait(lock, [this] { return !done_tags.empty() || n_pending_ops == 0; });
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+        if (done_tags.empty()) {
+            return false;
+        }
+        done.insert(done.end(), done_tags.begin(), done_tags.end());
+        done_tags.clear();
+        return true;
+    }
+
+    size_t n_pending() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return n_pending_ops;
+    }
+};
+#else
+struct llama_file_reader::impl {
+    impl(size_t n_threads) {
+        GGML_UNUSED(n_threads);
+
+        throw std::runtime_error("parallel file reads not supported");
+    }
+
+    const char * name() const { return "none"; }
+
+    void submit(int fd, size_t offs, void * dst, size_t len, size_t tag) {
+        GGML_UNUSED(fd);
+        GGML_UNUSED(offs);
+        GGML_UNUSED(dst);
+        GGML_UNUSED(len);
+        GGML_UNUSED(tag);
+    }
+
+    bool wait(std::vector<size_t> & done) {
+        GGML_UNUSED(done);
+        return false;
+    }
+
+    size_t n_pending() { return 0; }
+};
+#endif
+
+llama_file_reader::llama_file_reader(size_t n_threads) : pimpl(std::make_unique<impl>(n_threads)) {}
+llama_file_reader::~llama_file_reader() = default;
+
+void llama_file_reader::submit(const llama_file * file, size_t offs, void * dst, size_t len, size_t tag) {
+    pimpl->submit(file->file_id(), offs, dst, len, tag);
+}
+
+bool llama_file_reader::wait(std::vector<size_t> & done) { return pimpl->wait(done); }
+size_t llama_file_reader::n_pending() const { return pimpl->n_pending(); }
+const char * llama_file_reader::name() const { return pimpl->name(); }
+
+#if defined(_POSIX_MAPPED_FILES)
+const bool llama_file_reader::SUPPORTED = true;
+#else
+const bool llama_file_reader::SUPPORTED = false;
+#endif
+
 size_t llama_path_max() {
     return PATH_MAX;
 }
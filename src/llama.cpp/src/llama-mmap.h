@@ -36,7 +36,7 @@ private:
 
 struct llama_mmap {
     llama_mmap(const llama_mmap &) = delete;
-    llama_mmap(struct llama_file * file, size_t prefetch = (size_t) -1, bool numa = false);
+    llama_mmap(struct llama_file * file, size_t prefetch = (size_t) -1, bool numa = false, bool hugepages = false);
     ~llama_mmap();
 
     size_t size() const;
@@ -65,4 +65,28 @@ private:
     std::unique_ptr<impl> pimpl;
 };
 
+// concurrent reads for the non-mmap load path: io_uring on Linux, a pread thread pool on other POSIX systems
+struct llama_file_reader {
+    llama_file_reader(const llama_file_reader &) = delete;
+    llama_file_reader(size_t n_threads);
+    ~llama_file_reader();
+
+    // queue a read of len bytes at offset offs of file into dst; tag is reported by wait() once all of it has landed
+    void submit(const llama_file * file, size_t offs, void * dst, size_t len, size_t tag);
+
+    // block until at least one queued read completes and append the completed tags to done
+    // returns false if nothing was pending, throws on read errors
+    bool wait(std::vector<size_t> & done);
+
+    size_t n_pending() const;
+
+    const char * name() const;
+
+    static const bool SUPPORTED;
+
+private:
+    struct impl;
+    std::unique_ptr<impl> pimpl;
+};
+
 size_t llama_path_max();
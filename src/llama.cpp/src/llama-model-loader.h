@@ -9,6 +9,7 @@
 #include "ggml-cpp.h"
 
 #include <cstddef>
+#include <future>
 #include <map>
 #include <stdexcept>
 #include <unordered_map>
@@ -148,7 +149,7 @@ struct llama_model_loader {
 
     void done_getting_tensors() const;
 
-    void init_mappings(bool prefetch = true, llama_mlocks * mlock_mmaps = nullptr);
+    void init_mappings(bool prefetch = true, llama_mlocks * mlock_mmaps = nullptr, bool hugepages = false);
 
     void get_mapping_range(size_t * first, size_t * last, void ** addr, int idx, ggml_context * ctx) const;
 
@@ -163,6 +164,13 @@ struct llama_model_loader {
             llama_progress_callback progress_callback,
             void * progress_callback_user_data);
 
+    // non-mmap path: keeps several tensor reads in flight and repacks/validates tensors as their reads complete
+    bool load_all_data_parallel(
+            struct ggml_context * ctx,
+            std::vector<std::future<std::pair<ggml_tensor *, bool>>> & validation_result,
+            llama_progress_callback progress_callback,
+            void * progress_callback_user_data);
+
     std::string ftype_name() const;
 
     void print_info() const;